@@ -0,0 +1,525 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "columnar.h"
+
+
+/*
+ * The number of slots in the hash table that is used to build dictionaries (a power of two, at
+ * least twice COLUMNAR_DICTIONARY_ENTRIES).
+ */
+#define COLUMNAR_DICTIONARY_SLOTS (COLUMNAR_DICTIONARY_ENTRIES * 2U)
+
+
+/*
+ * The preferred encoding of each column (indexed by column).  Dictionary columns fall back to
+ * COLUMNAR_STRING and delta columns to COLUMNAR_INT64 in row groups where they do not fit.
+ */
+static const unsigned char column_encodings[COLUMNAR_COLUMNS] =
+{
+	COLUMNAR_DELTA32,     /* serial */
+	COLUMNAR_DICTIONARY,  /* tag */
+	COLUMNAR_DICTIONARY,  /* version */
+	COLUMNAR_DICTIONARY,  /* method */
+	COLUMNAR_DICTIONARY,  /* status */
+	COLUMNAR_INT64,       /* body_size */
+	COLUMNAR_INT64,       /* bytes_incoming */
+	COLUMNAR_INT64,       /* bytes_outgoing */
+	COLUMNAR_INT64,       /* time_used */
+	COLUMNAR_DICTIONARY,  /* connection_status */
+	COLUMNAR_STRING,      /* request_url */
+	COLUMNAR_STRING,      /* query_string */
+	COLUMNAR_STRING,      /* remote_address */
+	COLUMNAR_DICTIONARY,  /* host */
+	COLUMNAR_DICTIONARY,  /* user_agent */
+	COLUMNAR_STRING,      /* forwarded_for */
+	COLUMNAR_STRING,      /* referer */
+	COLUMNAR_DICTIONARY,  /* content_type */
+	COLUMNAR_INT64,       /* nexopia_userid */
+	COLUMNAR_INT64,       /* nexopia_userage */
+	COLUMNAR_DICTIONARY,  /* nexopia_usersex */
+	COLUMNAR_INT64,       /* nexopia_userlocation */
+	COLUMNAR_DICTIONARY,  /* nexopia_usertype */
+	COLUMNAR_DELTA32,     /* received */
+	COLUMNAR_DICTIONARY   /* source */
+};
+
+
+static unsigned char *encode_dictionary(struct columnar_group_t *, struct columnar_column_t *, unsigned char *);
+static unsigned char *encode_integers(struct columnar_group_t *, struct columnar_column_t *, unsigned char *, unsigned char *);
+static unsigned char *encode_strings(struct columnar_group_t *, struct columnar_column_t *, unsigned char *);
+static int integer_column(const struct columnar_column_t *);
+static int64_t parse_integer(const char *, size_t);
+static void store_le(unsigned char *, uint64_t, unsigned int);
+
+
+/**
+ * columnar_add(<group>, <record>)
+ *
+ * Adds a record to the row group.  Returns 1 if the record was added, 0 if the row group does not
+ * have room for it (the caller should encode the row group and add the record again), or -1 if the
+ * record would not fit in a row group of its own.
+ **/
+int columnar_add(struct columnar_group_t *group, struct log_record_t *record)
+{
+	char address[INET_ADDRSTRLEN];
+	size_t bound = 0;
+	struct columnar_column_t *column;
+	const char *field[COLUMNAR_COLUMNS];
+	unsigned int i;
+	size_t length[COLUMNAR_COLUMNS];
+	size_t offset;
+
+	if (! group->source_length || group->source_address != record->source.sin_addr.s_addr || group->source_port != record->source.sin_port)
+	{
+		inet_ntop(AF_INET, &record->source.sin_addr, address, sizeof(address));
+		group->source_address = record->source.sin_addr.s_addr;
+		group->source_port = record->source.sin_port;
+		group->source_length = sprintf(group->source, "%s:%hu", address, ntohs(record->source.sin_port));
+	}
+
+	for (i = 0; i < COLUMNAR_COLUMNS; i++)
+	{
+		if (i == COLUMNAR_RECEIVED)
+		{
+			field[i] = NULL;
+			length[i] = 0;
+		}
+		else if (i == COLUMNAR_SOURCE)
+		{
+			field[i] = group->source;
+			length[i] = group->source_length;
+		}
+		else if (record_field(record, i, &offset, &length[i]))
+		{
+			field[i] = record->data + offset;
+		}
+		else
+		{
+			field[i] = NULL;
+			length[i] = 0;
+		}
+
+		if (integer_column(&group->columns[i]))
+		{
+			bound += 8;
+		}
+		else
+		{
+			if (! field[i])
+			{
+				field[i] = "-";
+				length[i] = 1;
+			}
+			bound += length[i] + (group->columns[i].encoding == COLUMNAR_DICTIONARY ? 6 : 4);
+		}
+	}
+	if (group->rows == COLUMNAR_GROUP_ROWS || group->bound + bound > group->limit)
+	{
+		return group->rows ? 0 : -1;
+	}
+
+	for (i = 0; i < COLUMNAR_COLUMNS; i++)
+	{
+		column = &group->columns[i];
+		if (i == COLUMNAR_RECEIVED)
+		{
+			column->values[group->rows] = record->received.tv_sec;
+		}
+		else if (integer_column(column))
+		{
+			column->values[group->rows] = field[i] ? parse_integer(field[i], length[i]) : COLUMNAR_NULL;
+		}
+		else
+		{
+			memcpy(column->text + column->offsets[group->rows], field[i], length[i]);
+			column->offsets[group->rows + 1] = column->offsets[group->rows] + length[i];
+		}
+	}
+	group->rows++;
+	group->bound += bound;
+	return 1;
+}
+
+
+/**
+ * columnar_encode(<group>, <buffer>)
+ *
+ * Encodes the row group into <buffer>, which must have room for the group's bound, and empties the
+ * row group.  Returns the length of the encoded row group (0 if it had no rows).
+ **/
+size_t columnar_encode(struct columnar_group_t *group, char *buffer)
+{
+	struct columnar_column_t *column;
+	unsigned char *directory;
+	unsigned char encoding;
+	unsigned int i;
+	size_t length;
+	unsigned char *output = (unsigned char *)buffer;
+	unsigned char *position;
+	unsigned char *start;
+
+	if (! group->rows)
+	{
+		return 0;
+	}
+
+	directory = output + COLUMNAR_HEADER_SIZE;
+	position = directory + COLUMNAR_COLUMNS * COLUMNAR_DIRECTORY_ENTRY_SIZE;
+	for (i = 0; i < COLUMNAR_COLUMNS; i++, directory += COLUMNAR_DIRECTORY_ENTRY_SIZE)
+	{
+		column = &group->columns[i];
+		start = position;
+		if (integer_column(column))
+		{
+			position = encode_integers(group, column, start, &encoding);
+		}
+		else if (column->encoding == COLUMNAR_DICTIONARY && (position = encode_dictionary(group, column, start)))
+		{
+			encoding = COLUMNAR_DICTIONARY;
+		}
+		else
+		{
+			position = encode_strings(group, column, start);
+			encoding = COLUMNAR_STRING;
+		}
+		directory[0] = column->id;
+		directory[1] = encoding;
+		store_le(directory + 2, 0, 2);
+		store_le(directory + 4, position - start, 4);
+	}
+
+	length = position - output;
+	memcpy(output, COLUMNAR_MAGIC, 4);
+	store_le(output + 4, length, 4);
+	store_le(output + 8, group->rows, 4);
+	store_le(output + 12, COLUMNAR_COLUMNS, 2);
+	store_le(output + 14, COLUMNAR_VERSION, 2);
+
+	columnar_reset(group);
+	return length;
+}
+
+
+/**
+ * columnar_free(<group>)
+ *
+ * Releases a row group.
+ **/
+void columnar_free(struct columnar_group_t *group)
+{
+	unsigned int i;
+
+	for (i = 0; i < COLUMNAR_COLUMNS; i++)
+	{
+		free(group->columns[i].values);
+		free(group->columns[i].offsets);
+		free(group->columns[i].text);
+	}
+	free(group->dictionary_codes);
+	free(group->dictionary_rows);
+	free(group->dictionary_slots);
+	free(group);
+}
+
+
+/**
+ * columnar_new(<limit>)
+ *
+ * Creates an empty row group whose encoded length will not exceed <limit> bytes.  Returns the row
+ * group or NULL on failure.
+ **/
+struct columnar_group_t *columnar_new(size_t limit)
+{
+	struct columnar_column_t *column;
+	struct columnar_group_t *group;
+	unsigned int i;
+
+	group = calloc(1, sizeof(struct columnar_group_t));
+	if (! group)
+	{
+		perror("columnar.c calloc(group)");
+		return NULL;
+	}
+	group->limit = limit;
+	for (i = 0; i < COLUMNAR_COLUMNS; i++)
+	{
+		column = &group->columns[i];
+		column->id = i;
+		column->encoding = column_encodings[i];
+		if (integer_column(column))
+		{
+			column->values = malloc(COLUMNAR_GROUP_ROWS * sizeof(int64_t));
+			if (! column->values)
+			{
+				perror("columnar.c malloc(values)");
+				columnar_free(group);
+				return NULL;
+			}
+		}
+		else
+		{
+			column->offsets = malloc((COLUMNAR_GROUP_ROWS + 1) * sizeof(uint32_t));
+			column->text = malloc(limit);
+			if (! column->offsets || ! column->text)
+			{
+				perror("columnar.c malloc(text)");
+				columnar_free(group);
+				return NULL;
+			}
+		}
+	}
+	group->dictionary_codes = malloc(COLUMNAR_GROUP_ROWS * sizeof(uint16_t));
+	group->dictionary_rows = malloc(COLUMNAR_DICTIONARY_ENTRIES * sizeof(uint32_t));
+	group->dictionary_slots = malloc(COLUMNAR_DICTIONARY_SLOTS * sizeof(uint16_t));
+	if (! group->dictionary_codes || ! group->dictionary_rows || ! group->dictionary_slots)
+	{
+		perror("columnar.c malloc(dictionary)");
+		columnar_free(group);
+		return NULL;
+	}
+	columnar_reset(group);
+	return group;
+}
+
+
+/**
+ * columnar_reset(<group>)
+ *
+ * Empties a row group.
+ **/
+void columnar_reset(struct columnar_group_t *group)
+{
+	unsigned int i;
+
+	group->rows = 0;
+	group->bound = COLUMNAR_HEADER_SIZE + COLUMNAR_COLUMNS * COLUMNAR_DIRECTORY_ENTRY_SIZE;
+	for (i = 0; i < COLUMNAR_COLUMNS; i++)
+	{
+		if (! integer_column(&group->columns[i]))
+		{
+			group->columns[i].offsets[0] = 0;
+			group->bound += 4;
+		}
+	}
+}
+
+
+/**
+ * encode_dictionary(<group>, <column>, <output>)
+ *
+ * Encodes a string column as a dictionary of its distinct values (in order of first appearance)
+ * followed by the index of each row's value.  Returns the end of the encoded column, or NULL if
+ * the column has more than COLUMNAR_DICTIONARY_ENTRIES distinct values.
+ **/
+static unsigned char *encode_dictionary(struct columnar_group_t *group, struct columnar_column_t *column, unsigned char *output)
+{
+	unsigned int entries = 0;
+	uint16_t entry;
+	uint32_t hash;
+	const char *first;
+	size_t i;
+	size_t length;
+	unsigned char *position = output + 2;
+	unsigned int row;
+	uint32_t slot;
+	const char *value;
+
+	memset(group->dictionary_slots, 0, COLUMNAR_DICTIONARY_SLOTS * sizeof(uint16_t));
+	for (row = 0; row < group->rows; row++)
+	{
+		value = column->text + column->offsets[row];
+		length = column->offsets[row + 1] - column->offsets[row];
+
+		/* FNV-1a */
+		hash = 2166136261U;
+		for (i = 0; i < length; i++)
+		{
+			hash = (hash ^ (unsigned char)value[i]) * 16777619U;
+		}
+
+		for (slot = hash % COLUMNAR_DICTIONARY_SLOTS; (entry = group->dictionary_slots[slot]); slot = (slot + 1) % COLUMNAR_DICTIONARY_SLOTS)
+		{
+			first = column->text + column->offsets[group->dictionary_rows[entry - 1]];
+			if (column->offsets[group->dictionary_rows[entry - 1] + 1] - column->offsets[group->dictionary_rows[entry - 1]] == length && ! memcmp(first, value, length))
+			{
+				break;
+			}
+		}
+		if (! entry)
+		{
+			if (entries == COLUMNAR_DICTIONARY_ENTRIES)
+			{
+				return NULL;
+			}
+			group->dictionary_rows[entries++] = row;
+			entry = entries;
+			group->dictionary_slots[slot] = entry;
+			store_le(position, length, 4);
+			memcpy(position + 4, value, length);
+			position += 4 + length;
+		}
+		group->dictionary_codes[row] = entry - 1;
+	}
+
+	store_le(output, entries, 2);
+	for (row = 0; row < group->rows; row++, position += 2)
+	{
+		store_le(position, group->dictionary_codes[row], 2);
+	}
+	return position;
+}
+
+
+/**
+ * encode_integers(<group>, <column>, <output>, <encoding pointer>)
+ *
+ * Encodes an integer column, as COLUMNAR_DELTA32 if that is its preferred encoding and every
+ * difference fits, otherwise as COLUMNAR_INT64, and stores the encoding that was used.  Returns
+ * the end of the encoded column.
+ **/
+static unsigned char *encode_integers(struct columnar_group_t *group, struct columnar_column_t *column, unsigned char *output, unsigned char *encoding)
+{
+	int64_t delta;
+	unsigned int row;
+
+	if (column->encoding == COLUMNAR_DELTA32 && group->rows > 1)
+	{
+		for (row = 0; row < group->rows; row++)
+		{
+			if (column->values[row] <= COLUMNAR_DASH)
+			{
+				break;
+			}
+			if (row && ((delta = column->values[row] - column->values[row - 1]) > INT32_MAX || delta < INT32_MIN))
+			{
+				break;
+			}
+		}
+		if (row == group->rows)
+		{
+			*encoding = COLUMNAR_DELTA32;
+			store_le(output, column->values[0], 8);
+			output += 8;
+			for (row = 1; row < group->rows; row++, output += 4)
+			{
+				store_le(output, column->values[row] - column->values[row - 1], 4);
+			}
+			return output;
+		}
+	}
+
+	*encoding = COLUMNAR_INT64;
+	for (row = 0; row < group->rows; row++, output += 8)
+	{
+		store_le(output, column->values[row], 8);
+	}
+	return output;
+}
+
+
+/**
+ * encode_strings(<group>, <column>, <output>)
+ *
+ * Encodes a string column as offsets followed by the values.  Returns the end of the encoded column.
+ **/
+static unsigned char *encode_strings(struct columnar_group_t *group, struct columnar_column_t *column, unsigned char *output)
+{
+	unsigned int row;
+
+	for (row = 0; row <= group->rows; row++, output += 4)
+	{
+		store_le(output, column->offsets[row], 4);
+	}
+	memcpy(output, column->text, column->offsets[group->rows]);
+	return output + column->offsets[group->rows];
+}
+
+
+/**
+ * integer_column(<column>)
+ *
+ * Returns 1 if the column holds integers, otherwise 0.
+ **/
+static int integer_column(const struct columnar_column_t *column)
+{
+	return column->encoding == COLUMNAR_INT64 || column->encoding == COLUMNAR_DELTA32;
+}
+
+
+/**
+ * parse_integer(<field>, <length>)
+ *
+ * Returns the value of a decimal integer field, COLUMNAR_DASH for "-" or COLUMNAR_NULL if the field
+ * is not an integer (or is too long to be one).
+ **/
+static int64_t parse_integer(const char *field, size_t length)
+{
+	size_t i = 0;
+	int negative = 0;
+	int64_t value = 0;
+
+	if (length == 1 && field[0] == '-')
+	{
+		return COLUMNAR_DASH;
+	}
+	if (length && (field[0] == '-' || field[0] == '+'))
+	{
+		negative = (field[0] == '-');
+		i++;
+	}
+	if (i == length || length - i > 18)
+	{
+		return COLUMNAR_NULL;
+	}
+	for (; i < length; i++)
+	{
+		if (field[i] < '0' || field[i] > '9')
+		{
+			return COLUMNAR_NULL;
+		}
+		value = value * 10 + (field[i] - '0');
+	}
+	return negative ? -value : value;
+}
+
+
+/**
+ * store_le(<buffer>, <value>, <size>)
+ *
+ * Stores the low <size> bytes of <value> in <buffer>, least significant byte first.
+ **/
+static void store_le(unsigned char *buffer, uint64_t value, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+	{
+		buffer[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
@@ -0,0 +1,139 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __COLUMNAR_H__
+#define __COLUMNAR_H__
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include "record.h"
+
+
+/*
+ * Columnar archive format (udploggerc --columnar).  Log records are collected into row groups, and
+ * each row group is written out as a unit: a header, a directory of its columns and the data of
+ * each column, one after the other.  A reader can therefore skip straight to the columns that it
+ * needs (and over whole row groups) without looking at the rest.  A file is simply a sequence of
+ * row groups.  Every integer is little-endian.
+ *
+ * Row group header (COLUMNAR_HEADER_SIZE bytes):
+ *
+ *   offset  size  field
+ *        0     4  COLUMNAR_MAGIC
+ *        4     4  the length of the row group, including this header
+ *        8     4  the number of rows
+ *       12     2  the number of columns
+ *       14     2  COLUMNAR_VERSION
+ *
+ * followed by a directory entry (COLUMNAR_DIRECTORY_ENTRY_SIZE bytes) for each column:
+ *
+ *        0     1  column (an enum log_field_t value, COLUMNAR_RECEIVED or COLUMNAR_SOURCE)
+ *        1     1  encoding
+ *        2     2  reserved (0)
+ *        4     4  the length of the column data
+ *
+ * Column encodings:
+ *
+ *   COLUMNAR_INT64       a signed 64-bit integer per row.
+ *   COLUMNAR_DELTA32     a signed 64-bit integer for the first row, then the difference between each
+ *                        following row and the one before it as a signed 32-bit integer.
+ *   COLUMNAR_DICTIONARY  a 16-bit count of distinct values, each value as a 32-bit length followed by
+ *                        its bytes, then a 16-bit index into the values per row.
+ *   COLUMNAR_STRING      rows + 1 32-bit offsets, then the values back to back (the value of row i
+ *                        runs from offset i to offset i + 1).
+ *
+ * Integer columns hold COLUMNAR_DASH for a field of "-" and COLUMNAR_NULL for a field that is missing
+ * or is not a number.  String columns hold the field as it was logged ("-" for a missing field).  The
+ * received column holds the receive time (seconds since the epoch) and the source column holds the
+ * "<address>:<port>" of the udploggerd host.
+ */
+#define COLUMNAR_MAGIC               "UDPC"
+#define COLUMNAR_VERSION             1
+#define COLUMNAR_HEADER_SIZE         16U
+#define COLUMNAR_DIRECTORY_ENTRY_SIZE 8U
+
+#define COLUMNAR_INT64               1
+#define COLUMNAR_DELTA32             2
+#define COLUMNAR_DICTIONARY          3
+#define COLUMNAR_STRING              4
+
+#define COLUMNAR_NULL                INT64_MIN
+#define COLUMNAR_DASH                (INT64_MIN + 1)
+
+#define COLUMNAR_RECEIVED            FIELD_COUNT
+#define COLUMNAR_SOURCE              (FIELD_COUNT + 1)
+#define COLUMNAR_COLUMNS             (FIELD_COUNT + 2)
+
+
+/*
+ * COLUMNAR_GROUP_ROWS          The maximum number of rows in a row group.
+ * COLUMNAR_DICTIONARY_ENTRIES  The maximum number of distinct values in a dictionary-encoded column;
+ *                              a column with more is stored as a COLUMNAR_STRING column instead.
+ */
+#define COLUMNAR_GROUP_ROWS          4096U
+#define COLUMNAR_DICTIONARY_ENTRIES  1024U
+
+
+/*
+ * A column of the row group that is being collected.  Integer columns keep their values; string
+ * columns keep their values back to back in text, with offsets (rows + 1 of them) marking where
+ * each one starts.
+ */
+struct columnar_column_t {
+	unsigned char id;
+	unsigned char encoding;
+	int64_t *values;
+	uint32_t *offsets;
+	char *text;
+};
+
+
+/*
+ * A row group that is being collected.  bound is an upper bound of the encoded length of the rows
+ * collected so far, which is kept below limit.  The dictionary members are scratch space for the
+ * encoder, and the source members cache the rendered source of the last record.
+ */
+struct columnar_group_t {
+	struct columnar_column_t columns[COLUMNAR_COLUMNS];
+	unsigned int rows;
+	size_t bound;
+	size_t limit;
+	uint16_t *dictionary_codes;
+	uint32_t *dictionary_rows;
+	uint16_t *dictionary_slots;
+	in_addr_t source_address;
+	in_port_t source_port;
+	size_t source_length;
+	char source[INET_ADDRSTRLEN + 8];
+};
+
+
+int columnar_add(struct columnar_group_t *, struct log_record_t *);
+size_t columnar_encode(struct columnar_group_t *, char *);
+void columnar_free(struct columnar_group_t *);
+struct columnar_group_t *columnar_new(size_t);
+void columnar_reset(struct columnar_group_t *);
+
+#endif
@@ -0,0 +1,667 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "record.h"
+
+
+/*
+ * Filter expressions are compiled in two passes.  The parser appends one instruction per
+ * comparison to the program (in the order that they appear in the expression) and builds a
+ * small tree of the boolean operators that join them.  That tree is then walked to fill in
+ * the jump targets of each instruction, so that the finished program evaluates the expression
+ * with short-circuiting and without any stack:
+ *
+ *   expression := and_expression { '||' and_expression }
+ *   and_expression := unary { '&&' unary }
+ *   unary := '!' unary | '(' expression ')' | <field> <operator> <value>
+ *   operator := '==' | '!=' | '<' | '<=' | '>' | '>=' | '~' | '!~'
+ *
+ * Values may be quoted with either ' or ".  Unquoted values run until whitespace, '&&', '||' or
+ * an unbalanced ')'; so regular expressions such as ^/api/(v1|v2)/ do not need quoting.  The
+ * ordering operators compare integers, '~' and '!~' match POSIX extended regular expressions and
+ * '==' and '!=' compare strings.  Comparisons against a field that the record does not have are
+ * false (and their negations true).
+ */
+
+
+/*
+ * Node of the boolean operator tree built while parsing.  Comparison nodes refer to their
+ * instruction in the program by index.
+ */
+struct filter_node_t {
+	enum {
+		NODE_AND,
+		NODE_OR,
+		NODE_NOT,
+		NODE_TEST
+	} type;
+	int instruction;
+	struct filter_node_t *left;
+	struct filter_node_t *right;
+};
+
+
+/*
+ * State of the parser: the filter being built and the current position in the expression.
+ */
+struct filter_parser_t {
+	struct filter_t *filter;
+	const char *expression;
+	const char *position;
+};
+
+
+/*
+ * Alternative names that may be used for fields in filter expressions (matching the
+ * udploggergrep.py option names).
+ */
+static const struct {
+	const char *name;
+	enum log_field_t field;
+} field_aliases[] =
+{
+	{"query", FIELD_QUERY_STRING},
+	{"remote_ip", FIELD_REMOTE_ADDRESS},
+	{"url", FIELD_REQUEST_URL},
+	{NULL, 0}
+};
+
+
+static int emit(struct filter_t *, struct filter_node_t *, int, int);
+static void free_instruction(struct filter_instruction_t *);
+static void free_node(struct filter_node_t *);
+static int match_token(struct filter_parser_t *, const char *);
+static struct filter_node_t *new_node(int, struct filter_node_t *, struct filter_node_t *);
+static struct filter_node_t *parse_and(struct filter_parser_t *);
+static struct filter_node_t *parse_error(struct filter_parser_t *, const char *);
+static struct filter_node_t *parse_or(struct filter_parser_t *);
+static struct filter_node_t *parse_test(struct filter_parser_t *);
+static struct filter_node_t *parse_unary(struct filter_parser_t *);
+static int parse_value(struct filter_parser_t *, char **, size_t *);
+static void skip_whitespace(struct filter_parser_t *);
+static int test(struct filter_instruction_t *, struct log_record_t *);
+
+
+/**
+ * emit(<filter>, <node>, <true target>, <false target>)
+ *
+ * Fills in the jump targets of the instructions below the given node so that control reaches
+ * <true target> if the node evaluates to true and <false target> otherwise.  Returns the index of
+ * the first instruction that must be executed to evaluate the node.
+ **/
+static int emit(struct filter_t *filter, struct filter_node_t *node, int jump_true, int jump_false)
+{
+	switch (node->type)
+	{
+		case NODE_AND:
+			return emit(filter, node->left, emit(filter, node->right, jump_true, jump_false), jump_false);
+		case NODE_OR:
+			return emit(filter, node->left, jump_true, emit(filter, node->right, jump_true, jump_false));
+		case NODE_NOT:
+			return emit(filter, node->left, jump_false, jump_true);
+		default:
+			filter->program[node->instruction].jump_true = jump_true;
+			filter->program[node->instruction].jump_false = jump_false;
+			return node->instruction;
+	}
+}
+
+
+/**
+ * filter_compile(<expression>)
+ *
+ * Compiles the given filter expression into a filter program.  Returns the program, or NULL (after
+ * printing a description of the problem to stderr) if the expression is invalid.
+ **/
+struct filter_t *filter_compile(const char *expression)
+{
+	struct filter_t *filter;
+	struct filter_node_t *root;
+	struct filter_parser_t parser;
+
+	filter = calloc(1, sizeof(struct filter_t));
+	if (! filter)
+	{
+		perror("filter.c calloc(filter)");
+		return NULL;
+	}
+
+	parser.filter = filter;
+	parser.expression = expression;
+	parser.position = expression;
+
+	root = parse_or(&parser);
+	if (root)
+	{
+		skip_whitespace(&parser);
+		if (*parser.position)
+		{
+			parse_error(&parser, "unexpected input");
+			free_node(root);
+			root = NULL;
+		}
+	}
+	if (! root)
+	{
+		filter_free(filter);
+		return NULL;
+	}
+
+	filter->entry = emit(filter, root, FILTER_ACCEPT, FILTER_REJECT);
+	free_node(root);
+
+#ifdef __DEBUG__
+	{
+		int i;
+
+		printf("filter.c debug: compiled '%s' to %d instructions (entry %d)\n", expression, filter->length, filter->entry);
+		for (i = 0; i < filter->length; i++)
+		{
+			printf("filter.c debug:   %d: %s op %d '%s' jt %d jf %d\n", i, record_field_names[filter->program[i].field], filter->program[i].operator, filter->program[i].string, filter->program[i].jump_true, filter->program[i].jump_false);
+		}
+	}
+#endif
+
+	return filter;
+}
+
+
+/**
+ * filter_free(<filter>)
+ *
+ * Releases a filter program returned by filter_compile.
+ **/
+void filter_free(struct filter_t *filter)
+{
+	int i;
+
+	if (! filter)
+	{
+		return;
+	}
+	for (i = 0; i < filter->length; i++)
+	{
+		free_instruction(&filter->program[i]);
+	}
+	free(filter->program);
+	free(filter);
+}
+
+
+/**
+ * filter_match(<filter>, <record>)
+ *
+ * Runs the filter program against the given record.  Returns 1 if the record is accepted or 0 if it
+ * is rejected.
+ **/
+int filter_match(struct filter_t *filter, struct log_record_t *record)
+{
+	struct filter_instruction_t *instruction;
+	int pc = filter->entry;
+
+	while (pc >= 0)
+	{
+		instruction = &filter->program[pc];
+		pc = test(instruction, record) ? instruction->jump_true : instruction->jump_false;
+	}
+	return pc == FILTER_ACCEPT;
+}
+
+
+static void free_instruction(struct filter_instruction_t *instruction)
+{
+	if (instruction->operator == FILTER_MATCH || instruction->operator == FILTER_NOT_MATCH)
+	{
+		regfree(&instruction->regex);
+	}
+	free(instruction->string);
+}
+
+
+static void free_node(struct filter_node_t *node)
+{
+	if (node)
+	{
+		free_node(node->left);
+		free_node(node->right);
+		free(node);
+	}
+}
+
+
+/**
+ * match_token(<parser>, <token>)
+ *
+ * Skips whitespace and then consumes the given token if it is next in the expression.  Returns 1 if
+ * the token was consumed or 0 if it was not present.
+ **/
+static int match_token(struct filter_parser_t *parser, const char *token)
+{
+	size_t length = strlen(token);
+
+	skip_whitespace(parser);
+	if (! strncmp(parser->position, token, length))
+	{
+		parser->position += length;
+		return 1;
+	}
+	return 0;
+}
+
+
+static struct filter_node_t *new_node(int type, struct filter_node_t *left, struct filter_node_t *right)
+{
+	struct filter_node_t *node;
+
+	node = calloc(1, sizeof(struct filter_node_t));
+	if (! node)
+	{
+		perror("filter.c calloc(node)");
+		free_node(left);
+		free_node(right);
+		return NULL;
+	}
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	return node;
+}
+
+
+static struct filter_node_t *parse_and(struct filter_parser_t *parser)
+{
+	struct filter_node_t *node;
+	struct filter_node_t *right;
+
+	node = parse_unary(parser);
+	while (node && match_token(parser, "&&"))
+	{
+		right = parse_unary(parser);
+		if (! right)
+		{
+			free_node(node);
+			return NULL;
+		}
+		node = new_node(NODE_AND, node, right);
+	}
+	return node;
+}
+
+
+static struct filter_node_t *parse_error(struct filter_parser_t *parser, const char *message)
+{
+	fprintf(stderr, "filter.c invalid filter expression '%s': %s at offset %ld\n", parser->expression, message, (long)(parser->position - parser->expression));
+	return NULL;
+}
+
+
+static struct filter_node_t *parse_or(struct filter_parser_t *parser)
+{
+	struct filter_node_t *node;
+	struct filter_node_t *right;
+
+	node = parse_and(parser);
+	while (node && match_token(parser, "||"))
+	{
+		right = parse_and(parser);
+		if (! right)
+		{
+			free_node(node);
+			return NULL;
+		}
+		node = new_node(NODE_OR, node, right);
+	}
+	return node;
+}
+
+
+/**
+ * parse_test(<parser>)
+ *
+ * Parses a single <field> <operator> <value> comparison, appending the instruction for it to the
+ * program.  Returns the tree node that refers to the new instruction.
+ **/
+static struct filter_node_t *parse_test(struct filter_parser_t *parser)
+{
+	char *end;
+	int field = -1;
+	struct filter_instruction_t instruction;
+	int i;
+	char name[32];
+	size_t name_length;
+	struct filter_node_t *node;
+	int result;
+	struct filter_instruction_t *tmp;
+
+	skip_whitespace(parser);
+	for (name_length = 0; isalnum((unsigned char)parser->position[name_length]) || parser->position[name_length] == '_'; name_length++);
+	if (name_length == 0 || name_length >= sizeof(name))
+	{
+		return parse_error(parser, "expected a field name");
+	}
+	memcpy(name, parser->position, name_length);
+	name[name_length] = '\0';
+
+	field = record_field_lookup(name);
+	for (i = 0; field < 0 && field_aliases[i].name; i++)
+	{
+		if (! strcmp(name, field_aliases[i].name))
+		{
+			field = field_aliases[i].field;
+		}
+	}
+	if (field < 0)
+	{
+		return parse_error(parser, "unknown field name");
+	}
+	parser->position += name_length;
+
+	memset(&instruction, 0, sizeof(instruction));
+	instruction.field = field;
+	if (match_token(parser, "=="))
+	{
+		instruction.operator = FILTER_EQUAL;
+	}
+	else if (match_token(parser, "!="))
+	{
+		instruction.operator = FILTER_NOT_EQUAL;
+	}
+	else if (match_token(parser, "!~"))
+	{
+		instruction.operator = FILTER_NOT_MATCH;
+	}
+	else if (match_token(parser, "<="))
+	{
+		instruction.operator = FILTER_LESS_EQUAL;
+	}
+	else if (match_token(parser, ">="))
+	{
+		instruction.operator = FILTER_GREATER_EQUAL;
+	}
+	else if (match_token(parser, "<"))
+	{
+		instruction.operator = FILTER_LESS;
+	}
+	else if (match_token(parser, ">"))
+	{
+		instruction.operator = FILTER_GREATER;
+	}
+	else if (match_token(parser, "~"))
+	{
+		instruction.operator = FILTER_MATCH;
+	}
+	else
+	{
+		return parse_error(parser, "expected a comparison operator");
+	}
+
+	if (! parse_value(parser, &instruction.string, &instruction.string_length))
+	{
+		return NULL;
+	}
+
+	switch (instruction.operator)
+	{
+		case FILTER_LESS:
+		case FILTER_LESS_EQUAL:
+		case FILTER_GREATER:
+		case FILTER_GREATER_EQUAL:
+			errno = 0;
+			instruction.number = strtoimax(instruction.string, &end, 10);
+			if (*end || end == instruction.string)
+			{
+				free(instruction.string);
+				return parse_error(parser, "expected an integer");
+			}
+			if (errno == ERANGE)
+			{
+				free(instruction.string);
+				return parse_error(parser, "integer out of range");
+			}
+			break;
+		case FILTER_MATCH:
+		case FILTER_NOT_MATCH:
+			result = regcomp(&instruction.regex, instruction.string, REG_EXTENDED | REG_NOSUB);
+			if (result)
+			{
+				free(instruction.string);
+				return parse_error(parser, "invalid regular expression");
+			}
+			break;
+		default:
+			break;
+	}
+
+	tmp = realloc(parser->filter->program, (parser->filter->length + 1) * sizeof(struct filter_instruction_t));
+	if (! tmp)
+	{
+		perror("filter.c realloc(program)");
+		free_instruction(&instruction);
+		return NULL;
+	}
+	parser->filter->program = tmp;
+
+	node = new_node(NODE_TEST, NULL, NULL);
+	if (! node)
+	{
+		free_instruction(&instruction);
+		return NULL;
+	}
+	parser->filter->program[parser->filter->length] = instruction;
+	node->instruction = parser->filter->length++;
+	return node;
+}
+
+
+static struct filter_node_t *parse_unary(struct filter_parser_t *parser)
+{
+	struct filter_node_t *node;
+
+	if (match_token(parser, "!"))
+	{
+		node = parse_unary(parser);
+		if (! node)
+		{
+			return NULL;
+		}
+		return new_node(NODE_NOT, node, NULL);
+	}
+	if (match_token(parser, "("))
+	{
+		node = parse_or(parser);
+		if (node && ! match_token(parser, ")"))
+		{
+			free_node(node);
+			return parse_error(parser, "expected ')'");
+		}
+		return node;
+	}
+	return parse_test(parser);
+}
+
+
+/**
+ * parse_value(<parser>, <string pointer>, <length pointer>)
+ *
+ * Parses the value of a comparison (quoted or unquoted, see above) and stores a newly-allocated
+ * copy of it.  Returns 1 for success or 0 for failure.
+ **/
+static int parse_value(struct filter_parser_t *parser, char **string, size_t *length)
+{
+	int depth = 0;
+	const char *end;
+	const char *start;
+
+	skip_whitespace(parser);
+	if (*parser->position == '"' || *parser->position == '\'')
+	{
+		start = parser->position + 1;
+		end = strchr(start, *parser->position);
+		if (! end)
+		{
+			parse_error(parser, "unterminated quoted value");
+			return 0;
+		}
+		parser->position = end + 1;
+	}
+	else
+	{
+		start = parser->position;
+		for (end = start; *end && ! isspace((unsigned char)*end); end++)
+		{
+			if ((end[0] == '&' && end[1] == '&') || (end[0] == '|' && end[1] == '|'))
+			{
+				break;
+			}
+			if (*end == '(')
+			{
+				depth++;
+			}
+			else if (*end == ')')
+			{
+				if (depth == 0)
+				{
+					break;
+				}
+				depth--;
+			}
+		}
+		if (end == start)
+		{
+			parse_error(parser, "expected a value");
+			return 0;
+		}
+		parser->position = end;
+	}
+
+	*length = end - start;
+	*string = malloc(*length + 1);
+	if (! *string)
+	{
+		perror("filter.c malloc(value)");
+		return 0;
+	}
+	memcpy(*string, start, *length);
+	(*string)[*length] = '\0';
+	return 1;
+}
+
+
+static void skip_whitespace(struct filter_parser_t *parser)
+{
+	while (isspace((unsigned char)*parser->position))
+	{
+		parser->position++;
+	}
+}
+
+
+/**
+ * test(<instruction>, <record>)
+ *
+ * Carries out the comparison described by a single filter instruction.  Returns 1 if the comparison
+ * holds for the record or 0 if it does not.
+ **/
+static int test(struct filter_instruction_t *instruction, struct log_record_t *record)
+{
+	const char *data;
+	size_t i;
+	size_t length;
+	int negative = 0;
+	intmax_t number = 0;
+	size_t offset;
+	regmatch_t range;
+
+	if (! record_field(record, instruction->field, &offset, &length))
+	{
+		return instruction->operator == FILTER_NOT_EQUAL || instruction->operator == FILTER_NOT_MATCH;
+	}
+	data = record->data + offset;
+
+	switch (instruction->operator)
+	{
+		case FILTER_EQUAL:
+			return length == instruction->string_length && ! memcmp(data, instruction->string, length);
+		case FILTER_NOT_EQUAL:
+			return length != instruction->string_length || memcmp(data, instruction->string, length);
+		case FILTER_MATCH:
+		case FILTER_NOT_MATCH:
+			range.rm_so = 0;
+			range.rm_eo = length;
+			return (regexec(&instruction->regex, data, 1, &range, REG_STARTEND) == 0) == (instruction->operator == FILTER_MATCH);
+		default:
+			break;
+	}
+
+	/* The remaining (ordering) operators all compare integers. */
+	i = 0;
+	if (length > 0 && data[0] == '-')
+	{
+		negative = 1;
+		i++;
+	}
+	if (i == length)
+	{
+		return 0;
+	}
+	for (; i < length; i++)
+	{
+		if (data[i] < '0' || data[i] > '9')
+		{
+			return 0;
+		}
+		/* Values too large for an intmax_t are treated like any other non-integer value. */
+		if (number > (INTMAX_MAX - (data[i] - '0')) / 10)
+		{
+			return 0;
+		}
+		number = number * 10 + (data[i] - '0');
+	}
+	if (negative)
+	{
+		number = -number;
+	}
+
+	switch (instruction->operator)
+	{
+		case FILTER_LESS:
+			return number < instruction->number;
+		case FILTER_LESS_EQUAL:
+			return number <= instruction->number;
+		case FILTER_GREATER:
+			return number > instruction->number;
+		case FILTER_GREATER_EQUAL:
+			return number >= instruction->number;
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,86 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <inttypes.h>
+#include <regex.h>
+#include "record.h"
+
+
+/*
+ * Jump targets that terminate a filter program.
+ */
+#define FILTER_ACCEPT -2
+#define FILTER_REJECT -1
+
+
+/*
+ * The comparison carried out by a single filter instruction.
+ */
+enum filter_operator_t {
+	FILTER_EQUAL,
+	FILTER_NOT_EQUAL,
+	FILTER_LESS,
+	FILTER_LESS_EQUAL,
+	FILTER_GREATER,
+	FILTER_GREATER_EQUAL,
+	FILTER_MATCH,
+	FILTER_NOT_MATCH
+};
+
+
+/*
+ * A single instruction of a compiled filter program.  Each instruction compares one record
+ * field against a constant and then continues at jump_true or jump_false (either another
+ * instruction or one of FILTER_ACCEPT/FILTER_REJECT), in the style of a BPF program.
+ */
+struct filter_instruction_t {
+	enum log_field_t field;
+	enum filter_operator_t operator;
+	int jump_true;
+	int jump_false;
+	intmax_t number;
+	char *string;
+	size_t string_length;
+	regex_t regex;
+};
+
+
+/*
+ * A compiled filter program.  Execution starts at instruction <entry>.
+ */
+struct filter_t {
+	struct filter_instruction_t *program;
+	int length;
+	int entry;
+};
+
+
+struct filter_t *filter_compile(const char *);
+void filter_free(struct filter_t *);
+int filter_match(struct filter_t *, struct log_record_t *);
+
+#endif
@@ -0,0 +1,1701 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "output.h"
+
+
+/*
+ * OUTPUT_CHUNK_ALIGNMENT   The alignment of each chunk buffer (a page).
+ * OUTPUT_COMPRESSED_SIZE   The size of the buffer for the compressed copy of a chunk: the worst-case
+ *                          expansion of deflate (see compressBound() in zlib) plus room for the gzip
+ *                          header and trailer.
+ * OUTPUT_INDEX_ENTRY_SIZE  The size of an index entry in the index file (see output.h).
+ * OUTPUT_WRITE_BATCH       The maximum number of chunks that the writer passes to a single writev() call.
+ */
+#define OUTPUT_CHUNK_ALIGNMENT 4096U
+#define OUTPUT_COMPRESSED_SIZE (OUTPUT_CHUNK_SIZE + (OUTPUT_CHUNK_SIZE >> 12) + (OUTPUT_CHUNK_SIZE >> 14) + 64U)
+#define OUTPUT_INDEX_ENTRY_SIZE 32U
+#define OUTPUT_WRITE_BATCH     64
+
+
+static struct output_chunk_t *acquire_chunk(struct output_lane_t *);
+static void close_destination(struct output_writer_t *, struct output_destination_t *);
+static void close_destinations(struct output_writer_t *);
+static void commit_destinations(struct output_writer_t *, struct output_destination_t *);
+static int commit_due(struct output_writer_t *);
+static void *compressor_main(void *);
+static uint64_t data_length(struct output_destination_t *);
+static void drain_chunks(struct output_writer_t *);
+static void encode_le(unsigned char *, uint64_t, unsigned int);
+static struct output_destination_t *find_destination(struct output_writer_t *, const char *);
+static uint32_t format_hash(const char *);
+static void free_stream(struct output_stream_t *);
+static int map_window(struct output_stream_t *, struct output_destination_t *, uint64_t);
+static uint64_t microseconds_since(const struct timespec *);
+static struct output_destination_t *open_destination(struct output_writer_t *, const char *, int);
+static void open_index(struct output_writer_t *, struct output_destination_t *);
+static void prepare_destinations(struct output_writer_t *);
+static struct output_chunk_t *queue_peek(struct output_queue_t *);
+static struct output_chunk_t *queue_pop(struct output_queue_t *);
+static void queue_push(struct output_queue_t *, struct output_chunk_t *);
+static void seal_chunk(struct output_lane_t *);
+static void stop_threads(struct output_stream_t *);
+static int update_lane(struct output_stream_t *, struct output_lane_t *);
+static void write_chunks(struct output_writer_t *, struct output_chunk_t **, unsigned int);
+static void write_compressed(struct output_writer_t *);
+static void write_index(struct output_writer_t *, struct output_destination_t *, struct output_chunk_t *, uint64_t);
+static int write_mapped(struct output_stream_t *, struct output_destination_t *, const struct iovec *, unsigned int, uint64_t *);
+static void *writer_main(void *);
+
+
+/**
+ * acquire_chunk(<lane>)
+ *
+ * Takes an empty chunk back from the lane's writer (receive side).  Returns NULL if every chunk of
+ * the writer is in flight.
+ **/
+static struct output_chunk_t *acquire_chunk(struct output_lane_t *lane)
+{
+	struct output_chunk_t *chunk;
+
+	chunk = queue_pop(&lane->writer->empty);
+	if (chunk)
+	{
+		chunk->length = 0;
+		chunk->index_count = 0;
+		chunk->records = 0;
+		memcpy(chunk->path, lane->path, OUTPUT_PATH_SIZE);
+	}
+	return chunk;
+}
+
+
+/**
+ * close_destination(<writer>, <destination>)
+ *
+ * Closes a file opened by a writer (stdout is left open) and its index, removing the file if it was
+ * created ahead of time and never used, so that stopping just before a rotation does not leave an
+ * empty file behind.  A preallocated file is unmapped and truncated to the length of its data, and a
+ * file with unsynced log lines is synced first (if the stream has a group-commit policy).
+ **/
+static void close_destination(struct output_writer_t *writer, struct output_destination_t *destination)
+{
+	if (destination->fd < 0)
+	{
+		return;
+	}
+	#ifdef __DEBUG__
+		printf("output.c debug: closing log destination '%s'\n", destination->path);
+	#endif
+	if (destination->unsynced)
+	{
+		commit_destinations(writer, destination);
+	}
+	if (destination->index_fd >= 0)
+	{
+		if (close(destination->index_fd))
+		{
+			perror("output.c close(index)");
+		}
+		destination->index_fd = -1;
+	}
+	if (destination->map)
+	{
+		munmap(destination->map, OUTPUT_MAP_WINDOW);
+		destination->map = NULL;
+	}
+	if (destination->allocated > destination->offset)
+	{
+		if (ftruncate(destination->fd, destination->offset))
+		{
+			perror("output.c ftruncate()");
+		}
+	}
+	destination->allocated = 0;
+	if (destination->created && ! destination->used)
+	{
+		if (unlink(destination->path))
+		{
+			perror("output.c unlink()");
+		}
+	}
+	if (destination->fd != STDOUT_FILENO)
+	{
+		if (close(destination->fd))
+		{
+			perror("output.c close()");
+		}
+	}
+	destination->fd = -1;
+	destination->path[0] = '\0';
+	destination->created = 0;
+	destination->used = 0;
+	destination->unsynced = 0;
+}
+
+
+/**
+ * close_destinations(<writer>)
+ *
+ * Closes every file that the writer has open (committing them together first).
+ **/
+static void close_destinations(struct output_writer_t *writer)
+{
+	unsigned int i;
+
+	if (writer->unsynced_bytes)
+	{
+		commit_destinations(writer, NULL);
+	}
+	for (i = 0; i < OUTPUT_OPEN_FILES; i++)
+	{
+		close_destination(writer, &writer->destinations[i]);
+	}
+}
+
+
+/**
+ * commit_destinations(<writer>, <destination>)
+ *
+ * Syncs every file of the writer that has unsynced log lines (or just <destination>, if it is not
+ * NULL) with fdatasync(), counts their log lines as durable and adds the time the commit took to the
+ * latency histogram.  Does nothing if the stream has no group-commit policy.
+ **/
+static void commit_destinations(struct output_writer_t *writer, struct output_destination_t *destination)
+{
+	unsigned int bucket = 0;
+	unsigned int i;
+	struct timespec start;
+	uint64_t took;
+
+	if (! writer->stream->sync_interval && ! writer->stream->sync_bytes)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < OUTPUT_OPEN_FILES; i++)
+	{
+		if ((destination && destination != &writer->destinations[i]) || ! writer->destinations[i].unsynced)
+		{
+			continue;
+		}
+		if (fdatasync(writer->destinations[i].fd))
+		{
+			perror("output.c fdatasync()");
+		}
+		else
+		{
+			writer->durable += writer->destinations[i].unsynced;
+		}
+		writer->destinations[i].unsynced = 0;
+	}
+	if (! destination)
+	{
+		writer->unsynced_bytes = 0;
+	}
+
+	for (took = microseconds_since(&start) >> 1; took && bucket < OUTPUT_SYNC_BUCKETS - 1; took >>= 1)
+	{
+		bucket++;
+	}
+	writer->latencies[bucket]++;
+}
+
+
+/**
+ * commit_due(<writer>)
+ *
+ * Returns 1 if the group-commit policy of the stream calls for the writer to commit its files now
+ * (see output.h), otherwise 0.
+ **/
+static int commit_due(struct output_writer_t *writer)
+{
+	struct output_stream_t *stream = writer->stream;
+
+	if (! writer->unsynced_bytes)
+	{
+		return 0;
+	}
+	if (stream->sync_bytes && writer->unsynced_bytes >= stream->sync_bytes)
+	{
+		return 1;
+	}
+	return stream->sync_interval && microseconds_since(&writer->unsynced_since) >= stream->sync_interval * 1000ULL;
+}
+
+
+/**
+ * compressor_main(<stream>)
+ *
+ * Main loop of a compressor thread.  Takes chunks from the job queue and compresses each of them into a
+ * complete gzip member, then marks the chunk as ready and wakes its writer.  Exits once the stream is
+ * closed and the job queue is empty.
+ **/
+static void *compressor_main(void *argument)
+{
+	struct output_chunk_t *chunk;
+	int result;
+	struct output_stream_t *stream = argument;
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	result = deflateInit2(&z, stream->compression_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	if (result != Z_OK)
+	{
+		fprintf(stderr, "output.c deflateInit2() failed (%d)\n", result);
+	}
+
+	while (1)
+	{
+		pthread_mutex_lock(&stream->jobs_mutex);
+		while (! (chunk = queue_pop(&stream->jobs)) && ! stream->jobs_stopping)
+		{
+			pthread_cond_wait(&stream->jobs_available, &stream->jobs_mutex);
+		}
+		pthread_mutex_unlock(&stream->jobs_mutex);
+		if (! chunk)
+		{
+			break;
+		}
+
+		chunk->output = chunk->compressed;
+		chunk->output_length = 0;
+		if (result == Z_OK && deflateReset(&z) == Z_OK)
+		{
+			z.next_in = (Bytef *)chunk->data;
+			z.avail_in = chunk->length;
+			z.next_out = (Bytef *)chunk->compressed;
+			z.avail_out = OUTPUT_COMPRESSED_SIZE;
+			if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+			{
+				chunk->output_length = z.total_out;
+			}
+			else
+			{
+				fprintf(stderr, "output.c deflate() failed, discarding %lu bytes of log data\n", (unsigned long)chunk->length);
+			}
+		}
+		__atomic_store_n(&chunk->ready, 1, __ATOMIC_RELEASE);
+		sem_post(&chunk->writer->ready);
+	}
+
+	if (result == Z_OK)
+	{
+		deflateEnd(&z);
+	}
+	return NULL;
+}
+
+
+/**
+ * data_length(<destination>)
+ *
+ * Returns the length of the data in a preallocated file that is being reopened: its length without
+ * the zero-filled tail that is left if the file was not closed properly (see output.h).
+ **/
+static uint64_t data_length(struct output_destination_t *destination)
+{
+	char block[4096];
+	uint64_t end = destination->allocated;
+	ssize_t length;
+	uint64_t start;
+
+	while (end > 0)
+	{
+		start = (end > sizeof(block)) ? end - sizeof(block) : 0;
+		length = pread(destination->fd, block, end - start, start);
+		if (length != (ssize_t)(end - start))
+		{
+			perror("output.c pread()");
+			return destination->allocated;
+		}
+		while (length > 0 && ! block[length - 1])
+		{
+			length--;
+		}
+		if (length > 0)
+		{
+			return start + length;
+		}
+		end = start;
+	}
+	return 0;
+}
+
+
+/**
+ * drain_chunks(<writer>)
+ *
+ * Takes every chunk that is waiting in the writer's filled queue.  Without compression the chunks are
+ * written out immediately, grouping consecutive chunks that belong in the same file into a single
+ * writev() call; otherwise they are handed to the compressors and the chunks that have already been
+ * compressed are written out (see write_compressed).
+ **/
+static void drain_chunks(struct output_writer_t *writer)
+{
+	struct output_chunk_t *batch[OUTPUT_WRITE_BATCH];
+	struct output_chunk_t *chunk;
+	unsigned int count = 0;
+	struct output_stream_t *stream = writer->stream;
+
+	while ((chunk = queue_pop(&writer->filled)))
+	{
+		if (! chunk->length)
+		{
+			/* Lanes that are retired or have to make room hand over their chunks empty as well. */
+			queue_push(&writer->empty, chunk);
+			continue;
+		}
+		if (stream->compression_level)
+		{
+			chunk->ready = 0;
+			queue_push(&writer->pending, chunk);
+			pthread_mutex_lock(&stream->jobs_mutex);
+			queue_push(&stream->jobs, chunk);
+			pthread_cond_signal(&stream->jobs_available);
+			pthread_mutex_unlock(&stream->jobs_mutex);
+			continue;
+		}
+
+		chunk->output = chunk->data;
+		chunk->output_length = chunk->length;
+		if (count && (count == OUTPUT_WRITE_BATCH || strcmp(chunk->path, batch[0]->path)))
+		{
+			write_chunks(writer, batch, count);
+			count = 0;
+		}
+		batch[count++] = chunk;
+	}
+	if (count)
+	{
+		write_chunks(writer, batch, count);
+	}
+	if (stream->compression_level)
+	{
+		write_compressed(writer);
+	}
+}
+
+
+/**
+ * encode_le(<buffer>, <value>, <size>)
+ *
+ * Stores the low <size> bytes of <value> in <buffer>, least significant byte first.
+ **/
+static void encode_le(unsigned char *buffer, uint64_t value, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+	{
+		buffer[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+
+/**
+ * find_destination(<writer>, <path>)
+ *
+ * Returns the writer's open file for <path>, or NULL if the writer does not have it open.
+ **/
+static struct output_destination_t *find_destination(struct output_writer_t *writer, const char *path)
+{
+	unsigned int i;
+
+	for (i = 0; i < OUTPUT_OPEN_FILES; i++)
+	{
+		if (writer->destinations[i].fd >= 0 && ! strcmp(writer->destinations[i].path, path))
+		{
+			return &writer->destinations[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * format_hash(<format>)
+ *
+ * Returns a hash (FNV-1a) of a destination format, which picks the writer of its lane.  The hash only
+ * depends on the format, so a lane is written by the same writer every time the program runs.
+ **/
+static uint32_t format_hash(const char *format)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; format && *format; format++)
+	{
+		hash = (hash ^ (unsigned char)*format) * 16777619U;
+	}
+	return hash;
+}
+
+
+/**
+ * free_stream(<stream>)
+ *
+ * Releases a stream whose threads have exited (or were never started) and everything allocated for it.
+ * The semaphores of the first writer_count writers must have been initialized.
+ **/
+static void free_stream(struct output_stream_t *stream)
+{
+	unsigned int i;
+	struct output_lane_t *lane;
+	struct output_writer_t *writer;
+
+	pthread_mutex_destroy(&stream->jobs_mutex);
+	pthread_cond_destroy(&stream->jobs_available);
+	pthread_mutex_destroy(&stream->lanes_mutex);
+	while ((lane = stream->lanes))
+	{
+		stream->lanes = lane->next;
+		free(lane->format);
+		free(lane);
+	}
+	for (i = 0; stream->chunks && i < stream->chunk_count; i++)
+	{
+		free(stream->chunks[i].data);
+		free(stream->chunks[i].compressed);
+		free(stream->chunks[i].index);
+	}
+	for (i = 0; stream->writers && i < stream->writer_count; i++)
+	{
+		writer = &stream->writers[i];
+		sem_destroy(&writer->ready);
+		free(writer->filled.slots);
+		free(writer->empty.slots);
+		free(writer->pending.slots);
+		free(writer->index_buffer);
+	}
+	free(stream->writers);
+	free(stream->chunks);
+	free(stream->compressors);
+	free(stream->jobs.slots);
+	free(stream->format);
+	free(stream);
+}
+
+
+/**
+ * map_window(<stream>, <destination>, <offset>)
+ *
+ * Maps the window of a preallocated file that holds <offset>, first extending the file (by a multiple
+ * of the preallocation step) if the window reaches past its end.  Returns 1 for success or 0 for
+ * failure.
+ **/
+static int map_window(struct output_stream_t *stream, struct output_destination_t *destination, uint64_t offset)
+{
+	uint64_t allocated;
+	void *map;
+
+	if (destination->map)
+	{
+		munmap(destination->map, OUTPUT_MAP_WINDOW);
+		destination->map = NULL;
+	}
+	offset -= offset % OUTPUT_MAP_WINDOW;
+	if (offset + OUTPUT_MAP_WINDOW > destination->allocated)
+	{
+		allocated = offset + OUTPUT_MAP_WINDOW + stream->preallocate - 1;
+		allocated -= allocated % stream->preallocate;
+		#ifdef __DEBUG__
+			printf("output.c debug: preallocating '%s' up to %" PRIu64 " bytes\n", destination->path, allocated);
+		#endif
+		errno = posix_fallocate(destination->fd, destination->allocated, allocated - destination->allocated);
+		if (errno)
+		{
+			perror("output.c posix_fallocate()");
+			return 0;
+		}
+		destination->allocated = allocated;
+	}
+	map = mmap(NULL, OUTPUT_MAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, destination->fd, offset);
+	if (map == MAP_FAILED)
+	{
+		perror("output.c mmap()");
+		return 0;
+	}
+	destination->map = map;
+	destination->map_offset = offset;
+	return 1;
+}
+
+
+/**
+ * microseconds_since(<start>)
+ *
+ * Returns the number of microseconds since <start> (CLOCK_MONOTONIC).
+ **/
+static uint64_t microseconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000ULL + now.tv_nsec / 1000 - start->tv_nsec / 1000;
+}
+
+
+/**
+ * open_destination(<writer>, <path>, <ahead of time>)
+ *
+ * Returns the writer's open file for <path>, opening it (and closing the least recently written file
+ * if the writer already has OUTPUT_OPEN_FILES open) if necessary.  Files that are opened ahead of time
+ * only take a free slot, and are created with O_EXCL so that they can be removed again if they are
+ * never used.  Returns NULL if the file could not (or, ahead of time, need not) be opened.
+ **/
+static struct output_destination_t *open_destination(struct output_writer_t *writer, const char *path, int ahead)
+{
+	struct output_destination_t *destination;
+	int flags = writer->stream->preallocate ? O_RDWR : O_WRONLY | O_APPEND;
+	unsigned int i;
+	struct output_destination_t *victim = NULL;
+
+	if ((destination = find_destination(writer, path)))
+	{
+		return destination;
+	}
+	for (i = 0; i < OUTPUT_OPEN_FILES; i++)
+	{
+		destination = &writer->destinations[i];
+		if (! victim || (victim->fd >= 0 && (destination->fd < 0 || destination->last_used < victim->last_used)))
+		{
+			victim = destination;
+		}
+	}
+	if (ahead && victim->fd >= 0)
+	{
+		return NULL;
+	}
+	close_destination(writer, victim);
+
+	if (! writer->stream->format)
+	{
+		victim->fd = STDOUT_FILENO;
+	}
+	else
+	{
+		#ifdef __DEBUG__
+			printf("output.c debug: opening log destination '%s'%s\n", path, ahead ? " ahead of time" : "");
+		#endif
+		if (ahead)
+		{
+			victim->fd = open(path, flags | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+			victim->created = (victim->fd >= 0);
+		}
+		if (victim->fd < 0 && (! ahead || errno == EEXIST))
+		{
+			victim->fd = open(path, flags | O_CREAT | O_CLOEXEC, 0666);
+		}
+		if (victim->fd < 0)
+		{
+			perror("output.c open()");
+			fprintf(stderr, "output.c could not open file '%s' for appending\n", path);
+			return NULL;
+		}
+	}
+	memcpy(victim->path, path, OUTPUT_PATH_SIZE);
+	victim->last_used = ++writer->clock;
+	return victim;
+}
+
+
+/**
+ * open_index(<writer>, <destination>)
+ *
+ * Opens (creating it if necessary) the index of a destination, writing the magic number if the index
+ * is new.  The index of an empty destination is truncated, since any entries in it belong to a file
+ * that has since been rotated away.  A destination that cannot be indexed is still written to.
+ **/
+static void open_index(struct output_writer_t *writer, struct output_destination_t *destination)
+{
+	char path[OUTPUT_PATH_SIZE + 4];
+
+	if (! writer->stream->indexed || ! destination->path[0])
+	{
+		return;
+	}
+	snprintf(path, sizeof(path), "%s.idx", destination->path);
+	destination->index_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | (destination->offset ? 0 : O_TRUNC), 0666);
+	if (destination->index_fd < 0)
+	{
+		perror("output.c open(index)");
+		fprintf(stderr, "output.c could not open index '%s' for appending\n", path);
+		return;
+	}
+	if (lseek(destination->index_fd, 0, SEEK_END) == 0 && write(destination->index_fd, OUTPUT_INDEX_MAGIC, 8) != 8)
+	{
+		perror("output.c write(index)");
+		close(destination->index_fd);
+		destination->index_fd = -1;
+	}
+}
+
+
+/**
+ * output_close(<stream>)
+ *
+ * Hands any buffered data to the writers, waits for the writers to write everything out and exit,
+ * then closes the destinations and releases the stream.  Reports the log lines that were dropped or
+ * lost and, with a group-commit policy, those that were confirmed durable and the commit latency
+ * histogram.
+ **/
+void output_close(struct output_stream_t *stream)
+{
+	uintmax_t count;
+	uintmax_t durable = 0;
+	uintmax_t lost = 0;
+	unsigned int i;
+	unsigned int j;
+
+	output_flush(stream);
+	stop_threads(stream);
+
+	if (stream->dropped)
+	{
+		fprintf(stderr, "output.c dropped %" PRIuMAX " log lines because the output buffers were full\n", stream->dropped);
+	}
+	for (i = 0; i < stream->writer_count; i++)
+	{
+		lost += stream->writers[i].lost;
+	}
+	if (lost)
+	{
+		fprintf(stderr, "output.c lost %" PRIuMAX " log lines because they could not be written\n", lost);
+	}
+	if (stream->sync_interval || stream->sync_bytes)
+	{
+		for (i = 0; i < stream->writer_count; i++)
+		{
+			durable += stream->writers[i].durable;
+		}
+		fprintf(stderr, "output.c %" PRIuMAX " log lines confirmed durable; commit latencies:\n", durable);
+		for (j = 0; j < OUTPUT_SYNC_BUCKETS; j++)
+		{
+			for (count = 0, i = 0; i < stream->writer_count; i++)
+			{
+				count += stream->writers[i].latencies[j];
+			}
+			if (count && j == OUTPUT_SYNC_BUCKETS - 1)
+			{
+				fprintf(stderr, "output.c   %" PRIu64 " us or more: %" PRIuMAX "\n", (uint64_t)1 << j, count);
+			}
+			else if (count)
+			{
+				fprintf(stderr, "output.c   %" PRIu64 " us to %" PRIu64 " us: %" PRIuMAX "\n", j ? (uint64_t)1 << j : 0, (uint64_t)1 << (j + 1), count);
+			}
+		}
+	}
+	free_stream(stream);
+}
+
+
+/**
+ * output_commit(<stream>, <length>, <records>)
+ *
+ * Marks <length> bytes of the space returned by the last successful output_reserve() call as used,
+ * holding <records> log lines.
+ **/
+void output_commit(struct output_stream_t *stream, size_t length, uintmax_t records)
+{
+	stream->lane->current->length += length;
+	stream->lane->current->records += records;
+}
+
+
+/**
+ * output_discard(<stream>, <count>)
+ *
+ * Counts <count> log lines that the caller had to drop (for example because output_reserve() failed
+ * for data that held several log lines) as dropped.
+ **/
+void output_discard(struct output_stream_t *stream, uintmax_t count)
+{
+	stream->dropped += count;
+}
+
+
+/**
+ * output_flush(<stream>)
+ *
+ * Hands the chunk that each lane is filling (if it holds any data) to its writer.  Does not wait for
+ * the data to be written.
+ **/
+void output_flush(struct output_stream_t *stream)
+{
+	struct output_lane_t *lane;
+
+	for (lane = stream->lanes; lane; lane = lane->next)
+	{
+		if (lane->current && lane->current->length)
+		{
+			seal_chunk(lane);
+		}
+	}
+}
+
+
+/**
+ * output_index(<stream>, <type>, <source>, <key>)
+ *
+ * Records an index entry of <type> (OUTPUT_INDEX_TIME or OUTPUT_INDEX_SERIAL) with <key> for the log line
+ * that is about to be committed, i.e. it must be called between output_reserve() and output_commit().
+ * <source> is only used by serial entries and may be NULL.  Does nothing if the stream is not indexed.
+ * (Time entries are recorded by output_reserve() itself.)
+ **/
+void output_index(struct output_stream_t *stream, unsigned char type, const struct sockaddr_in *source, uint64_t key)
+{
+	struct output_chunk_t *chunk = stream->lane->current;
+	struct output_index_entry_t *entry;
+
+	if (! stream->indexed || ! chunk || chunk->index_count == OUTPUT_INDEX_ENTRIES)
+	{
+		return;
+	}
+	entry = &chunk->index[chunk->index_count++];
+	entry->type = type;
+	entry->address = source ? source->sin_addr.s_addr : 0;
+	entry->port = source ? ntohs(source->sin_port) : 0;
+	entry->key = key;
+	entry->position = chunk->length;
+}
+
+
+/**
+ * output_lane(<stream>, <destination format>)
+ *
+ * Returns the lane that writes to the files named by the strftime(3) format, creating it (and assigning
+ * it to one of the writers) if the stream does not have one yet.  Returns NULL on failure, or if the
+ * stream writes to stdout.
+ **/
+struct output_lane_t *output_lane(struct output_stream_t *stream, const char *format)
+{
+	uint32_t hash;
+	struct output_lane_t *lane;
+
+	if (! stream->format)
+	{
+		return NULL;
+	}
+	hash = format_hash(format);
+	for (lane = stream->lane_table[hash % OUTPUT_LANE_BUCKETS]; lane; lane = lane->bucket_next)
+	{
+		if (lane->hash == hash && ! strcmp(lane->format, format))
+		{
+			return lane;
+		}
+	}
+
+	lane = calloc(1, sizeof(struct output_lane_t));
+	if (! lane)
+	{
+		perror("output.c calloc(lane)");
+		return NULL;
+	}
+	lane->format = strdup(format);
+	if (! lane->format)
+	{
+		perror("output.c strdup(format)");
+		free(lane);
+		return NULL;
+	}
+	lane->hash = hash;
+	lane->writer = &stream->writers[hash % stream->writer_count];
+	lane->used = stream->timestamp;
+	if (stream->timestamp)
+	{
+		update_lane(stream, lane);
+	}
+	#ifdef __DEBUG__
+		printf("output.c debug: added lane '%s' (writer %u)\n", format, (unsigned int)(lane->writer - stream->writers));
+	#endif
+
+	lane->bucket_next = stream->lane_table[hash % OUTPUT_LANE_BUCKETS];
+	stream->lane_table[hash % OUTPUT_LANE_BUCKETS] = lane;
+	/* The writers walk the list (see prepare_destinations), so the lane is published complete. */
+	lane->next = stream->lanes;
+	__atomic_store_n(&stream->lanes, lane, __ATOMIC_RELEASE);
+	return lane;
+}
+
+
+/**
+ * output_open(<destination format>, <memory budget>, <compression level>, <compressor count>, <index>, <writer count>, <preallocation step>,
+ *             <sync interval>, <sync bytes>)
+ *
+ * Creates an output stream that writes to the files named by the strftime(3) format (or to stdout if
+ * the format is NULL), using up to <memory budget> bytes for buffers, and starts <writer count> writer
+ * threads (which share the buffers equally).  If the compression level is not 0, output is gzip-
+ * compressed (at that level) by <compressor count> compressor threads.  If <index> is not 0 (and there
+ * is a format), each file gets a sidecar index.  If the preallocation step is not 0 (and there is a
+ * format), files are preallocated in steps of that many bytes and written through a mapping (see
+ * output.h).  If the sync interval (milliseconds) or sync bytes is not 0 (and there is a format), the
+ * writers follow that group-commit policy (see output.h).  Returns the stream or NULL on failure.
+ **/
+struct output_stream_t *output_open(const char *format, size_t memory, int compression_level, unsigned int compressor_count, int index, unsigned int writer_count, size_t preallocate, unsigned long sync_interval, uint64_t sync_bytes)
+{
+	struct output_chunk_t *chunk;
+	unsigned int i;
+	struct output_lane_t *lane;
+	struct output_stream_t *stream;
+	struct output_writer_t *writer;
+
+	/* On failure, whatever has been set up is released by stop_threads() and free_stream(). */
+	stream = calloc(1, sizeof(struct output_stream_t));
+	lane = calloc(1, sizeof(struct output_lane_t));
+	if (! stream || ! lane)
+	{
+		perror("output.c calloc(stream)");
+		free(stream);
+		free(lane);
+		return NULL;
+	}
+	pthread_mutex_init(&stream->lanes_mutex, NULL);
+	pthread_mutex_init(&stream->jobs_mutex, NULL);
+	pthread_cond_init(&stream->jobs_available, NULL);
+	stream->lanes = lane;
+	stream->lane = lane;
+	if (format)
+	{
+		stream->format = strdup(format);
+		lane->format = strdup(format);
+		if (! stream->format || ! lane->format)
+		{
+			perror("output.c strdup(format)");
+			free_stream(stream);
+			return NULL;
+		}
+	}
+
+	stream->compression_level = compression_level;
+	stream->indexed = format && index;
+	stream->sync_interval = format ? sync_interval : 0;
+	stream->sync_bytes = format ? sync_bytes : 0;
+	if (format && preallocate)
+	{
+		stream->preallocate = preallocate + OUTPUT_MAP_WINDOW - 1;
+		stream->preallocate -= stream->preallocate % OUTPUT_MAP_WINDOW;
+	}
+	stream->writer_count = (format && writer_count) ? writer_count : 1;
+	stream->chunk_count = memory / (OUTPUT_CHUNK_SIZE + (compression_level ? OUTPUT_COMPRESSED_SIZE : 0));
+	if (stream->chunk_count < 2 * stream->writer_count)
+	{
+		stream->chunk_count = 2 * stream->writer_count;
+	}
+	stream->chunks = calloc(stream->chunk_count, sizeof(struct output_chunk_t));
+	stream->writers = calloc(stream->writer_count, sizeof(struct output_writer_t));
+	stream->jobs.slots = calloc(stream->chunk_count, sizeof(struct output_chunk_t *));
+	if (! stream->chunks || ! stream->writers || ! stream->jobs.slots)
+	{
+		perror("output.c calloc(chunks)");
+		stream->writer_count = 0;
+		free_stream(stream);
+		return NULL;
+	}
+	stream->jobs.size = stream->chunk_count;
+	for (i = 0; i < stream->writer_count; i++)
+	{
+		if (sem_init(&stream->writers[i].ready, 0, 0))
+		{
+			perror("output.c sem_init()");
+			stream->writer_count = i;
+			free_stream(stream);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < stream->writer_count; i++)
+	{
+		writer = &stream->writers[i];
+		writer->stream = stream;
+		writer->filled.slots = calloc(stream->chunk_count, sizeof(struct output_chunk_t *));
+		writer->empty.slots = calloc(stream->chunk_count, sizeof(struct output_chunk_t *));
+		writer->pending.slots = calloc(stream->chunk_count, sizeof(struct output_chunk_t *));
+		if (! writer->filled.slots || ! writer->empty.slots || ! writer->pending.slots)
+		{
+			perror("output.c calloc(queues)");
+			free_stream(stream);
+			return NULL;
+		}
+		writer->filled.size = stream->chunk_count;
+		writer->empty.size = stream->chunk_count;
+		writer->pending.size = stream->chunk_count;
+		for (writer->clock = 0; writer->clock < OUTPUT_OPEN_FILES; writer->clock++)
+		{
+			writer->destinations[writer->clock].fd = -1;
+			writer->destinations[writer->clock].index_fd = -1;
+		}
+		if (stream->indexed && ! (writer->index_buffer = malloc(OUTPUT_INDEX_ENTRIES * OUTPUT_INDEX_ENTRY_SIZE)))
+		{
+			perror("output.c malloc(index)");
+			free_stream(stream);
+			return NULL;
+		}
+	}
+
+	/* The chunks are dealt out to the writers in turn. */
+	for (i = 0; i < stream->chunk_count; i++)
+	{
+		chunk = &stream->chunks[i];
+		chunk->writer = &stream->writers[i % stream->writer_count];
+		if (posix_memalign((void **)&chunk->data, OUTPUT_CHUNK_ALIGNMENT, OUTPUT_CHUNK_SIZE))
+		{
+			fprintf(stderr, "output.c could not allocate output chunk\n");
+			free_stream(stream);
+			return NULL;
+		}
+		if (compression_level && posix_memalign((void **)&chunk->compressed, OUTPUT_CHUNK_ALIGNMENT, OUTPUT_COMPRESSED_SIZE))
+		{
+			fprintf(stderr, "output.c could not allocate output chunk\n");
+			free_stream(stream);
+			return NULL;
+		}
+		if (stream->indexed && ! (chunk->index = calloc(OUTPUT_INDEX_ENTRIES, sizeof(struct output_index_entry_t))))
+		{
+			perror("output.c calloc(index)");
+			free_stream(stream);
+			return NULL;
+		}
+		queue_push(&chunk->writer->empty, chunk);
+	}
+
+	lane->hash = format_hash(format);
+	lane->writer = &stream->writers[lane->hash % stream->writer_count];
+	if (format)
+	{
+		stream->lane_table[lane->hash % OUTPUT_LANE_BUCKETS] = lane;
+	}
+
+	if (compression_level)
+	{
+		stream->compressors = calloc(compressor_count, sizeof(pthread_t));
+		if (! stream->compressors)
+		{
+			perror("output.c calloc(compressors)");
+			free_stream(stream);
+			return NULL;
+		}
+		for (; stream->compressor_count < compressor_count; stream->compressor_count++)
+		{
+			errno = pthread_create(&stream->compressors[stream->compressor_count], NULL, compressor_main, stream);
+			if (errno)
+			{
+				perror("output.c pthread_create()");
+				stop_threads(stream);
+				free_stream(stream);
+				return NULL;
+			}
+		}
+	}
+	for (; stream->writers_started < stream->writer_count; stream->writers_started++)
+	{
+		errno = pthread_create(&stream->writers[stream->writers_started].thread, NULL, writer_main, &stream->writers[stream->writers_started]);
+		if (errno)
+		{
+			perror("output.c pthread_create()");
+			stop_threads(stream);
+			free_stream(stream);
+			return NULL;
+		}
+	}
+
+	#ifdef __DEBUG__
+		printf("output.c debug: started %u writers with %u chunks of %u bytes\n", stream->writer_count, stream->chunk_count, OUTPUT_CHUNK_SIZE);
+	#endif
+	return stream;
+}
+
+
+/**
+ * output_path_changes(<stream>, <broken-down time>)
+ *
+ * Returns 1 if output_set_time() with the same time would change the file that the selected lane
+ * writes to, otherwise 0 (so that a caller that buffers data of its own can hand it over first).
+ **/
+int output_path_changes(struct output_stream_t *stream, const struct tm *tm)
+{
+	char path[OUTPUT_PATH_SIZE];
+
+	if (! stream->lane->format)
+	{
+		return 0;
+	}
+	if (! strftime(path, OUTPUT_PATH_SIZE, stream->lane->format, tm))
+	{
+		path[0] = '\0';
+	}
+	return strcmp(path, stream->lane->path) != 0;
+}
+
+
+/**
+ * output_reopen(<stream>)
+ *
+ * Asks the writers to close and reopen their files before they write any more data (for example after
+ * the files have been moved aside by log rotation).
+ **/
+void output_reopen(struct output_stream_t *stream)
+{
+	unsigned int i;
+
+	for (i = 0; i < stream->writer_count; i++)
+	{
+		__atomic_store_n(&stream->writers[i].reopen, 1, __ATOMIC_RELEASE);
+		sem_post(&stream->writers[i].ready);
+	}
+}
+
+
+/**
+ * output_reserve(<stream>, <length>)
+ *
+ * Returns a pointer to <length> contiguous bytes of free space in the selected lane, handing its current
+ * chunk to the writer and taking a new one if the current chunk does not have room.  The caller fills in
+ * the space and then calls output_commit() with the number of bytes used.  Returns NULL (and counts the
+ * line as dropped) if every chunk of the lane's writer is waiting to be written, or if <length> is larger
+ * than OUTPUT_CHUNK_SIZE.
+ **/
+char *output_reserve(struct output_stream_t *stream, size_t length)
+{
+	struct output_lane_t *lane = stream->lane;
+	struct output_lane_t *other;
+
+	if (length > OUTPUT_CHUNK_SIZE)
+	{
+		stream->dropped++;
+		return NULL;
+	}
+	if (lane->current && lane->current->length + length > OUTPUT_CHUNK_SIZE)
+	{
+		seal_chunk(lane);
+	}
+	if (! lane->current)
+	{
+		lane->current = acquire_chunk(lane);
+		if (! lane->current)
+		{
+			/*
+			 * The writer's other lanes may be holding on to its chunks (even empty ones): hand them
+			 * over so they come back.
+			 */
+			for (other = stream->lanes; other; other = other->next)
+			{
+				if (other->writer == lane->writer && other->current)
+				{
+					seal_chunk(other);
+				}
+			}
+			stream->dropped++;
+			return NULL;
+		}
+	}
+	lane->used = stream->timestamp;
+	if (lane->index_time)
+	{
+		lane->index_time = 0;
+		output_index(stream, OUTPUT_INDEX_TIME, NULL, stream->timestamp);
+	}
+	return lane->current->data + lane->current->length;
+}
+
+
+/**
+ * output_retire(<stream>)
+ *
+ * Retires every lane (other than the selected one) that has not been written to for OUTPUT_LANE_IDLE
+ * seconds of stream time: its chunk is handed to the writer (which hands an empty one straight back)
+ * and the lane is unlinked and freed.  Lanes returned by output_lane() before the call must not be
+ * used after it if any lanes were retired (look them up again instead).  Does nothing if a writer is
+ * walking the lanes at the time, so that the receive side never waits for one.  Returns the number
+ * of lanes that were retired.
+ **/
+unsigned int output_retire(struct output_stream_t *stream)
+{
+	struct output_lane_t **bucket_ptr;
+	struct output_lane_t *lane;
+	struct output_lane_t **lane_ptr;
+	unsigned int retired = 0;
+
+	if (pthread_mutex_trylock(&stream->lanes_mutex))
+	{
+		return 0;
+	}
+	lane_ptr = &stream->lanes;
+	while ((lane = *lane_ptr))
+	{
+		if (lane == stream->lane || stream->timestamp - lane->used < OUTPUT_LANE_IDLE)
+		{
+			lane_ptr = &lane->next;
+			continue;
+		}
+		#ifdef __DEBUG__
+			printf("output.c debug: retiring lane '%s'\n", lane->format);
+		#endif
+		if (lane->current)
+		{
+			seal_chunk(lane);
+		}
+		for (bucket_ptr = &stream->lane_table[lane->hash % OUTPUT_LANE_BUCKETS]; *bucket_ptr != lane; bucket_ptr = &(*bucket_ptr)->bucket_next);
+		*bucket_ptr = lane->bucket_next;
+		*lane_ptr = lane->next;
+		free(lane->format);
+		free(lane);
+		retired++;
+	}
+	pthread_mutex_unlock(&stream->lanes_mutex);
+	return retired;
+}
+
+
+/**
+ * output_select(<stream>, <lane>)
+ *
+ * Makes <lane> the lane that output_reserve(), output_commit(), output_index() and output_path_changes()
+ * work on.
+ **/
+void output_select(struct output_stream_t *stream, struct output_lane_t *lane)
+{
+	stream->lane = lane;
+}
+
+
+/**
+ * output_set_time(<stream>, <time>, <broken-down time>)
+ *
+ * Sets the time of the log lines that follow, which selects the file that each lane writes to (if the
+ * destination formats contain conversion specifications).  When the file of a lane changes, its chunk
+ * is handed to the writer so that every chunk belongs in a single file.  Returns 1 if the file of any
+ * lane changed, otherwise 0.
+ **/
+int output_set_time(struct output_stream_t *stream, time_t timestamp, const struct tm *tm)
+{
+	int changed = 0;
+	struct output_lane_t *lane;
+
+	stream->timestamp = timestamp;
+	stream->tm = *tm;
+	for (lane = stream->lanes; lane; lane = lane->next)
+	{
+		changed |= update_lane(stream, lane);
+	}
+	return changed;
+}
+
+
+/**
+ * prepare_destinations(<writer>)
+ *
+ * For each of the writer's lanes that it is currently writing to, opens the file that the destination
+ * format will name OUTPUT_LOOKAHEAD seconds from now, if it is not already open (and there is room for
+ * it), so that the next rotation does not have to wait for the filesystem.  Lanes that are not in use
+ * (such as a default lane that is never written to) get no files ahead of time.
+ **/
+static void prepare_destinations(struct output_writer_t *writer)
+{
+	struct tm ahead;
+	struct output_lane_t *lane;
+	char path[OUTPUT_PATH_SIZE];
+	time_t t;
+	struct tm tm;
+
+	if (! writer->stream->format)
+	{
+		return;
+	}
+	t = time(NULL);
+	if (! localtime_r(&t, &tm))
+	{
+		return;
+	}
+	t += OUTPUT_LOOKAHEAD;
+	if (! localtime_r(&t, &ahead))
+	{
+		return;
+	}
+	/* Lanes are only unlinked while nobody holds lanes_mutex (see output_retire). */
+	pthread_mutex_lock(&writer->stream->lanes_mutex);
+	for (lane = __atomic_load_n(&writer->stream->lanes, __ATOMIC_ACQUIRE); lane; lane = lane->next)
+	{
+		if (lane->writer != writer || ! strftime(path, OUTPUT_PATH_SIZE, lane->format, &tm) || ! find_destination(writer, path))
+		{
+			continue;
+		}
+		if (strftime(path, OUTPUT_PATH_SIZE, lane->format, &ahead))
+		{
+			open_destination(writer, path, 1);
+		}
+	}
+	pthread_mutex_unlock(&writer->stream->lanes_mutex);
+}
+
+
+/**
+ * queue_peek(<queue>)
+ *
+ * Returns the oldest chunk in the queue without removing it (consumer side), or NULL if the queue is empty.
+ **/
+static struct output_chunk_t *queue_peek(struct output_queue_t *queue)
+{
+	unsigned int head;
+
+	head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+	return queue->slots[head % queue->size];
+}
+
+
+/**
+ * queue_pop(<queue>)
+ *
+ * Removes the oldest chunk from the queue (consumer side).  Returns NULL if the queue is empty.
+ **/
+static struct output_chunk_t *queue_pop(struct output_queue_t *queue)
+{
+	struct output_chunk_t *chunk;
+	unsigned int head;
+
+	head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+	chunk = queue->slots[head % queue->size];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return chunk;
+}
+
+
+/**
+ * queue_push(<queue>, <chunk>)
+ *
+ * Adds a chunk to the queue (producer side).  The queue has room for every chunk of the stream.
+ **/
+static void queue_push(struct output_queue_t *queue, struct output_chunk_t *chunk)
+{
+	unsigned int tail;
+
+	tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	queue->slots[tail % queue->size] = chunk;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * seal_chunk(<lane>)
+ *
+ * Hands the lane's current chunk to its writer (receive side).  A chunk that holds no data is simply
+ * handed back by the writer.
+ **/
+static void seal_chunk(struct output_lane_t *lane)
+{
+	queue_push(&lane->writer->filled, lane->current);
+	lane->current = NULL;
+	sem_post(&lane->writer->ready);
+}
+
+
+/**
+ * stop_threads(<stream>)
+ *
+ * Asks the writer and compressor threads that have been started to exit (once the writers have written
+ * out everything that was handed to them) and waits for them.
+ **/
+static void stop_threads(struct output_stream_t *stream)
+{
+	unsigned int i;
+
+	__atomic_store_n(&stream->stopping, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < stream->writers_started; i++)
+	{
+		sem_post(&stream->writers[i].ready);
+	}
+	for (i = 0; i < stream->writers_started; i++)
+	{
+		pthread_join(stream->writers[i].thread, NULL);
+	}
+
+	pthread_mutex_lock(&stream->jobs_mutex);
+	stream->jobs_stopping = 1;
+	pthread_cond_broadcast(&stream->jobs_available);
+	pthread_mutex_unlock(&stream->jobs_mutex);
+	for (i = 0; i < stream->compressor_count; i++)
+	{
+		pthread_join(stream->compressors[i], NULL);
+	}
+}
+
+
+/**
+ * update_lane(<stream>, <lane>)
+ *
+ * Brings the path of a lane up to date with the time of the stream (receive side), handing its chunk to
+ * the writer if the path changes.  Returns 1 if the path changed, otherwise 0.
+ **/
+static int update_lane(struct output_stream_t *stream, struct output_lane_t *lane)
+{
+	char path[OUTPUT_PATH_SIZE];
+
+	lane->index_time = stream->indexed;
+	if (! lane->format)
+	{
+		return 0;
+	}
+	if (! strftime(path, OUTPUT_PATH_SIZE, lane->format, &stream->tm))
+	{
+		path[0] = '\0';
+	}
+	if (! strcmp(path, lane->path))
+	{
+		return 0;
+	}
+	if (lane->current && lane->current->length)
+	{
+		seal_chunk(lane);
+	}
+	memcpy(lane->path, path, OUTPUT_PATH_SIZE);
+	if (lane->current)
+	{
+		memcpy(lane->current->path, path, OUTPUT_PATH_SIZE);
+	}
+	lane->generation++;
+	return 1;
+}
+
+
+/**
+ * write_chunks(<writer>, <chunks>, <count>)
+ *
+ * Writes a batch of chunks that all belong in the same file with writev() (retrying after partial
+ * writes) and appends their entries to the index, then hands the chunks back to the receive side.  The
+ * log lines of the chunks that could not be (completely) written are counted as lost.  Commits the
+ * writer's files if the group-commit policy calls for it.
+ **/
+static void write_chunks(struct output_writer_t *writer, struct output_chunk_t **chunks, unsigned int count)
+{
+	struct output_destination_t *destination;
+	unsigned int i;
+	struct iovec iov[OUTPUT_WRITE_BATCH];
+	uint64_t end = 0;
+	struct iovec *iov_ptr = iov;
+	int syncing;
+	int iov_count = count;
+	off_t length;
+	uint64_t offset;
+	ssize_t written;
+
+	for (i = 0; i < count; i++)
+	{
+		iov[i].iov_base = chunks[i]->output;
+		iov[i].iov_len = chunks[i]->output_length;
+	}
+
+	destination = open_destination(writer, chunks[0]->path, 0);
+	if (destination)
+	{
+		if (! destination->used)
+		{
+			length = lseek(destination->fd, 0, SEEK_END);
+			destination->offset = (length > 0) ? length : 0;
+			if (writer->stream->preallocate)
+			{
+				destination->allocated = destination->offset;
+				destination->offset = data_length(destination);
+			}
+			destination->used = 1;
+			open_index(writer, destination);
+		}
+		destination->last_used = ++writer->clock;
+	}
+	if (destination && writer->stream->preallocate)
+	{
+		end = destination->offset;
+		if (write_mapped(writer->stream, destination, iov, count, &end))
+		{
+			iov_count = 0;
+		}
+	}
+	while (iov_count > 0 && destination && ! writer->stream->preallocate)
+	{
+		written = writev(destination->fd, iov_ptr, iov_count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("output.c writev()");
+			break;
+		}
+		while (iov_count > 0 && (size_t)written >= iov_ptr->iov_len)
+		{
+			written -= iov_ptr->iov_len;
+			iov_ptr++;
+			iov_count--;
+		}
+		if (iov_count > 0)
+		{
+			iov_ptr->iov_base = (char *)iov_ptr->iov_base + written;
+			iov_ptr->iov_len -= written;
+		}
+	}
+
+	offset = destination ? destination->offset : 0;
+	syncing = (iov_count == 0 && (writer->stream->sync_interval || writer->stream->sync_bytes));
+	if (syncing && ! writer->unsynced_bytes)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &writer->unsynced_since);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (iov_count == 0 && destination->index_fd >= 0 && chunks[i]->index_count)
+		{
+			write_index(writer, destination, chunks[i], offset);
+		}
+		if (syncing)
+		{
+			destination->unsynced += chunks[i]->records;
+			writer->unsynced_bytes += chunks[i]->output_length;
+		}
+		if (iov_count > 0 && i >= count - iov_count)
+		{
+			writer->lost += chunks[i]->records;
+		}
+		offset += chunks[i]->output_length;
+		queue_push(&writer->empty, chunks[i]);
+	}
+	if (iov_count == 0)
+	{
+		destination->offset = offset;
+	}
+	else if (destination && writer->stream->preallocate)
+	{
+		destination->offset = end;
+	}
+	else if (destination && (length = lseek(destination->fd, 0, SEEK_END)) >= 0)
+	{
+		destination->offset = length;
+	}
+	if (commit_due(writer))
+	{
+		commit_destinations(writer, NULL);
+	}
+}
+
+
+/**
+ * write_compressed(<writer>)
+ *
+ * Writes out the chunks at the front of the writer's pending queue that have finished compressing,
+ * stopping at the first chunk that is still being compressed so that chunks are always written in the
+ * order in which they were filled.
+ **/
+static void write_compressed(struct output_writer_t *writer)
+{
+	struct output_chunk_t *batch[OUTPUT_WRITE_BATCH];
+	struct output_chunk_t *chunk;
+	unsigned int count = 0;
+
+	while ((chunk = queue_peek(&writer->pending)) && __atomic_load_n(&chunk->ready, __ATOMIC_ACQUIRE))
+	{
+		queue_pop(&writer->pending);
+		if (count && (count == OUTPUT_WRITE_BATCH || strcmp(chunk->path, batch[0]->path)))
+		{
+			write_chunks(writer, batch, count);
+			count = 0;
+		}
+		batch[count++] = chunk;
+	}
+	if (count)
+	{
+		write_chunks(writer, batch, count);
+	}
+}
+
+
+/**
+ * write_index(<writer>, <destination>, <chunk>, <offset>)
+ *
+ * Appends the index entries of a chunk that was written at <offset> in a destination to its index.  A
+ * failed write closes the index rather than leave it inconsistent.
+ **/
+static void write_index(struct output_writer_t *writer, struct output_destination_t *destination, struct output_chunk_t *chunk, uint64_t offset)
+{
+	unsigned char *entry = writer->index_buffer;
+	unsigned int i;
+	size_t length = chunk->index_count * OUTPUT_INDEX_ENTRY_SIZE;
+	ssize_t written;
+
+	for (i = 0; i < chunk->index_count; i++, entry += OUTPUT_INDEX_ENTRY_SIZE)
+	{
+		entry[0] = chunk->index[i].type;
+		entry[1] = 0;
+		encode_le(entry + 2, chunk->index[i].port, 2);
+		memcpy(entry + 4, &chunk->index[i].address, 4);
+		encode_le(entry + 8, chunk->index[i].key, 8);
+		encode_le(entry + 16, offset, 8);
+		encode_le(entry + 24, chunk->index[i].position, 8);
+	}
+
+	entry = writer->index_buffer;
+	while (length)
+	{
+		written = write(destination->index_fd, entry, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("output.c write(index)");
+			close(destination->index_fd);
+			destination->index_fd = -1;
+			return;
+		}
+		entry += written;
+		length -= written;
+	}
+}
+
+
+/**
+ * write_mapped(<stream>, <destination>, <data>, <count>, <end>)
+ *
+ * Copies <count> buffers of data into a preallocated file at <end> through its mapped window, moving
+ * the window along (and extending the file) as necessary, and advances <end> past the data that was
+ * copied.  Returns 1 for success or 0 if the file could not be extended or mapped.
+ **/
+static int write_mapped(struct output_stream_t *stream, struct output_destination_t *destination, const struct iovec *iov, unsigned int count, uint64_t *end)
+{
+	const char *data;
+	unsigned int i;
+	size_t length;
+	size_t room;
+
+	for (i = 0; i < count; i++)
+	{
+		data = iov[i].iov_base;
+		length = iov[i].iov_len;
+		while (length)
+		{
+			if (! destination->map || *end < destination->map_offset || *end >= destination->map_offset + OUTPUT_MAP_WINDOW)
+			{
+				if (! map_window(stream, destination, *end))
+				{
+					return 0;
+				}
+			}
+			room = destination->map_offset + OUTPUT_MAP_WINDOW - *end;
+			if (room > length)
+			{
+				room = length;
+			}
+			memcpy(destination->map + (*end - destination->map_offset), data, room);
+			data += room;
+			length -= room;
+			*end += room;
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * writer_main(<writer>)
+ *
+ * Main loop of a writer thread.  Wakes up whenever chunks are handed over or finish compressing (and
+ * at least once a second to look ahead for the next files, or sooner when a commit falls due), reopens
+ * its files if that was requested, writes out every waiting chunk, commits its files when the group-
+ * commit policy calls for it and exits (committing and closing its files) once the stream is closed
+ * and everything has been written.
+ **/
+static void *writer_main(void *argument)
+{
+	struct timespec deadline;
+	uint64_t elapsed;
+	uint64_t wait = 1000000;
+	struct output_writer_t *writer = argument;
+
+	while (1)
+	{
+		if (writer->unsynced_bytes && writer->stream->sync_interval)
+		{
+			elapsed = microseconds_since(&writer->unsynced_since);
+			wait = (elapsed < writer->stream->sync_interval * 1000ULL) ? writer->stream->sync_interval * 1000ULL - elapsed : 0;
+			if (wait > 1000000)
+			{
+				wait = 1000000;
+			}
+		}
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (wait % 1000000) * 1000;
+		deadline.tv_sec += wait / 1000000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		wait = 1000000;
+		while (sem_timedwait(&writer->ready, &deadline) && errno == EINTR);
+
+		if (__atomic_exchange_n(&writer->reopen, 0, __ATOMIC_ACQ_REL))
+		{
+			close_destinations(writer);
+		}
+		drain_chunks(writer);
+		if (commit_due(writer))
+		{
+			commit_destinations(writer, NULL);
+		}
+		if (__atomic_load_n(&writer->stream->stopping, __ATOMIC_ACQUIRE))
+		{
+			drain_chunks(writer);
+			while (queue_peek(&writer->pending))
+			{
+				while (sem_wait(&writer->ready) && errno == EINTR);
+				write_compressed(writer);
+			}
+			break;
+		}
+		prepare_destinations(writer);
+	}
+
+	close_destinations(writer);
+	return NULL;
+}
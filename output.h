@@ -0,0 +1,321 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/*
+ * Buffered, asynchronous output stream.  Formatted log lines are appended to large, page-aligned
+ * chunks by the receive path; filled chunks are handed to a dedicated writer thread through a
+ * lock-free single-producer/single-consumer queue and returned (empty) through a second one.  The
+ * chunks are allocated once, up front, so the memory used for buffering is bounded: if the writer
+ * falls so far behind that every chunk is in flight, log lines are dropped (and counted) rather than
+ * blocking the receive path.
+ *
+ * The writer thread owns every file descriptor.  Each chunk is tagged with the path that its data
+ * belongs in (the strftime(3) expansion of the destination format at the time of the records in it),
+ * and the writer opens and closes files as the path changes.  The file that the next rotation will
+ * need is opened ahead of time, so the switch itself costs nothing, and a reopen (for log rotation
+ * with SIGHUP) is only flagged by the receive path.  The receive path never touches the filesystem.
+ *
+ * Files may be preallocated: each one is then extended with posix_fallocate() OUTPUT_MAP_WINDOW-aligned
+ * steps of many megabytes at a time (so that the filesystem allocates large extents instead of a
+ * little more space for every write) and written through a sliding shared mapping of
+ * OUTPUT_MAP_WINDOW bytes instead of with writev().  A file is truncated to the length of its data
+ * when the writer closes it (on rotation, reopen or exit), so until then (or after a crash) it ends
+ * in a zero-filled tail.  When a preallocated file is reopened the writer carries on after its last
+ * non-zero byte, so preallocation is only for data that never ends in a NUL byte (such as text lines).
+ *
+ * Durability can follow a group-commit policy: each writer calls fdatasync() on the files it has
+ * written to once the oldest data it has not synced is a given number of milliseconds old, or once
+ * it has written a given number of bytes since its last sync, whichever comes first.  One sync thus
+ * covers every log line written in between (and a crash loses at most that much), without a sync per
+ * line.  The writers count the log lines that are confirmed durable and keep a histogram of commit
+ * latencies (in power-of-two microsecond buckets), both reported when the stream is closed.
+ *
+ * Output may optionally be gzip-compressed.  Each chunk is then compressed by one of a pool of
+ * compressor threads into a complete gzip member of its own (concatenated members form a valid gzip
+ * file), so every chunk can be decoded independently and a crash loses at most the chunks that were
+ * in flight.  The writer still writes the chunks out in the order in which they were filled.
+ *
+ * Output may be split into lanes (for example one per log tag or per source host), each with its own
+ * destination format and its own chunk being filled, so that interleaved log lines for different
+ * files do not cut each other's chunks short.  The stream can have a pool of writer threads, each with
+ * its own share of the chunks and its own set of open files; every lane is assigned to one writer by
+ * a hash of its destination format, so a lane is always written by the same writer (and the order of
+ * its data is kept) while different lanes are written in parallel.  Without lanes of its own a stream
+ * has a single, default lane (and only needs one writer).  Lanes are found by a hash table of their
+ * formats, and a lane that has not been written to for OUTPUT_LANE_IDLE seconds can be retired (see
+ * output_retire()), handing back its chunk, so that lanes for short-lived sources (such as a new
+ * source port per client) do not pile up or keep the writers' chunks pinned.
+ *
+ * Each output file may also get a sidecar index (the file name with ".idx" appended) that maps the
+ * first log line of each second, and periodic per-source serial numbers, to positions in the file.
+ * The receive path records index entries against positions within a chunk; the writer translates
+ * them into file positions once it knows where the chunk was written.  The index file starts with
+ * the 8 bytes OUTPUT_INDEX_MAGIC, followed by 32-byte little-endian entries:
+ *
+ *   offset  size  field
+ *        0     1  type (OUTPUT_INDEX_TIME or OUTPUT_INDEX_SERIAL)
+ *        1     1  reserved (0)
+ *        2     2  source port (serial entries)
+ *        4     4  source IPv4 address, in network byte order (serial entries)
+ *        8     8  key: the timestamp (seconds since the epoch) or the serial number
+ *       16     8  the position in the file of the chunk that holds the log line
+ *       24     8  the position of the log line within the (uncompressed) data of that chunk
+ *
+ * For an uncompressed file the log line starts at the sum of the two positions; for a compressed
+ * file the first position is the start of a gzip member and the second is the number of bytes to
+ * skip in its decompressed data.
+ *
+ * OUTPUT_CHUNK_SIZE        The size (bytes) of each chunk.
+ * OUTPUT_DEFAULT_MEMORY    The default memory budget (bytes) for chunks (and their compressed copies).
+ * OUTPUT_DEFAULT_COMPRESSORS  The default number of compressor threads.
+ * OUTPUT_INDEX_ENTRIES     The maximum number of index entries per chunk (further entries are dropped;
+ *                          the index is only ever sparser for it).
+ * OUTPUT_LANE_BUCKETS      The number of buckets of the hash table of lanes.
+ * OUTPUT_LANE_IDLE         How long (seconds) a lane must go unused before output_retire() retires it.
+ * OUTPUT_LOOKAHEAD         How far ahead (seconds) the writer looks for the next file to open.
+ * OUTPUT_MAP_WINDOW        The size (bytes) of the mapping that preallocated files are written through
+ *                          (preallocation sizes are rounded up to a multiple of it).
+ * OUTPUT_OPEN_FILES        The number of files that each writer keeps open (the least recently
+ *                          written one is closed to make room for another).
+ * OUTPUT_PATH_SIZE         The maximum length (including the terminating NUL) of a destination path.
+ * OUTPUT_SYNC_BUCKETS      The number of buckets of the commit latency histogram (bucket i counts
+ *                          commits that took from 2^i to 2^(i+1) microseconds; bucket 0 also counts
+ *                          faster ones, the last bucket slower ones).
+ */
+#define OUTPUT_CHUNK_SIZE     (256U * 1024U)
+#define OUTPUT_DEFAULT_MEMORY (64UL * 1024UL * 1024UL)
+#define OUTPUT_DEFAULT_COMPRESSORS 2U
+#define OUTPUT_INDEX_ENTRIES  1024U
+#define OUTPUT_LANE_BUCKETS   4096U
+#define OUTPUT_LANE_IDLE      300
+#define OUTPUT_LOOKAHEAD      60
+#define OUTPUT_MAP_WINDOW     (1024U * 1024U)
+#define OUTPUT_OPEN_FILES     16
+#define OUTPUT_PATH_SIZE      513U
+#define OUTPUT_SYNC_BUCKETS   32
+
+#define OUTPUT_INDEX_MAGIC    "UDPLIDX1"
+#define OUTPUT_INDEX_TIME     1
+#define OUTPUT_INDEX_SERIAL   2
+
+
+/*
+ * An index entry, as recorded by the receive path (position is relative to the start of the chunk).
+ */
+struct output_index_entry_t {
+	unsigned char type;
+	in_port_t port;
+	in_addr_t address;
+	uint64_t key;
+	size_t position;
+};
+
+
+/*
+ * A chunk of buffered output; data is OUTPUT_CHUNK_SIZE bytes long, of which length are used.  output
+ * and output_length describe the bytes that are actually written (data itself, or its compressed copy
+ * in compressed), and ready is set once they are available.  index holds index_count entries (if the
+ * stream is indexed).  records is the number of log lines in the chunk and writer is the writer
+ * that the chunk belongs to.
+ */
+struct output_chunk_t {
+	char *data;
+	size_t length;
+	char path[OUTPUT_PATH_SIZE];
+	struct output_index_entry_t *index;
+	unsigned int index_count;
+	char *compressed;
+	char *output;
+	size_t output_length;
+	int ready;
+	uintmax_t records;
+	struct output_writer_t *writer;
+};
+
+
+/*
+ * Single-producer/single-consumer queue of chunks.  slots has room for every chunk of the stream,
+ * so the queue can never overflow.  head is only written by the consumer and tail only by the
+ * producer.
+ */
+struct output_queue_t {
+	struct output_chunk_t **slots;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+};
+
+
+/*
+ * A file that a writer has open.  offset is the length of its data and index_fd its index (or -1).
+ * created is set if the file was created when it was opened ahead of time (so that it can be removed
+ * again if it is never used), used once data has been written to it, and last_used orders the files
+ * for closing.  If the file is preallocated, allocated is its actual length and map is the window of
+ * it (starting at map_offset) that is mapped, or NULL.  unsynced counts the log lines written to the
+ * file since it was last synced.  An unused slot has an fd of -1.
+ */
+struct output_destination_t {
+	int fd;
+	char path[OUTPUT_PATH_SIZE];
+	uint64_t offset;
+	int index_fd;
+	int created;
+	int used;
+	unsigned long last_used;
+	uint64_t allocated;
+	char *map;
+	uint64_t map_offset;
+	uintmax_t unsynced;
+};
+
+
+/*
+ * A writer thread.  filled and empty are the queues of its chunks to and from the writer, ready is
+ * posted whenever there is something for it to do and reopen is a request flag.  The rest is only
+ * used by the writer itself: pending holds the chunks that are being compressed, in the order in
+ * which they must be written, destinations are its open files (clock orders their use) and
+ * index_buffer is used to encode index entries.  unsynced_bytes is the amount of data written since
+ * the last commit, the first of which was written at unsynced_since (CLOCK_MONOTONIC); durable counts
+ * the log lines that have been synced and latencies is the histogram of commit latencies.  lost counts
+ * the log lines of the chunks that could not be written out.
+ */
+struct output_writer_t {
+	struct output_stream_t *stream;
+	struct output_queue_t filled;
+	struct output_queue_t empty;
+	sem_t ready;
+	int reopen;
+	pthread_t thread;
+
+	struct output_queue_t pending;
+	struct output_destination_t destinations[OUTPUT_OPEN_FILES];
+	unsigned long clock;
+	unsigned char *index_buffer;
+
+	uint64_t unsynced_bytes;
+	struct timespec unsynced_since;
+	uintmax_t durable;
+	uintmax_t latencies[OUTPUT_SYNC_BUCKETS];
+	uintmax_t lost;
+};
+
+
+/*
+ * A lane (receive side, apart from format and writer, which never change).  current is the chunk
+ * being filled (or NULL) and path is the destination that new data belongs in, the expansion of
+ * format (NULL for stdout) at the time set with output_set_time().  generation counts the changes of
+ * path, index_time is set when the next log line should get a time index entry and used is the time
+ * of the stream when the lane was last written to.  hash is the hash of format and bucket_next links
+ * the lanes of the same bucket of the hash table.
+ */
+struct output_lane_t {
+	char *format;
+	struct output_writer_t *writer;
+	struct output_chunk_t *current;
+	char path[OUTPUT_PATH_SIZE];
+	uintmax_t generation;
+	int index_time;
+	time_t used;
+	uint32_t hash;
+	struct output_lane_t *bucket_next;
+	struct output_lane_t *next;
+};
+
+
+/*
+ * State of an output stream.
+ *
+ * Receive side:  lane is the lane that output_reserve() and friends work on (the default lane unless
+ *                another one has been selected), lanes is the list of every lane and lane_table the
+ *                hash table of them, timestamp/tm is the time that was last set and dropped counts
+ *                the log lines that were discarded for lack of a free chunk.  The writers also walk
+ *                lanes (holding lanes_mutex), so lanes are only ever added at its head and are only
+ *                unlinked from it by output_retire() while it holds lanes_mutex, which the receive
+ *                side only ever tries to take.
+ * Shared:        stopping is a request flag; writers are the writer threads (of which writers_started
+ *                have been started) and preallocate is the step (bytes) in which files are
+ *                preallocated (0 to write them with writev()).
+ *                sync_interval (milliseconds) and sync_bytes are the group-commit policy (0 for no
+ *                limit; both 0 to never sync).
+ * Compression:   compression_level is the gzip level (0 for no compression); jobs is the queue of
+ *                chunks waiting for one of the compressors, protected by jobs_mutex.
+ */
+struct output_stream_t {
+	struct output_lane_t *lane;
+	struct output_lane_t *lanes;
+	struct output_lane_t *lane_table[OUTPUT_LANE_BUCKETS];
+	pthread_mutex_t lanes_mutex;
+	time_t timestamp;
+	struct tm tm;
+	uintmax_t dropped;
+
+	int stopping;
+	struct output_writer_t *writers;
+	unsigned int writer_count;
+	unsigned int writers_started;
+
+	int compression_level;
+	pthread_t *compressors;
+	unsigned int compressor_count;
+	struct output_queue_t jobs;
+	pthread_mutex_t jobs_mutex;
+	pthread_cond_t jobs_available;
+	int jobs_stopping;
+
+	struct output_chunk_t *chunks;
+	unsigned int chunk_count;
+	char *format;
+	int indexed;
+	size_t preallocate;
+	unsigned long sync_interval;
+	uint64_t sync_bytes;
+};
+
+
+void output_close(struct output_stream_t *);
+void output_commit(struct output_stream_t *, size_t, uintmax_t);
+void output_discard(struct output_stream_t *, uintmax_t);
+void output_flush(struct output_stream_t *);
+void output_index(struct output_stream_t *, unsigned char, const struct sockaddr_in *, uint64_t);
+struct output_lane_t *output_lane(struct output_stream_t *, const char *);
+struct output_stream_t *output_open(const char *, size_t, int, unsigned int, int, unsigned int, size_t, unsigned long, uint64_t);
+int output_path_changes(struct output_stream_t *, const struct tm *);
+void output_reopen(struct output_stream_t *);
+char *output_reserve(struct output_stream_t *, size_t);
+unsigned int output_retire(struct output_stream_t *);
+void output_select(struct output_stream_t *, struct output_lane_t *);
+int output_set_time(struct output_stream_t *, time_t, const struct tm *);
+
+#endif
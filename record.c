@@ -0,0 +1,248 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#include <string.h>
+#include "udplogger.h"
+#include "record.h"
+
+
+/*
+ * The names of each field (indexed by enum log_field_t).
+ */
+const char *record_field_names[FIELD_COUNT] =
+{
+	"serial",
+	"tag",
+	"version",
+	"method",
+	"status",
+	"body_size",
+	"bytes_incoming",
+	"bytes_outgoing",
+	"time_used",
+	"connection_status",
+	"request_url",
+	"query_string",
+	"remote_address",
+	"host",
+	"user_agent",
+	"forwarded_for",
+	"referer",
+	"content_type",
+	"nexopia_userid",
+	"nexopia_userage",
+	"nexopia_usersex",
+	"nexopia_userlocation",
+	"nexopia_usertype"
+};
+
+
+/*
+ * The position of each field (indexed by enum log_field_t) within version 1 and version 2
+ * log data payloads.  Fields that are not part of the payload (or of that version of it)
+ * are marked with -1.
+ */
+static const signed char v1_payload_index[FIELD_COUNT] =
+{
+	-1, -1, -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, 16, 17
+};
+static const signed char v2_payload_index[FIELD_COUNT] =
+{
+	-1, -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20
+};
+
+
+static void split_payload(struct log_record_t *, size_t);
+
+/**
+ * parse_record(<record>)
+ *
+ * Utility function that splits the data of the given record into its serial, tag and payload
+ * fields (as per the log packet format described in udplogger.h), filling in the offset and length
+ * of each.  The data and length members of the record must already be set.  Returns 1 if the record
+ * was well-formed, or 0 if it was not (in which case the whole of the data is taken to be the payload).
+ **/
+int parse_record(struct log_record_t *record)
+{
+	char *end = record->data + record->length;
+	char *serial_end;
+	char *tag_end;
+
+	serial_end = memchr(record->data, DELIMITER_CHARACTER, record->length);
+	if (serial_end)
+	{
+		tag_end = memchr(serial_end + 1, DELIMITER_CHARACTER, end - (serial_end + 1));
+		if (tag_end)
+		{
+			record->serial_offset = 0;
+			record->serial_length = serial_end - record->data;
+			record->tag_offset = record->serial_length + 1;
+			record->tag_length = tag_end - (serial_end + 1);
+			record->payload_offset = (tag_end + 1) - record->data;
+			record->payload_length = end - (tag_end + 1);
+			record->version = 0;
+			record->fields_complete = 0;
+			record->field_count = 0;
+			return 1;
+		}
+	}
+
+	record->serial_offset = 0;
+	record->serial_length = 0;
+	record->tag_offset = 0;
+	record->tag_length = 0;
+	record->payload_offset = 0;
+	record->payload_length = record->length;
+	record->version = 0;
+	record->fields_complete = 0;
+	record->field_count = 0;
+	return 0;
+}
+
+
+/**
+ * record_field(<record>, <field>, <offset pointer>, <length pointer>)
+ *
+ * Utility function that finds the given field of a record that has been through parse_record, storing
+ * its offset (into the record data) and length.  Payload fields are split on demand, so looking up an
+ * early field does not scan the rest of the line.  Returns 1 if the field was found or 0 if the record
+ * does not have that field.
+ **/
+int record_field(struct log_record_t *record, enum log_field_t field, size_t *offset, size_t *length)
+{
+	size_t index;
+	signed char payload_index;
+
+	if (field == FIELD_SERIAL)
+	{
+		*offset = record->serial_offset;
+		*length = record->serial_length;
+		return 1;
+	}
+	if (field == FIELD_TAG)
+	{
+		*offset = record->tag_offset;
+		*length = record->tag_length;
+		return 1;
+	}
+
+	if (! record->version)
+	{
+		split_payload(record, 0);
+		record->version = 1;
+		if (record->field_count > 1 && record->field_offsets[1] - record->field_offsets[0] == 3 && ! memcmp(record->data + record->field_offsets[0], "v2", 2))
+		{
+			record->version = 2;
+		}
+	}
+
+	if (record->version == 2)
+	{
+		payload_index = v2_payload_index[field];
+	}
+	else
+	{
+		payload_index = v1_payload_index[field];
+	}
+	if (payload_index < 0)
+	{
+		return 0;
+	}
+	index = payload_index;
+
+	split_payload(record, index);
+	if (index >= record->field_count)
+	{
+		return 0;
+	}
+
+	*offset = record->field_offsets[index];
+	if (index + 1 < record->field_count)
+	{
+		*length = record->field_offsets[index + 1] - 1 - *offset;
+	}
+	else
+	{
+		*length = record->payload_offset + record->payload_length - *offset;
+	}
+	return 1;
+}
+
+
+/**
+ * record_field_lookup(<field name>)
+ *
+ * Utility function that maps a field name (as per record_field_names) to its enum log_field_t
+ * identifier.  Returns -1 if the name is not a known field.
+ **/
+int record_field_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < FIELD_COUNT; i++)
+	{
+		if (! strcmp(name, record_field_names[i]))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * split_payload(<record>, <index>)
+ *
+ * Extends the split of the record payload until the start of field <index + 1> is known (so that both
+ * the start and the end of field <index> are known), or until the end of the payload is reached.
+ **/
+static void split_payload(struct log_record_t *record, size_t index)
+{
+	char *end = record->data + record->payload_offset + record->payload_length;
+	char *next;
+
+	if (record->field_count == 0)
+	{
+		record->field_offsets[0] = record->payload_offset;
+		record->field_count = 1;
+	}
+
+	while ((! record->fields_complete) && record->field_count <= index + 1)
+	{
+		if (record->field_count > RECORD_PAYLOAD_FIELDS_MAXIMUM)
+		{
+			record->fields_complete = 1;
+			break;
+		}
+		next = record->data + record->field_offsets[record->field_count - 1];
+		next = memchr(next, DELIMITER_CHARACTER, end - next);
+		if (! next)
+		{
+			record->fields_complete = 1;
+			break;
+		}
+		record->field_offsets[record->field_count] = (next + 1) - record->data;
+		record->field_count++;
+	}
+}
@@ -0,0 +1,110 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+
+/*
+ * Identifiers for the individual fields of a log record: the serial and tag fields of the log packet
+ * followed by the fields of the log data payload (see the accesslog.format strings in udplogger.h).  The
+ * names match the attributes of Nexopia.UDPLogger.Parse.LogLine.  Version 1 payloads do not carry the
+ * version, host or content_type fields.
+ */
+enum log_field_t {
+	FIELD_SERIAL,
+	FIELD_TAG,
+	FIELD_VERSION,
+	FIELD_METHOD,
+	FIELD_STATUS,
+	FIELD_BODY_SIZE,
+	FIELD_BYTES_INCOMING,
+	FIELD_BYTES_OUTGOING,
+	FIELD_TIME_USED,
+	FIELD_CONNECTION_STATUS,
+	FIELD_REQUEST_URL,
+	FIELD_QUERY_STRING,
+	FIELD_REMOTE_ADDRESS,
+	FIELD_HOST,
+	FIELD_USER_AGENT,
+	FIELD_FORWARDED_FOR,
+	FIELD_REFERER,
+	FIELD_CONTENT_TYPE,
+	FIELD_NEXOPIA_USERID,
+	FIELD_NEXOPIA_USERAGE,
+	FIELD_NEXOPIA_USERSEX,
+	FIELD_NEXOPIA_USERLOCATION,
+	FIELD_NEXOPIA_USERTYPE,
+	FIELD_COUNT
+};
+
+
+/* The number of fields in a complete log data payload of each version, and the larger of the two. */
+#define RECORD_PAYLOAD_FIELDS_V1 18
+#define RECORD_PAYLOAD_FIELDS_V2 21
+#define RECORD_PAYLOAD_FIELDS_MAXIMUM RECORD_PAYLOAD_FIELDS_V2
+
+
+/*
+ * A view onto a single log record as received from a udploggerd host.  The record is
+ * pre-split into its serial, tag and payload (log data) fields; each field is described by
+ * an offset into data and a length.  None of the fields (nor data itself) are guaranteed to
+ * be NUL-terminated, so the lengths must always be used.  A record view and the data that it
+ * points at are only valid for the duration of the hook call that it is passed to.
+ */
+struct log_record_t {
+	struct sockaddr_in source;
+	struct timeval received;
+	char *data;
+	size_t length;
+	size_t serial_offset;
+	size_t serial_length;
+	size_t tag_offset;
+	size_t tag_length;
+	size_t payload_offset;
+	size_t payload_length;
+
+	/*
+	 * Payload fields are split lazily (and only as far as needed) by record_field(); these
+	 * members track how far the split has progressed and are reset by parse_record().
+	 */
+	unsigned char version;
+	unsigned char fields_complete;
+	size_t field_count;
+	size_t field_offsets[RECORD_PAYLOAD_FIELDS_MAXIMUM + 1];
+};
+
+
+extern const char *record_field_names[FIELD_COUNT];
+
+
+int parse_record(struct log_record_t *);
+int record_field(struct log_record_t *, enum log_field_t, size_t *, size_t *);
+int record_field_lookup(const char *);
+
+#endif
@@ -0,0 +1,295 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "record.h"
+#include "ring.h"
+
+
+/*
+ * Ring geometry.  Each block must be able to hold the largest (reassembled) log datagram; the kernel
+ * hands a block over once it is full or RING_BLOCK_TIMEOUT milliseconds after its first packet arrived,
+ * which bounds the latency that the ring adds.
+ *
+ * RING_BLOCK_COUNT                      The number of blocks in the ring.
+ * RING_BLOCK_SIZE                       The size of each block (a multiple of the page size).
+ * RING_BLOCK_TIMEOUT                    The block retire timeout (milliseconds).
+ * RING_FRAME_SIZE                       The nominal frame size (only used to size the ring with TPACKET_V3).
+ */
+#define RING_BLOCK_COUNT                 16U
+#define RING_BLOCK_SIZE                  (1U << 20)
+#define RING_BLOCK_TIMEOUT               10U
+#define RING_FRAME_SIZE                  2048U
+
+
+/**
+ * ring_close(<ring>)
+ *
+ * Unmaps and closes the given ring.
+ **/
+void ring_close(struct packet_ring_t *ring)
+{
+	if (ring->map && munmap(ring->map, ring->map_length))
+	{
+		perror("ring.c munmap()");
+	}
+	if (close(ring->fd))
+	{
+		perror("ring.c close()");
+	}
+	free(ring);
+}
+
+
+/**
+ * ring_open(<interface>, <port>)
+ *
+ * Creates a TPACKET_V3 receive ring on the given interface ("any" for all interfaces) that captures
+ * the UDP datagrams sent to the given local port.  A classic BPF filter attached to the socket makes
+ * the kernel drop all other traffic before it reaches the ring, and the socket is made the only member
+ * of a defragmenting fanout group so that log lines which were fragmented on the wire arrive whole.
+ * Returns the ring, or NULL if the ring could not be set up (most commonly because the process does
+ * not have CAP_NET_RAW) in which case the caller should fall back to reading the UDP socket.
+ **/
+struct packet_ring_t *ring_open(const char *interface, uint16_t port)
+{
+	struct sock_filter code[] =
+	{
+		/* Accept only unfragmented UDP datagrams (offsets are relative to the IP header). */
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 9),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 6),
+		BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 6),
+		BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x3fff, 4, 0),
+		/* ...that are addressed to our port. */
+		BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+		BPF_STMT(BPF_LD + BPF_H + BPF_IND, 2),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, port, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, 0x40000),
+		BPF_STMT(BPF_RET + BPF_K, 0)
+	};
+	struct sockaddr_ll address;
+	int fanout;
+	struct sock_fprog program;
+	struct packet_ring_t *ring;
+	struct tpacket_req3 request;
+	int value;
+
+	ring = calloc(1, sizeof(struct packet_ring_t));
+	if (! ring)
+	{
+		perror("ring.c calloc(ring)");
+		return NULL;
+	}
+
+	ring->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (ring->fd < 0)
+	{
+		perror("ring.c socket(AF_PACKET)");
+		free(ring);
+		return NULL;
+	}
+
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+	if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)))
+	{
+		perror("ring.c setsockopt(SO_ATTACH_FILTER)");
+		ring_close(ring);
+		return NULL;
+	}
+
+	value = TPACKET_V3;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &value, sizeof(value)))
+	{
+		perror("ring.c setsockopt(PACKET_VERSION)");
+		ring_close(ring);
+		return NULL;
+	}
+
+#ifdef PACKET_IGNORE_OUTGOING
+	/* Not fatal; outgoing packets are also skipped in ring_receive. */
+	value = 1;
+	setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &value, sizeof(value));
+#endif
+
+	memset(&request, 0, sizeof(request));
+	request.tp_block_size = RING_BLOCK_SIZE;
+	request.tp_block_nr = RING_BLOCK_COUNT;
+	request.tp_frame_size = RING_FRAME_SIZE;
+	request.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_COUNT;
+	request.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)))
+	{
+		perror("ring.c setsockopt(PACKET_RX_RING)");
+		ring_close(ring);
+		return NULL;
+	}
+
+	ring->block_count = RING_BLOCK_COUNT;
+	ring->block_size = RING_BLOCK_SIZE;
+	ring->map_length = (size_t)RING_BLOCK_COUNT * RING_BLOCK_SIZE;
+	ring->map = mmap(NULL, ring->map_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+	if (ring->map == MAP_FAILED)
+	{
+		/* MAP_LOCKED can fail under RLIMIT_MEMLOCK; the ring works without it. */
+		ring->map = mmap(NULL, ring->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	}
+	if (ring->map == MAP_FAILED)
+	{
+		perror("ring.c mmap()");
+		ring->map = NULL;
+		ring_close(ring);
+		return NULL;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sll_family = AF_PACKET;
+	address.sll_protocol = htons(ETH_P_IP);
+	if (strcmp(interface, "any"))
+	{
+		address.sll_ifindex = if_nametoindex(interface);
+		if (! address.sll_ifindex)
+		{
+			fprintf(stderr, "ring.c unknown interface '%s'\n", interface);
+			ring_close(ring);
+			return NULL;
+		}
+	}
+	if (bind(ring->fd, (struct sockaddr *)&address, sizeof(address)))
+	{
+		perror("ring.c bind()");
+		ring_close(ring);
+		return NULL;
+	}
+
+	fanout = (getpid() & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)))
+	{
+		perror("ring.c setsockopt(PACKET_FANOUT)");
+		fprintf(stderr, "ring.c fragmented log lines will not be received\n");
+	}
+
+#ifdef __DEBUG__
+	printf("ring.c debug: created ring on fd %d (%u blocks of %u bytes) for %s port %hu\n", ring->fd, ring->block_count, ring->block_size, interface, port);
+#endif
+
+	return ring;
+}
+
+
+/**
+ * ring_receive(<ring>, <callback>, <callback argument>)
+ *
+ * Walks every block that the kernel has handed over to us, passing record views of the log datagrams
+ * in it to the callback (in batches of up to RING_BATCH_SIZE), then returns the blocks to the kernel.
+ * Records point straight into the ring (nothing is copied) and so are only valid until the callback
+ * returns.
+ **/
+void ring_receive(struct packet_ring_t *ring, void (*callback)(struct log_record_t *, size_t, void *), void *argument)
+{
+	struct tpacket_block_desc *block;
+	size_t count;
+	struct tpacket3_hdr *header;
+	struct iphdr *ip;
+	struct sockaddr_ll *link;
+	uint32_t i;
+	struct log_record_t *record;
+	size_t udp_length;
+	struct udphdr *udp;
+
+	while (1)
+	{
+		block = (struct tpacket_block_desc *)(ring->map + (size_t)ring->current_block * ring->block_size);
+		if (! (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+		{
+			break;
+		}
+
+		count = 0;
+		header = (struct tpacket3_hdr *)((char *)block + block->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < block->hdr.bh1.num_pkts; i++, header = (struct tpacket3_hdr *)((char *)header + header->tp_next_offset))
+		{
+			link = (struct sockaddr_ll *)((char *)header + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			if (link->sll_pkttype == PACKET_OUTGOING)
+			{
+				continue;
+			}
+
+			ip = (struct iphdr *)((char *)header + header->tp_net);
+			if (header->tp_snaplen < sizeof(struct iphdr) || header->tp_snaplen < ip->ihl * 4U + sizeof(struct udphdr))
+			{
+				continue;
+			}
+			udp = (struct udphdr *)((char *)ip + ip->ihl * 4U);
+			udp_length = ntohs(udp->len);
+			if (udp_length < sizeof(struct udphdr) || ip->ihl * 4U + udp_length > header->tp_snaplen)
+			{
+				continue;
+			}
+
+			record = &ring->records[count];
+			record->source.sin_family = AF_INET;
+			record->source.sin_addr.s_addr = ip->saddr;
+			record->source.sin_port = udp->source;
+			record->received.tv_sec = header->tp_sec;
+			record->received.tv_usec = header->tp_nsec / 1000;
+			record->data = (char *)udp + sizeof(struct udphdr);
+			record->length = udp_length - sizeof(struct udphdr);
+			/* udploggerd includes the terminating NUL in each packet; it is not part of the record. */
+			while (record->length > 0 && record->data[record->length - 1] == '\0')
+			{
+				record->length--;
+			}
+
+			count++;
+			if (count == RING_BATCH_SIZE)
+			{
+				callback(ring->records, count, argument);
+				count = 0;
+			}
+		}
+		if (count)
+		{
+			callback(ring->records, count, argument);
+		}
+
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		ring->current_block = (ring->current_block + 1) % ring->block_count;
+	}
+}
@@ -0,0 +1,59 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "record.h"
+
+
+/*
+ * State of a memory-mapped (PACKET_MMAP, TPACKET_V3) receive ring.
+ *
+ * fd             is the AF_PACKET socket that the ring belongs to (readable whenever a block is ready).
+ * map            is the start of the ring mapping, map_length is its length.
+ * block_count    is the number of blocks in the ring, each block_size bytes long.
+ * current_block  is the index of the next block that the kernel will hand to us.
+ * records        is used to collect the record views of a block into batches.
+ */
+#define RING_BATCH_SIZE 64
+
+struct packet_ring_t {
+	int fd;
+	char *map;
+	size_t map_length;
+	unsigned int block_count;
+	unsigned int block_size;
+	unsigned int current_block;
+	struct log_record_t records[RING_BATCH_SIZE];
+};
+
+
+void ring_close(struct packet_ring_t *);
+struct packet_ring_t *ring_open(const char *, uint16_t);
+void ring_receive(struct packet_ring_t *, void (*)(struct log_record_t *, size_t, void *), void *);
+
+#endif
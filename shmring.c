@@ -0,0 +1,492 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "record.h"
+#include "shmring.h"
+
+
+/*
+ * SHM_RING_MINIMUM_SIZE    The smallest ring (bytes); sizes are rounded up to a power of two.
+ * SHM_RING_RECORD_MAXIMUM  The largest record (bytes of data) that is published; larger ones are
+ *                          dropped (and counted in the header).
+ */
+#define SHM_RING_MINIMUM_SIZE   (1024UL * 1024UL)
+#define SHM_RING_RECORD_MAXIMUM 65536U
+
+
+static int map_ring(struct shm_ring_t *, int);
+static int open_object(const char *, int);
+static void resynchronize(struct shm_ring_t *);
+static void unmap_ring(struct shm_ring_t *);
+
+
+/**
+ * map_ring(<ring>, <writable>)
+ *
+ * Maps (or, if the ring has changed size, remaps) the shared memory object of the ring.  Returns 1 for
+ * success or 0 for failure, in which case the ring is left unmapped.
+ **/
+static int map_ring(struct shm_ring_t *ring, int writable)
+{
+	struct stat object;
+
+	unmap_ring(ring);
+	if (fstat(ring->fd, &object))
+	{
+		perror("shmring.c fstat()");
+		return 0;
+	}
+	if (object.st_size <= SHM_RING_HEADER_SIZE)
+	{
+		fprintf(stderr, "shmring.c shared memory object is not a record ring\n");
+		return 0;
+	}
+	ring->map_length = object.st_size;
+	ring->map = mmap(NULL, ring->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED)
+	{
+		perror("shmring.c mmap()");
+		ring->map = NULL;
+		return 0;
+	}
+	ring->header = (struct shm_ring_header_t *)ring->map;
+	ring->ring = ring->map + SHM_RING_HEADER_SIZE;
+	ring->size = ring->map_length - SHM_RING_HEADER_SIZE;
+	if (! writable && (memcmp(ring->header->magic, SHM_RING_MAGIC, 8) || __atomic_load_n(&ring->header->size, __ATOMIC_ACQUIRE) != ring->size))
+	{
+		fprintf(stderr, "shmring.c shared memory object is not a record ring\n");
+		unmap_ring(ring);
+		return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * open_object(<name>, <flags>)
+ *
+ * Opens the shared memory object <name> (a leading '/' is added if it has none).  Returns the
+ * descriptor, or -1 on failure.
+ **/
+static int open_object(const char *name, int flags)
+{
+	int fd;
+	char path[NAME_MAX + 1];
+
+	if (snprintf(path, sizeof(path), "%s%s", (name[0] == '/') ? "" : "/", name) >= (int)sizeof(path))
+	{
+		fprintf(stderr, "shmring.c ring name '%s' is too long\n", name);
+		return -1;
+	}
+	fd = shm_open(path, flags | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		perror("shmring.c shm_open()");
+		fprintf(stderr, "shmring.c could not open ring '%s'\n", path);
+	}
+	return fd;
+}
+
+
+/**
+ * resynchronize(<ring>)
+ *
+ * Moves a reader to the end of the published data (when it is opened, after an overrun, or when the
+ * ring has been reset).  After an overrun the sequence number of the next record is kept, so that the
+ * records that were skipped are counted when the next one is read; otherwise it is taken from the
+ * header (after head, so that it is never behind the record at head).
+ **/
+static void resynchronize(struct shm_ring_t *ring)
+{
+	uint64_t epoch;
+
+	epoch = __atomic_load_n(&ring->header->epoch, __ATOMIC_ACQUIRE);
+	ring->cursor = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+	if (epoch != ring->epoch)
+	{
+		ring->epoch = epoch;
+		ring->sequence = __atomic_load_n(&ring->header->records, __ATOMIC_ACQUIRE);
+	}
+}
+
+
+/**
+ * shm_ring_close(<ring>)
+ *
+ * Unmaps and closes the given ring (the shared memory object itself is left in place).
+ **/
+void shm_ring_close(struct shm_ring_t *ring)
+{
+	unmap_ring(ring);
+	if (ring->fd >= 0 && close(ring->fd))
+	{
+		perror("shmring.c close()");
+	}
+	free(ring->buffer);
+	free(ring);
+}
+
+
+/**
+ * shm_ring_create(<name>, <size>)
+ *
+ * Creates (or takes over and resets) the shared memory object <name> as a ring of at least <size>
+ * bytes, for publishing records into.  An existing object is never shrunk (readers that still have it
+ * mapped would fault on the pages that went away), so a ring that is taken over keeps its size if that
+ * is larger.  Returns the ring or NULL on failure.
+ **/
+struct shm_ring_t *shm_ring_create(const char *name, size_t size)
+{
+	struct stat object;
+	uint64_t ring_size = SHM_RING_MINIMUM_SIZE;
+	struct shm_ring_t *ring;
+	struct timeval now;
+
+	while (ring_size < size)
+	{
+		ring_size <<= 1;
+	}
+	ring = calloc(1, sizeof(struct shm_ring_t));
+	if (! ring)
+	{
+		perror("shmring.c calloc(ring)");
+		return NULL;
+	}
+	ring->fd = open_object(name, O_RDWR | O_CREAT);
+	if (ring->fd < 0)
+	{
+		shm_ring_close(ring);
+		return NULL;
+	}
+	if (fstat(ring->fd, &object))
+	{
+		perror("shmring.c fstat()");
+		shm_ring_close(ring);
+		return NULL;
+	}
+	while (SHM_RING_HEADER_SIZE + ring_size < (uint64_t)object.st_size)
+	{
+		ring_size <<= 1;
+	}
+	if (ftruncate(ring->fd, SHM_RING_HEADER_SIZE + ring_size))
+	{
+		perror("shmring.c ftruncate()");
+		shm_ring_close(ring);
+		return NULL;
+	}
+	if (! map_ring(ring, 1))
+	{
+		shm_ring_close(ring);
+		return NULL;
+	}
+
+	/* Readers of a previous ring in the object see the epoch change and start over. */
+	gettimeofday(&now, NULL);
+	__atomic_store_n(&ring->header->head, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->header->reserve, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->header->records, 0, __ATOMIC_RELEASE);
+	ring->header->dropped = 0;
+	memcpy(ring->header->magic, SHM_RING_MAGIC, 8);
+	__atomic_store_n(&ring->header->size, ring_size, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->header->epoch, ((uint64_t)now.tv_sec << 20) ^ now.tv_usec ^ ((uint64_t)getpid() << 40), __ATOMIC_RELEASE);
+	#ifdef __DEBUG__
+		printf("shmring.c debug: publishing records to ring '%s' (%" PRIu64 " bytes)\n", name, ring_size);
+	#endif
+	return ring;
+}
+
+
+/**
+ * shm_ring_open(<name>)
+ *
+ * Opens the ring in the shared memory object <name> for reading, starting at the end of the data that
+ * has been published so far.  Returns the ring or NULL on failure.
+ **/
+struct shm_ring_t *shm_ring_open(const char *name)
+{
+	struct shm_ring_t *ring;
+
+	ring = calloc(1, sizeof(struct shm_ring_t));
+	if (! ring)
+	{
+		perror("shmring.c calloc(ring)");
+		return NULL;
+	}
+	ring->fd = open_object(name, O_RDWR);
+	ring->buffer = malloc(SHM_RING_RECORD_MAXIMUM);
+	if (ring->fd < 0 || ! ring->buffer || ! map_ring(ring, 0))
+	{
+		shm_ring_close(ring);
+		return NULL;
+	}
+	resynchronize(ring);
+	return ring;
+}
+
+
+/**
+ * shm_ring_publish(<ring>, <records>, <count>)
+ *
+ * Publishes a batch of records into the ring (producer only), overwriting the oldest records, and wakes
+ * any readers that are waiting.
+ **/
+void shm_ring_publish(struct shm_ring_t *ring, struct log_record_t **records, size_t count)
+{
+	struct shm_ring_entry_t entry;
+	uint64_t head = ring->header->head;
+	size_t i;
+	uint32_t length;
+	uint64_t position;
+	uint64_t sequence = ring->header->records;
+
+	for (i = 0; i < count; i++)
+	{
+		if (records[i]->length > SHM_RING_RECORD_MAXIMUM)
+		{
+			ring->header->dropped++;
+			continue;
+		}
+		length = (sizeof(entry) + records[i]->length + 7) & ~7U;
+		position = head & (ring->size - 1);
+
+		/* Announce the space that is about to be overwritten before writing to it (see shmring.h). */
+		__atomic_store_n(&ring->header->reserve, head + ((position + length > ring->size) ? ring->size - position : 0) + length, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (position + length > ring->size)
+		{
+			entry.length = ring->size - position;
+			entry.data_length = SHM_RING_PADDING;
+			memcpy(ring->ring + position, &entry, 8);
+			head += entry.length;
+			position = 0;
+		}
+		entry.length = length;
+		entry.data_length = records[i]->length;
+		entry.sequence = sequence++;
+		entry.received_sec = records[i]->received.tv_sec;
+		entry.received_usec = records[i]->received.tv_usec;
+		entry.address = records[i]->source.sin_addr.s_addr;
+		entry.port = records[i]->source.sin_port;
+		entry.reserved = 0;
+		entry.serial_offset = records[i]->serial_offset;
+		entry.serial_length = records[i]->serial_length;
+		entry.tag_offset = records[i]->tag_offset;
+		entry.tag_length = records[i]->tag_length;
+		entry.payload_offset = records[i]->payload_offset;
+		entry.payload_length = records[i]->payload_length;
+		memcpy(ring->ring + position, &entry, sizeof(entry));
+		memcpy(ring->ring + position + sizeof(entry), records[i]->data, records[i]->length);
+		head += length;
+	}
+
+	__atomic_store_n(&ring->header->records, sequence, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->header->head, head, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&ring->header->wakeups, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->header->waiters, __ATOMIC_SEQ_CST))
+	{
+		syscall(SYS_futex, &ring->header->wakeups, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+
+/**
+ * shm_ring_read(<ring>, <record pointer>)
+ *
+ * Reads the next record from the ring (reader only) into the reader's own buffer and points <record
+ * pointer> at a view of it, which stays valid until the next call.  Returns 1 if a record was read,
+ * 0 if there are no new records, -1 if the reader was overrun (or the ring was reset) and has skipped
+ * ahead to the newest records, or -2 if the ring is not mapped (because remapping a ring that was
+ * recreated with another size failed; the reader has to be closed); the number of records it missed
+ * is added to ring->lost once it reads the next record.
+ **/
+int shm_ring_read(struct shm_ring_t *ring, struct log_record_t **record)
+{
+	struct shm_ring_entry_t entry;
+	uint64_t head;
+	uint64_t position;
+
+	if (! ring->map)
+	{
+		return -2;
+	}
+	if (__atomic_load_n(&ring->header->size, __ATOMIC_ACQUIRE) != ring->size)
+	{
+		/* The ring was recreated with another size. */
+		if (! map_ring(ring, 0))
+		{
+			return -2;
+		}
+		resynchronize(ring);
+		return -1;
+	}
+	if (__atomic_load_n(&ring->header->epoch, __ATOMIC_ACQUIRE) != ring->epoch)
+	{
+		resynchronize(ring);
+		return -1;
+	}
+
+	while (1)
+	{
+		head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+		if (head == ring->cursor)
+		{
+			return 0;
+		}
+		if (head - ring->cursor > ring->size)
+		{
+			resynchronize(ring);
+			return -1;
+		}
+
+		position = ring->cursor & (ring->size - 1);
+		memcpy(&entry, ring->ring + position, 8);
+		if (entry.data_length != SHM_RING_PADDING)
+		{
+			memcpy(&entry, ring->ring + position, sizeof(entry));
+			if (entry.data_length <= SHM_RING_RECORD_MAXIMUM && entry.length <= ring->size - position)
+			{
+				memcpy(ring->buffer, ring->ring + position + sizeof(entry), entry.data_length);
+			}
+		}
+
+		/* Only trust what was copied if the producer has not started overwriting it since. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ring->header->reserve, __ATOMIC_RELAXED) - ring->cursor > ring->size ||
+			entry.length < 8 || entry.length > ring->size - position ||
+			(entry.data_length != SHM_RING_PADDING && entry.data_length > SHM_RING_RECORD_MAXIMUM))
+		{
+			resynchronize(ring);
+			return -1;
+		}
+		ring->cursor += entry.length;
+		if (entry.data_length != SHM_RING_PADDING)
+		{
+			break;
+		}
+	}
+
+	if (entry.sequence > ring->sequence)
+	{
+		ring->lost += entry.sequence - ring->sequence;
+	}
+	ring->sequence = entry.sequence + 1;
+
+	memset(&ring->record.source, 0, sizeof(ring->record.source));
+	ring->record.source.sin_family = AF_INET;
+	ring->record.source.sin_addr.s_addr = entry.address;
+	ring->record.source.sin_port = entry.port;
+	ring->record.received.tv_sec = entry.received_sec;
+	ring->record.received.tv_usec = entry.received_usec;
+	ring->record.data = ring->buffer;
+	ring->record.length = entry.data_length;
+	ring->record.serial_offset = entry.serial_offset;
+	ring->record.serial_length = entry.serial_length;
+	ring->record.tag_offset = entry.tag_offset;
+	ring->record.tag_length = entry.tag_length;
+	ring->record.payload_offset = entry.payload_offset;
+	ring->record.payload_length = entry.payload_length;
+	ring->record.version = 0;
+	ring->record.fields_complete = 0;
+	ring->record.field_count = 0;
+	*record = &ring->record;
+	return 1;
+}
+
+
+/**
+ * shm_ring_wait(<ring>, <timeout>)
+ *
+ * Waits (reader only) until there are records that the reader has not read, for up to <timeout>
+ * milliseconds (-1 to wait indefinitely).  Returns 1 if there are records to read, 0 if the wait
+ * timed out, or -1 on failure (including when the ring is not mapped).
+ **/
+int shm_ring_wait(struct shm_ring_t *ring, int timeout)
+{
+	struct timespec interval;
+	int result = 1;
+	uint32_t wakeups;
+
+	if (! ring->map)
+	{
+		return -1;
+	}
+	__atomic_add_fetch(&ring->header->waiters, 1, __ATOMIC_SEQ_CST);
+	wakeups = __atomic_load_n(&ring->header->wakeups, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->header->head, __ATOMIC_SEQ_CST) == ring->cursor &&
+		__atomic_load_n(&ring->header->epoch, __ATOMIC_SEQ_CST) == ring->epoch)
+	{
+		interval.tv_sec = timeout / 1000;
+		interval.tv_nsec = (timeout % 1000) * 1000000L;
+		if (syscall(SYS_futex, &ring->header->wakeups, FUTEX_WAIT, wakeups, (timeout < 0) ? NULL : &interval, NULL, 0))
+		{
+			if (errno == ETIMEDOUT)
+			{
+				result = 0;
+			}
+			else if (errno != EAGAIN && errno != EINTR)
+			{
+				perror("shmring.c futex()");
+				result = -1;
+			}
+		}
+	}
+	__atomic_sub_fetch(&ring->header->waiters, 1, __ATOMIC_SEQ_CST);
+	return result;
+}
+
+
+/**
+ * unmap_ring(<ring>)
+ *
+ * Unmaps the shared memory object of the ring, if it is mapped, and clears the pointers into it.
+ **/
+static void unmap_ring(struct shm_ring_t *ring)
+{
+	if (ring->map && munmap(ring->map, ring->map_length))
+	{
+		perror("shmring.c munmap()");
+	}
+	ring->map = NULL;
+	ring->map_length = 0;
+	ring->header = NULL;
+	ring->ring = NULL;
+	ring->size = 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "record.h"
+
+
+/*
+ * Shared-memory ring for local fan-out of received records.
+ *
+ * A udploggerclientlib client started with --publish <name> publishes every record that it accepts
+ * into a POSIX shared memory object (see shm_open(3)), so that any number of local processes can tail
+ * the record stream of a single receiver (and a single beacon) at memory speed.  The ring has one
+ * producer and any number of consumers, each with a cursor of its own; the producer never waits for
+ * the consumers, so a consumer that falls more than a ring's worth behind is overrun and skips ahead
+ * (the records that it missed are counted).  The shared memory object is left in place when the
+ * producer exits; a producer that starts again resets the ring (readers notice and resynchronize) and
+ * never shrinks it.
+ *
+ * Readers:
+ *
+ *   ring = shm_ring_open("udplogger");
+ *   while (shm_ring_wait(ring, 1000) >= 0)
+ *       while ((result = shm_ring_read(ring, &record)) > 0 || result == -1)
+ *           if (result > 0) ...record...   (result -1: overrun, see ring->lost; -2: ring unusable)
+ *
+ * The object is SHM_RING_HEADER_SIZE bytes of header (struct shm_ring_header_t) followed by the ring
+ * of size bytes (a power of two).  Positions in the ring are byte counts since the ring was reset;
+ * head is the end of the published data, reserve the end of the data that the producer is writing
+ * (readers check it after copying an entry, so that an entry that was overwritten while it was being
+ * copied is detected), records the number of records published, epoch changes whenever the ring is
+ * reset and wakeups/waiters are the futex that readers sleep on.  Each entry is a struct
+ * shm_ring_entry_t followed by the record data, padded to 8 bytes; an entry that would not fit before
+ * the end of the ring is preceded by padding (an entry with data_length SHM_RING_PADDING) to the end.
+ *
+ * SHM_RING_DEFAULT_SIZE  The default size (bytes) of the ring.
+ * SHM_RING_HEADER_SIZE   The size (bytes) of the header (one page, so that the ring is page-aligned).
+ * SHM_RING_MAGIC         The magic number at the start of the header.
+ * SHM_RING_PADDING       The data_length of padding entries.
+ */
+#define SHM_RING_DEFAULT_SIZE (64UL * 1024UL * 1024UL)
+#define SHM_RING_HEADER_SIZE  4096U
+#define SHM_RING_MAGIC        "UDPLRNG1"
+#define SHM_RING_PADDING      0xFFFFFFFFU
+
+struct shm_ring_header_t {
+	char magic[8];
+	uint64_t size;
+	uint64_t epoch;
+	uint64_t reserve;
+	uint64_t head;
+	uint64_t records;
+	uint64_t dropped;
+	uint32_t wakeups;
+	uint32_t waiters;
+};
+
+struct shm_ring_entry_t {
+	uint32_t length;
+	uint32_t data_length;
+	uint64_t sequence;
+	int64_t received_sec;
+	uint32_t received_usec;
+	uint32_t address;
+	uint16_t port;
+	uint16_t reserved;
+	uint32_t serial_offset;
+	uint32_t serial_length;
+	uint32_t tag_offset;
+	uint32_t tag_length;
+	uint32_t payload_offset;
+	uint32_t payload_length;
+};
+
+
+/*
+ * A producer's or reader's handle on a ring.  header/ring point into the mapping of fd (map_length
+ * bytes long) and size is the ring size that was mapped.  Readers only: cursor is the position of the
+ * next entry, epoch the epoch of the ring that it belongs to, sequence the sequence number of the next
+ * record, lost counts the records that were missed because of overruns, buffer holds the data of the
+ * last record that was read and record is its view.
+ */
+struct shm_ring_t {
+	int fd;
+	char *map;
+	size_t map_length;
+	struct shm_ring_header_t *header;
+	char *ring;
+	uint64_t size;
+
+	uint64_t cursor;
+	uint64_t epoch;
+	uint64_t sequence;
+	uintmax_t lost;
+	char *buffer;
+	struct log_record_t record;
+};
+
+
+void shm_ring_close(struct shm_ring_t *);
+struct shm_ring_t *shm_ring_create(const char *, size_t);
+struct shm_ring_t *shm_ring_open(const char *);
+void shm_ring_publish(struct shm_ring_t *, struct log_record_t **, size_t);
+int shm_ring_read(struct shm_ring_t *, struct log_record_t **);
+int shm_ring_wait(struct shm_ring_t *, int);
+
+#endif
@@ -25,28 +25,93 @@
 #include <arpa/inet.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include "columnar.h"
+#include "output.h"
 #include "udplogger.h"
 #include "udploggerclientlib.h"
 
 
 /*
- * Give a strnlen prototype to stop compiler warnings.  GNU libraries give it to us,
- * but ISO C90 doesn't allow us to use _GNU_SOURCE before including <string.h>.
+ * The size of the memory to allocate for working with time string buffers.  This
+ * is used to store the current timestamp in a string for easy printing and also
+ * defines the maximum length of udploggerc_conf.log_destination_format (and of the
+ * log file paths that are based on it, see OUTPUT_PATH_SIZE).
  */
-size_t strnlen(const char *, size_t);
+#define TIME_STRING_BUFFER_SIZE OUTPUT_PATH_SIZE
 
 
 /*
- * The size of the memory to allocate for working with time string buffers.  This
- * is used to store the current timestamp in a string for easy printing and also
- * defines the maximum length of udploggerc_conf.log_destination_path, which is based
- * on udploggerc_conf.log_destination_format.
+ * The default interval (milliseconds) at which buffered output is written out, even if
+ * the output buffers are not yet full.
  */
-#define TIME_STRING_BUFFER_SIZE 513U
+#define DEFAULT_FLUSH_INTERVAL 250UL
+
+
+/*
+ * The number of log lines from a source between the serial number checkpoints that are
+ * recorded in the index (see --index).  Every source also gets a checkpoint at its first
+ * line in each file.
+ */
+#define SERIAL_CHECKPOINT_INTERVAL 1024U
+
+
+/*
+ * The lines of a source since its last serial number checkpoint, and the file (the
+ * generation of its output lane) that the checkpoint was recorded in.
+ */
+struct serial_checkpoint_t {
+	uintmax_t generation;
+	uintmax_t lines;
+};
+
+
+/*
+ * Cache of the rendered "[<address>:<port>]<delimiter>" prefix of each source host, so
+ * that the source does not have to be formatted for every log line.  The cache is
+ * direct-mapped (indexed by a hash of the address and port); a source that collides with
+ * another simply replaces it.  A length of zero marks an empty entry.  The entry also
+ * holds the source's serial number checkpoint (when output is not sharded).
+ */
+#define SOURCE_CACHE_SIZE 256U
+#define SOURCE_PREFIX_SIZE 32U
+
+struct source_prefix_t {
+	in_addr_t address;
+	in_port_t port;
+	size_t length;
+	char text[SOURCE_PREFIX_SIZE];
+	struct serial_checkpoint_t checkpoint;
+};
+
+
+/*
+ * Cache of the output lane of each source host and tag when the --file format is sharded
+ * (contains %{tag} or %{source}), so that the format only has to be expanded for the first
+ * log line of each.  Like the source cache it is direct-mapped; a tag_length of zero marks
+ * an empty entry.  Tags longer than SHARD_TAG_SIZE - 1 bytes are shortened (in the cache
+ * and in file names alike).  The entry also holds the serial number checkpoint of the
+ * source in the lane.  The whole cache is emptied whenever the output stream retires idle
+ * lanes, since it may point at them.
+ */
+#define SHARD_CACHE_SIZE 256U
+#define SHARD_TAG_SIZE 64U
+
+struct shard_t {
+	in_addr_t address;
+	in_port_t port;
+	size_t tag_length;
+	char tag[SHARD_TAG_SIZE];
+	struct output_lane_t *lane;
+	struct serial_checkpoint_t checkpoint;
+};
 
 
 /*
@@ -54,52 +119,105 @@ size_t strnlen(const char *, size_t);
  * of this udploggerc client program.
  */
 struct udploggerc_configuration_t {
+	uintmax_t buffer_memory;
+	int columnar;
+	int compression_level;
+	uintmax_t compressor_count;
 	unsigned char delimiter_character;
-	FILE *log_destination;
+	uintmax_t flush_interval;
+	int flush_timer;
+	int index;
+	struct output_stream_t *log_destination;
+	int log_destination_closed;
 	char *log_destination_format;
-	char log_destination_path[TIME_STRING_BUFFER_SIZE];
+	uintmax_t preallocate;
+	struct columnar_group_t *row_group;
+	int sharded;
+	uintmax_t sync_interval;
+	uintmax_t sync_size;
+	uintmax_t writer_count;
 } udploggerc_conf;
 
 
+static struct shard_t shard_cache[SHARD_CACHE_SIZE];
+
+
 int add_option_hook();
 static void close_log_file();
+static void flush_log_file(int);
 int getopt_hook(char);
 void handle_signal_hook(sigset_t *);
-void inline log_packet_hook(struct sockaddr_in *, char *);
-static int open_log_file(char *);
+void log_record_hook(struct log_record_t *);
+static int open_log_file();
+static uint64_t parse_serial(struct log_record_t *);
+static void replace_delimiters(char *, const char *, size_t);
+static size_t shard_expand(char *, const char *, const struct log_record_t *, size_t);
+static struct shard_t *shard_lane(struct log_record_t *);
+static struct source_prefix_t *source_prefix(struct sockaddr_in *);
 void usage_hook();
+static void write_row_group();
 
 
 int add_option_hook()
 {
+	udploggerc_conf.buffer_memory = OUTPUT_DEFAULT_MEMORY;
+	udploggerc_conf.columnar = 0;
+	udploggerc_conf.compression_level = 0;
+	udploggerc_conf.compressor_count = OUTPUT_DEFAULT_COMPRESSORS;
 	udploggerc_conf.delimiter_character = DELIMITER_CHARACTER;
-	udploggerc_conf.log_destination = stdout;
+	udploggerc_conf.flush_interval = DEFAULT_FLUSH_INTERVAL;
+	udploggerc_conf.flush_timer = -1;
+	udploggerc_conf.index = 0;
+	udploggerc_conf.log_destination = NULL;
+	udploggerc_conf.log_destination_closed = 0;
 	udploggerc_conf.log_destination_format = NULL;
-	memset(udploggerc_conf.log_destination_path, '\0', TIME_STRING_BUFFER_SIZE * sizeof(char));
+	udploggerc_conf.preallocate = 0;
+	udploggerc_conf.row_group = NULL;
+	udploggerc_conf.sharded = 0;
+	udploggerc_conf.sync_interval = 0;
+	udploggerc_conf.sync_size = 0;
+	udploggerc_conf.writer_count = 1;
 	return
 	(
+		add_option("buffer-memory", required_argument, 'm') &&
+		add_option("columnar", no_argument, 'c') &&
+		add_option("compress", required_argument, 'z') &&
+		add_option("compress-threads", required_argument, 'Z') &&
 		add_option("delimiter", required_argument, 'd') &&
-		add_option("file", required_argument, 'f')
+		add_option("file", required_argument, 'f') &&
+		add_option("flush-interval", required_argument, 'l') &&
+		add_option("index", no_argument, 'x') &&
+		add_option("preallocate", required_argument, 'p') &&
+		add_option("sync-interval", required_argument, 's') &&
+		add_option("sync-size", required_argument, 'S') &&
+		add_option("writers", required_argument, 'w')
 	);
 }
 
 
 static void close_log_file()
 {
-	if (strnlen(udploggerc_conf.log_destination_path, TIME_STRING_BUFFER_SIZE) > 0)
+	if (udploggerc_conf.log_destination)
 	{
-		#ifdef __DEBUG__
-			printf("udploggerc.c debug: closing log destination '%s'\n", udploggerc_conf.log_destination_path);
-		#endif
-		memset(udploggerc_conf.log_destination_path, '\0', TIME_STRING_BUFFER_SIZE * sizeof(char));
+		write_row_group();
+		output_close(udploggerc_conf.log_destination);
+		udploggerc_conf.log_destination = NULL;
 	}
-	if (udploggerc_conf.log_destination != stdout)
+	if (udploggerc_conf.row_group)
 	{
-		if (fclose(udploggerc_conf.log_destination))
-		{
-			perror("udploggerc.c fclose()");
-		}
-		udploggerc_conf.log_destination = stdout;
+		columnar_free(udploggerc_conf.row_group);
+		udploggerc_conf.row_group = NULL;
+	}
+	udploggerc_conf.log_destination_closed = 1;
+}
+
+
+static void flush_log_file(int fd)
+{
+	if (udploggerc_conf.log_destination)
+	{
+		write_row_group();
+		output_flush(udploggerc_conf.log_destination);
 	}
 }
 
@@ -108,6 +226,9 @@ int getopt_hook(char i)
 {
 	switch (i)
 	{
+		case 'c':
+			udploggerc_conf.columnar = 1;
+			return 1;
 		case 'd':
 			if (strlen(optarg) != 1)
 			{
@@ -138,6 +259,7 @@ int getopt_hook(char i)
 						perror("udploggerc.c strdup()");
 						return -1;
 					}
+					udploggerc_conf.sharded = (strstr(optarg, "%{tag}") || strstr(optarg, "%{source}"));
 					#ifdef __DEBUG__
 						printf("udploggerc.c debug: setting log file format specification to '%s'\n", udploggerc_conf.log_destination_format);
 					#endif
@@ -150,6 +272,76 @@ int getopt_hook(char i)
 				#endif
 			}
 			return 1;
+		case 'z':
+			if (strlen(optarg) != 1 || optarg[0] < '0' || optarg[0] > '9')
+			{
+				fprintf(stderr, "udploggerc.c invalid compression level '%s'\n", optarg);
+				return -1;
+			}
+			udploggerc_conf.compression_level = optarg[0] - '0';
+			return 1;
+		case 'Z':
+			udploggerc_conf.compressor_count = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.compressor_count || udploggerc_conf.compressor_count > 256)
+			{
+				fprintf(stderr, "udploggerc.c invalid number of compression threads '%s'\n", optarg);
+				return -1;
+			}
+			return 1;
+		case 'm':
+			udploggerc_conf.buffer_memory = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.buffer_memory || udploggerc_conf.buffer_memory >= (SIZE_MAX >> 20))
+			{
+				fprintf(stderr, "udploggerc.c invalid buffer memory size '%s'\n", optarg);
+				return -1;
+			}
+			udploggerc_conf.buffer_memory <<= 20;
+			return 1;
+		case 'l':
+			udploggerc_conf.flush_interval = strtoumax(optarg, 0, 10);
+			if (udploggerc_conf.flush_interval == UINT_MAX)
+			{
+				fprintf(stderr, "udploggerc.c invalid flush interval '%s'\n", optarg);
+				return -1;
+			}
+			return 1;
+		case 'p':
+			udploggerc_conf.preallocate = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.preallocate || udploggerc_conf.preallocate >= (SIZE_MAX >> 20))
+			{
+				fprintf(stderr, "udploggerc.c invalid preallocation size '%s'\n", optarg);
+				return -1;
+			}
+			udploggerc_conf.preallocate <<= 20;
+			return 1;
+		case 's':
+			udploggerc_conf.sync_interval = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.sync_interval || udploggerc_conf.sync_interval >= ULONG_MAX / 1000)
+			{
+				fprintf(stderr, "udploggerc.c invalid sync interval '%s'\n", optarg);
+				return -1;
+			}
+			return 1;
+		case 'S':
+			udploggerc_conf.sync_size = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.sync_size || udploggerc_conf.sync_size >= (UINT64_MAX >> 10))
+			{
+				fprintf(stderr, "udploggerc.c invalid sync size '%s'\n", optarg);
+				return -1;
+			}
+			udploggerc_conf.sync_size <<= 10;
+			return 1;
+		case 'w':
+			udploggerc_conf.writer_count = strtoumax(optarg, 0, 10);
+			if (! udploggerc_conf.writer_count || udploggerc_conf.writer_count > 256)
+			{
+				fprintf(stderr, "udploggerc.c invalid number of writer threads '%s'\n", optarg);
+				return -1;
+			}
+			return 1;
+		case 'x':
+			udploggerc_conf.index = 1;
+			return 1;
 	}
 	return 0;
 }
@@ -163,9 +355,9 @@ void handle_signal_hook(sigset_t *signal_flags)
 		#ifdef __DEBUG__
 			printf("udploggerc.c debug: HUP received\n");
 		#endif
-		if (strnlen(udploggerc_conf.log_destination_path, TIME_STRING_BUFFER_SIZE) > 0)
+		if (udploggerc_conf.log_destination)
 		{
-			open_log_file(udploggerc_conf.log_destination_path);
+			output_reopen(udploggerc_conf.log_destination);
 		}
 	}
 	if (sigismember(signal_flags, SIGTERM))
@@ -178,85 +370,405 @@ void handle_signal_hook(sigset_t *signal_flags)
 }
 
 
-void inline log_packet_hook(struct sockaddr_in *sender, char *line)
+void log_record_hook(struct log_record_t *record)
 {
 	static time_t current_timestamp = 0;
 	static struct tm current_time;
 	static char current_time_str[TIME_STRING_BUFFER_SIZE];
-	int i;
-	static char new_log_destination_path[TIME_STRING_BUFFER_SIZE];
+	static size_t current_time_length = 0;
+	struct serial_checkpoint_t *checkpoint;
+	char *line;
+	size_t line_length;
+	int result;
+	struct shard_t *shard;
+	struct source_prefix_t *source;
 
-	/* Update our timestamp string (if necessary). */
-	if ((! current_timestamp) || (current_timestamp != time(NULL)))
+	/* Start the output stream and its deadline timer (the first time through). */
+	if (! udploggerc_conf.log_destination)
 	{
-		current_timestamp = time(NULL);
-		if (current_timestamp == (time_t)-1)
+		if (udploggerc_conf.log_destination_closed || ! open_log_file())
 		{
-			perror("udploggerc.c time()");
 			return;
 		}
+	}
+	if (udploggerc_conf.flush_timer < 0 && udploggerc_conf.flush_interval)
+	{
+		udploggerc_conf.flush_timer = add_event_timer(udploggerc_conf.flush_interval, flush_log_file);
+	}
+
+	/* Update our timestamp string, which includes the delimiter that follows it (if necessary). */
+	if ((! current_timestamp) || (current_timestamp != record->received.tv_sec))
+	{
+		current_timestamp = record->received.tv_sec;
 		if (localtime_r(&current_timestamp, &current_time) == NULL)
 		{
 			perror("udploggerc.c localtime_r()");
 			return;
 		}
-		strftime(current_time_str, TIME_STRING_BUFFER_SIZE, "[%Y-%m-%d %H:%M:%S]", &current_time);
-		current_time_str[TIME_STRING_BUFFER_SIZE - 1] = '\0';
+		current_time_length = strftime(current_time_str, TIME_STRING_BUFFER_SIZE - 1, "[%Y-%m-%d %H:%M:%S]", &current_time);
+		current_time_str[current_time_length++] = udploggerc_conf.delimiter_character;
 
-		/* Update our log file destination path (if necessary). */
-		if (udploggerc_conf.log_destination_format != NULL)
+		/* Update our log file destination path (if necessary; the file itself is opened by the writer thread). */
+		if (udploggerc_conf.row_group && output_path_changes(udploggerc_conf.log_destination, &current_time))
 		{
-			strftime(new_log_destination_path, TIME_STRING_BUFFER_SIZE, udploggerc_conf.log_destination_format, &current_time);
-			new_log_destination_path[TIME_STRING_BUFFER_SIZE - 1] = '\0';
-			if (strncmp(new_log_destination_path, udploggerc_conf.log_destination_path, TIME_STRING_BUFFER_SIZE))
-			{
-				open_log_file(new_log_destination_path);
-			}
+			write_row_group();
+		}
+		output_set_time(udploggerc_conf.log_destination, current_timestamp, &current_time);
+		if (udploggerc_conf.sharded && output_retire(udploggerc_conf.log_destination))
+		{
+			memset(shard_cache, 0, sizeof(shard_cache));
 		}
 	}
 
-	/* Format the log line for output. */
-	if (udploggerc_conf.delimiter_character != DELIMITER_CHARACTER)
+	/* In columnar mode the record goes into the current row group, which is written out once it is full. */
+	if (udploggerc_conf.row_group)
 	{
-		for (i = 0; i < strnlen(line, PACKET_MAXIMUM_SIZE); i++)
+		if (! (result = columnar_add(udploggerc_conf.row_group, record)))
 		{
-			if (line[i] == DELIMITER_CHARACTER)
-			{
-				line[i] = udploggerc_conf.delimiter_character;
-			}
+			write_row_group();
+			result = columnar_add(udploggerc_conf.row_group, record);
+		}
+		if (result < 0)
+		{
+			output_discard(udploggerc_conf.log_destination, 1);
 		}
+		return;
 	}
 
-	fprintf(udploggerc_conf.log_destination, "%s%c[%s:%hu]%c%s\n", current_time_str, udploggerc_conf.delimiter_character, inet_ntoa(sender->sin_addr), ntohs(sender->sin_port), udploggerc_conf.delimiter_character, line);
+	/* Pick the file (lane) that the line belongs in, then assemble it directly in the output buffer. */
+	source = source_prefix(&record->source);
+	checkpoint = &source->checkpoint;
+	if (udploggerc_conf.sharded)
+	{
+		if (! (shard = shard_lane(record)))
+		{
+			output_discard(udploggerc_conf.log_destination, 1);
+			return;
+		}
+		output_select(udploggerc_conf.log_destination, shard->lane);
+		checkpoint = &shard->checkpoint;
+	}
+	line_length = current_time_length + source->length + record->length + 1;
+	line = output_reserve(udploggerc_conf.log_destination, line_length);
+	if (! line)
+	{
+		/* Every output buffer is waiting to be written; the line is dropped (and counted). */
+		return;
+	}
+	if (udploggerc_conf.index)
+	{
+		/* Index serial number checkpoints for each source (output_reserve() indexes the first line of each second). */
+		if (checkpoint->generation != udploggerc_conf.log_destination->lane->generation || checkpoint->lines >= SERIAL_CHECKPOINT_INTERVAL)
+		{
+			output_index(udploggerc_conf.log_destination, OUTPUT_INDEX_SERIAL, &record->source, parse_serial(record));
+			checkpoint->generation = udploggerc_conf.log_destination->lane->generation;
+			checkpoint->lines = 0;
+		}
+		checkpoint->lines++;
+	}
+	memcpy(line, current_time_str, current_time_length);
+	memcpy(line + current_time_length, source->text, source->length);
+	if (udploggerc_conf.delimiter_character != DELIMITER_CHARACTER)
+	{
+		replace_delimiters(line + current_time_length + source->length, record->data, record->length);
+	}
+	else
+	{
+		memcpy(line + current_time_length + source->length, record->data, record->length);
+	}
+	line[line_length - 1] = '\n';
+
+	output_commit(udploggerc_conf.log_destination, line_length, 1);
 }
 
 
-static int open_log_file(char *log_file_path)
+static int open_log_file()
 {
-	FILE *new_log_destination = NULL;
-
 	#ifdef __DEBUG__
-		printf("udploggerc.c debug: changing log destination to '%s'\n", log_file_path);
+		printf("udploggerc.c debug: starting output to '%s'\n", udploggerc_conf.log_destination_format ? udploggerc_conf.log_destination_format : "-");
 	#endif
-	new_log_destination = fopen(log_file_path, "a");
-	if (new_log_destination == NULL)
+	if (udploggerc_conf.columnar && udploggerc_conf.sharded)
 	{
-		perror("udploggerc.c fopen()");
-		fprintf(stderr, "udploggerc.c could not open file '%s' for appending\n", log_file_path);
+		fprintf(stderr, "udploggerc.c --columnar does not support %%{tag} or %%{source} in --file\n");
+		udploggerc_conf.log_destination_closed = 1;
+		return 0;
+	}
+	if (udploggerc_conf.preallocate && (udploggerc_conf.columnar || udploggerc_conf.compression_level))
+	{
+		/* A reopened preallocated file is trimmed of trailing NUL bytes, which only text output never ends in. */
+		fprintf(stderr, "udploggerc.c --preallocate does not support --columnar or --compress\n");
+		udploggerc_conf.log_destination_closed = 1;
+		return 0;
+	}
+	if (udploggerc_conf.columnar)
+	{
+		udploggerc_conf.row_group = columnar_new(OUTPUT_CHUNK_SIZE);
+		if (! udploggerc_conf.row_group)
+		{
+			fprintf(stderr, "udploggerc.c could not start log output\n");
+			udploggerc_conf.log_destination_closed = 1;
+			return 0;
+		}
+	}
+	udploggerc_conf.log_destination = output_open(udploggerc_conf.log_destination_format, udploggerc_conf.buffer_memory, udploggerc_conf.compression_level, udploggerc_conf.compressor_count, udploggerc_conf.index && ! udploggerc_conf.columnar, udploggerc_conf.writer_count, udploggerc_conf.preallocate, udploggerc_conf.sync_interval, udploggerc_conf.sync_size);
+	if (! udploggerc_conf.log_destination)
+	{
+		fprintf(stderr, "udploggerc.c could not start log output\n");
+		close_log_file();
 		return 0;
 	}
-	close_log_file();
-	udploggerc_conf.log_destination = new_log_destination;
-	strncpy(udploggerc_conf.log_destination_path, log_file_path, TIME_STRING_BUFFER_SIZE);
-	udploggerc_conf.log_destination_path[TIME_STRING_BUFFER_SIZE - 1] = '\0';
 	return 1;
 }
 
 
+/*
+ * Returns the serial number of a log record (the digits at the start of its serial field).
+ */
+static uint64_t parse_serial(struct log_record_t *record)
+{
+	const char *digit = record->data + record->serial_offset;
+	const char *end = digit + record->serial_length;
+	uint64_t serial = 0;
+
+	for (; digit < end && *digit >= '0' && *digit <= '9'; digit++)
+	{
+		serial = serial * 10 + (*digit - '0');
+	}
+	return serial;
+}
+
+
+/*
+ * Copies <length> bytes of log data from <source> to <destination>, replacing each
+ * DELIMITER_CHARACTER with the configured delimiter.  Fields are only a few bytes apart, so
+ * rather than searching for each delimiter (memchr) the data is processed a word at a time:
+ * every byte of the word that equals the delimiter is located with the usual "has zero byte"
+ * bit trick (which is exact, with no false positives), turned into a byte mask and blended
+ * with the replacement.
+ */
+static void replace_delimiters(char *destination, const char *source, size_t length)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t lows = 0x7F7F7F7F7F7F7F7FULL;
+	const uint64_t from = ones * DELIMITER_CHARACTER;
+	uint64_t mask;
+	const uint64_t to = ones * udploggerc_conf.delimiter_character;
+	uint64_t word;
+
+	for (; length >= sizeof(word); length -= sizeof(word), source += sizeof(word), destination += sizeof(word))
+	{
+		memcpy(&word, source, sizeof(word));
+		mask = word ^ from;
+		mask = ~(((mask & lows) + lows) | mask | lows);
+		mask = (mask >> 7) * 0xFF;
+		word = (word & ~mask) | (to & mask);
+		memcpy(destination, &word, sizeof(word));
+	}
+	for (; length > 0; length--, source++, destination++)
+	{
+		*destination = (*source == (char)DELIMITER_CHARACTER) ? udploggerc_conf.delimiter_character : *source;
+	}
+}
+
+
+/*
+ * Expands the %{tag} and %{source} placeholders of the --file format for a log record into
+ * <destination> (which holds <size> bytes), leaving the strftime(3) conversions for the
+ * output stream.  The tag is shortened to SHARD_TAG_SIZE - 1 bytes and the values are made
+ * safe for use in a file name: '/' and a leading '.' become '_', and '%' is escaped.
+ * Returns the length of the expansion, or 0 if it does not fit.
+ */
+static size_t shard_expand(char *destination, const char *format, const struct log_record_t *record, size_t size)
+{
+	char address[INET_ADDRSTRLEN];
+	char source[INET_ADDRSTRLEN + 8];
+	size_t length = 0;
+	const char *value;
+	size_t value_length;
+	size_t i;
+
+	while (*format)
+	{
+		if (! strncmp(format, "%{tag}", 6))
+		{
+			value = record->data + record->tag_offset;
+			value_length = (record->tag_length < SHARD_TAG_SIZE) ? record->tag_length : SHARD_TAG_SIZE - 1;
+			format += 6;
+		}
+		else if (! strncmp(format, "%{source}", 9))
+		{
+			inet_ntop(AF_INET, &record->source.sin_addr, address, sizeof(address));
+			value_length = snprintf(source, sizeof(source), "%s_%hu", address, ntohs(record->source.sin_port));
+			value = source;
+			format += 9;
+		}
+		else
+		{
+			/* Copy conversion specifications whole, so that "%%{tag}" stays literal. */
+			if (length + 2 >= size)
+			{
+				return 0;
+			}
+			if (*format == '%' && format[1])
+			{
+				destination[length++] = *format++;
+			}
+			destination[length++] = *format++;
+			continue;
+		}
+
+		for (i = 0; i < value_length; i++)
+		{
+			if (length + 2 >= size)
+			{
+				return 0;
+			}
+			if (value[i] == '/' || (value[i] == '.' && i == 0) || value[i] == '\0')
+			{
+				destination[length++] = '_';
+			}
+			else if (value[i] == '%')
+			{
+				destination[length++] = '%';
+				destination[length++] = '%';
+			}
+			else
+			{
+				destination[length++] = value[i];
+			}
+		}
+		if (! value_length)
+		{
+			destination[length++] = '_';
+		}
+	}
+	destination[length] = '\0';
+	return length;
+}
+
+
+/*
+ * Returns the shard cache entry (and so the output lane) of a log record's source and tag,
+ * creating the lane if it does not exist yet.  Returns NULL on failure.
+ */
+static struct shard_t *shard_lane(struct log_record_t *record)
+{
+	struct shard_t *entry;
+	char format[OUTPUT_PATH_SIZE];
+	uint32_t hash = 2166136261U;
+	size_t i;
+	const char *tag = record->data + record->tag_offset;
+	size_t tag_length = (record->tag_length < SHARD_TAG_SIZE) ? record->tag_length : SHARD_TAG_SIZE - 1;
+
+	for (i = 0; i < tag_length; i++)
+	{
+		hash = (hash ^ (unsigned char)tag[i]) * 16777619U;
+	}
+	entry = &shard_cache[(hash ^ record->source.sin_addr.s_addr ^ record->source.sin_port) % SHARD_CACHE_SIZE];
+	if (entry->lane && entry->address == record->source.sin_addr.s_addr && entry->port == record->source.sin_port &&
+		entry->tag_length == tag_length && ! memcmp(entry->tag, tag, tag_length))
+	{
+		return entry;
+	}
+
+	if (! shard_expand(format, udploggerc_conf.log_destination_format, record, OUTPUT_PATH_SIZE))
+	{
+		fprintf(stderr, "udploggerc.c log file format specification is too long for tag '%.*s'\n", (int)tag_length, tag);
+		return NULL;
+	}
+	entry->lane = output_lane(udploggerc_conf.log_destination, format);
+	if (! entry->lane)
+	{
+		return NULL;
+	}
+	entry->address = record->source.sin_addr.s_addr;
+	entry->port = record->source.sin_port;
+	entry->tag_length = tag_length;
+	memcpy(entry->tag, tag, tag_length);
+	entry->checkpoint.generation = 0;
+	entry->checkpoint.lines = 0;
+	return entry;
+}
+
+
+static struct source_prefix_t *source_prefix(struct sockaddr_in *source)
+{
+	static struct source_prefix_t cache[SOURCE_CACHE_SIZE];
+	char address[INET_ADDRSTRLEN];
+	struct source_prefix_t *entry;
+
+	entry = &cache[(source->sin_addr.s_addr ^ (source->sin_addr.s_addr >> 16) ^ source->sin_port) % SOURCE_CACHE_SIZE];
+	if (entry->length && entry->address == source->sin_addr.s_addr && entry->port == source->sin_port)
+	{
+		return entry;
+	}
+
+	inet_ntop(AF_INET, &source->sin_addr, address, sizeof(address));
+	entry->address = source->sin_addr.s_addr;
+	entry->port = source->sin_port;
+	entry->checkpoint.generation = 0;
+	entry->checkpoint.lines = 0;
+	entry->length = snprintf(entry->text, SOURCE_PREFIX_SIZE, "[%s:%hu]%c", address, ntohs(source->sin_port), udploggerc_conf.delimiter_character);
+	return entry;
+}
+
+
 void usage_hook()
 {
+	printf("  -m, --buffer-memory <megabytes>   memory to use for buffering log data while it waits to be written (default %lu)\n", OUTPUT_DEFAULT_MEMORY >> 20);
+	printf("                                    log lines are dropped (and counted) if the buffers are ever all full\n");
+	printf("  -c, --columnar                    write log data in the columnar archive format (see columnar.h) instead of as\n");
+	printf("                                    text lines, for reading with Nexopia.UDPLogger.Columnar (--delimiter and\n");
+	printf("                                    --index do not apply)\n");
+	printf("  -z, --compress <level>            gzip-compress the log data at <level> (1 to 9, default 0 for no compression)\n");
+	printf("                                    each buffer is written as an independent gzip member, so a crash loses at most\n");
+	printf("                                    the buffers that were in flight; add `.gz' to the --file name yourself\n");
+	printf("  -Z, --compress-threads <count>    number of threads to compress with (default %u)\n", OUTPUT_DEFAULT_COMPRESSORS);
 	printf("  -d, --delimiter <delim>           set the delimiter to be used in-between log fields\n");
 	printf("                                    (defaults to character 0x%x)\n", DELIMITER_CHARACTER);
 	printf("  -f, --file <file>                 send log data to the file <file> (use `-' for stdout, which is the default)\n");
 	printf("                                    <file> can be a format specification and supports conversion specifications as per strftime(3)\n");
+	printf("                                    plus %%{tag} and %%{source} (`<address>_<port>'), which shard log data into\n");
+	printf("                                    a file per tag and/or source host (not with --columnar)\n");
+	printf("  -l, --flush-interval <interval>   write buffered log data out at least every <interval> milliseconds\n");
+	printf("                                    (default %lu, 0 to only write when the buffers are full or the file changes)\n", DEFAULT_FLUSH_INTERVAL);
+	printf("  -x, --index                       write a sidecar index (<file>.idx) next to each log file that maps each second, and\n");
+	printf("                                    every %u lines of each source's serial numbers, to positions in the file (the\n", SERIAL_CHECKPOINT_INTERVAL);
+	printf("                                    udploggertools use it to seek to a time range); ignored for stdout\n");
+	printf("  -p, --preallocate <megabytes>     preallocate log files <megabytes> at a time and write them through a memory\n");
+	printf("                                    mapping rather than with write calls (uncompressed text output only); files\n");
+	printf("                                    are truncated to their data when they are closed, and end in zeros until then\n");
+	printf("  -s, --sync-interval <interval>    fdatasync() log files once the oldest unsynced data is <interval> milliseconds\n");
+	printf("                                    old (group commit; by default data is left to the page cache)\n");
+	printf("  -S, --sync-size <kilobytes>       fdatasync() log files once <kilobytes> of data have been written since the\n");
+	printf("                                    last sync (with --sync-interval, whichever comes first); the log lines confirmed\n");
+	printf("                                    durable and a histogram of sync latencies are reported on exit\n");
+	printf("  -w, --writers <count>             number of threads to write files with (default 1); each sharded file is always\n");
+	printf("                                    written by the same thread\n");
+}
+
+
+/*
+ * Encodes the current row group (if it has any rows) straight into the output buffers.
+ */
+static void write_row_group()
+{
+	char *buffer;
+	struct columnar_group_t *group = udploggerc_conf.row_group;
+	uintmax_t rows;
+
+	if (! group || ! group->rows)
+	{
+		return;
+	}
+	rows = group->rows;
+	buffer = output_reserve(udploggerc_conf.log_destination, group->bound);
+	if (! buffer)
+	{
+		/* Every output buffer is waiting to be written; output_reserve() counted one of the rows. */
+		output_discard(udploggerc_conf.log_destination, rows - 1);
+		columnar_reset(group);
+		return;
+	}
+	output_commit(udploggerc_conf.log_destination, columnar_encode(group, buffer), rows);
 }
@@ -0,0 +1,969 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "filter.h"
+#include "record.h"
+#include "ring.h"
+#include "socket.h"
+#include "udplogger.h"
+#include "udploggerclient.h"
+
+
+/*
+ * Structure that is used to store information about the logging hosts that
+ * a client is currently sending beacons to.  One host per structure, arranged
+ * as a singly-linked list.
+ */
+struct log_host_t {
+	struct sockaddr_in address;
+	struct log_host_t *next;
+};
+
+
+/*
+ * Structure that is used to store information about each file descriptor that the
+ * event loop of a client is watching (the log socket or packet ring, timers and any
+ * descriptors added by the owner of the client).  One descriptor per structure, arranged
+ * as a singly-linked list.  Watches that are removed while events are being dispatched
+ * are moved to a separate list and freed once the dispatch has finished, so that pending
+ * events never refer to freed memory.
+ */
+struct event_watch_t {
+	int fd;
+	int timer;
+	udplogger_event_callback_t callback;
+	void *argument;
+	struct event_watch_t *next;
+};
+
+
+/*
+ * Event loop sizing.
+ *
+ * MAXIMUM_EVENTS                        The maximum number of events that are dispatched per epoll_wait() call.
+ * RECEIVE_BATCH_SIZE                    The maximum number of log packets read per recvmmsg() call (and so the
+ *                                       maximum size of a batch).  The socket is level-triggered, so any packets
+ *                                       beyond this are read on the next pass (after timers and other descriptors
+ *                                       have had a chance to be dispatched).
+ */
+#define MAXIMUM_EVENTS                   16
+#define RECEIVE_BATCH_SIZE               RING_BATCH_SIZE
+
+
+/*
+ * Buffers used to receive a batch of log packets from the socket with recvmmsg().
+ */
+struct receive_buffers_t {
+	char data[RECEIVE_BATCH_SIZE][PACKET_MAXIMUM_SIZE];
+	char controls[RECEIVE_BATCH_SIZE][CMSG_SPACE(sizeof(struct timeval))];
+	struct iovec iovecs[RECEIVE_BATCH_SIZE];
+	struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+	struct log_record_t records[RECEIVE_BATCH_SIZE];
+};
+
+
+/*
+ * Structure that contains the configuration and state of a client.
+ *
+ * batch_callback   is called with each batch of accepted records (with batch_argument).
+ * beacon_interval  is the interval (seconds) between beacon transmissions.
+ * epoll_fd         is the epoll instance that all watched descriptors are registered with.
+ * filter           is the compiled filter program that records must match, or NULL.
+ * log_fd           is the log socket (used to send beacons and, unless a ring is in use, to receive).
+ * log_hosts        is the list of hosts that beacons are sent to.
+ * receive          holds the recvmmsg() buffers (allocated by udplogger_client_start).
+ * ring             is the packet ring that records are received from, or NULL.
+ * ring_interface   is the interface that a packet ring was requested on, or NULL.
+ * watches          is the list of watched descriptors; retired_watches are removed but not yet freed.
+ */
+struct udplogger_client_t {
+	udplogger_batch_callback_t batch_callback;
+	void *batch_argument;
+	uintmax_t beacon_interval;
+	int epoll_fd;
+	struct filter_t *filter;
+	int log_fd;
+	struct log_host_t *log_hosts;
+	struct receive_buffers_t *receive;
+	struct packet_ring_t *ring;
+	char *ring_interface;
+	struct event_watch_t *watches;
+	struct event_watch_t *retired_watches;
+};
+
+
+static int add_log_host(struct udplogger_client_t *, struct sockaddr_in *);
+static void broadcast_scan(struct udplogger_client_t *);
+static void dispatch_batch(struct log_record_t *, size_t, void *);
+static void receive_packets(struct udplogger_client_t *, int, void *);
+static void receive_ring(struct udplogger_client_t *, int, void *);
+static void send_beacons(struct udplogger_client_t *, int, void *);
+
+
+/**
+ * add_log_host(<client>, <log host sockaddr_in>)
+ *
+ * Simple utility function to take the host designated and add it to the end of the list
+ * of log hosts.  Returns 1 for success and 0 for failure.
+ **/
+static int add_log_host(struct udplogger_client_t *client, struct sockaddr_in *sin)
+{
+	struct log_host_t **log_host_ptr_ptr;
+
+	log_host_ptr_ptr = &client->log_hosts;
+	while (*log_host_ptr_ptr)
+	{
+		log_host_ptr_ptr = &(*log_host_ptr_ptr)->next;
+	}
+
+	*log_host_ptr_ptr = calloc(1, sizeof(struct log_host_t));
+	if (! *log_host_ptr_ptr)
+	{
+		perror("udploggerclient.c calloc(log_host)");
+		return 0;
+	}
+
+	(*log_host_ptr_ptr)->address.sin_family = sin->sin_family;
+	(*log_host_ptr_ptr)->address.sin_addr.s_addr = sin->sin_addr.s_addr;
+	(*log_host_ptr_ptr)->address.sin_port = sin->sin_port;
+
+#ifdef __DEBUG__
+	printf("udploggerclient.c debug: added target %s:%hu\n", inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
+#endif
+
+	return 1;
+}
+
+
+/**
+ * broadcast_scan(<client>)
+ *
+ * Iterates through all interfaces on the system and adds all broadcast addresses found to the
+ * list of log hosts of the client.
+ **/
+static void broadcast_scan(struct udplogger_client_t *client)
+{
+	int fd;
+	int i;
+	struct ifconf ifc;
+	struct ifreq *ifr;
+	int max_interfaces = 32; /* The maximum number of interfaces that we should obtain configuration for. */
+	int num_interfaces = 0; /* The number of interfaces that we have actually found. */
+	struct sockaddr_in sin;
+
+	ifc.ifc_len = max_interfaces * sizeof(struct ifreq);
+
+	ifc.ifc_buf = calloc(1, ifc.ifc_len);
+	if (! ifc.ifc_buf)
+	{
+		perror("udploggerclient.c calloc(ifc_buf)");
+		return;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+	{
+		perror("udploggerclient.c socket()");
+		free(ifc.ifc_buf);
+		return;
+	}
+
+	if (ioctl(fd, SIOCGIFCONF, &ifc) < 0)
+	{
+		perror("udploggerclient.c ioctl(SIOCGIFCONF)");
+		if (close(fd))
+		{
+			perror("udploggerclient.c close()");
+		}
+		free(ifc.ifc_buf);
+		return;
+	}
+
+	ifr = ifc.ifc_req;
+	num_interfaces = ifc.ifc_len / sizeof(struct ifreq);
+	for (i = 0; i++ < num_interfaces; ifr++)
+	{
+#ifdef __DEBUG__
+		printf("udploggerclient.c debug: found interface %s (%s)\n", ifr->ifr_name, inet_ntoa(((struct sockaddr_in *)&ifr->ifr_addr)->sin_addr));
+#endif
+
+		if (ifr->ifr_addr.sa_family != AF_INET)
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:   %s is not of the family AF_INET\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+
+		if (ioctl(fd, SIOCGIFFLAGS, ifr) < 0)
+		{
+			perror("udploggerclient.c ioctl(SIOCGIFFLAGS)");
+			continue;
+		}
+
+		if (!(ifr->ifr_flags & IFF_UP))
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:   %s flagged as down\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+		if (ifr->ifr_flags & IFF_LOOPBACK)
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:   %s is a loopback interface\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+		if (ifr->ifr_flags & IFF_POINTOPOINT)
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:   %s is a point-to-point interface\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+		if (!(ifr->ifr_flags & IFF_BROADCAST))
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:   %s does not have the broadcast flag set\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+
+		if (ioctl(fd, SIOCGIFBRDADDR, ifr) < 0)
+		{
+			perror("udploggerclient.c ioctl(SIOCGIFBRDADDR)");
+			continue;
+		}
+
+		memcpy(&sin, &(ifr->ifr_broadaddr), sizeof(ifr->ifr_broadaddr));
+		if (sin.sin_addr.s_addr == INADDR_ANY)
+		{
+#ifdef __DEBUG__
+			printf("udploggerclient.c debug:    %s is associated with INADDR_ANY\n", ifr->ifr_name);
+#endif
+			continue;
+		}
+
+		sin.sin_port = htons(UDPLOGGER_DEFAULT_PORT);
+		add_log_host(client, &sin);
+	}
+
+	if (close(fd))
+	{
+		perror("udploggerclient.c close()");
+	}
+	free(ifc.ifc_buf);
+}
+
+
+/**
+ * dispatch_batch(<records>, <count>, <client>)
+ *
+ * Splits each received record into its fields and runs it through the filter (if there is one), then
+ * passes the records that were accepted to the batch callback in one call.
+ **/
+static void dispatch_batch(struct log_record_t *records, size_t count, void *argument)
+{
+	struct log_record_t *accepted[RECEIVE_BATCH_SIZE];
+	size_t accepted_count = 0;
+	struct udplogger_client_t *client = argument;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		parse_record(&records[i]);
+		if ((! client->filter) || filter_match(client->filter, &records[i]))
+		{
+			accepted[accepted_count++] = &records[i];
+		}
+	}
+
+	if (accepted_count && client->batch_callback)
+	{
+		client->batch_callback(client, accepted, accepted_count, client->batch_argument);
+	}
+}
+
+
+/**
+ * receive_packets(<client>, <log socket>, <unused>)
+ *
+ * Event callback for the log socket.  Reads up to RECEIVE_BATCH_SIZE waiting log packets with a single
+ * recvmmsg() call, wraps each of them in a record view (stamped with the kernel receive time) and passes
+ * them to dispatch_batch.
+ **/
+static void receive_packets(struct udplogger_client_t *client, int fd, void *argument)
+{
+	struct cmsghdr *cmsg;
+	int i;
+	struct log_record_t *record;
+	struct receive_buffers_t *receive = client->receive;
+	int result;
+
+	result = recvmmsg(fd, receive->messages, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+	if (result < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			perror("udploggerclient.c recvmmsg()");
+		}
+		return;
+	}
+
+	for (i = 0; i < result; i++)
+	{
+		record = &receive->records[i];
+		record->data = receive->data[i];
+		record->length = receive->messages[i].msg_len;
+		if (record->length >= PACKET_MAXIMUM_SIZE)
+		{
+			record->length = PACKET_MAXIMUM_SIZE - 1;
+		}
+		/* udploggerd includes the terminating NUL in each packet; it is not part of the record. */
+		while (record->length > 0 && record->data[record->length - 1] == '\0')
+		{
+			record->length--;
+		}
+		record->data[record->length] = '\0';
+
+		cmsg = CMSG_FIRSTHDR(&receive->messages[i].msg_hdr);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP)
+		{
+			memcpy(&record->received, CMSG_DATA(cmsg), sizeof(record->received));
+		}
+		else
+		{
+			gettimeofday(&record->received, NULL);
+		}
+	}
+
+	dispatch_batch(receive->records, result, client);
+
+	for (i = 0; i < result; i++)
+	{
+		receive->messages[i].msg_hdr.msg_namelen = sizeof(receive->records[i].source);
+		receive->messages[i].msg_hdr.msg_controllen = sizeof(receive->controls[i]);
+	}
+}
+
+
+/**
+ * receive_ring(<client>, <ring descriptor>, <unused>)
+ *
+ * Event callback for the packet ring (see ring.c).  Passes every record in the blocks that are ready
+ * to dispatch_batch, straight from the ring.
+ **/
+static void receive_ring(struct udplogger_client_t *client, int fd, void *argument)
+{
+	ring_receive(client->ring, dispatch_batch, client);
+}
+
+
+/**
+ * send_beacons(<client>, <timer descriptor>, <unused>)
+ *
+ * Event callback for the beacon timer.  Sends a beacon to each of the logging hosts of the client.
+ **/
+static void send_beacons(struct udplogger_client_t *client, int fd, void *argument)
+{
+	char beacon[BEACON_PACKET_SIZE];
+	struct log_host_t *log_host_ptr;
+
+	#ifdef __DEBUG__
+		printf("udploggerclient.c debug: sending beacon\n");
+	#endif
+	memset(beacon, 0, BEACON_PACKET_SIZE);
+	strncpy(beacon, BEACON_STRING, BEACON_PACKET_SIZE - 1);
+
+	for (log_host_ptr = client->log_hosts; log_host_ptr; log_host_ptr = log_host_ptr->next)
+	{
+		sendto(client->log_fd, beacon, BEACON_PACKET_SIZE, 0, (struct sockaddr *)&log_host_ptr->address, sizeof(log_host_ptr->address));
+	}
+}
+
+
+/**
+ * udplogger_client_add_fd(<client>, <file descriptor>, <callback>, <callback argument>)
+ *
+ * Adds the given file descriptor to the set of descriptors watched by the event loop of the client.  The
+ * callback is called whenever the descriptor is readable.  Returns 1 for success and 0 for failure.
+ **/
+int udplogger_client_add_fd(struct udplogger_client_t *client, int fd, udplogger_event_callback_t callback, void *argument)
+{
+	struct epoll_event event;
+	struct event_watch_t *watch_ptr;
+
+	watch_ptr = calloc(1, sizeof(struct event_watch_t));
+	if (! watch_ptr)
+	{
+		perror("udploggerclient.c calloc(event_watch)");
+		return 0;
+	}
+	watch_ptr->fd = fd;
+	watch_ptr->callback = callback;
+	watch_ptr->argument = argument;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = watch_ptr;
+	if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+	{
+		perror("udploggerclient.c epoll_ctl(EPOLL_CTL_ADD)");
+		free(watch_ptr);
+		return 0;
+	}
+
+	watch_ptr->next = client->watches;
+	client->watches = watch_ptr;
+
+#ifdef __DEBUG__
+	printf("udploggerclient.c debug: watching fd %d\n", fd);
+#endif
+
+	return 1;
+}
+
+
+/**
+ * udplogger_client_add_host(<client>, <host specification>)
+ *
+ * Resolves a <host>[:<port>] specification and adds each of its IPv4 addresses to the list of hosts
+ * that beacons are sent to (the default port is UDPLOGGER_DEFAULT_PORT).  If no hosts are added before
+ * udplogger_client_start, beacons are sent to the broadcast address of every interface.  Returns 1 for
+ * success and 0 for failure.
+ **/
+int udplogger_client_add_host(struct udplogger_client_t *client, const char *specification)
+{
+	char *char_ptr;
+	struct hostent *hostent_ptr;
+	char *hostname_tmp;
+	int j;
+	struct sockaddr_in sin;
+	uintmax_t uint_tmp;
+
+	char_ptr = strstr(specification, ":");
+	if (char_ptr == specification)
+	{
+		fprintf(stderr, "udploggerclient.c invalid host specification '%s'\n", specification);
+		return 0;
+	}
+#ifdef __DEBUG__
+	printf("udploggerclient.c debug: parsing host target '%s'\n", specification);
+#endif
+
+	if (char_ptr)
+	{
+		hostname_tmp = strndup(specification, (char_ptr - specification));
+	}
+	else
+	{
+		hostname_tmp = strdup(specification);
+	}
+	if (! hostname_tmp)
+	{
+		fprintf(stderr, "udploggerclient.c could not allocate memory to record host '%s'\n", specification);
+		return 0;
+	}
+#ifdef __DEBUG__
+	printf("udploggerclient.c debug:   determined hostname '%s'\n", hostname_tmp);
+#endif
+
+	if (char_ptr && *char_ptr == ':')
+	{
+		char_ptr++;
+		uint_tmp = strtoumax(char_ptr, 0, 10);
+		if (! uint_tmp || uint_tmp > 0xFFFF)
+		{
+			fprintf(stderr, "udploggerclient.c invalid port in host specification '%s'\n", specification);
+			free(hostname_tmp);
+			return 0;
+		}
+	}
+	else
+	{
+		uint_tmp = UDPLOGGER_DEFAULT_PORT;
+	}
+#ifdef __DEBUG__
+	printf("udploggerclient.c debug:   determined port '%lu'\n", uint_tmp);
+#endif
+
+	hostent_ptr = gethostbyname(hostname_tmp);
+	if (! hostent_ptr)
+	{
+		fprintf(stderr, "udploggerclient.c could not find the IP address of the host '%s'\n", hostname_tmp);
+		free(hostname_tmp);
+		return 0;
+	}
+	free(hostname_tmp);
+
+	for (j = 0; hostent_ptr->h_addr_list[j] != NULL; j++)
+	{
+#ifdef __DEBUG__
+		printf("udploggerclient.c debug:     considering address '%s', family '%hu'\n", inet_ntoa(*(struct in_addr *)(hostent_ptr->h_addr_list[j])), hostent_ptr->h_addrtype);
+#endif
+		if (hostent_ptr->h_addrtype == AF_INET)
+		{
+			memset(&sin, 0, sizeof(sin));
+			sin.sin_family = hostent_ptr->h_addrtype;
+			sin.sin_addr.s_addr = ((struct in_addr *)(hostent_ptr->h_addr_list[j]))->s_addr;
+			sin.sin_port = htons(uint_tmp);
+
+			if (! add_log_host(client, &sin))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * udplogger_client_add_timer(<client>, <interval>, <callback>, <callback argument>)
+ *
+ * Creates a periodic timer that first fires <interval> milliseconds from now and every <interval>
+ * milliseconds thereafter, calling the callback each time.  Returns the timer descriptor (which may
+ * be passed to udplogger_client_remove) or -1 on failure.
+ **/
+int udplogger_client_add_timer(struct udplogger_client_t *client, uintmax_t interval, udplogger_event_callback_t callback, void *argument)
+{
+	int fd;
+	struct itimerspec timer_spec;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		perror("udploggerclient.c timerfd_create()");
+		return -1;
+	}
+
+	timer_spec.it_interval.tv_sec = interval / 1000;
+	timer_spec.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+	timer_spec.it_value = timer_spec.it_interval;
+	if (timerfd_settime(fd, 0, &timer_spec, NULL))
+	{
+		perror("udploggerclient.c timerfd_settime()");
+		close(fd);
+		return -1;
+	}
+
+	if (! udplogger_client_add_fd(client, fd, callback, argument))
+	{
+		close(fd);
+		return -1;
+	}
+	client->watches->timer = 1;
+
+	return fd;
+}
+
+
+/**
+ * udplogger_client_fd(<client>)
+ *
+ * Returns the epoll descriptor of the client, which is readable whenever udplogger_client_poll has
+ * work to do.  This allows the client to be driven from another event loop.
+ **/
+int udplogger_client_fd(struct udplogger_client_t *client)
+{
+	return client->epoll_fd;
+}
+
+
+/**
+ * udplogger_client_free(<client>)
+ *
+ * Closes every descriptor owned by the client (the log socket, packet ring and timers; descriptors
+ * added with udplogger_client_add_fd are left open) and releases it.
+ **/
+void udplogger_client_free(struct udplogger_client_t *client)
+{
+	struct log_host_t *log_host_ptr;
+	struct event_watch_t *watch_ptr;
+
+	while (client->watches)
+	{
+		watch_ptr = client->watches;
+		client->watches = watch_ptr->next;
+		if (watch_ptr->timer)
+		{
+			close(watch_ptr->fd);
+		}
+		free(watch_ptr);
+	}
+	while (client->retired_watches)
+	{
+		watch_ptr = client->retired_watches;
+		client->retired_watches = watch_ptr->next;
+		free(watch_ptr);
+	}
+	while (client->log_hosts)
+	{
+		log_host_ptr = client->log_hosts;
+		client->log_hosts = log_host_ptr->next;
+		free(log_host_ptr);
+	}
+	if (client->ring)
+	{
+		ring_close(client->ring);
+	}
+	if (client->log_fd >= 0)
+	{
+		close(client->log_fd);
+	}
+	close(client->epoll_fd);
+	filter_free(client->filter);
+	free(client->receive);
+	free(client->ring_interface);
+	free(client);
+}
+
+
+/**
+ * udplogger_client_new()
+ *
+ * Creates a new client with the default configuration.  Returns the client or NULL on failure.
+ **/
+struct udplogger_client_t *udplogger_client_new(void)
+{
+	struct udplogger_client_t *client;
+
+	client = calloc(1, sizeof(struct udplogger_client_t));
+	if (! client)
+	{
+		perror("udploggerclient.c calloc(client)");
+		return NULL;
+	}
+	client->beacon_interval = UDPLOGGER_CLIENT_DEFAULT_BEACON_INTERVAL;
+	client->log_fd = -1;
+
+	client->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (client->epoll_fd < 0)
+	{
+		perror("udploggerclient.c epoll_create1()");
+		free(client);
+		return NULL;
+	}
+	return client;
+}
+
+
+/**
+ * udplogger_client_poll(<client>, <timeout>)
+ *
+ * Runs one step of the event loop of the client: waits up to <timeout> milliseconds (-1 to wait
+ * indefinitely, 0 to not wait at all) for the log socket, timers or other watched descriptors to
+ * become ready, then dispatches them (which calls the batch callback for any records received).
+ * Returns the number of events dispatched (0 on timeout or interruption by a signal) or -1 on error.
+ **/
+int udplogger_client_poll(struct udplogger_client_t *client, int timeout)
+{
+	struct epoll_event events[MAXIMUM_EVENTS];
+	uint64_t expirations;
+	int i;
+	int result;
+	struct event_watch_t *watch_ptr;
+
+	result = epoll_wait(client->epoll_fd, events, MAXIMUM_EVENTS, timeout);
+	if (result < 0)
+	{
+		if (errno == EINTR)
+		{
+			return 0;
+		}
+		perror("udploggerclient.c epoll_wait()");
+		return -1;
+	}
+
+	for (i = 0; i < result; i++)
+	{
+		watch_ptr = events[i].data.ptr;
+		if (watch_ptr->fd < 0)
+		{
+			/* This watch was removed by a callback earlier in this dispatch. */
+			continue;
+		}
+		if (watch_ptr->timer)
+		{
+			if (read(watch_ptr->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			{
+				continue;
+			}
+		}
+		watch_ptr->callback(client, watch_ptr->fd, watch_ptr->argument);
+	}
+
+	while (client->retired_watches)
+	{
+		watch_ptr = client->retired_watches;
+		client->retired_watches = watch_ptr->next;
+		free(watch_ptr);
+	}
+
+	return result;
+}
+
+
+/**
+ * udplogger_client_remove(<client>, <file descriptor>)
+ *
+ * Stops watching the given file descriptor.  Timers created by udplogger_client_add_timer are closed
+ * as well; any other descriptor is left open for the caller to deal with.  Safe to call from within a
+ * callback.  Returns 1 for success and 0 if the descriptor was not being watched.
+ **/
+int udplogger_client_remove(struct udplogger_client_t *client, int fd)
+{
+	struct event_watch_t **watch_ptr_ptr;
+	struct event_watch_t *watch_ptr;
+
+	for (watch_ptr_ptr = &client->watches; *watch_ptr_ptr; watch_ptr_ptr = &(*watch_ptr_ptr)->next)
+	{
+		if ((*watch_ptr_ptr)->fd == fd)
+		{
+			watch_ptr = *watch_ptr_ptr;
+			*watch_ptr_ptr = watch_ptr->next;
+
+			if (epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, fd, NULL))
+			{
+				perror("udploggerclient.c epoll_ctl(EPOLL_CTL_DEL)");
+			}
+			if (watch_ptr->timer && close(fd))
+			{
+				perror("udploggerclient.c close()");
+			}
+
+			watch_ptr->fd = -1;
+			watch_ptr->next = client->retired_watches;
+			client->retired_watches = watch_ptr;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * udplogger_client_set_batch_callback(<client>, <callback>, <callback argument>)
+ *
+ * Sets the function that is called with each batch of received (and accepted) records.
+ **/
+void udplogger_client_set_batch_callback(struct udplogger_client_t *client, udplogger_batch_callback_t callback, void *argument)
+{
+	client->batch_callback = callback;
+	client->batch_argument = argument;
+}
+
+
+/**
+ * udplogger_client_set_beacon_interval(<client>, <interval>)
+ *
+ * Sets the interval (in seconds) between beacon transmissions (at most UINT_MAX / 1000, so that it can
+ * be counted in milliseconds).  Must be called before udplogger_client_start.  Returns 1 for success or
+ * 0 for an invalid interval.
+ **/
+int udplogger_client_set_beacon_interval(struct udplogger_client_t *client, uintmax_t interval)
+{
+	if (! interval || interval > UINT_MAX / 1000)
+	{
+		fprintf(stderr, "udploggerclient.c invalid beacon interval '%" PRIuMAX "'\n", interval);
+		return 0;
+	}
+	client->beacon_interval = interval;
+	return 1;
+}
+
+
+/**
+ * udplogger_client_set_filter(<client>, <filter expression>)
+ *
+ * Compiles the given filter expression (see filter.c) and only passes records that match it on to
+ * the batch callback.  Replaces any previous filter; a NULL expression removes the filter.  Returns 1
+ * for success or 0 if the expression is invalid.
+ **/
+int udplogger_client_set_filter(struct udplogger_client_t *client, const char *expression)
+{
+	struct filter_t *filter = NULL;
+
+	if (expression)
+	{
+		filter = filter_compile(expression);
+		if (! filter)
+		{
+			return 0;
+		}
+	}
+	filter_free(client->filter);
+	client->filter = filter;
+	return 1;
+}
+
+
+/**
+ * udplogger_client_set_ring(<client>, <interface>)
+ *
+ * Requests that records are received through a memory-mapped packet ring on the given interface (see
+ * ring.c) rather than through the log socket.  Must be called before udplogger_client_start.  Returns 1
+ * for success or 0 for failure.
+ **/
+int udplogger_client_set_ring(struct udplogger_client_t *client, const char *interface)
+{
+	char *tmp = NULL;
+
+	if (interface)
+	{
+		tmp = strdup(interface);
+		if (! tmp)
+		{
+			perror("udploggerclient.c strdup(ring_interface)");
+			return 0;
+		}
+	}
+	free(client->ring_interface);
+	client->ring_interface = tmp;
+	return 1;
+}
+
+
+/**
+ * udplogger_client_start(<client>)
+ *
+ * Creates the log socket (and packet ring, if one was requested), sends the first beacon and starts the
+ * beacon timer.  If no hosts have been added, the broadcast address of each interface is used.  Returns
+ * 1 for success or 0 for failure.
+ **/
+int udplogger_client_start(struct udplogger_client_t *client)
+{
+	struct sock_filter drop_code[] = { BPF_STMT(BPF_RET + BPF_K, 0) };
+	struct sock_fprog drop_program;
+	int i;
+	struct sockaddr_in local;
+	socklen_t local_length = sizeof(local);
+	int yes = 1;
+
+	if (! client->log_hosts)
+	{
+		/* No target hosts have been passed in.  Default is to add all broadcast addresses. */
+		broadcast_scan(client);
+	}
+	if (! client->log_hosts)
+	{
+		/* Final sanity check.  If we don't have any log hosts to target, then don't continue. */
+		fprintf(stderr, "udploggerclient.c no log targets\n");
+		return 0;
+	}
+
+	client->log_fd = bind_socket(0, 0);
+	if (client->log_fd < 0)
+	{
+		fprintf(stderr, "udploggerclient.c could not setup socket\n");
+		return 0;
+	}
+
+	if (client->ring_interface)
+	{
+		/*
+		 * Read log packets from a memory-mapped ring instead of the socket.  The socket is still
+		 * used to send beacons (and so determines the port that log packets are sent to), but the
+		 * kernel is told to drop everything that arrives on it so that its queue does not fill up.
+		 */
+		if (getsockname(client->log_fd, (struct sockaddr *)&local, &local_length) == 0)
+		{
+			client->ring = ring_open(client->ring_interface, ntohs(local.sin_port));
+		}
+		if (client->ring)
+		{
+			drop_program.len = 1;
+			drop_program.filter = drop_code;
+			if (setsockopt(client->log_fd, SOL_SOCKET, SO_ATTACH_FILTER, &drop_program, sizeof(drop_program)))
+			{
+				perror("udploggerclient.c setsockopt(SO_ATTACH_FILTER)");
+			}
+			if (! udplogger_client_add_fd(client, client->ring->fd, receive_ring, NULL))
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "udploggerclient.c packet ring unavailable on '%s', falling back to socket receive\n", client->ring_interface);
+		}
+	}
+	if (! client->ring)
+	{
+		client->receive = calloc(1, sizeof(struct receive_buffers_t));
+		if (! client->receive)
+		{
+			perror("udploggerclient.c calloc(receive)");
+			return 0;
+		}
+		for (i = 0; i < RECEIVE_BATCH_SIZE; i++)
+		{
+			client->receive->iovecs[i].iov_base = client->receive->data[i];
+			client->receive->iovecs[i].iov_len = PACKET_MAXIMUM_SIZE;
+			client->receive->messages[i].msg_hdr.msg_iov = &client->receive->iovecs[i];
+			client->receive->messages[i].msg_hdr.msg_iovlen = 1;
+			client->receive->messages[i].msg_hdr.msg_name = &client->receive->records[i].source;
+			client->receive->messages[i].msg_hdr.msg_namelen = sizeof(client->receive->records[i].source);
+			client->receive->messages[i].msg_hdr.msg_control = client->receive->controls[i];
+			client->receive->messages[i].msg_hdr.msg_controllen = sizeof(client->receive->controls[i]);
+		}
+
+		if (setsockopt(client->log_fd, SOL_SOCKET, SO_TIMESTAMP, &yes, sizeof(yes)))
+		{
+			perror("udploggerclient.c setsockopt(SO_TIMESTAMP)");
+		}
+		if (! udplogger_client_add_fd(client, client->log_fd, receive_packets, NULL))
+		{
+			return 0;
+		}
+	}
+
+	/* Broadcast a beacon immediately on startup, then once every beacon_interval seconds. */
+	send_beacons(client, -1, NULL);
+	if (udplogger_client_add_timer(client, client->beacon_interval * 1000, send_beacons, NULL) < 0)
+	{
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,81 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __UDPLOGGERCLIENT_H__
+#define __UDPLOGGERCLIENT_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "record.h"
+
+
+/*
+ * Embeddable udplogger client API (libudploggerclient.so).
+ *
+ * A udplogger_client_t holds everything needed to receive log records from udploggerd hosts: the log
+ * socket (or packet ring), the list of hosts that beacons are sent to, the beacon timer, the optional
+ * filter program and an epoll-based event loop.  The owner of the context drives it by calling
+ * udplogger_client_poll(), either in a loop of its own or whenever the descriptor returned by
+ * udplogger_client_fd() becomes readable (so that it can be nested inside another event loop).
+ * Accepted records are delivered in batches to the batch callback.
+ *
+ *   client = udplogger_client_new();
+ *   udplogger_client_add_host(client, "loghost:43824");
+ *   udplogger_client_set_batch_callback(client, handle_records, NULL);
+ *   udplogger_client_start(client);
+ *   while (udplogger_client_poll(client, -1) >= 0);
+ *
+ * See udploggerclientlib.c for a complete example.
+ */
+struct udplogger_client_t;
+
+
+/*
+ * Callback types.  Batch callbacks receive an array of pointers to the records that were accepted in
+ * one receive pass; the records are only valid until the callback returns.  Event callbacks receive
+ * the descriptor that became readable (or the timer that expired).
+ */
+typedef void (*udplogger_batch_callback_t)(struct udplogger_client_t *, struct log_record_t **, size_t, void *);
+typedef void (*udplogger_event_callback_t)(struct udplogger_client_t *, int, void *);
+
+
+/* The default interval (seconds) at which beacons are sent. */
+#define UDPLOGGER_CLIENT_DEFAULT_BEACON_INTERVAL 30UL
+
+
+int udplogger_client_add_fd(struct udplogger_client_t *, int, udplogger_event_callback_t, void *);
+int udplogger_client_add_host(struct udplogger_client_t *, const char *);
+int udplogger_client_add_timer(struct udplogger_client_t *, uintmax_t, udplogger_event_callback_t, void *);
+int udplogger_client_fd(struct udplogger_client_t *);
+void udplogger_client_free(struct udplogger_client_t *);
+struct udplogger_client_t *udplogger_client_new(void);
+int udplogger_client_poll(struct udplogger_client_t *, int);
+int udplogger_client_remove(struct udplogger_client_t *, int);
+void udplogger_client_set_batch_callback(struct udplogger_client_t *, udplogger_batch_callback_t, void *);
+int udplogger_client_set_beacon_interval(struct udplogger_client_t *, uintmax_t);
+int udplogger_client_set_filter(struct udplogger_client_t *, const char *);
+int udplogger_client_set_ring(struct udplogger_client_t *, const char *);
+int udplogger_client_start(struct udplogger_client_t *);
+
+#endif
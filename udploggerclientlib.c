@@ -22,317 +22,236 @@
  * THE SOFTWARE.
  **/
 
-#include <arpa/inet.h>
-#include <errno.h>
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
 #include <getopt.h>
 #include <inttypes.h>
-#include <net/if.h>
-#include <netdb.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <unistd.h>
 #include "udplogger.h"
+#include "record.h"
+#include "shmring.h"
+#include "udploggerclient.h"
 #include "udploggerclientlib.h"
-#include "socket.h"
+#include "udploggerplugin.h"
 
 
 /*
- * Please note that this file cannot link successfully by itself (or even with just socket.o).
- * This library implements a framework for sending beacons and receiving log information from
- * udploggerd logging hosts, but it is not complete in and of itself.  To implement a full client, this
- * library should be linked with another source file that gives an implementation of the function
- * log_packet_hook.
- *
- * Preferrably the log_packet_hook function should be kept simple enough to be inlined.
+ * Please note that this file cannot link successfully by itself (or even with just udploggerclient.o).
+ * This library implements a framework for command-line udplogger clients on top of the client API in
+ * udploggerclient.c (option parsing, signal handling and a main loop), but it is not complete in and of
+ * itself.  To implement a full client, this library should be linked with another source file that gives
+ * an implementation of the hook functions declared in udploggerclientlib.h.
  *
  * See 'udploggerc.c' for a simple example.
  */
 
 
 /*
- * Give a strndup prototype to stop compiler warnings.  GNU libraries give it to us,
- * but ISO C90 doesn't allow us to use _GNU_SOURCE before including <string.h>.
+ * Clients implement log_packet_hook, log_record_hook or both, so both are weak references; whichever
+ * of them are left undefined are null and are not called.
  */
-char *strndup(const char *, size_t);
+#pragma weak log_packet_hook
+#pragma weak log_record_hook
 
 
 /*
- * Structure that is used to store information about the logging hosts that
- * the running instance of this udplogger client is currently sending beacons to.  One host
- * per structure, arranged as a singly-linked list.
+ * Structure that is used to store the callback of each descriptor or timer that has been added with
+ * add_event_fd or add_event_timer.  The client API passes a pointer to this structure back to
+ * handle_event, which calls the hook-style callback.  One descriptor per structure, arranged as a
+ * singly-linked list.
  */
-struct log_host_t {
-	struct sockaddr_in address;
-	struct log_host_t *next;
+struct event_hook_t {
+	int fd;
+	void (*callback)(int);
+	struct event_hook_t *next;
 };
 
 
 /*
- * Structure that holds a collection of signal flags.  A signal will be a member
- * of this set if the signal has been received/has not been dealt with.  This
- * set should be checked for signals to be handled and if they are present,
- * the condition should be handled and the signal should be removed from the set.
- */
-static sigset_t signal_flags;
-
-
-/*
- * Structure that contains configuration information for the running instance
- * of this udplogger library.
- */
-struct udploggerclientlib_configuration_t {
-	uintmax_t beacon_interval;
-	struct log_host_t log_host;
-} udploggerclientlib_conf;
-
-
-/*
- * Default configuration values.  Used if not over-ridden by a command-line parameter.
- *
- * DEFAULT_BEACON_INTERVAL               The default interval at which beacons should be dispatched.
+ * Structure that is used to store each plugin that has been loaded with --plugin (see udploggerplugin.h):
+ * the handle of the shared object, its plugin description and the state that its open function returned.
+ * Arranged as a singly-linked list in the order in which the plugins were given.
  */
-#define DEFAULT_BEACON_INTERVAL          30UL
+struct plugin_t {
+	void *handle;
+	const struct udplogger_plugin_t *plugin;
+	void *state;
+	struct plugin_t *next;
+};
 
 
-int add_log_host(struct sockaddr_in *);
 int add_option(const char *, const int, const char);
 int arguments_parse(int, char **);
-void broadcast_scan();
-static void sig_handler(int);
+static void close_plugins();
+static void dispatch_records(struct udplogger_client_t *, struct log_record_t **, size_t, void *);
+static void handle_event(struct udplogger_client_t *, int, void *);
+static int load_plugin(const char *);
+static int publish_records(const char *);
+static void receive_signals(struct udplogger_client_t *, int, void *);
 
 
+static struct udplogger_client_t *client = NULL;
+static struct event_hook_t *event_hooks = NULL;
 static struct option *long_options = NULL;
+static struct plugin_t *plugins = NULL;
+static struct shm_ring_t *published = NULL;
+static int running = 1;
 char *short_options = NULL;
 
 
 /**
  * main()
  *
- * Initializes the program configuration and state, then enters a main loop that reads log entries
- * (calling the log_packet_hook function on each) and sends beacon packets.
+ * Initializes the program configuration and state, then runs the client event loop until SIGTERM is
+ * received.  The loop waits for log entries (calling the log_record_hook and/or log_packet_hook function
+ * on each), signals, beacon timers and any descriptors or timers that have been registered by the client.
  **/
 int main (int argc, char **argv)
 {
-	fd_set all_set;
-	sigset_t blocked_signals;
-	char beacon[BEACON_PACKET_SIZE];
-	char buffer[PACKET_MAXIMUM_SIZE];
-	int fd;
-	struct log_host_t *log_host_ptr;
-	sigset_t original_signal_mask;
-	fd_set read_set;
+	sigset_t handled_signals;
 	int result = 0;
-	struct sockaddr_in sender;
-	socklen_t senderlen = sizeof(sender);
+	int signal_fd;
 
-	/*
-	 * Create a signal set that consists of all of the signals except for SIGKILL,
-	 * SIGSEGV, and SIGSTOP.  Do not include those signals because blocking them
-	 * doesn't work (for SIGKILL and SIGSTOP) or they are too important to block
-	 * (for SIGSEGV).
-	 */
-	if (sigfillset(&blocked_signals))
+	client = udplogger_client_new();
+	if (! client)
 	{
-		perror("udploggerclientlib.c sigfillset()");
-		return -1;
-	}
-	if (sigdelset(&blocked_signals, SIGKILL) || sigdelset(&blocked_signals, SIGSEGV) || sigdelset(&blocked_signals, SIGSTOP))
-	{
-		perror("udploggerclientlib.c sigdelset()");
 		return -1;
 	}
 
 	/*
-	 * Block all of the signals in blocked_signals from being delivered to this
-	 * process.  Save the current/original signal mask of this process
-	 * to original_signal_mask.
+	 * Block the signals that we handle ourselves so that they are only ever delivered
+	 * through the signal descriptor, which is watched by the event loop just like the
+	 * log socket.  All other signals keep their default dispositions.
 	 */
-	if (sigemptyset(&original_signal_mask))
+	if (sigemptyset(&handled_signals) || sigaddset(&handled_signals, SIGHUP) || sigaddset(&handled_signals, SIGTERM))
 	{
-		perror("udploggerclientlib.c sigemptyset()");
+		perror("udploggerclientlib.c sigaddset()");
 		return -1;
 	}
-	if (sigprocmask(SIG_BLOCK, &blocked_signals, &original_signal_mask))
+	if (sigprocmask(SIG_BLOCK, &handled_signals, NULL))
 	{
 		perror("udploggerclientlib.c sigprocmask()");
 		return -1;
 	}
-
-	/*
-	 * Clear out the list of signals that have been received by this process,
-	 * so that every signal reads as "not received".
-	 */
-	if (sigemptyset(&signal_flags))
-	{
-		perror("udploggerclientlib.c sigemptyset()");
-		return -1;
-	}
-
-	/*
-	 * Install signal handlers that will record the receipt of signals that
-	 * we are interested in.
-	 */
-	if (signal(SIGALRM, sig_handler) == SIG_ERR)
+	signal_fd = signalfd(-1, &handled_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
 	{
-		perror("udploggerclientlib.c signal(SIGALRM)");
+		perror("udploggerclientlib.c signalfd()");
 		return -1;
 	}
-	if (signal(SIGTERM, sig_handler) == SIG_ERR)
+	if (! udplogger_client_add_fd(client, signal_fd, receive_signals, NULL))
 	{
-		perror("udploggerclientlib.c signal(SIGTERM)");
 		return -1;
 	}
-	if (signal(SIGHUP, sig_handler) == SIG_ERR)
+
+	if (! log_packet_hook && ! log_record_hook)
 	{
-		perror("udploggerclientlib.c signal(SIGHUP)");
+		fprintf(stderr, "udploggerclientlib.c the client implements neither log_packet_hook nor log_record_hook\n");
 		return -1;
 	}
 
 	result = arguments_parse(argc, argv);
 	if (result <= 0)
 	{
+		close_plugins();
 		return result;
 	}
 
-#ifdef __DEBUG__
-	printf("udploggerclientlib.c debug: parameter beacon_interval = '%lu'\n", udploggerclientlib_conf.beacon_interval);
-	log_host_ptr = &udploggerclientlib_conf.log_host;
-	while (log_host_ptr)
-	{
-		printf("udploggerclientlib.c debug: logging host %s:%u\n", inet_ntoa(log_host_ptr->address.sin_addr), ntohs(log_host_ptr->address.sin_port));
-		log_host_ptr = log_host_ptr->next;
-	}
-#endif
-
-	fd = bind_socket(0, 0);
-	if (fd < 0)
+	udplogger_client_set_batch_callback(client, dispatch_records, NULL);
+	if (! udplogger_client_start(client))
 	{
-		fprintf(stderr, "udploggerclientlib.c could not setup socket\n");
+		close_plugins();
 		return -1;
 	}
 
-	strncpy(beacon, BEACON_STRING, BEACON_PACKET_SIZE);
-	beacon[BEACON_PACKET_SIZE - 1] = '\0';
-
-	/*
-	 * Send an ALARM signal to ourselves so that we immediately broadcast a beacon
-	 * on startup.  Note that this signal is currently blocked but will be delivered
-	 * as soon as we unblock signals (i.e. on pselect).
-	 */
-	raise(SIGALRM);
-
-	FD_ZERO(&all_set);
-	FD_SET(fd, &all_set);
-	while (1)
+	while (running)
 	{
-		read_set = all_set;
-		/*
-		 * Wait for either a log packet to arrive or the receipt of a
-		 * signal.
-		 */
-		result = pselect(fd+1, &read_set, NULL, NULL, NULL, &original_signal_mask);
-
-		if (result < 0)
-		{
-			/*
-			 * If we were not interrupted by a signal, die with a pselect() error.
-			 */
-			if (errno != EINTR)
-			{
-				perror("udploggerclientlib.c pselect()");
-				return -1;
-			}
-
-			/*
-			 * If we have received a SIGALRM, send out a beacon and then start another
-			 * alarm counter so that it will trigger to send out the next one.
-			 */
-			if (sigismember(&signal_flags, SIGALRM))
-			{
-				#ifdef __DEBUG__
-					printf("udploggerclientlib.c debug: ALRM received, sending beacon\n");
-				#endif
-				log_host_ptr = &udploggerclientlib_conf.log_host;
-				do
-				{
-					sendto(fd, beacon, BEACON_PACKET_SIZE, 0, (struct sockaddr *)&log_host_ptr->address, sizeof(log_host_ptr->address));
-				} while ((log_host_ptr = log_host_ptr->next));
-				alarm(udploggerclientlib_conf.beacon_interval);
-			}
-
-			handle_signal_hook(&signal_flags);
-		}
-		else if (FD_ISSET(fd, &read_set))
-		{
-			if (recvfrom(fd, buffer, PACKET_MAXIMUM_SIZE, 0, (struct sockaddr *)&sender, &senderlen) >= 0)
-			{
-				buffer[PACKET_MAXIMUM_SIZE - 1] = '\0';
-				log_packet_hook(&sender, buffer);
-			}
-		}
-
-		if (sigismember(&signal_flags, SIGTERM))
-		{
-			#ifdef __DEBUG__
-				printf("udploggerclientlib.c debug: exiting normally\n");
-			#endif
-			break;
-		}
-
-		/*
-		 * Clear out the list of signals that have been received by this process,
-		 * so that every signal reads as "not received".
-		 */
-		if (sigemptyset(&signal_flags))
+		if (udplogger_client_poll(client, -1) < 0)
 		{
-			perror("udploggerclientlib.c sigemptyset()");
+			close_plugins();
 			return -1;
 		}
 	}
 
+#ifdef __DEBUG__
+	printf("udploggerclientlib.c debug: exiting normally\n");
+#endif
+	close_plugins();
+	if (published)
+	{
+		shm_ring_close(published);
+	}
+	udplogger_client_free(client);
 	return 0;
 }
 
 
 /**
- * add_log_host(<log host sockaddr_in>)
+ * add_event_fd(<file descriptor>, <callback>)
  *
- * Simple utility function to take the host designated and add it to the list
- * of log hosts.  Returns 1 for success and 0 for failure.
+ * Adds the given file descriptor to the set of descriptors watched by the main loop.  The callback is
+ * called (with the descriptor as its argument) whenever the descriptor is readable.  Returns 1 for
+ * success and 0 for failure.
  **/
-int add_log_host(struct sockaddr_in *sin)
+int add_event_fd(int fd, void (*callback)(int))
 {
-	struct log_host_t *log_host_ptr;
+	struct event_hook_t *hook_ptr;
 
-	log_host_ptr = &udploggerclientlib_conf.log_host;
-	while (log_host_ptr->next)
+	hook_ptr = calloc(1, sizeof(struct event_hook_t));
+	if (! hook_ptr)
 	{
-		log_host_ptr = log_host_ptr->next;
+		perror("udploggerclientlib.c calloc(event_hook)");
+		return 0;
 	}
+	hook_ptr->fd = fd;
+	hook_ptr->callback = callback;
 
-	if (log_host_ptr->address.sin_family)
+	if (! udplogger_client_add_fd(client, fd, handle_event, hook_ptr))
 	{
-		log_host_ptr->next = calloc(1, sizeof(struct log_host_t));
-		if (! log_host_ptr->next)
-		{
-			perror("udploggerclientlib.c calloc(log_host)");
-			return 0;
-		}
-		log_host_ptr = log_host_ptr->next;
+		free(hook_ptr);
+		return 0;
 	}
+	hook_ptr->next = event_hooks;
+	event_hooks = hook_ptr;
+	return 1;
+}
 
-	log_host_ptr->address.sin_family = sin->sin_family;
-	log_host_ptr->address.sin_addr.s_addr = sin->sin_addr.s_addr;
-	log_host_ptr->address.sin_port = sin->sin_port;
 
-#ifdef __DEBUG__
-	printf("udploggerclientlib.c debug: added target %s:%hu\n", inet_ntoa(log_host_ptr->address.sin_addr), ntohs(log_host_ptr->address.sin_port));
-#endif
+/**
+ * add_event_timer(<interval>, <callback>)
+ *
+ * Creates a periodic timer that first fires <interval> milliseconds from now and every <interval>
+ * milliseconds thereafter, calling the callback (with the timer descriptor as its argument) each time.
+ * Returns the timer descriptor (which may be passed to remove_event) or -1 on failure.
+ **/
+int add_event_timer(uintmax_t interval, void (*callback)(int))
+{
+	struct event_hook_t *hook_ptr;
 
-	return 1;
+	hook_ptr = calloc(1, sizeof(struct event_hook_t));
+	if (! hook_ptr)
+	{
+		perror("udploggerclientlib.c calloc(event_hook)");
+		return -1;
+	}
+	hook_ptr->callback = callback;
+
+	hook_ptr->fd = udplogger_client_add_timer(client, interval, handle_event, hook_ptr);
+	if (hook_ptr->fd < 0)
+	{
+		free(hook_ptr);
+		return -1;
+	}
+	hook_ptr->next = event_hooks;
+	event_hooks = hook_ptr;
+	return hook_ptr->fd;
 }
 
 
@@ -398,10 +317,10 @@ int add_option(const char *long_option, const int has_arg, const char short_opti
 			tmp = realloc(short_options, (j + 1 + 3) * sizeof(char));
 			if (tmp)
 			{
-				short_options[j] = short_option;
-				short_options[j+1] = ':';
-				short_options[j+2] = ':';
-				short_options[j+3] = '\0';
+				tmp[j] = short_option;
+				tmp[j+1] = ':';
+				tmp[j+2] = ':';
+				tmp[j+3] = '\0';
 			}
 		}
 		else if (has_arg == no_argument)
@@ -409,8 +328,8 @@ int add_option(const char *long_option, const int has_arg, const char short_opti
 			tmp = realloc(short_options, (j + 1 + 1) * sizeof(char));
 			if (tmp)
 			{
-				short_options[j] = short_option;
-				short_options[j+1] = '\0';
+				tmp[j] = short_option;
+				tmp[j+1] = '\0';
 			}
 		}
 		if (tmp)
@@ -451,18 +370,14 @@ int add_option(const char *long_option, const int has_arg, const char short_opti
  **/
 int arguments_parse(int argc, char **argv)
 {
-	char *char_ptr;
-	struct hostent *hostent_ptr;
-	char *hostname_tmp;
 	int i, j;
-
-	struct sockaddr_in sin;
+	int filtered = 0;
 	uintmax_t uint_tmp;
 
-	/* Initialize our configuration to the default settings. */
-	udploggerclientlib_conf.beacon_interval = DEFAULT_BEACON_INTERVAL;
-	memset(&udploggerclientlib_conf.log_host, 0, sizeof(udploggerclientlib_conf.log_host));
-
+	if (! add_option("filter", required_argument, 'F'))
+	{
+		return -1;
+	}
 	if (! add_option("help", no_argument, 'h'))
 	{
 		return -1;
@@ -475,6 +390,18 @@ int arguments_parse(int argc, char **argv)
 	{
 		return -1;
 	}
+	if (! add_option("plugin", required_argument, 'P'))
+	{
+		return -1;
+	}
+	if (! add_option("publish", required_argument, 'u'))
+	{
+		return -1;
+	}
+	if (! add_option("ring", required_argument, 'r'))
+	{
+		return -1;
+	}
 	if (! add_option("version", no_argument, 'v'))
 	{
 		return -1;
@@ -497,14 +424,37 @@ int arguments_parse(int argc, char **argv)
 		}
 		switch (i)
 		{
+			case 'F':
+				if (filtered)
+				{
+					fprintf(stderr, "udploggerclientlib.c only one filter expression may be given\n");
+					return -1;
+				}
+				if (! udplogger_client_set_filter(client, optarg))
+				{
+					return -1;
+				}
+				filtered = 1;
+				break;
 			case 'h':
 				printf("Usage: %s [OPTIONS]\n", argv[0]);
 				printf("\n");
 				printf("General Library Options\n");
+				printf("  -F, --filter <expression>         only pass on log lines that match <expression> (e.g. 'status>=500 && tag==web3')\n");
+				printf("                                    fields are compared with ==, !=, <, <=, >, >=, ~ and !~ (regular expression)\n");
+				printf("                                    and comparisons can be combined with &&, ||, ! and parentheses\n");
 				printf("  -h, --help                        display this help and exit\n");
 				printf("  -o, --host <host>[:<port>]        host and port to target with beacon transmissions (default broadcast)\n");
 				printf("                                    (default udplogger port is %u)\n", UDPLOGGER_DEFAULT_PORT);
-				printf("  -i, --interval <interval>         interval in seconds between beacon transmissions (default %lu)\n", DEFAULT_BEACON_INTERVAL);
+				printf("  -i, --interval <interval>         interval in seconds between beacon transmissions (default %lu)\n", UDPLOGGER_CLIENT_DEFAULT_BEACON_INTERVAL);
+				printf("  -P, --plugin <object>[:<arg>]     load the consumer plugin in the shared object <object> (passing it <arg>),\n");
+				printf("                                    which is passed every log line as well (may be given several times to\n");
+				printf("                                    share one receiver between several consumers; see udploggerplugin.h)\n");
+				printf("  -u, --publish <name>[:<megabytes>] publish every accepted log line into the shared memory ring <name>\n");
+				printf("                                    (default %lu megabytes) for local readers to tail (see shmring.h)\n", SHM_RING_DEFAULT_SIZE >> 20);
+				printf("  -r, --ring <interface>            receive log packets through a memory-mapped packet ring on <interface>\n");
+				printf("                                    (or `any'), falling back to the socket if the ring cannot be set up\n");
+				printf("                                    (requires CAP_NET_RAW)\n");
 				printf("  -v, --version                     display version and exit\n");
 				printf("\n");
 				printf("%s Specific Options\n", argv[0]);
@@ -512,86 +462,39 @@ int arguments_parse(int argc, char **argv)
 				return 0;
 			case 'i':
 				uint_tmp = strtoumax(optarg, 0, 10);
-				if (! uint_tmp || uint_tmp == UINT_MAX)
+				if (uint_tmp > UINT_MAX / 1000 || ! udplogger_client_set_beacon_interval(client, uint_tmp))
 				{
 					fprintf(stderr, "udploggerclientlib.c invalid beacon interval '%s'\n", optarg);
 					return -1;
 				}
-				udploggerclientlib_conf.beacon_interval = uint_tmp;
 				break;
 			case 'o':
-				char_ptr = strstr(optarg, ":");
-				if (char_ptr == optarg)
+				if (! udplogger_client_add_host(client, optarg))
 				{
-					fprintf(stderr, "udploggerclientlib.c invalid host specification '%s'\n", optarg);
 					return -1;
 				}
-#ifdef __DEBUG__
-				printf("udploggerclientlib.c debug: parsing host target '%s'\n", optarg);
-#endif
-
-				if (char_ptr)
-				{
-					hostname_tmp = strndup(optarg, (char_ptr - optarg));
-				}
-				else
-				{
-					hostname_tmp = strdup(optarg);
-				}
-				if (! hostname_tmp)
+				break;
+			case 'P':
+				if (! load_plugin(optarg))
 				{
-					fprintf(stderr, "udploggerclientlib.c could not allocate memory to record host '%s'\n", optarg);
 					return -1;
 				}
-#ifdef __DEBUG__
-				printf("udploggerclientlib.c debug:   determined hostname '%s'\n", hostname_tmp);
-#endif
-
-				if (char_ptr && *char_ptr == ':')
-				{
-					char_ptr++;
-					uint_tmp = 0;
-					if (char_ptr)
-					{
-						uint_tmp = strtoumax(char_ptr, 0, 10);
-					}
-					if (! uint_tmp || uint_tmp == UINT_MAX)
-					{
-						fprintf(stderr, "udploggerclientlib.c invalid port in host specification '%s'\n", optarg);
-						free(hostname_tmp);
-						return -1;
-					}
-				}
-				else
+				break;
+			case 'u':
+				if (published)
 				{
-					uint_tmp = UDPLOGGER_DEFAULT_PORT;
+					fprintf(stderr, "udploggerclientlib.c only one ring may be published\n");
+					return -1;
 				}
-#ifdef __DEBUG__
-				printf("udploggerclientlib.c debug:   determined port '%lu'\n", uint_tmp);
-#endif
-
-				hostent_ptr = gethostbyname(hostname_tmp);
-				if (! hostent_ptr)
+				if (! publish_records(optarg))
 				{
-					fprintf(stderr, "udploggerclientlib.c could not find the IP address of the host '%s'\n", hostname_tmp);
-					free(hostname_tmp);
 					return -1;
 				}
-				free(hostname_tmp);
-
-				for (j = 0; hostent_ptr->h_addr_list[j] != NULL; j++)
+				break;
+			case 'r':
+				if (! udplogger_client_set_ring(client, optarg))
 				{
-#ifdef __DEBUG__
-					printf("udploggerclientlib.c debug:     considering address '%s', family '%hu'\n", inet_ntoa(*(struct in_addr *)(hostent_ptr->h_addr_list[j])), hostent_ptr->h_addrtype);
-#endif
-					if (hostent_ptr->h_addrtype == AF_INET)
-					{
-						sin.sin_family = hostent_ptr->h_addrtype;
-						sin.sin_addr.s_addr = ((struct in_addr *)(hostent_ptr->h_addr_list[j]))->s_addr;
-						sin.sin_port = htons(uint_tmp);
-
-						add_log_host(&sin);
-					}
+					return -1;
 				}
 				break;
 			case 'v':
@@ -614,158 +517,258 @@ int arguments_parse(int argc, char **argv)
 		}
 	}
 
-	if (udploggerclientlib_conf.log_host.address.sin_family == 0)
-	{
-		/* No target hosts have been passed in.  Default is to add all broadcast addresses. */
-		broadcast_scan();
+	return 1;
+}
+
+
+/**
+ * close_plugins()
+ *
+ * Closes and unloads every plugin, last one first.
+ **/
+static void close_plugins()
+{
+	struct plugin_t **plugin_ptr_ptr;
+	struct plugin_t *plugin_ptr;
+
+	while (plugins)
+	{
+		for (plugin_ptr_ptr = &plugins; (*plugin_ptr_ptr)->next; plugin_ptr_ptr = &(*plugin_ptr_ptr)->next);
+		plugin_ptr = *plugin_ptr_ptr;
+		*plugin_ptr_ptr = NULL;
+		#ifdef __DEBUG__
+			printf("udploggerclientlib.c debug: closing plugin '%s'\n", plugin_ptr->plugin->name);
+		#endif
+		if (plugin_ptr->plugin->close)
+		{
+			plugin_ptr->plugin->close(plugin_ptr->state);
+		}
+		dlclose(plugin_ptr->handle);
+		free(plugin_ptr);
 	}
+}
 
-	if (udploggerclientlib_conf.log_host.address.sin_family == 0)
+
+/**
+ * dispatch_records(<client>, <records>, <count>, <unused>)
+ *
+ * Batch callback for the client.  Publishes the batch into the shared memory ring (if any), then passes
+ * each record of the batch to log_record_hook and/or log_packet_hook (whichever the client implements)
+ * and the whole batch to each plugin.  Records are copied into a NUL-terminated line for log_packet_hook,
+ * since the packet ring backend hands out records that point straight into the ring.
+ **/
+static void dispatch_records(struct udplogger_client_t *client, struct log_record_t **records, size_t count, void *argument)
+{
+	size_t i;
+	size_t length;
+	static char line[PACKET_MAXIMUM_SIZE];
+	struct plugin_t *plugin;
+
+	if (published)
 	{
-		/* Final sanity check.  If we don't have any log hosts to target, then don't continue. */
-		printf("udploggerclientlib.c no log targets\n");
-		return -1;
+		shm_ring_publish(published, records, count);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (log_record_hook)
+		{
+			log_record_hook(records[i]);
+		}
+		if (log_packet_hook)
+		{
+			length = records[i]->length < PACKET_MAXIMUM_SIZE ? records[i]->length : PACKET_MAXIMUM_SIZE - 1;
+			memcpy(line, records[i]->data, length);
+			line[length] = '\0';
+			log_packet_hook(&records[i]->source, line);
+		}
+	}
+	for (plugin = plugins; plugin; plugin = plugin->next)
+	{
+		plugin->plugin->records(plugin->state, records, count);
 	}
-
-	return 1;
 }
 
 
 /**
- * broadcast_scan()
+ * handle_event(<client>, <file descriptor>, <event hook>)
  *
- * Iterates through all interfaces on the system and adds all broadcast addresses found to the
- * udploggerclientlib_conf.log_host list.
+ * Event callback for descriptors and timers added with add_event_fd and add_event_timer; calls the
+ * callback that was registered with them.
  **/
-void broadcast_scan()
+static void handle_event(struct udplogger_client_t *client, int fd, void *argument)
 {
-	int fd;
-	int i;
-	struct ifconf ifc;
-	struct ifreq *ifr;
-	struct log_host_t *log_host_ptr;
-	int max_interfaces = 32; /* The maximum number of interfaces that we should obtain configuration for. */
-	int num_interfaces = 0; /* The number of interfaces that we have actually found. */
-	struct sockaddr_in sin;
+	((struct event_hook_t *)argument)->callback(fd);
+}
 
-	log_host_ptr = &udploggerclientlib_conf.log_host;
 
-	ifc.ifc_len = max_interfaces * sizeof(struct ifreq);
+/**
+ * load_plugin(<specification>)
+ *
+ * Loads the plugin given as <shared object>[:<argument>] (see udploggerplugin.h), opens it and adds it
+ * to the end of the list of plugins.  Returns 1 for success and 0 for failure.
+ **/
+static int load_plugin(const char *specification)
+{
+	char *argument;
+	void *handle;
+	const struct udplogger_plugin_t *plugin;
+	struct plugin_t **plugin_ptr_ptr;
+	char path[PATH_MAX];
+	void *state;
 
-	ifc.ifc_buf = calloc(1, ifc.ifc_len);
-	if (! ifc.ifc_buf)
+	if (strlen(specification) >= sizeof(path))
 	{
-		perror("udploggerclientlib.c calloc(ifc_buf)");
-		return;
+		fprintf(stderr, "udploggerclientlib.c plugin specification '%s' is too long\n", specification);
+		return 0;
+	}
+	strcpy(path, specification);
+	argument = strchr(path, ':');
+	if (argument)
+	{
+		*argument++ = '\0';
 	}
 
-	fd = socket(AF_INET, SOCK_DGRAM, 0);
-	if (fd < 0)
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (! handle)
 	{
-		perror("udploggerclientlib.c socket()");
-		return;
+		fprintf(stderr, "udploggerclientlib.c could not load plugin '%s': %s\n", path, dlerror());
+		return 0;
+	}
+	plugin = dlsym(handle, "udplogger_plugin");
+	if (! plugin || plugin->version != UDPLOGGER_PLUGIN_VERSION || ! plugin->open || ! plugin->records)
+	{
+		fprintf(stderr, "udploggerclientlib.c '%s' is not a udplogger plugin (of version %u)\n", path, UDPLOGGER_PLUGIN_VERSION);
+		dlclose(handle);
+		return 0;
+	}
+	#ifdef __DEBUG__
+		printf("udploggerclientlib.c debug: opening plugin '%s' from '%s'\n", plugin->name, path);
+	#endif
+	state = plugin->open(argument);
+	if (! state)
+	{
+		fprintf(stderr, "udploggerclientlib.c could not open plugin '%s'\n", plugin->name);
+		dlclose(handle);
+		return 0;
 	}
 
-	if (ioctl(fd, SIOCGIFCONF, &ifc) < 0)
+	for (plugin_ptr_ptr = &plugins; *plugin_ptr_ptr; plugin_ptr_ptr = &(*plugin_ptr_ptr)->next);
+	*plugin_ptr_ptr = calloc(1, sizeof(struct plugin_t));
+	if (! *plugin_ptr_ptr)
 	{
-		perror("udploggerclientlib.c ioctl(SIOCGIFCONF)");
-		if (close(fd))
+		perror("udploggerclientlib.c calloc(plugin)");
+		if (plugin->close)
 		{
-			perror("udploggerclientlib.c close()");
+			plugin->close(state);
 		}
-		return;
+		dlclose(handle);
+		return 0;
 	}
+	(*plugin_ptr_ptr)->handle = handle;
+	(*plugin_ptr_ptr)->plugin = plugin;
+	(*plugin_ptr_ptr)->state = state;
+	return 1;
+}
 
-	ifr = ifc.ifc_req;
-	num_interfaces = ifc.ifc_len / sizeof(struct ifreq);
-	for (i = 0; i++ < num_interfaces; ifr++)
-	{
-#ifdef __DEBUG__
-		printf("udploggerclientlib.c debug: found interface %s (%s)\n", ifr->ifr_name, inet_ntoa(((struct sockaddr_in *)&ifr->ifr_addr)->sin_addr));
-#endif
 
-		if (ifr->ifr_addr.sa_family != AF_INET)
-		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:   %s is not of the family AF_INET\n", ifr->ifr_name);
-#endif
-			continue;
-		}
+/**
+ * publish_records(<specification>)
+ *
+ * Creates the shared memory ring given as <name>[:<megabytes>] that accepted records are published
+ * into.  Returns 1 for success and 0 for failure.
+ **/
+static int publish_records(const char *specification)
+{
+	char name[NAME_MAX + 1];
+	char *size;
+	uintmax_t megabytes = SHM_RING_DEFAULT_SIZE >> 20;
 
-		if (ioctl(fd, SIOCGIFFLAGS, ifr) < 0)
+	if (strlen(specification) >= sizeof(name))
+	{
+		fprintf(stderr, "udploggerclientlib.c ring name '%s' is too long\n", specification);
+		return 0;
+	}
+	strcpy(name, specification);
+	size = strchr(name, ':');
+	if (size)
+	{
+		*size++ = '\0';
+		megabytes = strtoumax(size, 0, 10);
+		if (! megabytes || megabytes >= (SIZE_MAX >> 21))
 		{
-			perror("udploggerclientlib.c ioctl(SIOCGIFFLAGS)");
-			continue;
+			fprintf(stderr, "udploggerclientlib.c invalid ring size '%s'\n", size);
+			return 0;
 		}
+	}
+	published = shm_ring_create(name, megabytes << 20);
+	return published != NULL;
+}
 
-		if (!(ifr->ifr_flags & IFF_UP))
-		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:   %s flagged as down\n", ifr->ifr_name);
-#endif
-			continue;
-		}
-		if (ifr->ifr_flags & IFF_LOOPBACK)
-		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:   %s is a loopback interface\n", ifr->ifr_name);
-#endif
-			continue;
-		}
-		if (ifr->ifr_flags & IFF_POINTOPOINT)
-		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:   %s is a point-to-point interface\n", ifr->ifr_name);
-#endif
-			continue;
-		}
-		if (!(ifr->ifr_flags & IFF_BROADCAST))
-		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:   %s does not have the broadcast flag set\n", ifr->ifr_name);
-#endif
-			continue;
-		}
 
-		if (ioctl(fd, SIOCGIFBRDADDR, ifr) < 0)
+/**
+ * receive_signals(<client>, <signal descriptor>, <unused>)
+ *
+ * Event callback for the signal descriptor.  Collects every signal that is waiting to be read into
+ * a signal set, passes that set to handle_signal_hook and then (on SIGTERM) stops the main loop.
+ **/
+static void receive_signals(struct udplogger_client_t *client, int fd, void *argument)
+{
+	struct signalfd_siginfo info;
+	struct plugin_t *plugin;
+	sigset_t signal_flags;
+
+	if (sigemptyset(&signal_flags))
+	{
+		perror("udploggerclientlib.c sigemptyset()");
+		return;
+	}
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+	{
+		#ifdef __DEBUG__
+			printf("udploggerclientlib.c debug: received signal %u\n", info.ssi_signo);
+		#endif
+		if (sigaddset(&signal_flags, info.ssi_signo))
 		{
-			perror("udploggerclientlib.c ioctl(SIOCGIFBRDADDR)");
-			continue;
+			perror("udploggerclientlib.c sigaddset()");
 		}
+	}
 
-		memcpy(&sin, &(ifr->ifr_broadaddr), sizeof(ifr->ifr_broadaddr));
-		if (sin.sin_addr.s_addr == INADDR_ANY)
+	handle_signal_hook(&signal_flags);
+	for (plugin = plugins; plugin; plugin = plugin->next)
+	{
+		if (plugin->plugin->signal)
 		{
-#ifdef __DEBUG__
-			printf("udploggerclientlib.c debug:    %s is associated with INADDR_ANY\n", ifr->ifr_name);
-#endif
-			continue;
+			plugin->plugin->signal(plugin->state, &signal_flags);
 		}
-
-		sin.sin_port = htons(UDPLOGGER_DEFAULT_PORT);
-		add_log_host(&sin);
 	}
-
-	if (close(fd))
+	if (sigismember(&signal_flags, SIGTERM))
 	{
-		perror("udploggerclientlib.c close()");
+		running = 0;
 	}
 }
 
 
 /**
- * sig_handler(int signal_number)
+ * remove_event(<file descriptor>)
  *
- * Generic signal handler -- just adds the received signal to our set of
- * signals received and then returns.
- */
-static void sig_handler(int signal_number)
+ * Stops watching the given file descriptor.  Timers created by add_event_timer are closed as well; any
+ * other descriptor is left open for the caller to deal with.  Safe to call from within a callback.
+ * Returns 1 for success and 0 if the descriptor was not being watched.
+ **/
+int remove_event(int fd)
 {
-	#ifdef __DEBUG__
-		printf("udploggerclientlib.c debug: received signal %d\n", signal_number);
-	#endif
-	if (sigaddset(&signal_flags, signal_number))
+	struct event_hook_t **hook_ptr_ptr;
+	struct event_hook_t *hook_ptr;
+
+	for (hook_ptr_ptr = &event_hooks; *hook_ptr_ptr; hook_ptr_ptr = &(*hook_ptr_ptr)->next)
 	{
-		perror("udploggerclientlib.c sigaddset()");
+		if ((*hook_ptr_ptr)->fd == fd)
+		{
+			hook_ptr = *hook_ptr_ptr;
+			*hook_ptr_ptr = hook_ptr->next;
+			free(hook_ptr);
+			return udplogger_client_remove(client, fd);
+		}
 	}
+	return 0;
 }
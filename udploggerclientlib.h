@@ -25,6 +25,28 @@
 #ifndef __UDPLOGGERCLIENTLIB_H__
 #define __UDPLOGGERCLIENTLIB_H__
 
+#include "record.h"
+
+
+/**
+ * add_event_fd(<file descriptor>, <callback>)
+ *
+ * Utility function implemented in udploggerclientlib.c to add a file descriptor to the set of descriptors
+ * that the main loop waits on.  The callback is called with the descriptor whenever it becomes readable.
+ * May be called from any hook.  Returns 1 for success or 0 for failure.
+ **/
+extern int add_event_fd(int, void (*)(int));
+
+
+/**
+ * add_event_timer(<interval>, <callback>)
+ *
+ * Utility function implemented in udploggerclientlib.c to add a periodic timer to the main loop.  The callback
+ * is called with the timer descriptor every <interval> milliseconds (for example to flush output on a deadline).
+ * May be called from any hook.  Returns the timer descriptor, or -1 on failure.
+ **/
+extern int add_event_timer(uintmax_t, void (*)(int));
+
 
 /**
  * add_option(<long option>, <has argument>, <short option>)
@@ -59,7 +81,7 @@ extern int getopt_hook(char);
  * handle_signal_hook(<signal flags>)
  *
  * Implemented in udplogger clients to handle any signals that are marked as received in
- * the sigset_t <signal flags>.
+ * the sigset_t <signal flags>.  Only SIGHUP and SIGTERM are delivered to clients.
  **/
 extern void handle_signal_hook(sigset_t *);
 
@@ -68,9 +90,31 @@ extern void handle_signal_hook(sigset_t *);
  * log_packet_hook(<source host>, <log line>)
  *
  * Implemented in udplogger clients to take the arguments sockaddr_in * (the source host of the log line)
- * and char * (the log packet data itself) and do something with it (called once per log line).
+ * and char * (the log packet data itself) and do something with it (called once per log line).  Clients
+ * implement this hook, log_record_hook or both; new clients should prefer log_record_hook, which saves
+ * copying each line into a NUL-terminated buffer.
+ **/
+extern void log_packet_hook(struct sockaddr_in *, char *);
+
+
+/**
+ * log_record_hook(<record>)
+ *
+ * Implemented in udplogger clients to take a record view (see record.h) of a received log packet -- its
+ * source host, receive timestamp, length and the offsets of its serial, tag and payload fields -- and do
+ * something with it (called once per log line).  The record data is not guaranteed to be NUL-terminated.
+ **/
+extern void log_record_hook(struct log_record_t *);
+
+
+/**
+ * remove_event(<file descriptor>)
+ *
+ * Utility function implemented in udploggerclientlib.c to stop watching a descriptor that was added with
+ * add_event_fd or add_event_timer (timers are closed as well).  Safe to call from within a callback.
+ * Returns 1 for success or 0 if the descriptor was not being watched.
  **/
-extern void inline log_packet_hook(struct sockaddr_in *, char *);
+extern int remove_event(int);
 
 
 /**
@@ -0,0 +1,1253 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+/*
+ * Native counterpart of udploggertools/udploggergrep.py: prints the udploggerc log lines that match
+ * every given predicate, in the order in which they appear in the input.
+ *
+ * Uncompressed files are mapped into memory and searched in place; gzip-compressed files and standard
+ * input are decompressed (or read) into a buffer.  Either way the input is taken a block at a time,
+ * the block is cut into line-aligned segments and a pool of worker threads searches the segments in
+ * parallel, while the main thread writes out the results of each segment in turn as soon as it is
+ * done.  The workers only find the field delimiters of each line (with memchr(), which the C library
+ * vectorizes) and only convert the fields that a predicate looks at.
+ *
+ * Usage:
+ *   udploggergrep --status 503 --time-after "2010-01-01 00:00:00" /var/log/udplogger/access.log
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "output.h"
+#include "udplogger.h"
+#include "udploggergrep.h"
+
+
+/*
+ * A position in a log file, as recorded in its index (see output.h).
+ */
+struct grep_position_t {
+	uint64_t offset;
+	uint64_t skip;
+};
+
+
+int arguments_parse(int, char **);
+static void add_span(struct grep_segment_t *, unsigned char, size_t, size_t, uintmax_t);
+static uint64_t decode_le(const unsigned char *, unsigned int);
+static void emit_segment(struct grep_segment_t *);
+static void grep_block(const char *, size_t);
+static int grep_file(const char *);
+static void grep_mapped(int, const char *, const struct grep_position_t *, const struct grep_position_t *);
+static int grep_stream(gzFile, const char *, uint64_t);
+static int is_space(char);
+static int match_line(struct grep_worker_t *, const char *, size_t);
+static int parse_integer(const char *, size_t, long *);
+static int parse_time(struct grep_worker_t *, const char *, size_t, time_t *);
+static int read_index(const char *, struct grep_position_t *, int *, struct grep_position_t *, int *);
+static void search_segment(struct grep_worker_t *, struct grep_segment_t *);
+static void *worker_main(void *);
+
+
+/*
+ * Sizes of the pieces that the input is searched in.
+ *
+ * BLOCK_SIZE          The amount of input (bytes) taken at a time; also the initial size of the read
+ *                     buffer for compressed files and standard input (it grows for longer lines).
+ * SEGMENT_SIZE        The approximate size (bytes) of the segments that a block is cut into.
+ * INDEX_ENTRY_SIZE    The size of an index entry in an index file (see output.h).
+ * READ_BUFFER_SIZE    The size of the zlib input buffer.
+ */
+#define BLOCK_SIZE          (64UL * 1024UL * 1024UL)
+#define SEGMENT_SIZE        (1024UL * 1024UL)
+#define INDEX_ENTRY_SIZE    32U
+#define READ_BUFFER_SIZE    (128U * 1024U)
+
+
+/*
+ * Global Variable Declarations
+ *
+ * conf             is used to store the configuration of the currently-running udploggergrep process.
+ * layouts          holds the field positions of v1 and v2 log lines, in that order.
+ * lines_read       is the number of lines that have been searched so far (for error messages).
+ * next_segment     is the index of the next segment of the current block that a worker should take.
+ * segments         holds the segments of the current block; segment_count are in use and segment_size
+ *                  are allocated.
+ * segments_cond    is signalled whenever a worker finishes a segment.
+ * segments_mutex   protects the done flags of the segments.
+ * workers          holds the state of each worker thread.
+ */
+struct udploggergrep_configuration_t conf;
+static const struct field_layout_t layouts[2] =
+{
+	{FIELD_V1_COUNT, 4, 5, 9, 13, 17, {FIELD_MISSING, FIELD_MISSING, 12, 11}},
+	{FIELD_V2_COUNT, 5, 6, 10, 14, 20, {19, 15, 13, 12}}
+};
+static uintmax_t lines_read = 0;
+static size_t next_segment = 0;
+static struct grep_segment_t *segments = NULL;
+static size_t segment_count = 0;
+static size_t segment_size = 0;
+static pthread_cond_t segments_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t segments_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct grep_worker_t *workers = NULL;
+
+
+/**
+ * main()
+ *
+ * Parses the arguments and sets up the workers, then searches each of the files given on the command
+ * line (or standard input, if there are none).  Returns 0, or 1 if any file could not be read.
+ **/
+int main(int argc, char **argv)
+{
+	int failed = 0;
+	int i;
+	int result;
+	unsigned int j;
+	unsigned int k;
+
+	result = arguments_parse(argc, argv);
+	if (result <= 0)
+	{
+		return -result;
+	}
+
+#ifdef __DEBUG__
+	fprintf(stderr, "udploggergrep.c debug: parameter threads = '%u'\n", conf.threads);
+	if (conf.has_time_after)
+	{
+		fprintf(stderr, "udploggergrep.c debug: parameter time_after = '%jd'\n", (intmax_t)conf.time_after);
+	}
+	if (conf.has_time_before)
+	{
+		fprintf(stderr, "udploggergrep.c debug: parameter time_before = '%jd'\n", (intmax_t)conf.time_before);
+	}
+#endif
+
+	workers = calloc(conf.threads, sizeof(struct grep_worker_t));
+	if (! workers)
+	{
+		perror("udploggergrep.c calloc()");
+		return 1;
+	}
+	for (j = 0; j < conf.threads; j++)
+	{
+		for (k = 0; k < PATTERN_COUNT; k++)
+		{
+			if (conf.patterns[k] && regcomp(&workers[j].regexes[k], conf.patterns[k], REG_EXTENDED | REG_NOSUB))
+			{
+				fprintf(stderr, "udploggergrep.c could not compile regular expression '%s'\n", conf.patterns[k]);
+				return 1;
+			}
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, READ_BUFFER_SIZE);
+
+	if (optind < argc)
+	{
+		for (i = optind; i < argc; i++)
+		{
+			if (! grep_file(argv[i]))
+			{
+				failed = 1;
+			}
+		}
+	}
+	else if (! grep_stream(gzdopen(STDIN_FILENO, "rb"), "stdin", 0))
+	{
+		failed = 1;
+	}
+
+	if (fflush(stdout))
+	{
+		perror("udploggergrep.c fflush()");
+		failed = 1;
+	}
+	return failed;
+}
+
+
+/**
+ * arguments_parse(argc, argv)
+ *
+ * Utility function to parse the passed in arguments using getopt and to check the values given.
+ * Returns 1 to go ahead, 0 if the program should exit successfully (after --help or --version)
+ * or a negative value if the arguments were not valid.
+ **/
+int arguments_parse(int argc, char **argv)
+{
+	static const char *methods[] = {"CONNECT", "DELETE", "GET", "HEAD", "OPTIONS", "POST", "PUT", "TRACE", NULL};
+	static const char *pattern_options[PATTERN_COUNT] = {"content-type", "host", "query", "url"};
+	static struct option long_options[] =
+	{
+		{"content-type", required_argument, 0, 'C'},
+		{"help", no_argument, 0, 'h'},
+		{"host", required_argument, 0, 'H'},
+		{"method", required_argument, 0, 'M'},
+		{"nexopia-userid", required_argument, 0, 'N'},
+		{"query", required_argument, 0, 'Q'},
+		{"remote-ip", required_argument, 0, 'R'},
+		{"status", required_argument, 0, 'S'},
+		{"tag", required_argument, 0, 'T'},
+		{"threads", required_argument, 0, 't'},
+		{"time-after", required_argument, 0, 'A'},
+		{"time-before", required_argument, 0, 'B'},
+		{"time-used", required_argument, 0, 'U'},
+		{"url", required_argument, 0, 'L'},
+		{"version", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+	char error[256];
+	char *end;
+	int i;
+	unsigned int j;
+	long long_tmp;
+	unsigned int pattern;
+	long processors;
+	regex_t regex;
+	int result;
+	struct tm tm;
+
+	memset(&conf, 0, sizeof(conf));
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+	conf.threads = (processors > 0) ? (unsigned int)processors : 1;
+
+	while (1)
+	{
+		i = getopt_long(argc, argv, "ht:v", long_options, NULL);
+		if (i == -1)
+		{
+			break;
+		}
+		switch (i)
+		{
+			case 'A':
+			case 'B':
+				memset(&tm, 0, sizeof(tm));
+				end = strptime(optarg, "%Y-%m-%d %H:%M:%S", &tm);
+				if (! end || *end)
+				{
+					fprintf(stderr, "udploggergrep.c invalid argument for option %s: '%s'\n", (i == 'A') ? "time-after" : "time-before", optarg);
+					fprintf(stderr, "udploggergrep.c date and times must be in the format \"%%Y-%%m-%%d %%H:%%M:%%S\" (i.e. \"2009-10-20 15:18:17\")\n");
+					return -2;
+				}
+				tm.tm_isdst = -1;
+				if (i == 'A')
+				{
+					conf.time_after = mktime(&tm);
+					conf.has_time_after = 1;
+				}
+				else
+				{
+					conf.time_before = mktime(&tm);
+					conf.has_time_before = 1;
+				}
+				break;
+			case 'C':
+			case 'H':
+			case 'L':
+			case 'Q':
+				pattern = (i == 'C') ? PATTERN_CONTENT_TYPE : (i == 'H') ? PATTERN_HOST : (i == 'L') ? PATTERN_URL : PATTERN_QUERY;
+				result = regcomp(&regex, optarg, REG_EXTENDED | REG_NOSUB);
+				if (result)
+				{
+					regerror(result, &regex, error, sizeof(error));
+					fprintf(stderr, "udploggergrep.c invalid regular expression given for option %s: '%s' (%s)\n", pattern_options[pattern], optarg, error);
+					return -2;
+				}
+				regfree(&regex);
+				conf.patterns[pattern] = optarg;
+				break;
+			case 'h':
+				printf("Usage: udploggergrep [OPTIONS] [FILE]...\n");
+				printf("\n");
+				printf("Reads udploggerc output from each FILE (which may be gzip-compressed) or from\n");
+				printf("standard input and prints the log lines that match every given option, in\n");
+				printf("order.  Files that have a udploggerc index (FILE.idx) are only read within the\n");
+				printf("--time-after/--time-before range.  Regular expressions are POSIX extended ones.\n");
+				printf("\n");
+				printf("      --content-type <regexp>                    show log entries whose content-type matches <regexp>\n");
+				printf("  -h, --help                                     display this help and exit\n");
+				printf("      --host <regexp>                            show log entries whose host matches <regexp>\n");
+				printf("      --method <method>                          show log entries whose request method equals <method>\n");
+				printf("      --nexopia-userid <uid>                     show log entries whose nexopia UID equals <uid>\n");
+				printf("      --query <regexp>                           show log entries whose query string matches <regexp>\n");
+				printf("      --remote-ip <ip>                           show log entries whose remote ip matches <ip>\n");
+				printf("      --status <status code>                     show log entries whose status code equals <status code>\n");
+				printf("      --tag <tag>                                show log entries whose tag equals <tag>\n");
+				printf("  -t, --threads <count>                          search with <count> threads (default: one per processor, %u)\n", conf.threads);
+				printf("      --time-after <date/time>                   show log entries that occurred at-or-after <date/time> (e.g. 2009-10-20 15:18:17)\n");
+				printf("      --time-before <date/time>                  show log entries that occurred before-or-at <date/time> (e.g. 2009-10-20 17:18:17)\n");
+				printf("      --time-used <time in seconds>              show log entries that took exactly <time in seconds> to complete\n");
+				printf("      --url <regexp>                             show log entries whose url matches <regexp>\n");
+				printf("  -v, --version                                  display udploggergrep version and exit\n");
+				printf("\n");
+				return 0;
+			case 'M':
+				conf.method = optarg;
+				conf.method_length = strlen(optarg);
+				for (j = 0; methods[j] && strcmp(methods[j], optarg); j++);
+				/* Methods are upper-cased before they are compared, so any other method never matches. */
+				conf.method_valid = (methods[j] != NULL);
+				break;
+			case 'N':
+				if (! parse_integer(optarg, strlen(optarg), &long_tmp) || long_tmp < 0)
+				{
+					fprintf(stderr, "udploggergrep.c invalid argument for option nexopia-userid (must be integer x, where x >= 0): '%s'\n", optarg);
+					return -2;
+				}
+				conf.nexopia_userid = long_tmp;
+				conf.has_nexopia_userid = 1;
+				break;
+			case 'R':
+				conf.remote_ip = optarg;
+				conf.remote_ip_length = strlen(optarg);
+				break;
+			case 'S':
+				if (! parse_integer(optarg, strlen(optarg), &long_tmp))
+				{
+					fprintf(stderr, "udploggergrep.c invalid argument for option status: '%s'\n", optarg);
+					return -2;
+				}
+				conf.status = long_tmp;
+				conf.has_status = 1;
+				break;
+			case 'T':
+				conf.tag = optarg;
+				conf.tag_length = strlen(optarg);
+				break;
+			case 't':
+				if (! parse_integer(optarg, strlen(optarg), &long_tmp) || long_tmp < 1 || long_tmp > 1024)
+				{
+					fprintf(stderr, "udploggergrep.c invalid argument for option threads (must be integer x, where 1 <= x <= 1024): '%s'\n", optarg);
+					return -2;
+				}
+				conf.threads = (unsigned int)long_tmp;
+				break;
+			case 'U':
+				if (! parse_integer(optarg, strlen(optarg), &long_tmp) || long_tmp < -1 || long_tmp > 10)
+				{
+					fprintf(stderr, "udploggergrep.c invalid argument for option time-used (must be integer x, where -1 <= x <= 10): '%s'\n", optarg);
+					return -2;
+				}
+				conf.time_used = long_tmp;
+				conf.has_time_used = 1;
+				break;
+			case 'v':
+				printf("udploggergrep.c revision r%d\n", REVISION);
+				return 0;
+			default:
+				return -3;
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+ * add_span(<segment>, <type>, <offset>, <length>, <line>)
+ *
+ * Appends a span of output to a segment, merging runs of matching lines into a single span.  Exits if
+ * the span list cannot be grown.
+ **/
+static void add_span(struct grep_segment_t *segment, unsigned char type, size_t offset, size_t length, uintmax_t line)
+{
+	struct grep_span_t *span;
+
+	if (type == SPAN_MATCH && segment->span_count)
+	{
+		span = &segment->spans[segment->span_count - 1];
+		if (span->type == SPAN_MATCH && span->offset + span->length == offset)
+		{
+			span->length += length;
+			return;
+		}
+	}
+
+	if (segment->span_count == segment->span_size)
+	{
+		span = realloc(segment->spans, (segment->span_size ? segment->span_size * 2 : 64) * sizeof(struct grep_span_t));
+		if (! span)
+		{
+			perror("udploggergrep.c realloc()");
+			exit(1);
+		}
+		segment->spans = span;
+		segment->span_size = segment->span_size ? segment->span_size * 2 : 64;
+	}
+
+	span = &segment->spans[segment->span_count++];
+	span->type = type;
+	span->offset = offset;
+	span->length = length;
+	span->line = line;
+}
+
+
+/**
+ * decode_le(<buffer>, <size>)
+ *
+ * Returns the <size>-byte little-endian unsigned integer stored at <buffer>.
+ **/
+static uint64_t decode_le(const unsigned char *buffer, unsigned int size)
+{
+	uint64_t value = 0;
+
+	while (size--)
+	{
+		value = (value << 8) | buffer[size];
+	}
+	return value;
+}
+
+
+/**
+ * emit_segment(<segment>)
+ *
+ * Writes out the matching lines of a segment that has been searched, and reports the lines in it
+ * that could not be parsed (numbered from the start of the input).  Exits if the output cannot be
+ * written.
+ **/
+static void emit_segment(struct grep_segment_t *segment)
+{
+	const char *data;
+	unsigned int delimiters;
+	size_t i;
+	size_t j;
+	struct grep_span_t *span;
+
+	for (i = 0; i < segment->span_count; i++)
+	{
+		span = &segment->spans[i];
+		data = segment->data + span->offset;
+		if (span->type == SPAN_INVALID)
+		{
+			fprintf(stderr, "skipping line #%ju, could not parse data \"", lines_read + span->line);
+			for (j = 0, delimiters = 0; j < span->length; j++)
+			{
+				if (data[j] == DELIMITER_CHARACTER)
+				{
+					fputs("\\x1e", stderr);
+					delimiters++;
+				}
+				else
+				{
+					fputc(data[j], stderr);
+				}
+			}
+			/* The same reasons that udploggergrep.py gives (it fails to find the version field of short lines). */
+			fprintf(stderr, "\": %s\n", (delimiters < FIELD_VERSION) ? "list index out of range" : "invalid number of fields in log line");
+			continue;
+		}
+		if (fwrite(data, 1, span->length, stdout) != span->length || (span->type == SPAN_MATCH_NEWLINE && putchar('\n') == EOF))
+		{
+			perror("udploggergrep.c fwrite()");
+			exit(1);
+		}
+	}
+	lines_read += segment->lines;
+}
+
+
+/**
+ * grep_block(<data>, <length>)
+ *
+ * Searches a block of whole lines: cuts it into segments, has the workers search them and writes out
+ * the results of each segment in order.  With a single thread (or a single segment) the block is
+ * searched by the calling thread.
+ **/
+static void grep_block(const char *data, size_t length)
+{
+	const char *end = data + length;
+	const char *next;
+	size_t i;
+	struct grep_segment_t *resized;
+	unsigned int started;
+	unsigned int threads;
+
+	segment_count = 0;
+	while (data < end)
+	{
+		next = end;
+		if ((size_t)(end - data) > SEGMENT_SIZE)
+		{
+			next = memchr(data + SEGMENT_SIZE, '\n', end - data - SEGMENT_SIZE);
+			next = next ? next + 1 : end;
+		}
+
+		if (segment_count == segment_size)
+		{
+			resized = realloc(segments, (segment_size ? segment_size * 2 : 16) * sizeof(struct grep_segment_t));
+			if (! resized)
+			{
+				perror("udploggergrep.c realloc()");
+				exit(1);
+			}
+			segments = resized;
+			segment_size = segment_size ? segment_size * 2 : 16;
+			memset(&segments[segment_count], 0, (segment_size - segment_count) * sizeof(struct grep_segment_t));
+		}
+		segments[segment_count].data = data;
+		segments[segment_count].length = next - data;
+		segments[segment_count].done = 0;
+		segment_count++;
+		data = next;
+	}
+
+	threads = (segment_count < conf.threads) ? segment_count : conf.threads;
+	if (threads <= 1)
+	{
+		for (i = 0; i < segment_count; i++)
+		{
+			search_segment(&workers[0], &segments[i]);
+			emit_segment(&segments[i]);
+		}
+		return;
+	}
+
+	next_segment = 0;
+	for (started = 0; started < threads; started++)
+	{
+		if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]))
+		{
+			perror("udploggergrep.c pthread_create()");
+			break;
+		}
+	}
+	if (! started)
+	{
+		worker_main(&workers[0]);
+	}
+
+	for (i = 0; i < segment_count; i++)
+	{
+		pthread_mutex_lock(&segments_mutex);
+		while (! segments[i].done)
+		{
+			pthread_cond_wait(&segments_cond, &segments_mutex);
+		}
+		pthread_mutex_unlock(&segments_mutex);
+		emit_segment(&segments[i]);
+	}
+
+	while (started--)
+	{
+		pthread_join(workers[started].thread, NULL);
+	}
+}
+
+
+/**
+ * grep_file(<path>)
+ *
+ * Searches a log file, which is mapped into memory if it is uncompressed or decompressed a block at a
+ * time if it is gzip-compressed.  If a time range was given and the file has an index, only the part
+ * of the file that the index puts in the range is read (the end of the range is only used for
+ * uncompressed files).  Returns 1 for success or 0 if the file could not be read.
+ **/
+static int grep_file(const char *path)
+{
+	int fd;
+	struct grep_position_t first;
+	int has_first = 0;
+	struct grep_position_t last;
+	int has_last = 0;
+	unsigned char magic[2];
+	gzFile stream;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "udploggergrep.c could not open '%s': %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	if (conf.has_time_after || conf.has_time_before)
+	{
+		read_index(path, &first, &has_first, &last, &has_last);
+	}
+
+	if (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+	{
+		if (has_first && lseek(fd, first.offset, SEEK_SET) < 0)
+		{
+			has_first = 0;
+		}
+		stream = gzdopen(fd, "rb");
+		if (! stream)
+		{
+			close(fd);
+			fprintf(stderr, "udploggergrep.c could not read '%s'\n", path);
+			return 0;
+		}
+		return grep_stream(stream, path, has_first ? first.skip : 0);
+	}
+
+	grep_mapped(fd, path, has_first ? &first : NULL, has_last ? &last : NULL);
+	close(fd);
+	return 1;
+}
+
+
+/**
+ * grep_mapped(<file descriptor>, <path>, <first>, <last>)
+ *
+ * Searches an uncompressed log file from position <first> up to position <last> (either of which may
+ * be NULL for the start or end of the file) through a read-only mapping of it.  A zero-filled tail
+ * (see udploggerc --preallocate) is not searched.
+ **/
+static void grep_mapped(int fd, const char *path, const struct grep_position_t *first, const struct grep_position_t *last)
+{
+	const char *data;
+	size_t end;
+	size_t length;
+	const char *newline;
+	size_t position = 0;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+	{
+		perror("udploggergrep.c fstat()");
+		return;
+	}
+	if (! st.st_size)
+	{
+		return;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "udploggergrep.c could not map '%s': %s\n", path, strerror(errno));
+		return;
+	}
+	madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+	end = st.st_size;
+	if (last && last->offset + last->skip < end)
+	{
+		end = last->offset + last->skip;
+	}
+	if (first)
+	{
+		position = first->offset + first->skip;
+	}
+	while (end > position && ! data[end - 1])
+	{
+		end--;
+	}
+
+	while (position < end)
+	{
+		length = end - position;
+		if (length > BLOCK_SIZE)
+		{
+			newline = memrchr(data + position, '\n', BLOCK_SIZE);
+			if (! newline)
+			{
+				newline = memchr(data + position + BLOCK_SIZE, '\n', end - position - BLOCK_SIZE);
+			}
+			if (newline)
+			{
+				length = newline + 1 - (data + position);
+			}
+		}
+		grep_block(data + position, length);
+		position += length;
+	}
+
+	munmap((void *)data, st.st_size);
+}
+
+
+/**
+ * grep_stream(<stream>, <name>, <skip>)
+ *
+ * Searches the log lines read from a zlib stream (which reads uncompressed data as it is) after
+ * skipping its first <skip> bytes, a block at a time, then closes the stream.  Returns 1 for success
+ * or 0 if the stream could not be read.
+ **/
+static int grep_stream(gzFile stream, const char *name, uint64_t skip)
+{
+	char *buffer;
+	size_t length;
+	const char *newline;
+	int result;
+	char *resized;
+	size_t size = BLOCK_SIZE;
+	size_t used = 0;
+
+	if (! stream)
+	{
+		fprintf(stderr, "udploggergrep.c could not read %s\n", name);
+		return 0;
+	}
+	gzbuffer(stream, READ_BUFFER_SIZE);
+
+	buffer = malloc(size);
+	if (! buffer)
+	{
+		perror("udploggergrep.c malloc()");
+		gzclose(stream);
+		return 0;
+	}
+
+	while (1)
+	{
+		result = gzread(stream, buffer + used, (size - used > INT_MAX) ? INT_MAX : (unsigned int)(size - used));
+		if (result < 0)
+		{
+			fprintf(stderr, "udploggergrep.c could not read %s: %s\n", name, gzerror(stream, &result));
+			break;
+		}
+		used += result;
+
+		if (skip)
+		{
+			length = (skip < used) ? skip : used;
+			memmove(buffer, buffer + length, used - length);
+			used -= length;
+			skip -= length;
+		}
+
+		if (! result)
+		{
+			if (used)
+			{
+				grep_block(buffer, used);
+			}
+			break;
+		}
+
+		newline = memrchr(buffer, '\n', used);
+		if (! newline)
+		{
+			if (used == size)
+			{
+				resized = realloc(buffer, size * 2);
+				if (! resized)
+				{
+					perror("udploggergrep.c realloc()");
+					result = -1;
+					break;
+				}
+				buffer = resized;
+				size *= 2;
+			}
+			continue;
+		}
+
+		length = newline + 1 - buffer;
+		grep_block(buffer, length);
+		memmove(buffer, buffer + length, used - length);
+		used -= length;
+	}
+
+	free(buffer);
+	gzclose(stream);
+	return (result >= 0);
+}
+
+
+/**
+ * is_space(<character>)
+ *
+ * Returns non-zero if <character> is whitespace in the C locale (the characters that Python's
+ * str.rstrip() removes).
+ **/
+static int is_space(char character)
+{
+	return (character == ' ' || (character >= '\t' && character <= '\r'));
+}
+
+
+/**
+ * match_line(<worker>, <line>, <length>)
+ *
+ * Splits a log line (without its trailing whitespace) into fields and applies the predicates to the
+ * fields that they look at.  Returns 1 if the line matches, 0 if it does not or -1 if it does not have
+ * the number of fields of a v1 or v2 log line.
+ **/
+static int match_line(struct grep_worker_t *worker, const char *line, size_t length)
+{
+	const char *delimiter;
+	const char *end = line + length;
+	unsigned int count = 0;
+	size_t field_lengths[FIELD_MAXIMUM_COUNT];
+	const char *fields[FIELD_MAXIMUM_COUNT];
+	size_t i;
+	int index;
+	size_t field_length;
+	const struct field_layout_t *layout;
+	time_t timestamp;
+	int valid;
+	long value;
+
+	while (1)
+	{
+		delimiter = memchr(line, DELIMITER_CHARACTER, end - line);
+		fields[count] = line;
+		field_lengths[count] = (delimiter ? delimiter : end) - line;
+		count++;
+		if (! delimiter)
+		{
+			break;
+		}
+		if (count == FIELD_MAXIMUM_COUNT)
+		{
+			return -1;
+		}
+		line = delimiter + 1;
+	}
+
+	layout = &layouts[count > FIELD_VERSION && field_lengths[FIELD_VERSION] == 2 && ! memcmp(fields[FIELD_VERSION], "v2", 2)];
+	if (count != layout->count)
+	{
+		return -1;
+	}
+
+	if (conf.tag && (field_lengths[FIELD_TAG] != conf.tag_length || memcmp(fields[FIELD_TAG], conf.tag, conf.tag_length)))
+	{
+		return 0;
+	}
+
+	if (conf.has_status && (! parse_integer(fields[layout->status], field_lengths[layout->status], &value) || value != conf.status))
+	{
+		return 0;
+	}
+
+	if (conf.method)
+	{
+		if (! conf.method_valid || field_lengths[layout->method] != conf.method_length)
+		{
+			return 0;
+		}
+		for (i = 0; i < conf.method_length; i++)
+		{
+			if (toupper((unsigned char)fields[layout->method][i]) != conf.method[i])
+			{
+				return 0;
+			}
+		}
+	}
+
+	if (conf.has_time_used && (! parse_integer(fields[layout->time_used], field_lengths[layout->time_used], &value) || value != conf.time_used))
+	{
+		return 0;
+	}
+
+	if (conf.remote_ip && (field_lengths[layout->remote_ip] != conf.remote_ip_length || memcmp(fields[layout->remote_ip], conf.remote_ip, conf.remote_ip_length) || (conf.remote_ip_length == 1 && conf.remote_ip[0] == '-')))
+	{
+		return 0;
+	}
+
+	if (conf.has_nexopia_userid && (! parse_integer(fields[layout->nexopia_userid], field_lengths[layout->nexopia_userid], &value) || value != conf.nexopia_userid))
+	{
+		return 0;
+	}
+
+	if (conf.has_time_after || conf.has_time_before)
+	{
+		/* Like udploggergrep.py, a line without a valid timestamp is never after a time but never past one either. */
+		valid = parse_time(worker, fields[FIELD_TIME], field_lengths[FIELD_TIME], &timestamp);
+		if (conf.has_time_after && (! valid || timestamp < conf.time_after))
+		{
+			return 0;
+		}
+		if (conf.has_time_before && valid && timestamp > conf.time_before)
+		{
+			return 0;
+		}
+	}
+
+	for (i = 0; i < PATTERN_COUNT; i++)
+	{
+		if (! conf.patterns[i])
+		{
+			continue;
+		}
+
+		/* A missing field ("-", or one that v1 log lines do not have) is searched as an empty string. */
+		index = layout->patterns[i];
+		field_length = (index == FIELD_MISSING || (field_lengths[index] == 1 && fields[index][0] == '-')) ? 0 : field_lengths[index];
+		if (field_length >= worker->scratch_size)
+		{
+			free(worker->scratch);
+			worker->scratch_size = field_length + 256;
+			worker->scratch = malloc(worker->scratch_size);
+			if (! worker->scratch)
+			{
+				perror("udploggergrep.c malloc()");
+				exit(1);
+			}
+		}
+		if (field_length)
+		{
+			memcpy(worker->scratch, fields[index], field_length);
+		}
+		worker->scratch[field_length] = '\0';
+		if (regexec(&worker->regexes[i], worker->scratch, 0, NULL, 0))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+ * parse_integer(<string>, <length>, <value>)
+ *
+ * Parses a decimal integer the way that Python's int() does (surrounding whitespace and a sign are
+ * allowed) into <value>.  Returns 1 for success or 0 if the string is not an integer (or is out of
+ * range).
+ **/
+static int parse_integer(const char *string, size_t length, long *value)
+{
+	const char *end = string + length;
+	int negative = 0;
+	unsigned long result = 0;
+
+	while (string < end && is_space(*string))
+	{
+		string++;
+	}
+	while (end > string && is_space(end[-1]))
+	{
+		end--;
+	}
+	if (string < end && (*string == '-' || *string == '+'))
+	{
+		negative = (*string == '-');
+		string++;
+	}
+	if (string == end)
+	{
+		return 0;
+	}
+
+	for (; string < end; string++)
+	{
+		if (*string < '0' || *string > '9' || result > (ULONG_MAX - 9) / 10)
+		{
+			return 0;
+		}
+		result = result * 10 + (*string - '0');
+	}
+	if (result > (unsigned long)LONG_MAX)
+	{
+		return 0;
+	}
+
+	*value = negative ? -(long)result : (long)result;
+	return 1;
+}
+
+
+/**
+ * parse_time(<worker>, <field>, <length>, <timestamp>)
+ *
+ * Converts a "[%Y-%m-%d %H:%M:%S]" local time field into seconds since the epoch.  mktime() is only
+ * called once for each hour that is seen in a row (the minutes and seconds are added on).  Returns 1
+ * for success or 0 if the field is not a valid time.
+ **/
+static int parse_time(struct grep_worker_t *worker, const char *field, size_t length, time_t *timestamp)
+{
+	static const char format[] = "[dddd-dd-dd dd:dd:dd]";
+	static const int month_days[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	int days;
+	size_t i;
+	int minute;
+	int second;
+	struct tm tm;
+
+	if (length != sizeof(format) - 1)
+	{
+		return 0;
+	}
+	for (i = 0; i < length; i++)
+	{
+		if ((format[i] == 'd') ? (field[i] < '0' || field[i] > '9') : (field[i] != format[i]))
+		{
+			return 0;
+		}
+	}
+
+	minute = (field[15] - '0') * 10 + (field[16] - '0');
+	second = (field[18] - '0') * 10 + (field[19] - '0');
+	if (minute > 59 || second > 61)
+	{
+		return 0;
+	}
+
+	if (memcmp(worker->hour, field + 1, 13))
+	{
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = (field[1] - '0') * 1000 + (field[2] - '0') * 100 + (field[3] - '0') * 10 + (field[4] - '0') - 1900;
+		tm.tm_mon = (field[6] - '0') * 10 + (field[7] - '0') - 1;
+		tm.tm_mday = (field[9] - '0') * 10 + (field[10] - '0');
+		tm.tm_hour = (field[12] - '0') * 10 + (field[13] - '0');
+		tm.tm_isdst = -1;
+		if (tm.tm_mon < 0 || tm.tm_mon > 11 || tm.tm_hour > 23)
+		{
+			return 0;
+		}
+		days = month_days[tm.tm_mon];
+		if (tm.tm_mon == 1 && ((tm.tm_year + 1900) % 4 || (! ((tm.tm_year + 1900) % 100) && (tm.tm_year + 1900) % 400)))
+		{
+			days = 28;
+		}
+		if (tm.tm_mday < 1 || tm.tm_mday > days)
+		{
+			return 0;
+		}
+		worker->hour_time = mktime(&tm);
+		memcpy(worker->hour, field + 1, 13);
+	}
+
+	*timestamp = worker->hour_time + minute * 60 + second;
+	return 1;
+}
+
+
+/**
+ * read_index(<path>, <first>, <has first>, <last>, <has last>)
+ *
+ * Looks up the --time-after/--time-before range in the index of a log file (see
+ * Nexopia/UDPLogger/Index.py): <first> is set to the position of the last indexed second before the
+ * range (so that seconds missing from the index cannot cause lines to be skipped) and <last> to that
+ * of the first indexed second after it, and the has flags are set for the positions that were found.
+ * An index whose times go backwards cannot be searched and is ignored.  Returns 1 if the file has a
+ * usable index or 0 otherwise.
+ **/
+static int read_index(const char *path, struct grep_position_t *first, int *has_first, struct grep_position_t *last, int *has_last)
+{
+	unsigned char *data = NULL;
+	const unsigned char *entry;
+	ssize_t done;
+	int fd;
+	char *index_path;
+	size_t length = 0;
+	size_t lower;
+	size_t i;
+	uint64_t previous = 0;
+	struct stat st;
+	uint64_t *times = NULL;
+	size_t time_count = 0;
+	size_t upper;
+
+	*has_first = 0;
+	*has_last = 0;
+
+	index_path = malloc(strlen(path) + 5);
+	if (! index_path)
+	{
+		return 0;
+	}
+	sprintf(index_path, "%s.idx", path);
+	fd = open(index_path, O_RDONLY);
+	free(index_path);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	if (! fstat(fd, &st) && st.st_size >= (off_t)strlen(OUTPUT_INDEX_MAGIC) && (data = malloc(st.st_size)))
+	{
+		while (length < (size_t)st.st_size)
+		{
+			done = read(fd, data + length, st.st_size - length);
+			if (done <= 0)
+			{
+				break;
+			}
+			length += done;
+		}
+	}
+	close(fd);
+
+	if (! data || length < strlen(OUTPUT_INDEX_MAGIC) || memcmp(data, OUTPUT_INDEX_MAGIC, strlen(OUTPUT_INDEX_MAGIC)) || ! (times = malloc((length / INDEX_ENTRY_SIZE + 1) * sizeof(uint64_t))))
+	{
+		free(data);
+		return 0;
+	}
+
+	/* The time entries are kept in place; times[] holds their keys, in the same order. */
+	for (entry = data + strlen(OUTPUT_INDEX_MAGIC); entry + INDEX_ENTRY_SIZE <= data + length; entry += INDEX_ENTRY_SIZE)
+	{
+		if (entry[0] != OUTPUT_INDEX_TIME)
+		{
+			continue;
+		}
+		times[time_count] = decode_le(entry + 8, 8);
+		if (time_count && times[time_count] < previous)
+		{
+			free(times);
+			free(data);
+			return 0;
+		}
+		previous = times[time_count];
+		memmove(data + strlen(OUTPUT_INDEX_MAGIC) + time_count * INDEX_ENTRY_SIZE, entry, INDEX_ENTRY_SIZE);
+		time_count++;
+	}
+	entry = data + strlen(OUTPUT_INDEX_MAGIC);
+
+	if (conf.has_time_after)
+	{
+		/* The first entry at or after the start of the range. */
+		for (lower = 0, upper = time_count; lower < upper; )
+		{
+			i = (lower + upper) / 2;
+			if ((int64_t)times[i] < (int64_t)conf.time_after)
+			{
+				lower = i + 1;
+			}
+			else
+			{
+				upper = i;
+			}
+		}
+		if (lower > 0)
+		{
+			first->offset = decode_le(entry + (lower - 1) * INDEX_ENTRY_SIZE + 16, 8);
+			first->skip = decode_le(entry + (lower - 1) * INDEX_ENTRY_SIZE + 24, 8);
+			*has_first = 1;
+		}
+	}
+
+	if (conf.has_time_before)
+	{
+		/* The first entry after the end of the range. */
+		for (lower = 0, upper = time_count; lower < upper; )
+		{
+			i = (lower + upper) / 2;
+			if ((int64_t)times[i] <= (int64_t)conf.time_before)
+			{
+				lower = i + 1;
+			}
+			else
+			{
+				upper = i;
+			}
+		}
+		if (lower < time_count)
+		{
+			last->offset = decode_le(entry + lower * INDEX_ENTRY_SIZE + 16, 8);
+			last->skip = decode_le(entry + lower * INDEX_ENTRY_SIZE + 24, 8);
+			*has_last = 1;
+		}
+	}
+
+	free(times);
+	free(data);
+	return 1;
+}
+
+
+/**
+ * search_segment(<worker>, <segment>)
+ *
+ * Searches each line of a segment and records the matching lines (and those that could not be parsed)
+ * as spans.  As in udploggergrep.py, trailing whitespace is stripped from a line before it is parsed
+ * and printed.
+ **/
+static void search_segment(struct grep_worker_t *worker, struct grep_segment_t *segment)
+{
+	const char *end = segment->data + segment->length;
+	const char *line = segment->data;
+	const char *line_end;
+	const char *newline;
+	int result;
+	const char *trimmed;
+
+	segment->span_count = 0;
+	segment->lines = 0;
+	while (line < end)
+	{
+		newline = memchr(line, '\n', end - line);
+		line_end = newline ? newline : end;
+		for (trimmed = line_end; trimmed > line && is_space(trimmed[-1]); trimmed--);
+		segment->lines++;
+
+		result = match_line(worker, line, trimmed - line);
+		if (result > 0)
+		{
+			if (newline && trimmed == line_end)
+			{
+				add_span(segment, SPAN_MATCH, line - segment->data, newline + 1 - line, 0);
+			}
+			else
+			{
+				add_span(segment, SPAN_MATCH_NEWLINE, line - segment->data, trimmed - line, 0);
+			}
+		}
+		else if (result < 0)
+		{
+			add_span(segment, SPAN_INVALID, line - segment->data, trimmed - line, segment->lines);
+		}
+
+		line = line_end + (newline != NULL);
+	}
+}
+
+
+/**
+ * worker_main(<worker>)
+ *
+ * Worker thread: searches segments of the current block until there are none left, flagging each one
+ * as done for the main thread to write out.
+ **/
+static void *worker_main(void *arg)
+{
+	size_t i;
+	struct grep_worker_t *worker = (struct grep_worker_t *)arg;
+
+	while ((i = __atomic_fetch_add(&next_segment, 1, __ATOMIC_RELAXED)) < segment_count)
+	{
+		search_segment(worker, &segments[i]);
+		pthread_mutex_lock(&segments_mutex);
+		segments[i].done = 1;
+		pthread_cond_broadcast(&segments_cond);
+		pthread_mutex_unlock(&segments_mutex);
+	}
+	return NULL;
+}
@@ -0,0 +1,150 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __UDPLOGGERGREP_H__
+#define __UDPLOGGERGREP_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/*
+ * The regular expression options, as indexes into the pattern and regex_t arrays.
+ */
+#define PATTERN_CONTENT_TYPE  0
+#define PATTERN_HOST          1
+#define PATTERN_QUERY         2
+#define PATTERN_URL           3
+#define PATTERN_COUNT         4
+
+
+/*
+ * Field positions of the log lines written by udploggerc ("[time]", "[source]", serial, tag, then the
+ * payload), for v1 payloads (22 fields) and v2 payloads (25 fields, the fifth of which is "v2").  See
+ * Nexopia/UDPLogger/Parse.py.
+ */
+#define FIELD_TIME            0
+#define FIELD_TAG             3
+#define FIELD_VERSION         4
+#define FIELD_V1_COUNT        22
+#define FIELD_V2_COUNT        25
+#define FIELD_MAXIMUM_COUNT   FIELD_V2_COUNT
+
+#define FIELD_MISSING         -1
+
+
+/*
+ * The positions of the fields that can be searched on, for one version of the payload (fields that the
+ * version does not have are FIELD_MISSING, and are searched as empty strings).  patterns is indexed by
+ * PATTERN_*.
+ */
+struct field_layout_t {
+	unsigned int count;
+	int method;
+	int status;
+	int time_used;
+	int remote_ip;
+	int nexopia_userid;
+	int patterns[PATTERN_COUNT];
+};
+
+
+/*
+ * Structure that contains configuration information for the running instance of udploggergrep.  Each
+ * predicate is only applied if its has_ flag is set (or, for strings and patterns, if it is not NULL).
+ */
+struct udploggergrep_configuration_t {
+	char *method;
+	size_t method_length;
+	int method_valid;
+	char *patterns[PATTERN_COUNT];
+	char *remote_ip;
+	size_t remote_ip_length;
+	char *tag;
+	size_t tag_length;
+	int has_nexopia_userid;
+	long nexopia_userid;
+	int has_status;
+	long status;
+	int has_time_after;
+	time_t time_after;
+	int has_time_before;
+	time_t time_before;
+	int has_time_used;
+	long time_used;
+	unsigned int threads;
+};
+
+
+/*
+ * A run of output from a segment: matching lines (either copied as they are, or -- for lines that end
+ * in whitespace other than a single newline -- copied without it and followed by a newline) or a line
+ * that could not be parsed (line is its number within the segment, counting from 1).
+ */
+#define SPAN_MATCH            0
+#define SPAN_MATCH_NEWLINE    1
+#define SPAN_INVALID          2
+
+struct grep_span_t {
+	size_t offset;
+	size_t length;
+	uintmax_t line;
+	unsigned char type;
+};
+
+
+/*
+ * A line-aligned piece of a block of input, searched by one worker.  The spans are kept (and reused)
+ * from block to block; done is set once the worker has finished with the segment.
+ */
+struct grep_segment_t {
+	const char *data;
+	size_t length;
+	uintmax_t lines;
+	struct grep_span_t *spans;
+	size_t span_count;
+	size_t span_size;
+	int done;
+};
+
+
+/*
+ * The state of a worker thread: its own compiled copies of the regular expressions (regexec() on a
+ * shared regex_t serializes the threads), a buffer to NUL-terminate fields in for them and a cache of
+ * the last hour that a timestamp was converted for.
+ */
+struct grep_worker_t {
+	pthread_t thread;
+	regex_t regexes[PATTERN_COUNT];
+	char *scratch;
+	size_t scratch_size;
+	char hour[14];
+	time_t hour_time;
+};
+
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __UDPLOGGERPLUGIN_H__
+#define __UDPLOGGERPLUGIN_H__
+
+#include <signal.h>
+#include <stddef.h>
+#include "record.h"
+#include "udploggerclientlib.h"
+
+
+/*
+ * Consumer plugins for udploggerclientlib clients (such as udploggerc).
+ *
+ * A plugin is a shared object that is loaded at runtime with --plugin <shared object>[:<argument>]
+ * (which may be given several times).  Every plugin in a process shares the client's socket, beacon
+ * and filter, and is passed the same stream of decoded records as the client itself, so one receiver
+ * (and one copy of each log line sent by udploggerd) can serve several consumers at once.  Records
+ * are passed in the batches in which they were received: first to the client's own log_record_hook,
+ * then to each plugin in the order in which they were given.  Plugins may use the utility functions
+ * of udploggerclientlib.h (add_event_fd, add_event_timer and remove_event, for example to flush their
+ * results on a deadline) and record_field() of record.h; the client exports them for that purpose.
+ *
+ * A plugin exports a struct udplogger_plugin_t named udplogger_plugin:
+ *
+ *   static void *open_counter(const char *argument) { return calloc(1, sizeof(uintmax_t)); }
+ *   static void count_records(void *state, struct log_record_t **records, size_t count) { *(uintmax_t *)state += count; }
+ *   static void close_counter(void *state) { printf("%ju\n", *(uintmax_t *)state); free(state); }
+ *
+ *   const struct udplogger_plugin_t udplogger_plugin = {
+ *       UDPLOGGER_PLUGIN_VERSION, "counter", open_counter, count_records, NULL, close_counter
+ *   };
+ *
+ * built with `gcc -shared -fPIC -I<udplogger include directory> counter.c -o counter.so'.
+ *
+ * version   Must be UDPLOGGER_PLUGIN_VERSION (plugins built against another version are refused).
+ * name      Name of the plugin, for messages.
+ * open      Called once the plugin is loaded (while the command line is parsed) with the argument
+ *           that followed the colon (or NULL).  Returns the state that is passed to the other
+ *           functions, or NULL on failure (which stops the client).
+ * records   Called with each batch of records that the client accepts.  The records are only valid
+ *           until the call returns.
+ * signal    Called with the signals that the client received (SIGHUP and SIGTERM); may be NULL.
+ * close     Called when the client exits, in the reverse order of loading; may be NULL.
+ */
+#define UDPLOGGER_PLUGIN_VERSION 1
+
+struct udplogger_plugin_t {
+	unsigned int version;
+	const char *name;
+	void *(*open)(const char *);
+	void (*records)(void *, struct log_record_t **, size_t);
+	void (*signal)(void *, sigset_t *);
+	void (*close)(void *);
+};
+
+
+extern const struct udplogger_plugin_t udplogger_plugin;
+
+#endif
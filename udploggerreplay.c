@@ -0,0 +1,1763 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+/*
+ * Native counterpart of udploggertools/udploggermirror.py: replays the requests of udploggerc log files
+ * against a test host, at the rate at which they were logged (or faster, or as fast as possible), and
+ * reports the responses by status code and the percentiles of their latency.
+ *
+ * Requests are scheduled against the time at which their lines were received (spread evenly over the
+ * second, as udploggerc only records whole seconds), divided by --speed.  Up to REPLAY_READ_AHEAD of
+ * requests are read ahead and put on a hashed timer wheel with a resolution of REPLAY_TICK, which also
+ * holds the response timeouts and the checkpoints.  A single thread drives an epoll loop over a pool of
+ * up to --max-concurrent-requests keep-alive HTTP/1.1 connections; requests that are due while every
+ * connection is busy wait for the next free one, and how late each request is sent (its lag) is reported
+ * along with the latencies.
+ *
+ * Usage:
+ *   udploggerreplay --target-host test-web1:8080 --speed 2 /var/log/udplogger/access.log
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "udplogger.h"
+#include "udploggerreplay.h"
+
+
+int arguments_parse(int, char **);
+static void add_timer(struct replay_timer_t *, uint64_t, unsigned char, void *);
+static void advance_wheel(uint64_t);
+static void close_connection(struct replay_connection_t *);
+static void complete_request(struct replay_connection_t *, int, uint64_t);
+static void dispatch_requests(uint64_t);
+static void fail_request(struct replay_connection_t *, uint64_t);
+static void handle_connection(struct replay_connection_t *, uint32_t, uint64_t);
+static unsigned int histogram_bin(uint64_t);
+static void histogram_print(const char *, const uintmax_t *, uint64_t);
+static uint64_t histogram_value(const uintmax_t *, double);
+static uint64_t monotonic_time(void);
+static int next_timeout(uint64_t);
+static int open_connection(struct replay_connection_t *);
+static int parse_line(const char *, size_t, time_t *, const char **, size_t *, const char **, size_t *);
+static int parse_response(struct replay_connection_t *);
+static void print_checkpoint(uint64_t);
+static void print_results(void);
+static void queue_request(struct replay_request_t *, int);
+static void read_input(uint64_t);
+static int read_line(size_t *);
+static void remove_timer(struct replay_timer_t *);
+static void schedule_batch(void);
+static int send_request(struct replay_connection_t *);
+static void stop_replay(int);
+static void watch_connection(struct replay_connection_t *, uint32_t);
+
+
+/*
+ * Global Variable Declarations
+ *
+ * address          is the resolved address of the target host.
+ * batch            holds the requests of the second (batch_time) that is being read, until its last line
+ *                  has been read and they can be spread over it; batch_count are in use and batch_size
+ *                  are allocated.
+ * checkpoint_timer is the timer of the next checkpoint.
+ * conf             is used to store the configuration of the currently-running udploggerreplay process.
+ * connections      holds conf.concurrency connections, open_connections of which are open and idle of
+ *                  which are waiting for a request; in_flight requests are being served.
+ * epoll_fd         is the epoll instance that the connections are registered with.
+ * files            holds the names of the files to read (file_count of them), file_index is the index of
+ *                  the next one and input is the one being read (input_name, at line input_line).
+ * first_time       is the time at which the first line was received, replayed at replay_start.
+ * input_done       is set once every line has been read.
+ * last_due         is the time at which the last scheduled request is due.
+ * line             holds the line that was read last (line_size bytes are allocated).
+ * pending_head     is the first of the requests that are due and waiting for a connection
+ *                  (pending_tail is the last); scheduled counts them along with those still on the wheel.
+ * skipped          counts the lines that were not replayed (as they are not records of valid requests).
+ * stopping         is set by SIGINT and SIGTERM.
+ * summary          holds the results so far.
+ * time_string      is the last time field that was converted (to time_value).
+ * wheel            holds the timer lists of the slots of the timer wheel; wheel_tick is the next tick to
+ *                  expire and timers_active counts the timers on the wheel.
+ */
+static struct addrinfo *address = NULL;
+static struct replay_request_t **batch = NULL;
+static size_t batch_count = 0;
+static size_t batch_size = 0;
+static time_t batch_time = 0;
+static struct replay_timer_t checkpoint_timer;
+struct udploggerreplay_configuration_t conf;
+static struct replay_connection_t *connections = NULL;
+static int epoll_fd = -1;
+static char **files = NULL;
+static int file_count = 0;
+static int file_index = 0;
+static int have_first = 0;
+static time_t first_time = 0;
+static struct replay_connection_t *idle = NULL;
+static uintmax_t in_flight = 0;
+static gzFile input = NULL;
+static int input_done = 0;
+static uintmax_t input_line = 0;
+static const char *input_name = NULL;
+static uint64_t last_due = 0;
+static char *line = NULL;
+static size_t line_size = 0;
+static unsigned int open_connections = 0;
+static struct replay_request_t *pending_head = NULL;
+static struct replay_request_t *pending_tail = NULL;
+static uint64_t replay_start = 0;
+static size_t scheduled = 0;
+static uintmax_t skipped = 0;
+static volatile sig_atomic_t stopping = 0;
+static struct replay_summary_t summary;
+static char time_string[32] = "";
+static time_t time_value = 0;
+static size_t timers_active = 0;
+static struct replay_timer_t *wheel[REPLAY_WHEEL_SLOTS];
+static uint64_t wheel_tick = 0;
+
+
+/**
+ * main()
+ *
+ * Parses the arguments and resolves the target host, then replays the requests of each of the files given
+ * on the command line (or of standard input, if there are none) and prints a summary of the results.
+ **/
+int main(int argc, char **argv)
+{
+	struct epoll_event events[64];
+	struct addrinfo hints;
+	struct sigaction action;
+	uint64_t now;
+	unsigned int i;
+	int count;
+	int j;
+	int result;
+
+	result = arguments_parse(argc, argv);
+	if (result <= 0)
+	{
+		return -result;
+	}
+
+#ifdef __DEBUG__
+	fprintf(stderr, "udploggerreplay.c debug: parameter target = '%s' port '%s' (Host: %s)\n", conf.node, conf.service, conf.vhost ? conf.vhost : conf.host);
+	fprintf(stderr, "udploggerreplay.c debug: parameter concurrency = '%u'\n", conf.concurrency);
+	fprintf(stderr, "udploggerreplay.c debug: parameter speed = '%g'\n", conf.speed);
+#endif
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	result = getaddrinfo(conf.node, conf.service, &hints, &address);
+	if (result)
+	{
+		fprintf(stderr, "udploggerreplay.c getaddrinfo(%s): %s\n", conf.node, gai_strerror(result));
+		return 1;
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_replay;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+	{
+		perror("udploggerreplay.c epoll_create1()");
+		return 1;
+	}
+	connections = calloc(conf.concurrency, sizeof(struct replay_connection_t));
+	if (! connections)
+	{
+		perror("udploggerreplay.c calloc(connections)");
+		return 1;
+	}
+	for (i = 0; i < conf.concurrency; i++)
+	{
+		connections[i].fd = -1;
+	}
+
+	files = argv + optind;
+	file_count = argc - optind;
+	if (! file_count)
+	{
+		input = gzdopen(STDIN_FILENO, "rb");
+		input_name = "stdin";
+		if (! input)
+		{
+			perror("udploggerreplay.c gzdopen()");
+			return 1;
+		}
+	}
+
+	now = monotonic_time();
+	memset(&summary, 0, sizeof(summary));
+	summary.started = now;
+	summary.last_checkpoint = now;
+	wheel_tick = now / REPLAY_TICK;
+	add_timer(&checkpoint_timer, now + conf.checkpoint, TIMER_CHECKPOINT, NULL);
+
+	while (! stopping)
+	{
+		now = monotonic_time();
+		advance_wheel(now);
+		read_input(now);
+		dispatch_requests(now);
+		if (input_done && ! scheduled && ! in_flight)
+		{
+			break;
+		}
+
+		count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), next_timeout(now));
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("udploggerreplay.c epoll_wait()");
+			break;
+		}
+		now = monotonic_time();
+		for (j = 0; j < count; j++)
+		{
+			handle_connection(events[j].data.ptr, events[j].events, now);
+		}
+	}
+
+	now = monotonic_time();
+	printf("Run Complete: ");
+	print_results();
+	printf("\n");
+	histogram_print("latency", summary.latencies, summary.latency_maximum);
+	if (! conf.flood)
+	{
+		histogram_print("lag", summary.lags, summary.lag_maximum);
+	}
+	if (skipped)
+	{
+		printf("%ju lines skipped (not records of valid requests)\n", skipped);
+	}
+	printf("%ju results in %.3f seconds (%.3f/sec)\n", summary.total, (now - summary.started) / 1000000.0, (now > summary.started) ? summary.total * 1000000.0 / (now - summary.started) : 0.0);
+	return 0;
+}
+
+
+/**
+ * arguments_parse(argc, argv)
+ *
+ * Utility function to parse the passed in arguments using getopt and to check the values given.
+ * Returns 1 to go ahead, 0 if the program should exit successfully (after --help or --version)
+ * or a negative value if the arguments were not valid.
+ **/
+int arguments_parse(int argc, char **argv)
+{
+	static struct option long_options[] =
+	{
+		{"checkpoint", required_argument, 0, 'c'},
+		{"flood", no_argument, 0, 'f'},
+		{"help", no_argument, 0, 'h'},
+		{"max-concurrent-requests", required_argument, 0, 'm'},
+		{"speed", required_argument, 0, 's'},
+		{"target-host", required_argument, 0, 'H'},
+		{"target-vhost", required_argument, 0, 'V'},
+		{"timeout", required_argument, 0, 't'},
+		{"version", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+	char *end;
+	char *host;
+	char *port;
+	double double_tmp;
+	int i;
+	long long_tmp;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.checkpoint = 30ULL * 1000000ULL;
+	conf.concurrency = 16;
+	conf.speed = 1.0;
+	conf.timeout = 2ULL * 1000000ULL;
+
+	while (1)
+	{
+		i = getopt_long(argc, argv, "hv", long_options, NULL);
+		if (i == -1)
+		{
+			break;
+		}
+		switch (i)
+		{
+			case 'c':
+			case 't':
+				errno = 0;
+				double_tmp = strtod(optarg, &end);
+				if (errno || end == optarg || *end || double_tmp <= 0 || double_tmp > 86400)
+				{
+					fprintf(stderr, "udploggerreplay.c invalid argument for option %s (must be a number of seconds x, where 0 < x <= 86400): '%s'\n", (i == 'c') ? "checkpoint" : "timeout", optarg);
+					return -2;
+				}
+				if (i == 'c')
+				{
+					conf.checkpoint = double_tmp * 1000000.0;
+				}
+				else
+				{
+					conf.timeout = double_tmp * 1000000.0;
+				}
+				break;
+			case 'f':
+				conf.flood = 1;
+				break;
+			case 'H':
+				/* Only plain HTTP is replayed; a path after the host is ignored, as udploggermirror.py does. */
+				host = optarg;
+				if (strstr(host, "://"))
+				{
+					if (strncasecmp(host, "http://", 7))
+					{
+						fprintf(stderr, "udploggerreplay.c invalid argument for option target-host (only http:// is supported): '%s'\n", optarg);
+						return -2;
+					}
+					host += 7;
+				}
+				host = strndup(host, strcspn(host, "/"));
+				conf.host = strdup(host);
+				if (! host || ! conf.host)
+				{
+					perror("udploggerreplay.c strdup()");
+					return -1;
+				}
+				port = NULL;
+				if (*host == '[' && strchr(host, ']'))
+				{
+					conf.node = host + 1;
+					port = strchr(host, ']');
+					*port++ = '\0';
+					port = (*port == ':') ? port + 1 : NULL;
+				}
+				else
+				{
+					conf.node = host;
+					port = strchr(host, ':');
+					if (port && ! strchr(port + 1, ':'))
+					{
+						*port++ = '\0';
+					}
+					else
+					{
+						port = NULL;
+					}
+				}
+				conf.service = (port && *port) ? port : "80";
+				if (! *conf.node)
+				{
+					fprintf(stderr, "udploggerreplay.c invalid argument for option target-host: '%s'\n", optarg);
+					return -2;
+				}
+				break;
+			case 'h':
+				printf("Usage: udploggerreplay [OPTIONS] --target-host <host> [FILE]...\n");
+				printf("\n");
+				printf("Reads udploggerc output from each FILE (which may be gzip-compressed) or from\n");
+				printf("standard input and sends its requests (GET, with the logged URL and query\n");
+				printf("string) to <host> at the rate at which they were logged, over keep-alive\n");
+				printf("connections.  Prints the responses by status code and the percentiles of their\n");
+				printf("latency (and of how late the requests were sent) when done.\n");
+				printf("\n");
+				printf("      --checkpoint <seconds>                     set the length of time between display of checkpoints (default: 30)\n");
+				printf("      --flood                                    send requests as fast as possible rather than at the logged rate\n");
+				printf("  -h, --help                                     display this help and exit\n");
+				printf("      --max-concurrent-requests <count>          set the maximum number of requests (and connections) at once (default: 16)\n");
+				printf("      --speed <factor>                           replay <factor> times as fast as logged (default: 1)\n");
+				printf("      --target-host <host>[:<port>]              the host to send requests to\n");
+				printf("      --target-vhost <vhost>                     override the Host header (which is based on the value of <host>)\n");
+				printf("      --timeout <seconds>                        give up on responses that take longer than <seconds> (default: 2)\n");
+				printf("  -v, --version                                  display udploggerreplay version and exit\n");
+				printf("\n");
+				return 0;
+			case 'm':
+				errno = 0;
+				long_tmp = strtol(optarg, &end, 10);
+				if (errno || end == optarg || *end || long_tmp < 1 || long_tmp > 65536)
+				{
+					fprintf(stderr, "udploggerreplay.c invalid argument for option max-concurrent-requests (must be integer x, where 1 <= x <= 65536): '%s'\n", optarg);
+					return -2;
+				}
+				conf.concurrency = (unsigned int)long_tmp;
+				break;
+			case 's':
+				errno = 0;
+				double_tmp = strtod(optarg, &end);
+				if (errno || end == optarg || *end || double_tmp <= 0)
+				{
+					fprintf(stderr, "udploggerreplay.c invalid argument for option speed (must be a number x, where x > 0): '%s'\n", optarg);
+					return -2;
+				}
+				conf.speed = double_tmp;
+				break;
+			case 'V':
+				conf.vhost = optarg;
+				break;
+			case 'v':
+				printf("udploggerreplay.c revision r%d\n", REVISION);
+				return 0;
+			default:
+				return -3;
+		}
+	}
+
+	if (! conf.host)
+	{
+		fprintf(stderr, "udploggerreplay.c option --target-host: required\n");
+		return -2;
+	}
+	return 1;
+}
+
+
+/**
+ * add_timer(<timer>, <due time>, <type>, <data>)
+ *
+ * Puts a timer on the wheel.  Timers that are already due are put in the slot of the next tick.
+ **/
+static void add_timer(struct replay_timer_t *timer, uint64_t due, unsigned char type, void *data)
+{
+	uint64_t tick = due / REPLAY_TICK;
+
+	if (tick < wheel_tick)
+	{
+		tick = wheel_tick;
+	}
+	timer->due = due;
+	timer->type = type;
+	timer->data = data;
+	timer->slot = tick % REPLAY_WHEEL_SLOTS;
+	timer->previous = NULL;
+	timer->next = wheel[timer->slot];
+	if (timer->next)
+	{
+		timer->next->previous = timer;
+	}
+	wheel[timer->slot] = timer;
+	timer->active = 1;
+	timers_active++;
+}
+
+
+/**
+ * advance_wheel(<now>)
+ *
+ * Expires the timers of every tick up to now: due requests join the queue for a connection, requests that
+ * timed out are counted and the checkpoint is printed.  Timers are taken off the wheel before any of them
+ * are handled, so that handling one may add or remove others.
+ **/
+static void advance_wheel(uint64_t now)
+{
+	struct replay_timer_t *expired = NULL;
+	struct replay_timer_t *last = NULL;
+	struct replay_timer_t *timer;
+	struct replay_timer_t *next;
+	uint64_t target = now / REPLAY_TICK;
+	uint64_t ticks;
+	uint64_t i;
+
+	if (target < wheel_tick)
+	{
+		return;
+	}
+	ticks = target - wheel_tick + 1;
+	if (! timers_active)
+	{
+		ticks = 0;
+	}
+	else if (ticks > REPLAY_WHEEL_SLOTS)
+	{
+		ticks = REPLAY_WHEEL_SLOTS;
+	}
+
+	for (i = 0; i < ticks; i++)
+	{
+		for (timer = wheel[(wheel_tick + i) % REPLAY_WHEEL_SLOTS]; timer; timer = next)
+		{
+			next = timer->next;
+			if (timer->due / REPLAY_TICK <= target)
+			{
+				remove_timer(timer);
+				if (last)
+				{
+					last->next = timer;
+				}
+				else
+				{
+					expired = timer;
+				}
+				last = timer;
+				timer->next = NULL;
+			}
+		}
+	}
+	wheel_tick = target + 1;
+
+	for (timer = expired; timer; timer = next)
+	{
+		next = timer->next;
+		switch (timer->type)
+		{
+			case TIMER_REQUEST:
+				queue_request(timer->data, 0);
+				break;
+			case TIMER_TIMEOUT:
+				complete_request(timer->data, RESULT_TIMEOUT, now);
+				break;
+			case TIMER_CHECKPOINT:
+				print_checkpoint(now);
+				add_timer(&checkpoint_timer, now + conf.checkpoint, TIMER_CHECKPOINT, NULL);
+				break;
+		}
+	}
+}
+
+
+/**
+ * close_connection(<connection>)
+ *
+ * Closes a connection, taking it off the idle list.  Its request (if any) must have been dealt with.
+ **/
+static void close_connection(struct replay_connection_t *connection)
+{
+	struct replay_connection_t **previous;
+
+	if (connection->state == CONNECTION_CLOSED)
+	{
+		return;
+	}
+	if (connection->state == CONNECTION_IDLE)
+	{
+		for (previous = &idle; *previous && *previous != connection; previous = &(*previous)->next_idle);
+		if (*previous)
+		{
+			*previous = connection->next_idle;
+		}
+	}
+	remove_timer(&connection->timer);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	connection->fd = -1;
+	connection->events = 0;
+	connection->state = CONNECTION_CLOSED;
+	connection->input_length = 0;
+	open_connections--;
+}
+
+
+/**
+ * complete_request(<connection>, <result>, <now>)
+ *
+ * Counts the result of the request of a connection and frees it.  The connection is kept for the next
+ * request, unless the request failed or the server is closing it.
+ **/
+static void complete_request(struct replay_connection_t *connection, int result, uint64_t now)
+{
+	struct replay_request_t *request = connection->request;
+	uint64_t latency = now - request->dispatched;
+
+	summary.results[result]++;
+	summary.total++;
+	summary.latencies[histogram_bin(latency)]++;
+	if (latency > summary.latency_maximum)
+	{
+		summary.latency_maximum = latency;
+	}
+
+	remove_timer(&connection->timer);
+	free(request);
+	connection->request = NULL;
+	connection->served++;
+	in_flight--;
+
+	if (connection->close || result == RESULT_TIMEOUT || result == RESULT_ERROR)
+	{
+		close_connection(connection);
+	}
+	else
+	{
+		connection->state = CONNECTION_IDLE;
+		connection->next_idle = idle;
+		idle = connection;
+		watch_connection(connection, EPOLLIN);
+	}
+}
+
+
+/**
+ * dispatch_requests(<now>)
+ *
+ * Sends the requests that are waiting for a connection over the idle connections, opening new ones while
+ * there are fewer than conf.concurrency.  Requests for which no connection can be opened are counted as
+ * errors straight away.
+ **/
+static void dispatch_requests(uint64_t now)
+{
+	struct replay_connection_t *connection;
+	struct replay_request_t *request;
+	uint64_t lag;
+	unsigned int i;
+
+	while (pending_head)
+	{
+		connection = NULL;
+		if (idle)
+		{
+			connection = idle;
+			idle = connection->next_idle;
+		}
+		else if (open_connections < conf.concurrency)
+		{
+			for (i = 0; connections[i].state != CONNECTION_CLOSED; i++);
+			connection = &connections[i];
+		}
+		else
+		{
+			break;
+		}
+
+		request = pending_head;
+		pending_head = request->next;
+		if (! pending_head)
+		{
+			pending_tail = NULL;
+		}
+		scheduled--;
+		request->dispatched = now;
+		if (! conf.flood)
+		{
+			lag = (now > request->due) ? now - request->due : 0;
+			summary.lags[histogram_bin(lag)]++;
+			if (lag > summary.lag_maximum)
+			{
+				summary.lag_maximum = lag;
+			}
+		}
+
+		if (connection->state == CONNECTION_CLOSED && open_connection(connection) < 0)
+		{
+			summary.results[RESULT_ERROR]++;
+			summary.total++;
+			summary.latencies[0]++;
+			free(request);
+			continue;
+		}
+		in_flight++;
+		connection->request = request;
+		connection->received = 0;
+		connection->output_sent = 0;
+		connection->output_length = snprintf(NULL, 0, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: udploggerreplay/r%d\r\n\r\n", request->target, conf.vhost ? conf.vhost : conf.host, REVISION);
+		if (connection->output_length >= connection->output_size)
+		{
+			free(connection->output);
+			connection->output_size = connection->output_length + 1;
+			connection->output = malloc(connection->output_size);
+			if (! connection->output)
+			{
+				perror("udploggerreplay.c malloc(output)");
+				exit(1);
+			}
+		}
+		snprintf(connection->output, connection->output_size, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: udploggerreplay/r%d\r\n\r\n", request->target, conf.vhost ? conf.vhost : conf.host, REVISION);
+		add_timer(&connection->timer, now + conf.timeout, TIMER_TIMEOUT, connection);
+		if (connection->state == CONNECTION_IDLE)
+		{
+			connection->state = CONNECTION_SENDING;
+			send_request(connection);
+		}
+	}
+}
+
+
+/**
+ * fail_request(<connection>, <now>)
+ *
+ * Handles a connection that failed while serving a request.  A keep-alive connection may have been closed
+ * by the server just as the request was sent, so a request that failed on a connection that had already
+ * served others, without receiving any of its response, is sent once more (first in line); any other
+ * request that fails is counted as an error.
+ **/
+static void fail_request(struct replay_connection_t *connection, uint64_t now)
+{
+	struct replay_request_t *request = connection->request;
+
+	if (! request)
+	{
+		close_connection(connection);
+		return;
+	}
+	if (! request->retried && connection->served && ! connection->received)
+	{
+		request->retried = 1;
+		connection->request = NULL;
+		in_flight--;
+		scheduled++;
+		close_connection(connection);
+		queue_request(request, 1);
+		return;
+	}
+	connection->close = 1;
+	complete_request(connection, RESULT_ERROR, now);
+}
+
+
+/**
+ * handle_connection(<connection>, <events>, <now>)
+ *
+ * Handles the epoll events of a connection: completes a connect, sends the rest of a request or reads
+ * (and parses) as much of a response as is available.
+ **/
+static void handle_connection(struct replay_connection_t *connection, uint32_t events, uint64_t now)
+{
+	socklen_t length;
+	ssize_t count;
+	char *buffer;
+	int error;
+	int result;
+
+	switch (connection->state)
+	{
+		case CONNECTION_CLOSED:
+			/* Closed while handling earlier events of the same batch. */
+			return;
+		case CONNECTION_IDLE:
+			/* Keep-alive connections that the server closes (or sends anything on) are not reused. */
+			close_connection(connection);
+			return;
+		case CONNECTION_CONNECTING:
+			error = 0;
+			length = sizeof(error);
+			if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error)
+			{
+#ifdef __DEBUG__
+				fprintf(stderr, "udploggerreplay.c debug: connect(): %s\n", strerror(error ? error : errno));
+#endif
+				fail_request(connection, now);
+				return;
+			}
+			connection->state = CONNECTION_SENDING;
+			send_request(connection);
+			return;
+		case CONNECTION_SENDING:
+			if (events & (EPOLLERR | EPOLLHUP))
+			{
+				fail_request(connection, now);
+				return;
+			}
+			if (events & EPOLLOUT && send_request(connection) < 0)
+			{
+				return;
+			}
+			if (! (events & EPOLLIN))
+			{
+				return;
+			}
+			break;
+	}
+
+	while (connection->state == CONNECTION_SENDING || connection->state == CONNECTION_RECEIVING)
+	{
+		if (connection->input_length == connection->input_size)
+		{
+			if (connection->input_size >= REPLAY_HEADERS_MAXIMUM + REPLAY_BUFFER_SIZE)
+			{
+				fail_request(connection, now);
+				return;
+			}
+			buffer = realloc(connection->input, connection->input_size ? connection->input_size * 2 : REPLAY_BUFFER_SIZE);
+			if (! buffer)
+			{
+				perror("udploggerreplay.c realloc(input)");
+				exit(1);
+			}
+			connection->input = buffer;
+			connection->input_size = connection->input_size ? connection->input_size * 2 : REPLAY_BUFFER_SIZE;
+		}
+
+		count = recv(connection->fd, connection->input + connection->input_length, connection->input_size - connection->input_length, 0);
+		if (count < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			fail_request(connection, now);
+			return;
+		}
+		if (! count)
+		{
+			if (connection->response_state == RESPONSE_UNTIL_CLOSE && connection->state == CONNECTION_RECEIVING)
+			{
+				connection->close = 1;
+				complete_request(connection, connection->status, now);
+			}
+			else
+			{
+				fail_request(connection, now);
+			}
+			return;
+		}
+		connection->received += count;
+		connection->input_length += count;
+
+		result = parse_response(connection);
+		if (result < 0)
+		{
+			fail_request(connection, now);
+			return;
+		}
+		if (result > 0)
+		{
+			complete_request(connection, connection->status, now);
+			return;
+		}
+	}
+}
+
+
+/**
+ * histogram_bin(<value>)
+ *
+ * Returns the index of the bin of the latency histograms that <value> falls in: values below
+ * 2 ^ HISTOGRAM_SUB_BUCKET_BITS have a bin each, larger ones share bins with those that have the same
+ * HISTOGRAM_SUB_BUCKET_BITS most significant bits.
+ **/
+static unsigned int histogram_bin(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < (1ULL << HISTOGRAM_SUB_BUCKET_BITS))
+	{
+		return (unsigned int)value;
+	}
+	shift = 64 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKET_BITS;
+	return (shift << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + (unsigned int)(value >> shift);
+}
+
+
+/**
+ * histogram_print(<name>, <histogram>, <maximum>)
+ *
+ * Prints the percentiles of a histogram of microseconds, in milliseconds.
+ **/
+static void histogram_print(const char *name, const uintmax_t *histogram, uint64_t maximum)
+{
+	static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+	static const char *labels[] = {"p50", "p90", "p99", "p99.9"};
+	uint64_t value;
+	unsigned int i;
+
+	printf("%s (ms):", name);
+	for (i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++)
+	{
+		/* The middle of the bin of the largest value may be above it. */
+		value = histogram_value(histogram, fractions[i]);
+		printf(" %s %.3f,", labels[i], ((value < maximum) ? value : maximum) / 1000.0);
+	}
+	printf(" max %.3f\n", maximum / 1000.0);
+}
+
+
+/**
+ * histogram_value(<histogram>, <fraction>)
+ *
+ * Returns the value below which <fraction> of the values of a histogram fall (the middle of its bin), or
+ * 0 if it is empty.
+ **/
+static uint64_t histogram_value(const uintmax_t *histogram, double fraction)
+{
+	uintmax_t seen = 0;
+	uintmax_t total = 0;
+	uintmax_t rank;
+	uint64_t lowest;
+	uint64_t width;
+	unsigned int shift;
+	unsigned int i;
+
+	for (i = 0; i < HISTOGRAM_BINS; i++)
+	{
+		total += histogram[i];
+	}
+	if (! total)
+	{
+		return 0;
+	}
+	rank = (uintmax_t)(fraction * total + 0.5);
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+	for (i = 0; i < HISTOGRAM_BINS - 1; i++)
+	{
+		seen += histogram[i];
+		if (seen >= rank)
+		{
+			break;
+		}
+	}
+	if (i < (1U << HISTOGRAM_SUB_BUCKET_BITS))
+	{
+		return i;
+	}
+	shift = (i >> (HISTOGRAM_SUB_BUCKET_BITS - 1)) - 1;
+	lowest = (uint64_t)(i - (shift << (HISTOGRAM_SUB_BUCKET_BITS - 1))) << shift;
+	width = 1ULL << shift;
+	return lowest + (width - 1) / 2;
+}
+
+
+/**
+ * monotonic_time()
+ *
+ * Returns the time of the monotonic clock, in microseconds.
+ **/
+static uint64_t monotonic_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+/**
+ * next_timeout(<now>)
+ *
+ * Returns how long (milliseconds) epoll_wait() may wait: until the first timer on the wheel is due, or
+ * until more of the input is to be read ahead.
+ **/
+static int next_timeout(uint64_t now)
+{
+	struct replay_timer_t *timer;
+	uint64_t due = UINT64_MAX;
+	uint64_t wait;
+	unsigned int i;
+
+	if (! input_done && ! conf.flood && have_first && scheduled < REPLAY_MAX_SCHEDULED)
+	{
+		due = replay_start + (uint64_t)((batch_time - first_time) * 1000000.0 / conf.speed);
+		due = (due > REPLAY_READ_AHEAD) ? due - REPLAY_READ_AHEAD : 0;
+	}
+	else if (! input_done && conf.flood && scheduled < 2 * conf.concurrency)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < REPLAY_WHEEL_SLOTS; i++)
+	{
+		for (timer = wheel[(wheel_tick + i) % REPLAY_WHEEL_SLOTS]; timer; timer = timer->next)
+		{
+			if (timer->due < due)
+			{
+				due = timer->due;
+			}
+		}
+		/* Timers in this slot that are due on this turn of the wheel are due before any later slot. */
+		if (due / REPLAY_TICK <= wheel_tick + i)
+		{
+			break;
+		}
+	}
+
+	if (due <= now)
+	{
+		return 0;
+	}
+	wait = (due - now + 999) / 1000;
+	return (wait > INT_MAX) ? INT_MAX : (int)wait;
+}
+
+
+/**
+ * open_connection(<connection>)
+ *
+ * Starts a non-blocking connect to the target host and registers the connection with epoll.  Returns 0
+ * on success or -1 on error.
+ **/
+static int open_connection(struct replay_connection_t *connection)
+{
+	struct epoll_event event;
+	int fd;
+	int value = 1;
+
+	fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+	if (fd < 0)
+	{
+		perror("udploggerreplay.c socket()");
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+	if (connect(fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS)
+	{
+#ifdef __DEBUG__
+		perror("udploggerreplay.c connect()");
+#endif
+		close(fd);
+		return -1;
+	}
+
+	connection->fd = fd;
+	connection->events = EPOLLOUT;
+	connection->state = CONNECTION_CONNECTING;
+	connection->close = 0;
+	connection->input_length = 0;
+	connection->served = 0;
+	memset(&event, 0, sizeof(event));
+	event.events = connection->events;
+	event.data.ptr = connection;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		perror("udploggerreplay.c epoll_ctl()");
+		close(fd);
+		connection->fd = -1;
+		connection->state = CONNECTION_CLOSED;
+		return -1;
+	}
+	open_connections++;
+	return 0;
+}
+
+
+/**
+ * parse_line(<line>, <length>, <time>, <url>, <url length>, <query>, <query length>)
+ *
+ * Splits a line written by udploggerc into its fields and finds the time at which it was received and the
+ * URL and query string of its request.  Returns 0 on success or -1 if the line is not a v1 or v2 record.
+ **/
+static int parse_line(const char *data, size_t length, time_t *when, const char **url, size_t *url_length, const char **query, size_t *query_length)
+{
+	const char *fields[FIELD_MAXIMUM_COUNT + 1];
+	const char *end = data + length;
+	const char *position = data;
+	struct tm tm;
+	size_t lengths[FIELD_MAXIMUM_COUNT + 1];
+	size_t count = 0;
+	int url_field;
+	int query_field;
+
+	while (count <= FIELD_MAXIMUM_COUNT)
+	{
+		fields[count] = position;
+		position = memchr(position, DELIMITER_CHARACTER, end - position);
+		if (! position)
+		{
+			lengths[count] = end - fields[count];
+			count++;
+			break;
+		}
+		lengths[count] = position - fields[count];
+		count++;
+		position++;
+	}
+
+	if (count == FIELD_V1_COUNT)
+	{
+		url_field = FIELD_V1_URL;
+		query_field = FIELD_V1_QUERY;
+	}
+	else if (count == FIELD_V2_COUNT && lengths[FIELD_VERSION] == 2 && ! memcmp(fields[FIELD_VERSION], "v2", 2))
+	{
+		url_field = FIELD_V2_URL;
+		query_field = FIELD_V2_QUERY;
+	}
+	else
+	{
+		return -1;
+	}
+
+	/* Lines come in order, so the time rarely changes from one line to the next. */
+	if (lengths[FIELD_TIME] >= sizeof(time_string))
+	{
+		return -1;
+	}
+	if (strncmp(time_string, fields[FIELD_TIME], lengths[FIELD_TIME]) || time_string[lengths[FIELD_TIME]])
+	{
+		memcpy(time_string, fields[FIELD_TIME], lengths[FIELD_TIME]);
+		time_string[lengths[FIELD_TIME]] = '\0';
+		memset(&tm, 0, sizeof(tm));
+		position = strptime(time_string, "[%Y-%m-%d %H:%M:%S]", &tm);
+		if (! position || *position)
+		{
+			time_string[0] = '\0';
+			return -1;
+		}
+		tm.tm_isdst = -1;
+		time_value = mktime(&tm);
+	}
+
+	*when = time_value;
+	*url = fields[url_field];
+	*url_length = lengths[url_field];
+	*query = fields[query_field];
+	*query_length = lengths[query_field];
+	return 0;
+}
+
+
+/**
+ * parse_response(<connection>)
+ *
+ * Parses as much of the response in the input buffer of a connection as possible (discarding its body).
+ * Returns 1 once the response is complete, 0 if more of it is needed or -1 if it is not valid.
+ **/
+static int parse_response(struct replay_connection_t *connection)
+{
+	char *data = connection->input;
+	char *end = connection->input + connection->input_length;
+	char *header;
+	char *next;
+	char *value;
+	size_t available;
+	int chunked;
+	int content_length;
+	int keep_alive;
+	int more = 0;
+	int result = 0;
+
+	while (! result && ! more && data < end)
+	{
+		switch (connection->response_state)
+		{
+			case RESPONSE_HEADERS:
+				next = memmem(data, end - data, "\r\n\r\n", 4);
+				if (! next)
+				{
+					if (end - data > REPLAY_HEADERS_MAXIMUM)
+					{
+						return -1;
+					}
+					more = 1;
+					break;
+				}
+				*next = '\0';
+				if (strncmp(data, "HTTP/1.", 7) || (data[7] != '0' && data[7] != '1') || data[8] != ' ' || sscanf(data + 9, "%3d", &connection->status) != 1 || connection->status < 100)
+				{
+					return -1;
+				}
+				keep_alive = (data[7] == '1');
+				chunked = 0;
+				content_length = 0;
+				connection->remaining = 0;
+				for (header = strstr(data, "\r\n"); header; header = strstr(header, "\r\n"))
+				{
+					header += 2;
+					value = strchr(header, ':');
+					if (! value)
+					{
+						continue;
+					}
+					for (value++; *value == ' ' || *value == '\t'; value++);
+					if (! strncasecmp(header, "Content-Length:", 15))
+					{
+						connection->remaining = strtoumax(value, NULL, 10);
+						content_length = 1;
+					}
+					else if (! strncasecmp(header, "Transfer-Encoding:", 18))
+					{
+						chunked = ! strncasecmp(value, "chunked", 7);
+					}
+					else if (! strncasecmp(header, "Connection:", 11))
+					{
+						if (! strncasecmp(value, "close", 5))
+						{
+							keep_alive = 0;
+						}
+						else if (! strncasecmp(value, "keep-alive", 10))
+						{
+							keep_alive = 1;
+						}
+					}
+				}
+				data = next + 4;
+				if (! keep_alive)
+				{
+					connection->close = 1;
+				}
+
+				if (connection->status < 200)
+				{
+					/* Interim responses are followed by the real one. */
+					continue;
+				}
+				if (connection->status == 204 || connection->status == 304)
+				{
+					result = 1;
+				}
+				else if (chunked)
+				{
+					connection->response_state = RESPONSE_CHUNK_SIZE;
+				}
+				else if (content_length)
+				{
+					connection->response_state = RESPONSE_BODY;
+					result = ! connection->remaining;
+				}
+				else
+				{
+					connection->response_state = RESPONSE_UNTIL_CLOSE;
+					connection->close = 1;
+				}
+				break;
+			case RESPONSE_BODY:
+			case RESPONSE_CHUNK_DATA:
+				available = end - data;
+				if (available > connection->remaining)
+				{
+					available = connection->remaining;
+				}
+				data += available;
+				connection->remaining -= available;
+				if (! connection->remaining)
+				{
+					if (connection->response_state == RESPONSE_BODY)
+					{
+						result = 1;
+					}
+					else
+					{
+						connection->response_state = RESPONSE_CHUNK_END;
+					}
+				}
+				break;
+			case RESPONSE_CHUNK_SIZE:
+			case RESPONSE_CHUNK_END:
+			case RESPONSE_TRAILERS:
+				next = memmem(data, end - data, "\r\n", 2);
+				if (! next)
+				{
+					if (end - data > REPLAY_BUFFER_SIZE)
+					{
+						return -1;
+					}
+					more = 1;
+					break;
+				}
+				if (connection->response_state == RESPONSE_CHUNK_SIZE)
+				{
+					if (! isxdigit((unsigned char)*data))
+					{
+						return -1;
+					}
+					connection->remaining = strtoumax(data, NULL, 16);
+					connection->response_state = connection->remaining ? RESPONSE_CHUNK_DATA : RESPONSE_TRAILERS;
+				}
+				else if (connection->response_state == RESPONSE_CHUNK_END)
+				{
+					if (next != data)
+					{
+						return -1;
+					}
+					connection->response_state = RESPONSE_CHUNK_SIZE;
+				}
+				else if (next == data)
+				{
+					result = 1;
+				}
+				data = next + 2;
+				break;
+			case RESPONSE_UNTIL_CLOSE:
+				data = end;
+				break;
+		}
+	}
+
+	/* Keep what is left for the next read; nothing should follow a complete response. */
+	if (result && data < end)
+	{
+		connection->close = 1;
+		data = end;
+	}
+	connection->input_length = end - data;
+	if (connection->input_length && data != connection->input)
+	{
+		memmove(connection->input, data, connection->input_length);
+	}
+	return result;
+}
+
+
+/**
+ * print_checkpoint(<now>)
+ *
+ * Prints the results so far along with how many arrived (and at what rate) since the last checkpoint.
+ **/
+static void print_checkpoint(uint64_t now)
+{
+	char buffer[32];
+	struct tm tm;
+	time_t current = time(NULL);
+	intmax_t delta = summary.total - summary.last_checkpoint_total;
+
+	if (! localtime_r(&current, &tm) || ! strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm))
+	{
+		buffer[0] = '\0';
+	}
+	printf("%s checkpoint (%-+4jd results, %+06.3f/sec): ", buffer, delta, (now > summary.last_checkpoint) ? delta * 1000000.0 / (now - summary.last_checkpoint) : 0.0);
+	if (summary.total)
+	{
+		print_results();
+	}
+	else
+	{
+		printf("no results yet");
+	}
+	printf("\n");
+	fflush(stdout);
+	summary.last_checkpoint = now;
+	summary.last_checkpoint_total = summary.total;
+}
+
+
+/**
+ * print_results()
+ *
+ * Prints the number of results and their breakdown by status code, as udploggermirror.py does.
+ **/
+static void print_results(void)
+{
+	unsigned int i;
+
+	if (! summary.total)
+	{
+		return;
+	}
+	printf("%ju results total - breakdown (code[occurrences]):", summary.total);
+	for (i = 0; i < RESULT_TIMEOUT; i++)
+	{
+		if (summary.results[i])
+		{
+			printf(" %u[%ju]", i, summary.results[i]);
+		}
+	}
+	if (summary.results[RESULT_TIMEOUT])
+	{
+		printf(" Timeout[%ju]", summary.results[RESULT_TIMEOUT]);
+	}
+	if (summary.results[RESULT_ERROR])
+	{
+		printf(" Error[%ju]", summary.results[RESULT_ERROR]);
+	}
+}
+
+
+/**
+ * queue_request(<request>, <front>)
+ *
+ * Adds a request that is due to the queue of those waiting for a connection, at the front of the queue
+ * (for one that is being retried) or at the back.
+ **/
+static void queue_request(struct replay_request_t *request, int front)
+{
+	if (front)
+	{
+		request->next = pending_head;
+		pending_head = request;
+		if (! pending_tail)
+		{
+			pending_tail = request;
+		}
+		return;
+	}
+	request->next = NULL;
+	if (pending_tail)
+	{
+		pending_tail->next = request;
+	}
+	else
+	{
+		pending_head = request;
+	}
+	pending_tail = request;
+}
+
+
+/**
+ * read_input(<now>)
+ *
+ * Reads lines and schedules their requests until the input is read REPLAY_READ_AHEAD ahead of the replay
+ * (or, with --flood, until enough requests are waiting to keep every connection busy).  The lines of each
+ * second are read before any of them is scheduled, so that they can be spread evenly over the second.
+ **/
+static void read_input(uint64_t now)
+{
+	struct replay_request_t *request;
+	struct replay_request_t **grown;
+	const char *query;
+	const char *url;
+	size_t length;
+	size_t query_length;
+	size_t url_length;
+	size_t i;
+	time_t when;
+
+	while (! input_done && ! stopping)
+	{
+		if (conf.flood)
+		{
+			if (scheduled >= 2 * (size_t)conf.concurrency)
+			{
+				return;
+			}
+		}
+		else if (scheduled >= REPLAY_MAX_SCHEDULED)
+		{
+			/* Far more requests in a second than can be held: schedule those read so far. */
+			if (batch_count && batch_count == scheduled)
+			{
+				schedule_batch();
+			}
+			return;
+		}
+		else if (have_first && replay_start + (uint64_t)((batch_time - first_time) * 1000000.0 / conf.speed) > now + REPLAY_READ_AHEAD)
+		{
+			return;
+		}
+
+		if (! read_line(&length))
+		{
+			schedule_batch();
+			input_done = 1;
+			return;
+		}
+		input_line++;
+		if (parse_line(line, length, &when, &url, &url_length, &query, &query_length) < 0)
+		{
+			skipped++;
+#ifdef __DEBUG__
+			fprintf(stderr, "udploggerreplay.c debug: %s:%ju: not a udploggerc record\n", input_name, input_line);
+#endif
+			continue;
+		}
+		if (query_length == 1 && *query == '-')
+		{
+			query_length = 0;
+		}
+		for (i = 0; i < url_length && (unsigned char)url[i] > ' ' && url[i] != 0x7F; i++);
+		if (! url_length || *url != '/' || i < url_length)
+		{
+			skipped++;
+#ifdef __DEBUG__
+			fprintf(stderr, "udploggerreplay.c debug: %s:%ju: not a valid request URL\n", input_name, input_line);
+#endif
+			continue;
+		}
+		for (i = 0; i < query_length && (unsigned char)query[i] > ' ' && query[i] != 0x7F; i++);
+		if (i < query_length)
+		{
+			skipped++;
+#ifdef __DEBUG__
+			fprintf(stderr, "udploggerreplay.c debug: %s:%ju: not a valid query string\n", input_name, input_line);
+#endif
+			continue;
+		}
+
+		request = malloc(sizeof(struct replay_request_t) + url_length + query_length + 2);
+		if (! request)
+		{
+			perror("udploggerreplay.c malloc(request)");
+			exit(1);
+		}
+		memset(request, 0, sizeof(struct replay_request_t));
+		request->target = (char *)(request + 1);
+		memcpy(request->target, url, url_length);
+		request->target_length = url_length;
+		if (query_length)
+		{
+			request->target[request->target_length++] = '?';
+			memcpy(request->target + request->target_length, query, query_length);
+			request->target_length += query_length;
+		}
+		request->target[request->target_length] = '\0';
+		scheduled++;
+
+		if (conf.flood)
+		{
+			request->due = now;
+			queue_request(request, 0);
+			continue;
+		}
+
+		if (! have_first)
+		{
+			have_first = 1;
+			first_time = when;
+			batch_time = when;
+			replay_start = now;
+		}
+		if (when > batch_time)
+		{
+			schedule_batch();
+			batch_time = when;
+		}
+		if (batch_count == batch_size)
+		{
+			grown = realloc(batch, (batch_size ? batch_size * 2 : 1024) * sizeof(struct replay_request_t *));
+			if (! grown)
+			{
+				perror("udploggerreplay.c realloc(batch)");
+				exit(1);
+			}
+			batch = grown;
+			batch_size = batch_size ? batch_size * 2 : 1024;
+		}
+		/* Lines that are out of order (as from several files) are sent with the second being read. */
+		batch[batch_count++] = request;
+	}
+}
+
+
+/**
+ * read_line(<length>)
+ *
+ * Reads the next line of the input into line (without its newline), moving on to the next file at the end
+ * of each one.  Returns 1 if a line was read or 0 at the end of the input.
+ **/
+static int read_line(size_t *length)
+{
+	char *grown;
+	size_t used = 0;
+
+	if (! line)
+	{
+		line_size = REPLAY_LINE_SIZE;
+		line = malloc(line_size);
+		if (! line)
+		{
+			perror("udploggerreplay.c malloc(line)");
+			exit(1);
+		}
+	}
+
+	while (1)
+	{
+		if (! input)
+		{
+			if (file_index >= file_count)
+			{
+				return 0;
+			}
+			input_name = files[file_index++];
+			input_line = 0;
+			input = gzopen(input_name, "rb");
+			if (! input)
+			{
+				fprintf(stderr, "udploggerreplay.c gzopen(%s): %s\n", input_name, strerror(errno));
+				continue;
+			}
+			gzbuffer(input, 131072);
+		}
+
+		if (! gzgets(input, line + used, line_size - used))
+		{
+			gzclose(input);
+			input = NULL;
+			if (used)
+			{
+				break;
+			}
+			continue;
+		}
+		used += strlen(line + used);
+		if (used && line[used - 1] == '\n')
+		{
+			used--;
+			break;
+		}
+		if (used == line_size - 1)
+		{
+			grown = realloc(line, line_size * 2);
+			if (! grown)
+			{
+				perror("udploggerreplay.c realloc(line)");
+				exit(1);
+			}
+			line = grown;
+			line_size *= 2;
+		}
+	}
+
+	line[used] = '\0';
+	*length = used;
+	return 1;
+}
+
+
+/**
+ * remove_timer(<timer>)
+ *
+ * Takes a timer off the wheel, if it is on it.
+ **/
+static void remove_timer(struct replay_timer_t *timer)
+{
+	if (! timer->active)
+	{
+		return;
+	}
+	if (timer->previous)
+	{
+		timer->previous->next = timer->next;
+	}
+	else
+	{
+		wheel[timer->slot] = timer->next;
+	}
+	if (timer->next)
+	{
+		timer->next->previous = timer->previous;
+	}
+	timer->previous = NULL;
+	timer->next = NULL;
+	timer->active = 0;
+	timers_active--;
+}
+
+
+/**
+ * schedule_batch()
+ *
+ * Puts the requests of the second that was read last on the wheel, spread evenly over that second (of
+ * the replay).
+ **/
+static void schedule_batch(void)
+{
+	uint64_t start;
+	double length;
+	size_t i;
+
+	if (! batch_count)
+	{
+		return;
+	}
+	length = 1000000.0 / conf.speed;
+	start = replay_start + (uint64_t)((batch_time - first_time) * length);
+	for (i = 0; i < batch_count; i++)
+	{
+		batch[i]->due = start + (uint64_t)(i * length / batch_count);
+		add_timer(&batch[i]->timer, batch[i]->due, TIMER_REQUEST, batch[i]);
+	}
+	last_due = batch[batch_count - 1]->due;
+	batch_count = 0;
+}
+
+
+/**
+ * send_request(<connection>)
+ *
+ * Sends as much of the request of a connection as the socket takes, then waits for the rest of it to be
+ * sent or for the response.  Returns 0 on success or -1 if the connection failed.
+ **/
+static int send_request(struct replay_connection_t *connection)
+{
+	ssize_t count;
+
+	while (connection->output_sent < connection->output_length)
+	{
+		count = send(connection->fd, connection->output + connection->output_sent, connection->output_length - connection->output_sent, MSG_NOSIGNAL);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				watch_connection(connection, EPOLLIN | EPOLLOUT);
+				return 0;
+			}
+			fail_request(connection, monotonic_time());
+			return -1;
+		}
+		connection->output_sent += count;
+	}
+
+	connection->state = CONNECTION_RECEIVING;
+	connection->response_state = RESPONSE_HEADERS;
+	connection->status = 0;
+	connection->received = 0;
+	watch_connection(connection, EPOLLIN);
+	return 0;
+}
+
+
+/**
+ * stop_replay(<signal>)
+ *
+ * Signal handler that stops the replay (the results so far are still printed).
+ **/
+static void stop_replay(int signal_number)
+{
+	stopping = 1;
+}
+
+
+/**
+ * watch_connection(<connection>, <events>)
+ *
+ * Changes the epoll events that a connection is registered for, if they differ from the current ones.
+ **/
+static void watch_connection(struct replay_connection_t *connection, uint32_t events)
+{
+	struct epoll_event event;
+
+	if (connection->events == events)
+	{
+		return;
+	}
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = connection;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) < 0)
+	{
+		perror("udploggerreplay.c epoll_ctl()");
+		return;
+	}
+	connection->events = events;
+}
@@ -0,0 +1,213 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __UDPLOGGERREPLAY_H__
+#define __UDPLOGGERREPLAY_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/*
+ * Field positions of the log lines written by udploggerc ("[time]", "[source]", serial, tag, then the
+ * payload), for v1 payloads (22 fields) and v2 payloads (25 fields, the fifth of which is "v2").  See
+ * Nexopia/UDPLogger/Parse.py.
+ */
+#define FIELD_TIME            0
+#define FIELD_VERSION         4
+#define FIELD_V1_COUNT        22
+#define FIELD_V1_URL          11
+#define FIELD_V1_QUERY        12
+#define FIELD_V2_COUNT        25
+#define FIELD_V2_URL          12
+#define FIELD_V2_QUERY        13
+#define FIELD_MAXIMUM_COUNT   FIELD_V2_COUNT
+
+
+/*
+ * Timing.
+ *
+ * REPLAY_TICK            The resolution (microseconds) of the timer wheel.
+ * REPLAY_WHEEL_SLOTS     The number of slots of the timer wheel; timers further than REPLAY_WHEEL_SLOTS
+ *                        ticks ahead wait in their slot for further turns of the wheel.
+ * REPLAY_READ_AHEAD      How far ahead of time (microseconds) requests are read and scheduled.
+ * REPLAY_MAX_SCHEDULED   The most requests that are held (scheduled or waiting for a connection) at once.
+ */
+#define REPLAY_TICK           1000ULL
+#define REPLAY_WHEEL_SLOTS    4096U
+#define REPLAY_READ_AHEAD     1000000ULL
+#define REPLAY_MAX_SCHEDULED  65536U
+
+
+/*
+ * Buffers.
+ *
+ * REPLAY_BUFFER_SIZE     The initial size of the response buffer of a connection.
+ * REPLAY_HEADERS_MAXIMUM The largest response header that is accepted.
+ * REPLAY_LINE_SIZE       The initial size of the buffer that log lines are read into (it grows as needed).
+ */
+#define REPLAY_BUFFER_SIZE    16384U
+#define REPLAY_HEADERS_MAXIMUM 65536U
+#define REPLAY_LINE_SIZE      16384U
+
+
+/*
+ * Results are counted by status code (0 to 999), with two more for requests that timed out and requests
+ * that failed otherwise.
+ */
+#define RESULT_TIMEOUT        1000
+#define RESULT_ERROR          1001
+#define RESULT_COUNT          1002
+
+
+/*
+ * Latencies (microseconds) are kept in log-linear histograms: exactly below 2 ^ HISTOGRAM_SUB_BUCKET_BITS
+ * and within 1.6% above (as Nexopia/UDPLogger/Histogram.py bins values), in HISTOGRAM_BINS bins.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_BINS        3776U
+
+
+/*
+ * The kinds of timers: the time at which a request is to be sent, the response timeout of a connection
+ * and the next checkpoint.
+ */
+#define TIMER_REQUEST         0
+#define TIMER_TIMEOUT         1
+#define TIMER_CHECKPOINT      2
+
+
+/*
+ * The states of a connection, and of the response that it is reading.
+ */
+#define CONNECTION_CLOSED     0
+#define CONNECTION_CONNECTING 1
+#define CONNECTION_SENDING    2
+#define CONNECTION_RECEIVING  3
+#define CONNECTION_IDLE       4
+
+#define RESPONSE_HEADERS      0
+#define RESPONSE_BODY         1
+#define RESPONSE_CHUNK_SIZE   2
+#define RESPONSE_CHUNK_DATA   3
+#define RESPONSE_CHUNK_END    4
+#define RESPONSE_TRAILERS     5
+#define RESPONSE_UNTIL_CLOSE  6
+
+
+/*
+ * Structure that contains configuration information for the running instance of udploggerreplay.
+ */
+struct udploggerreplay_configuration_t {
+	uintmax_t checkpoint;
+	unsigned int concurrency;
+	int flood;
+	char *host;
+	char *node;
+	char *service;
+	double speed;
+	uintmax_t timeout;
+	char *vhost;
+};
+
+
+/*
+ * A timer in the wheel: a member of the doubly-linked list of the slot of its due time (microseconds on
+ * the monotonic clock).  data is the request or connection that it belongs to.
+ */
+struct replay_timer_t {
+	uint64_t due;
+	unsigned int slot;
+	unsigned char type;
+	unsigned char active;
+	void *data;
+	struct replay_timer_t *previous;
+	struct replay_timer_t *next;
+};
+
+
+/*
+ * A request to replay: its target (the logged URL and query string, allocated along with the request),
+ * the time at which it is due and whether it has already been retried on a fresh connection.  Waiting
+ * requests are arranged as a singly-linked queue.
+ */
+struct replay_request_t {
+	struct replay_timer_t timer;
+	uint64_t due;
+	uint64_t dispatched;
+	char *target;
+	size_t target_length;
+	int retried;
+	struct replay_request_t *next;
+};
+
+
+/*
+ * A keep-alive connection to the target host (and the epoll events that it is registered for), with the
+ * request that it is serving (if any), the unsent part of that request, the unparsed part of the response
+ * and the state of its parser: the status, the length of the body (or chunk) that remains and whether the
+ * server will close the connection.  Idle connections are arranged as a singly-linked list.
+ */
+struct replay_connection_t {
+	int fd;
+	uint32_t events;
+	unsigned char state;
+	unsigned char response_state;
+	unsigned char close;
+	struct replay_request_t *request;
+	char *output;
+	size_t output_length;
+	size_t output_sent;
+	size_t output_size;
+	char *input;
+	size_t input_length;
+	size_t input_size;
+	int status;
+	uintmax_t remaining;
+	uintmax_t received;
+	uintmax_t served;
+	struct replay_timer_t timer;
+	struct replay_connection_t *next_idle;
+};
+
+
+/*
+ * The results so far: counts by status (see RESULT_*), histograms of the latency of the responses and of
+ * how late the requests were sent, and the state of the last checkpoint.
+ */
+struct replay_summary_t {
+	uintmax_t results[RESULT_COUNT];
+	uintmax_t total;
+	uintmax_t latencies[HISTOGRAM_BINS];
+	uint64_t latency_maximum;
+	uintmax_t lags[HISTOGRAM_BINS];
+	uint64_t lag_maximum;
+	uint64_t started;
+	uint64_t last_checkpoint;
+	uintmax_t last_checkpoint_total;
+};
+
+
+#endif
@@ -0,0 +1,1764 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+/*
+ * Consumer plugin (see udploggerplugin.h) that keeps the statistics of udploggertools/udploggerstats.py
+ * as the records arrive, rather than in a batch pass over the archived log files.
+ *
+ * Records are bucketed by the hour in which they were received (the time that udploggerc writes at the
+ * start of each line, truncated to the hour as udploggerstats.py does) and each bucket counts hits and
+ * bytes, content types, hosts, statuses, times used, user sexes and user types, and keeps histograms of the
+ * time used and bytes sent and HyperLogLog sketches of the distinct remote addresses and users per host,
+ * exactly as the classes of Nexopia.UDPLogger.Statistics do.  Every ROLLUP_CHECK_INTERVAL the buckets
+ * whose hour ended more than ROLLUP_GRACE_PERIOD ago are handed to a writer thread (so that receiving is
+ * never held up by the database), which writes them to the SQLite database, in one transaction, into the
+ * tables (and with the additive upserts, or merges of sketches) of Statistics.Store -- so Graphs.py reads
+ * them as it reads the results of udploggerstats.py, and the two may write to the same database.  Each
+ * row is also added to the day and week rollup tables that Statistics.Store keeps.  SIGHUP (and exiting)
+ * writes out every bucket, including the current one.
+ *
+ * Usage:
+ *   udploggerc --plugin /usr/local/lib/udploggerrollup.so:/var/lib/udplogger/statistics.db ...
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "record.h"
+#include "udploggerclientlib.h"
+#include "udploggerplugin.h"
+#include "udploggerrollup.h"
+
+
+static void add_record(struct rollup_t *, struct log_record_t *);
+static void check_rollups(int);
+static void close_rollup(void *);
+static struct rollup_counter_t *count_key(struct rollup_bucket_t *, unsigned char, unsigned char, intmax_t, const char *, size_t, intmax_t, intmax_t);
+static struct rollup_bucket_t *find_bucket(struct rollup_t *, time_t);
+static void flush_rollup(struct rollup_t *, int);
+static void free_bucket(struct rollup_bucket_t *);
+static int histogram_add(struct rollup_histogram_t *, uint32_t, uintmax_t);
+static uint32_t histogram_bin(uintmax_t);
+static int histogram_decode(const unsigned char *, size_t, struct rollup_histogram_t *);
+static unsigned char *histogram_encode(const struct rollup_histogram_t *, const struct rollup_histogram_t *, size_t *);
+static int hyperloglog_add(struct rollup_hyperloglog_t *, const char *, size_t);
+static int hyperloglog_decode(const unsigned char *, size_t, struct rollup_hyperloglog_t *);
+static int hyperloglog_densify(struct rollup_hyperloglog_t *);
+static unsigned char *hyperloglog_encode(const struct rollup_hyperloglog_t *, size_t *);
+static void hyperloglog_free(struct rollup_hyperloglog_t *);
+static int hyperloglog_merge(struct rollup_hyperloglog_t *, const struct rollup_hyperloglog_t *);
+static int hyperloglog_set(struct rollup_hyperloglog_t *, uint32_t, unsigned char);
+static int is_space(char);
+static void *open_rollup(const char *);
+static int parse_integer(const char *, size_t, intmax_t *);
+static int prepare_statements(struct rollup_t *);
+static int read_varint(const unsigned char **, const unsigned char *, uintmax_t *);
+static void rollup_records(void *, struct log_record_t **, size_t);
+static time_t rollup_timestamp(time_t, int);
+static void signal_rollup(void *, sigset_t *);
+static size_t varint_length(uintmax_t);
+static int write_bucket(struct rollup_t *, struct rollup_bucket_t *);
+static int write_buckets(struct rollup_t *, struct rollup_bucket_t *);
+static int write_row(sqlite3_stmt *, time_t, const struct rollup_counter_t *, const intmax_t *, int);
+static int write_sketches(struct rollup_t *, int, time_t, const struct rollup_counter_t *);
+static size_t write_varint(unsigned char *, uintmax_t);
+static void *writer_main(void *);
+
+
+const struct udplogger_plugin_t udplogger_plugin = {
+	UDPLOGGER_PLUGIN_VERSION, "rollup", open_rollup, rollup_records, signal_rollup, close_rollup
+};
+
+
+/*
+ * The tables of the statistics (indexed by STATISTIC_*), as created by Statistics.Store.
+ */
+static const struct rollup_table_t rollup_tables[STATISTIC_COUNT] = {
+	{"content_type_statistics", "content_type", "TEXT", {"count", "transferred", NULL}, "INTEGER"},
+	{"host_statistics", "host", "TEXT", {"count", NULL, NULL}, "INTEGER"},
+	{"status_statistics", "status", "INTEGER", {"count", NULL, NULL}, "INTEGER"},
+	{"time_used_statistics", "time_used", "INTEGER", {"count", NULL, NULL}, "INTEGER"},
+	{"usersex_statistics", "sex", "TEXT", {"count", NULL, NULL}, "INTEGER"},
+	{"usertype_statistics", "type", "TEXT", {"count", NULL, NULL}, "INTEGER"},
+	{"quantile_statistics", "host", "TEXT", {"time_used", "bytes_outgoing", NULL}, "BLOB"},
+	{"unique_statistics", "host", "TEXT", {"remote_address", "userid", NULL}, "BLOB"},
+	{"hit_statistics", NULL, NULL, {"hits", "bytes_incoming", "bytes_outgoing"}, "INTEGER"}
+};
+
+
+/*
+ * The suffixes of the names of the tables of each resolution (indexed by ROLLUP_RESOLUTION_*).
+ */
+static const char *rollup_resolutions[ROLLUP_RESOLUTION_COUNT] = {"", "_day", "_week"};
+
+
+/*
+ * Every loaded instance of the plugin, and the timer that checks them for closed buckets.
+ */
+static struct rollup_t *rollups = NULL;
+static int rollup_timer = -1;
+
+
+/**
+ * add_record(<rollup>, <record>)
+ *
+ * Counts the record in the bucket of the hour in which it was received.  Records that udploggerstats.py
+ * could not parse (ones without exactly the fields of a version 1 or version 2 payload) are skipped.
+ * Each field is converted as Nexopia.UDPLogger.Parse converts it and then keyed as the update() method
+ * of the Statistics.py class does.
+ **/
+static void add_record(struct rollup_t *rollup, struct log_record_t *record)
+{
+	struct rollup_bucket_t *bucket;
+	struct rollup_counter_t *counter;
+	const char *host;
+	const char *text;
+	char userid[32];
+	intmax_t bytes_incoming;
+	intmax_t bytes_outgoing;
+	intmax_t number;
+	size_t host_length;
+	size_t length;
+	size_t offset;
+	int has_bytes_incoming;
+	int has_bytes_outgoing;
+	int has_number;
+
+	if (! record_field(record, FIELD_NEXOPIA_USERTYPE, &offset, &length))
+	{
+		return;
+	}
+	if (record->field_count != (record->version == 2 ? RECORD_PAYLOAD_FIELDS_V2 : RECORD_PAYLOAD_FIELDS_V1))
+	{
+		return;
+	}
+
+	bucket = find_bucket(rollup, record->received.tv_sec);
+	if (! bucket)
+	{
+		return;
+	}
+
+	/* HitStatistic */
+	record_field(record, FIELD_BYTES_INCOMING, &offset, &length);
+	bytes_incoming = 0;
+	has_bytes_incoming = (length == 1 && record->data[offset] == '-') || parse_integer(record->data + offset, length, &bytes_incoming);
+	record_field(record, FIELD_BYTES_OUTGOING, &offset, &length);
+	bytes_outgoing = 0;
+	has_bytes_outgoing = (length == 1 && record->data[offset] == '-') || parse_integer(record->data + offset, length, &bytes_outgoing);
+	bucket->hits++;
+	if (has_bytes_incoming)
+	{
+		bucket->bytes_incoming += bytes_incoming;
+	}
+	if (has_bytes_outgoing)
+	{
+		bucket->bytes_outgoing += bytes_outgoing;
+	}
+
+	/* ContentTypeStatistic (Statistics.py fails on a missing bytes_outgoing; it is counted as 0 here) */
+	text = "";
+	if (record_field(record, FIELD_CONTENT_TYPE, &offset, &length) && ! (length == 1 && record->data[offset] == '-'))
+	{
+		text = record->data + offset;
+		if (memchr(text, ';', length))
+		{
+			length = (const char *)memchr(text, ';', length) - text;
+		}
+	}
+	else
+	{
+		length = 0;
+	}
+	count_key(bucket, STATISTIC_CONTENT_TYPE, 0, 0, text, length, 1, bytes_outgoing);
+
+	/* HostStatistic */
+	host = "";
+	if (record_field(record, FIELD_HOST, &offset, &host_length) && ! (host_length == 1 && record->data[offset] == '-'))
+	{
+		host = record->data + offset;
+		if (memchr(host, ':', host_length))
+		{
+			host_length = (const char *)memchr(host, ':', host_length) - host;
+		}
+	}
+	else
+	{
+		host_length = 0;
+	}
+	count_key(bucket, STATISTIC_HOST, 0, 0, host, host_length, 1, 0);
+
+	/* StatusStatistic */
+	record_field(record, FIELD_STATUS, &offset, &length);
+	has_number = parse_integer(record->data + offset, length, &number);
+	count_key(bucket, STATISTIC_STATUS, ! has_number, number, NULL, 0, 1, 0);
+
+	/* QuantileStatistic (negative values are left out) */
+	record_field(record, FIELD_TIME_USED, &offset, &length);
+	has_number = parse_integer(record->data + offset, length, &number);
+	counter = count_key(bucket, STATISTIC_QUANTILE, 0, 0, host, host_length, 0, 0);
+	if (counter && ! counter->histograms)
+	{
+		counter->histograms = calloc(2, sizeof(struct rollup_histogram_t));
+		if (! counter->histograms)
+		{
+			perror("udploggerrollup.c calloc(histograms)");
+		}
+	}
+	if (counter && counter->histograms)
+	{
+		if (has_number && number >= 0)
+		{
+			histogram_add(&counter->histograms[0], histogram_bin(number), 1);
+		}
+		if (has_bytes_outgoing && bytes_outgoing >= 0)
+		{
+			histogram_add(&counter->histograms[1], histogram_bin(bytes_outgoing), 1);
+		}
+	}
+
+	/* TimeUsedStatistic */
+	if (has_number && number > 10)
+	{
+		number = -1;
+	}
+	count_key(bucket, STATISTIC_TIME_USED, ! has_number, number, NULL, 0, 1, 0);
+
+	/* UniqueStatistic (user ids are hashed as Python prints them) */
+	counter = count_key(bucket, STATISTIC_UNIQUE, 0, 0, host, host_length, 0, 0);
+	if (counter && ! counter->hyperloglogs)
+	{
+		counter->hyperloglogs = calloc(2, sizeof(struct rollup_hyperloglog_t));
+		if (! counter->hyperloglogs)
+		{
+			perror("udploggerrollup.c calloc(hyperloglogs)");
+		}
+	}
+	if (counter && counter->hyperloglogs)
+	{
+		if (record_field(record, FIELD_REMOTE_ADDRESS, &offset, &length) && ! (length == 1 && record->data[offset] == '-'))
+		{
+			hyperloglog_add(&counter->hyperloglogs[0], record->data + offset, length);
+		}
+		record_field(record, FIELD_NEXOPIA_USERID, &offset, &length);
+		if (parse_integer(record->data + offset, length, &number) && number > 0)
+		{
+			hyperloglog_add(&counter->hyperloglogs[1], userid, snprintf(userid, sizeof(userid), "%jd", number));
+		}
+	}
+
+	/* UserSexStatistic */
+	record_field(record, FIELD_NEXOPIA_USERSEX, &offset, &length);
+	if (length == 6 && ! strncasecmp(record->data + offset, "female", 6))
+	{
+		text = "female";
+	}
+	else if (length == 4 && ! strncasecmp(record->data + offset, "male", 4))
+	{
+		text = "male";
+	}
+	else
+	{
+		text = "unknown";
+	}
+	count_key(bucket, STATISTIC_USERSEX, 0, 0, text, strlen(text), 1, 0);
+
+	/* UserTypeStatistic */
+	record_field(record, FIELD_NEXOPIA_USERTYPE, &offset, &length);
+	if (length == 4 && ! strncasecmp(record->data + offset, "anon", 4))
+	{
+		text = "anon";
+	}
+	else if (length == 4 && ! strncasecmp(record->data + offset, "plus", 4))
+	{
+		text = "plus";
+	}
+	else if (length == 4 && ! strncasecmp(record->data + offset, "user", 4))
+	{
+		text = "user";
+	}
+	else
+	{
+		text = "unknown";
+	}
+	count_key(bucket, STATISTIC_USERTYPE, 0, 0, text, strlen(text), 1, 0);
+}
+
+
+/**
+ * check_rollups(<timer descriptor>)
+ *
+ * Timer callback that hands the closed buckets of every instance to its writer.
+ **/
+static void check_rollups(int fd)
+{
+	struct rollup_t *rollup;
+
+	for (rollup = rollups; rollup; rollup = rollup->next)
+	{
+		flush_rollup(rollup, 0);
+	}
+}
+
+
+/**
+ * close_rollup(<rollup>)
+ *
+ * Hands every bucket to the writer, waits for it to write them out (it reports the records that are lost
+ * if that fails) and closes the database.
+ **/
+static void close_rollup(void *state)
+{
+	struct rollup_t *rollup = state;
+	struct rollup_t **rollup_ptr_ptr;
+	struct rollup_bucket_t *bucket;
+	int i;
+	int r;
+
+	flush_rollup(rollup, 1);
+	if (rollup->writer_started)
+	{
+		pthread_mutex_lock(&rollup->closed_mutex);
+		rollup->closed_stopping = 1;
+		pthread_cond_signal(&rollup->closed_available);
+		pthread_mutex_unlock(&rollup->closed_mutex);
+		pthread_join(rollup->writer, NULL);
+	}
+	while (rollup->closed)
+	{
+		bucket = rollup->closed;
+		rollup->closed = bucket->next;
+		free_bucket(bucket);
+	}
+	pthread_mutex_destroy(&rollup->closed_mutex);
+	pthread_cond_destroy(&rollup->closed_available);
+
+	for (rollup_ptr_ptr = &rollups; *rollup_ptr_ptr; rollup_ptr_ptr = &(*rollup_ptr_ptr)->next)
+	{
+		if (*rollup_ptr_ptr == rollup)
+		{
+			*rollup_ptr_ptr = rollup->next;
+			break;
+		}
+	}
+	if (! rollups && rollup_timer >= 0)
+	{
+		remove_event(rollup_timer);
+		rollup_timer = -1;
+	}
+
+	for (r = 0; r < ROLLUP_RESOLUTION_COUNT; r++)
+	{
+		for (i = 0; i < STATISTIC_COUNT; i++)
+		{
+			sqlite3_finalize(rollup->statements[r][i][0]);
+			sqlite3_finalize(rollup->statements[r][i][1]);
+			sqlite3_finalize(rollup->null_statements[r][i][0]);
+			sqlite3_finalize(rollup->null_statements[r][i][1]);
+		}
+	}
+	sqlite3_close(rollup->database);
+	free(rollup->path);
+	free(rollup);
+}
+
+
+/**
+ * count_key(<bucket>, <statistic>, <null key>, <integer key>, <string key>, <string key length>, <value>, <second value>)
+ *
+ * Adds the values to the counter of the key (an integer key if the string key is NULL) of the given
+ * statistic, creating it if needed.  Returns the counter, or NULL on failure.
+ **/
+static struct rollup_counter_t *count_key(struct rollup_bucket_t *bucket, unsigned char statistic, unsigned char null, intmax_t number, const char *text, size_t text_length, intmax_t value, intmax_t second_value)
+{
+	struct rollup_counter_t *counter;
+	uint32_t hash = 2166136261U ^ statistic;
+	size_t i;
+
+	if (null)
+	{
+		number = 0;
+	}
+	else if (text)
+	{
+		for (i = 0; i < text_length; i++)
+		{
+			hash = (hash ^ (unsigned char)text[i]) * 16777619U;
+		}
+	}
+	else
+	{
+		for (i = 0; i < sizeof(number); i++)
+		{
+			hash = (hash ^ (unsigned char)((uintmax_t)number >> (i * 8))) * 16777619U;
+		}
+	}
+	hash %= ROLLUP_HASH_SIZE;
+
+	for (counter = bucket->counters[hash]; counter; counter = counter->next)
+	{
+		if (counter->statistic == statistic && counter->null == null && counter->number == number && counter->text_length == text_length && (! text || ! memcmp(counter->text, text, text_length)))
+		{
+			break;
+		}
+	}
+	if (! counter)
+	{
+		counter = calloc(1, sizeof(struct rollup_counter_t) + text_length);
+		if (! counter)
+		{
+			perror("udploggerrollup.c calloc(counter)");
+			return NULL;
+		}
+		counter->statistic = statistic;
+		counter->null = null;
+		counter->number = number;
+		if (text)
+		{
+			counter->text = (char *)(counter + 1);
+			memcpy(counter->text, text, text_length);
+		}
+		counter->text_length = text_length;
+		counter->next = bucket->counters[hash];
+		bucket->counters[hash] = counter;
+	}
+	counter->values[0] += value;
+	counter->values[1] += second_value;
+	return counter;
+}
+
+
+/**
+ * find_bucket(<rollup>, <time>)
+ *
+ * Returns the bucket of the hour that contains the given time, creating it if needed, or NULL on failure.
+ * The start of the hour is found as udploggerstats.py finds it (the local time with the minutes and
+ * seconds cleared, converted back with mktime()); the last hour is cached.
+ **/
+static struct rollup_bucket_t *find_bucket(struct rollup_t *rollup, time_t seconds)
+{
+	struct rollup_bucket_t *bucket;
+	struct tm tm;
+
+	if (seconds < rollup->hour_start || seconds >= rollup->hour_end)
+	{
+		if (! localtime_r(&seconds, &tm))
+		{
+			return NULL;
+		}
+		rollup->hour_start = seconds - tm.tm_min * 60 - tm.tm_sec;
+		rollup->hour_end = rollup->hour_start + 3600;
+		tm.tm_min = 0;
+		tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+		rollup->hour_timestamp = mktime(&tm);
+	}
+
+	for (bucket = rollup->buckets; bucket; bucket = bucket->next)
+	{
+		if (bucket->timestamp == rollup->hour_timestamp)
+		{
+			if (bucket->closes < rollup->hour_end)
+			{
+				bucket->closes = rollup->hour_end;
+			}
+			return bucket;
+		}
+	}
+
+	bucket = calloc(1, sizeof(struct rollup_bucket_t));
+	if (! bucket)
+	{
+		perror("udploggerrollup.c calloc(bucket)");
+		return NULL;
+	}
+	bucket->timestamp = rollup->hour_timestamp;
+	bucket->closes = rollup->hour_end;
+	bucket->next = rollup->buckets;
+	rollup->buckets = bucket;
+	return bucket;
+}
+
+
+/**
+ * flush_rollup(<rollup>, <all>)
+ *
+ * Hands the buckets that have closed (or every bucket, if <all> is set) to the writer, which writes them
+ * out and frees them.
+ **/
+static void flush_rollup(struct rollup_t *rollup, int all)
+{
+	struct rollup_bucket_t **bucket_ptr_ptr;
+	struct rollup_bucket_t **closed_ptr_ptr;
+	struct rollup_bucket_t *bucket;
+	struct rollup_bucket_t *closed = NULL;
+	time_t now = time(NULL);
+
+	bucket_ptr_ptr = &rollup->buckets;
+	closed_ptr_ptr = &closed;
+	while (*bucket_ptr_ptr)
+	{
+		bucket = *bucket_ptr_ptr;
+		if (all || now >= bucket->closes + ROLLUP_GRACE_PERIOD)
+		{
+			*bucket_ptr_ptr = bucket->next;
+			bucket->next = NULL;
+			*closed_ptr_ptr = bucket;
+			closed_ptr_ptr = &bucket->next;
+		}
+		else
+		{
+			bucket_ptr_ptr = &bucket->next;
+		}
+	}
+	if (! closed)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&rollup->closed_mutex);
+	*closed_ptr_ptr = rollup->closed;
+	rollup->closed = closed;
+	pthread_cond_signal(&rollup->closed_available);
+	pthread_mutex_unlock(&rollup->closed_mutex);
+}
+
+
+/**
+ * free_bucket(<bucket>)
+ *
+ * Frees a bucket and its counters.
+ **/
+static void free_bucket(struct rollup_bucket_t *bucket)
+{
+	struct rollup_counter_t *counter;
+	unsigned int i;
+
+	for (i = 0; i < ROLLUP_HASH_SIZE; i++)
+	{
+		while (bucket->counters[i])
+		{
+			counter = bucket->counters[i];
+			bucket->counters[i] = counter->next;
+			if (counter->histograms)
+			{
+				free(counter->histograms[0].indexes);
+				free(counter->histograms[0].counts);
+				free(counter->histograms[1].indexes);
+				free(counter->histograms[1].counts);
+				free(counter->histograms);
+			}
+			if (counter->hyperloglogs)
+			{
+				hyperloglog_free(&counter->hyperloglogs[0]);
+				hyperloglog_free(&counter->hyperloglogs[1]);
+				free(counter->hyperloglogs);
+			}
+			free(counter);
+		}
+	}
+	free(bucket);
+}
+
+
+/**
+ * histogram_add(<histogram>, <bin index>, <count>)
+ *
+ * Adds the count to the given bin of the histogram.  Returns 1 for success or 0 for failure.
+ **/
+static int histogram_add(struct rollup_histogram_t *histogram, uint32_t index, uintmax_t count)
+{
+	uintmax_t *counts;
+	uint32_t *indexes;
+	size_t high = histogram->bins;
+	size_t low = 0;
+	size_t middle;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (histogram->indexes[middle] < index)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low < histogram->bins && histogram->indexes[low] == index)
+	{
+		histogram->counts[low] += count;
+		return 1;
+	}
+
+	if (histogram->bins == histogram->size)
+	{
+		indexes = realloc(histogram->indexes, (histogram->size ? histogram->size * 2 : 8) * sizeof(uint32_t));
+		if (! indexes)
+		{
+			perror("udploggerrollup.c realloc(indexes)");
+			return 0;
+		}
+		histogram->indexes = indexes;
+		counts = realloc(histogram->counts, (histogram->size ? histogram->size * 2 : 8) * sizeof(uintmax_t));
+		if (! counts)
+		{
+			perror("udploggerrollup.c realloc(counts)");
+			return 0;
+		}
+		histogram->counts = counts;
+		histogram->size = histogram->size ? histogram->size * 2 : 8;
+	}
+	memmove(histogram->indexes + low + 1, histogram->indexes + low, (histogram->bins - low) * sizeof(uint32_t));
+	memmove(histogram->counts + low + 1, histogram->counts + low, (histogram->bins - low) * sizeof(uintmax_t));
+	histogram->indexes[low] = index;
+	histogram->counts[low] = count;
+	histogram->bins++;
+	return 1;
+}
+
+
+/**
+ * histogram_bin(<value>)
+ *
+ * Returns the index of the histogram bin that a value falls into (as Histogram.bin_index() does).
+ **/
+static uint32_t histogram_bin(uintmax_t value)
+{
+	unsigned int bits = 0;
+	unsigned int shift;
+
+	while (bits < sizeof(uintmax_t) * 8 && (value >> bits))
+	{
+		bits++;
+	}
+	if (bits <= HISTOGRAM_SUB_BUCKET_BITS)
+	{
+		return value;
+	}
+	shift = bits - HISTOGRAM_SUB_BUCKET_BITS;
+	return (shift << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + (uint32_t)(value >> shift);
+}
+
+
+/**
+ * histogram_decode(<data>, <length>, <histogram>)
+ *
+ * Adds the bins of a histogram serialized by Histogram.dumps() (or histogram_encode) to the histogram.
+ * Returns 1 for success or 0 if the data is not a valid histogram.
+ **/
+static int histogram_decode(const unsigned char *data, size_t length, struct rollup_histogram_t *histogram)
+{
+	const unsigned char *end = data + length;
+	uintmax_t bins;
+	uintmax_t count;
+	uintmax_t delta;
+	uintmax_t index = 0;
+	uintmax_t i;
+
+	if (! read_varint(&data, end, &bins))
+	{
+		return 0;
+	}
+	for (i = 0; i < bins; i++)
+	{
+		if (! read_varint(&data, end, &delta) || ! read_varint(&data, end, &count) || delta > UINT32_MAX - index)
+		{
+			return 0;
+		}
+		index += delta;
+		if (! histogram_add(histogram, index, count))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * histogram_encode(<histogram>, <second histogram>, <length pointer>)
+ *
+ * Serializes the two histograms merged into one (as Histogram.dumps() does) into a newly-allocated buffer,
+ * storing its length.  Returns the buffer or NULL on failure.
+ **/
+static unsigned char *histogram_encode(const struct rollup_histogram_t *first, const struct rollup_histogram_t *second, size_t *length)
+{
+	unsigned char *data;
+	uintmax_t count;
+	uint32_t index;
+	uint32_t previous = 0;
+	size_t bins = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	while (i < first->bins || j < second->bins)
+	{
+		if (j == second->bins || (i < first->bins && first->indexes[i] < second->indexes[j]))
+		{
+			i++;
+		}
+		else if (i == first->bins || second->indexes[j] < first->indexes[i])
+		{
+			j++;
+		}
+		else
+		{
+			i++;
+			j++;
+		}
+		bins++;
+	}
+
+	/* Each varint takes at most 10 bytes. */
+	data = malloc(10 + bins * 20);
+	if (! data)
+	{
+		perror("udploggerrollup.c malloc(histogram)");
+		return NULL;
+	}
+	*length = write_varint(data, bins);
+	i = 0;
+	j = 0;
+	while (i < first->bins || j < second->bins)
+	{
+		if (j == second->bins || (i < first->bins && first->indexes[i] < second->indexes[j]))
+		{
+			index = first->indexes[i];
+			count = first->counts[i++];
+		}
+		else if (i == first->bins || second->indexes[j] < first->indexes[i])
+		{
+			index = second->indexes[j];
+			count = second->counts[j++];
+		}
+		else
+		{
+			index = first->indexes[i];
+			count = first->counts[i++] + second->counts[j++];
+		}
+		*length += write_varint(data + *length, index - previous);
+		*length += write_varint(data + *length, count);
+		previous = index;
+	}
+	return data;
+}
+
+
+/**
+ * hyperloglog_add(<sketch>, <value>, <value length>)
+ *
+ * Adds a value to a HyperLogLog sketch.  Values are hashed with FNV-1a and mixed with the finalizer of
+ * MurmurHash3, as HyperLogLog.hash64() does.  Returns 1 for success or 0 for failure.
+ **/
+static int hyperloglog_add(struct rollup_hyperloglog_t *sketch, const char *value, size_t length)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	unsigned char rank = 1;
+	size_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)value[i]) * UINT64_C(0x100000001b3);
+	}
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+
+	/* The rank is the position of the first set bit after the index bits. */
+	while (rank <= 64 - HYPERLOGLOG_PRECISION && ! (hash & (UINT64_C(1) << (64 - HYPERLOGLOG_PRECISION - rank))))
+	{
+		rank++;
+	}
+	return hyperloglog_set(sketch, hash >> (64 - HYPERLOGLOG_PRECISION), rank);
+}
+
+
+/**
+ * hyperloglog_decode(<data>, <length>, <sketch>)
+ *
+ * Merges a HyperLogLog sketch serialized by HyperLogLog.dumps() (or hyperloglog_encode) into the sketch.
+ * Returns 1 for success or 0 if the data is not a valid sketch of HYPERLOGLOG_PRECISION (or on failure).
+ **/
+static int hyperloglog_decode(const unsigned char *data, size_t length, struct rollup_hyperloglog_t *sketch)
+{
+	const unsigned char *end = data + length;
+	uintmax_t count;
+	uintmax_t delta;
+	uintmax_t index = 0;
+	uintmax_t i;
+
+	if (length < 2 || data[0] != HYPERLOGLOG_PRECISION)
+	{
+		return 0;
+	}
+	if (data[1] == HYPERLOGLOG_ENCODING_DENSE)
+	{
+		if (length != 2 + HYPERLOGLOG_REGISTERS || ! hyperloglog_densify(sketch))
+		{
+			return 0;
+		}
+		for (i = 0; i < HYPERLOGLOG_REGISTERS; i++)
+		{
+			if (data[2 + i] > sketch->registers[i])
+			{
+				sketch->registers[i] = data[2 + i];
+			}
+		}
+		return 1;
+	}
+	if (data[1] != HYPERLOGLOG_ENCODING_SPARSE)
+	{
+		return 0;
+	}
+
+	/* The count of registers in use and then pairs of an index delta and a value (a byte). */
+	data += 2;
+	if (! read_varint(&data, end, &count))
+	{
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (! read_varint(&data, end, &delta) || data == end || delta >= HYPERLOGLOG_REGISTERS - index)
+		{
+			return 0;
+		}
+		index += delta;
+		if (! hyperloglog_set(sketch, index, *data))
+		{
+			return 0;
+		}
+		data++;
+	}
+	return 1;
+}
+
+
+/**
+ * hyperloglog_densify(<sketch>)
+ *
+ * Switches a sketch to keeping every register.  Returns 1 for success or 0 for failure.
+ **/
+static int hyperloglog_densify(struct rollup_hyperloglog_t *sketch)
+{
+	size_t i;
+
+	if (sketch->registers)
+	{
+		return 1;
+	}
+	sketch->registers = calloc(1, HYPERLOGLOG_REGISTERS);
+	if (! sketch->registers)
+	{
+		perror("udploggerrollup.c calloc(registers)");
+		return 0;
+	}
+	for (i = 0; i < sketch->count; i++)
+	{
+		sketch->registers[sketch->indexes[i]] = sketch->ranks[i];
+	}
+	free(sketch->indexes);
+	free(sketch->ranks);
+	sketch->indexes = NULL;
+	sketch->ranks = NULL;
+	sketch->count = 0;
+	sketch->size = 0;
+	sketch->sparse_length = 0;
+	return 1;
+}
+
+
+/**
+ * hyperloglog_encode(<sketch>, <length pointer>)
+ *
+ * Serializes a HyperLogLog sketch (as HyperLogLog.dumps() does, in the shorter of its encodings, which is
+ * that of the form the sketch is kept in) into a newly-allocated buffer, storing its length.  Returns the
+ * buffer or NULL on failure.
+ **/
+static unsigned char *hyperloglog_encode(const struct rollup_hyperloglog_t *sketch, size_t *length)
+{
+	unsigned char *data;
+	size_t previous = 0;
+	size_t i;
+
+	/* The count takes at most 10 bytes. */
+	data = malloc(sketch->registers ? 2 + HYPERLOGLOG_REGISTERS : 2 + 10 + sketch->sparse_length);
+	if (! data)
+	{
+		perror("udploggerrollup.c malloc(hyperloglog)");
+		return NULL;
+	}
+	data[0] = HYPERLOGLOG_PRECISION;
+	if (sketch->registers)
+	{
+		data[1] = HYPERLOGLOG_ENCODING_DENSE;
+		memcpy(data + 2, sketch->registers, HYPERLOGLOG_REGISTERS);
+		*length = 2 + HYPERLOGLOG_REGISTERS;
+		return data;
+	}
+
+	data[1] = HYPERLOGLOG_ENCODING_SPARSE;
+	*length = 2 + write_varint(data + 2, sketch->count);
+	for (i = 0; i < sketch->count; i++)
+	{
+		*length += write_varint(data + *length, sketch->indexes[i] - previous);
+		data[(*length)++] = sketch->ranks[i];
+		previous = sketch->indexes[i];
+	}
+	return data;
+}
+
+
+/**
+ * hyperloglog_free(<sketch>)
+ *
+ * Frees the registers of a sketch, leaving it empty.
+ **/
+static void hyperloglog_free(struct rollup_hyperloglog_t *sketch)
+{
+	free(sketch->indexes);
+	free(sketch->ranks);
+	free(sketch->registers);
+	memset(sketch, 0, sizeof(struct rollup_hyperloglog_t));
+}
+
+
+/**
+ * hyperloglog_merge(<sketch>, <other sketch>)
+ *
+ * Merges the other sketch into the sketch (as HyperLogLog.merge() does).  Returns 1 for success or 0 for
+ * failure.
+ **/
+static int hyperloglog_merge(struct rollup_hyperloglog_t *sketch, const struct rollup_hyperloglog_t *other)
+{
+	size_t i;
+
+	if (other->registers)
+	{
+		if (! hyperloglog_densify(sketch))
+		{
+			return 0;
+		}
+		for (i = 0; i < HYPERLOGLOG_REGISTERS; i++)
+		{
+			if (other->registers[i] > sketch->registers[i])
+			{
+				sketch->registers[i] = other->registers[i];
+			}
+		}
+		return 1;
+	}
+	for (i = 0; i < other->count; i++)
+	{
+		if (! hyperloglog_set(sketch, other->indexes[i], other->ranks[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * hyperloglog_set(<sketch>, <register index>, <rank>)
+ *
+ * Raises a register of a sketch to the rank, if it is lower.  While the sketch is sparse, its
+ * sparse_length is kept up to date and it is made dense once its sparse encoding would be longer than the
+ * dense one.  Returns 1 for success or 0 for failure.
+ **/
+static int hyperloglog_set(struct rollup_hyperloglog_t *sketch, uint32_t index, unsigned char rank)
+{
+	unsigned char *ranks;
+	uint16_t *indexes;
+	size_t high = sketch->count;
+	size_t low = 0;
+	size_t middle;
+	size_t previous;
+
+	if (sketch->registers)
+	{
+		if (rank > sketch->registers[index])
+		{
+			sketch->registers[index] = rank;
+		}
+		return 1;
+	}
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (sketch->indexes[middle] < index)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low < sketch->count && sketch->indexes[low] == index)
+	{
+		if (rank > sketch->ranks[low])
+		{
+			sketch->ranks[low] = rank;
+		}
+		return 1;
+	}
+
+	if (sketch->count == sketch->size)
+	{
+		indexes = realloc(sketch->indexes, (sketch->size ? sketch->size * 2 : 8) * sizeof(uint16_t));
+		if (! indexes)
+		{
+			perror("udploggerrollup.c realloc(indexes)");
+			return 0;
+		}
+		sketch->indexes = indexes;
+		ranks = realloc(sketch->ranks, sketch->size ? sketch->size * 2 : 8);
+		if (! ranks)
+		{
+			perror("udploggerrollup.c realloc(ranks)");
+			return 0;
+		}
+		sketch->ranks = ranks;
+		sketch->size = sketch->size ? sketch->size * 2 : 8;
+	}
+
+	/* The register takes the place of the one after it in the delta of that one. */
+	previous = low ? sketch->indexes[low - 1] : 0;
+	sketch->sparse_length += varint_length(index - previous) + 1;
+	if (low < sketch->count)
+	{
+		sketch->sparse_length += varint_length(sketch->indexes[low] - index);
+		sketch->sparse_length -= varint_length(sketch->indexes[low] - previous);
+	}
+	memmove(sketch->indexes + low + 1, sketch->indexes + low, (sketch->count - low) * sizeof(uint16_t));
+	memmove(sketch->ranks + low + 1, sketch->ranks + low, sketch->count - low);
+	sketch->indexes[low] = index;
+	sketch->ranks[low] = rank;
+	sketch->count++;
+
+	if (varint_length(sketch->count) + sketch->sparse_length > HYPERLOGLOG_REGISTERS)
+	{
+		return hyperloglog_densify(sketch);
+	}
+	return 1;
+}
+
+
+/**
+ * is_space(<character>)
+ *
+ * Returns 1 if the character is whitespace as Python's int() strips it, or 0 if it is not.
+ **/
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+
+/**
+ * open_rollup(<database path>)
+ *
+ * Opens (creating if needed) the statistics database and its tables, switches it to write-ahead logging
+ * (so that the graphs do not block the writes) and prepares the statements that write each statistic.
+ * Returns the state of the instance or NULL on failure.
+ **/
+static void *open_rollup(const char *argument)
+{
+	struct rollup_t *rollup;
+
+	if (! argument || ! *argument)
+	{
+		fprintf(stderr, "udploggerrollup.c: the path of the statistics database must be given (as --plugin udploggerrollup.so:<path>)\n");
+		return NULL;
+	}
+
+	rollup = calloc(1, sizeof(struct rollup_t));
+	if (! rollup)
+	{
+		perror("udploggerrollup.c calloc(rollup)");
+		return NULL;
+	}
+	pthread_mutex_init(&rollup->closed_mutex, NULL);
+	pthread_cond_init(&rollup->closed_available, NULL);
+	rollup->path = strdup(argument);
+	if (! rollup->path)
+	{
+		perror("udploggerrollup.c strdup(path)");
+		close_rollup(rollup);
+		return NULL;
+	}
+
+	if (sqlite3_open(rollup->path, &rollup->database) != SQLITE_OK || ! prepare_statements(rollup))
+	{
+		fprintf(stderr, "udploggerrollup.c: unable to open '%s': %s\n", rollup->path, sqlite3_errmsg(rollup->database));
+		close_rollup(rollup);
+		return NULL;
+	}
+
+	errno = pthread_create(&rollup->writer, NULL, writer_main, rollup);
+	if (errno)
+	{
+		perror("udploggerrollup.c pthread_create()");
+		close_rollup(rollup);
+		return NULL;
+	}
+	rollup->writer_started = 1;
+
+	if (rollup_timer < 0)
+	{
+		rollup_timer = add_event_timer(ROLLUP_CHECK_INTERVAL, check_rollups);
+		if (rollup_timer < 0)
+		{
+			close_rollup(rollup);
+			return NULL;
+		}
+	}
+	rollup->next = rollups;
+	rollups = rollup;
+	return rollup;
+}
+
+
+/**
+ * parse_integer(<string>, <length>, <result pointer>)
+ *
+ * Converts a field as Python's int() does (surrounding whitespace and a sign are allowed).  Returns 1 and
+ * stores the value if the field is an integer, or 0 if it is not (or does not fit in an intmax_t).
+ **/
+static int parse_integer(const char *string, size_t length, intmax_t *result)
+{
+	const char *end = string + length;
+	uintmax_t value = 0;
+	int negative = 0;
+	int digits = 0;
+
+	while (string < end && is_space(*string))
+	{
+		string++;
+	}
+	while (end > string && is_space(end[-1]))
+	{
+		end--;
+	}
+	if (string < end && (*string == '-' || *string == '+'))
+	{
+		negative = *string == '-';
+		string++;
+	}
+	for (; string < end; string++, digits++)
+	{
+		if (*string < '0' || *string > '9' || value > (INTMAX_MAX - 9) / 10)
+		{
+			return 0;
+		}
+		value = value * 10 + (*string - '0');
+	}
+	if (! digits)
+	{
+		return 0;
+	}
+	*result = negative ? -(intmax_t)value : (intmax_t)value;
+	return 1;
+}
+
+
+/**
+ * prepare_statements(<rollup>)
+ *
+ * Creates the table of each statistic at each resolution (as Statistics.Store creates them) and prepares
+ * the statements that add a row to it.  For SQLite 3.24 and later this is one upsert that adds the values
+ * of the row to those already stored under its key; for older versions it is an insert of a zero row (if
+ * the key is missing) followed by an update.  A NULL key never conflicts with the primary key, so rows
+ * with one are added by an update of one stored row with the key (matched with IS, as Statistics.Store
+ * does), followed by an insert if there was none.  Sketches are read back with a select and written with
+ * a replace.  Parameters are numbered alike in every statement: the timestamp, the key and then the
+ * values.  Returns 1 for success or 0 for failure.
+ **/
+static int prepare_statements(struct rollup_t *rollup)
+{
+	const struct rollup_table_t *table;
+	char columns[256];
+	char increments[256];
+	char keys[128];
+	char name[64];
+	char parameters[128];
+	char sql[1024];
+	char updates[256];
+	char zeros[128];
+	int i;
+	int j;
+	int n;
+	int r;
+
+	sqlite3_busy_timeout(rollup->database, ROLLUP_BUSY_TIMEOUT);
+	if (sqlite3_exec(rollup->database, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		return 0;
+	}
+
+	for (r = 0; r < ROLLUP_RESOLUTION_COUNT; r++)
+	{
+		for (i = 0; i < STATISTIC_COUNT; i++)
+		{
+			table = &rollup_tables[i];
+			snprintf(name, sizeof(name), "%s%s", table->name, rollup_resolutions[r]);
+			if (table->key)
+			{
+				snprintf(keys, sizeof(keys), "timestamp, %s", table->key);
+				snprintf(columns, sizeof(columns), "timestamp INTEGER, %s %s", table->key, table->key_type);
+				snprintf(parameters, sizeof(parameters), "?1, ?2");
+				snprintf(zeros, sizeof(zeros), "?1, ?2");
+				n = 2;
+			}
+			else
+			{
+				snprintf(keys, sizeof(keys), "timestamp");
+				snprintf(columns, sizeof(columns), "timestamp INTEGER");
+				snprintf(parameters, sizeof(parameters), "?1");
+				snprintf(zeros, sizeof(zeros), "?1");
+				n = 1;
+			}
+			increments[0] = '\0';
+			updates[0] = '\0';
+			for (j = 0; j < 3 && table->values[j]; j++)
+			{
+				snprintf(columns + strlen(columns), sizeof(columns) - strlen(columns), ", %s INTEGER", table->values[j]);
+				snprintf(parameters + strlen(parameters), sizeof(parameters) - strlen(parameters), ", ?%d", n + j + 1);
+				snprintf(zeros + strlen(zeros), sizeof(zeros) - strlen(zeros), ", 0");
+				snprintf(increments + strlen(increments), sizeof(increments) - strlen(increments), "%s%s = %s + ?%d", j ? ", " : "", table->values[j], table->values[j], n + j + 1);
+				snprintf(updates + strlen(updates), sizeof(updates) - strlen(updates), "%s%s = %s + excluded.%s", j ? ", " : "", table->values[j], table->values[j], table->values[j]);
+			}
+
+			if (! strcmp(table->value_type, "BLOB"))
+			{
+				snprintf(columns, sizeof(columns), "timestamp INTEGER, %s %s", table->key, table->key_type);
+				for (j = 0; j < 3 && table->values[j]; j++)
+				{
+					snprintf(columns + strlen(columns), sizeof(columns) - strlen(columns), ", %s BLOB", table->values[j]);
+				}
+			}
+			snprintf(sql, sizeof(sql), "CREATE TABLE IF NOT EXISTS %s (%s, PRIMARY KEY (%s));", name, columns, keys);
+			if (sqlite3_exec(rollup->database, sql, NULL, NULL, NULL) != SQLITE_OK)
+			{
+				return 0;
+			}
+
+			/* The column list of the insert is the keys followed by the values. */
+			snprintf(columns, sizeof(columns), "%s", keys);
+			for (j = 0; j < 3 && table->values[j]; j++)
+			{
+				snprintf(columns + strlen(columns), sizeof(columns) - strlen(columns), ", %s", table->values[j]);
+			}
+			if (! strcmp(table->value_type, "BLOB"))
+			{
+				snprintf(sql, sizeof(sql), "SELECT %s FROM %s WHERE timestamp = ?1 AND %s = ?2;", columns + strlen(keys) + 2, name, table->key);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->statements[r][i][0], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+				snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO %s (%s) VALUES (%s);", name, columns, parameters);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->statements[r][i][1], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+			}
+			else if (sqlite3_libversion_number() >= 3024000)
+			{
+				snprintf(sql, sizeof(sql), "INSERT INTO %s (%s) VALUES (%s) ON CONFLICT (%s) DO UPDATE SET %s;", name, columns, parameters, keys, updates);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->statements[r][i][0], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+			}
+			else
+			{
+				snprintf(sql, sizeof(sql), "INSERT OR IGNORE INTO %s (%s) VALUES (%s);", name, columns, zeros);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->statements[r][i][0], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+				snprintf(sql, sizeof(sql), "UPDATE %s SET %s WHERE timestamp = ?1%s%s%s;", name, increments, table->key ? " AND " : "", table->key ? table->key : "", table->key ? " = ?2" : "");
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->statements[r][i][1], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+			}
+
+			if (table->key && strcmp(table->value_type, "BLOB"))
+			{
+				snprintf(sql, sizeof(sql), "UPDATE %s SET %s WHERE rowid = (SELECT rowid FROM %s WHERE timestamp = ?1 AND %s IS ?2 LIMIT 1);", name, increments, name, table->key);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->null_statements[r][i][0], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+				snprintf(sql, sizeof(sql), "INSERT INTO %s (%s) VALUES (%s);", name, columns, parameters);
+				if (sqlite3_prepare_v2(rollup->database, sql, -1, &rollup->null_statements[r][i][1], NULL) != SQLITE_OK)
+				{
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * read_varint(<data pointer>, <end of data>, <value pointer>)
+ *
+ * Reads an unsigned LEB128 varint and advances the data pointer past it.  Returns 1 for success or 0 if
+ * the data ends within it or it does not fit in 64 bits.
+ **/
+static int read_varint(const unsigned char **data, const unsigned char *end, uintmax_t *value)
+{
+	unsigned int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 64 && *data < end; shift += 7)
+	{
+		*value |= (uintmax_t)(**data & 0x7f) << shift;
+		if (! (*(*data)++ & 0x80))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * rollup_records(<rollup>, <records>, <count>)
+ *
+ * Counts each record of a batch.
+ **/
+static void rollup_records(void *state, struct log_record_t **records, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		add_record(state, records[i]);
+	}
+}
+
+
+/**
+ * rollup_timestamp(<timestamp>, <resolution>)
+ *
+ * Returns the start of the period of the resolution that the start of an hour falls in: the hour itself,
+ * or local midnight of its day or of the Monday of its week (as Statistics.rollup_timestamp() does).
+ **/
+static time_t rollup_timestamp(time_t timestamp, int resolution)
+{
+	struct tm tm;
+
+	if (resolution == ROLLUP_RESOLUTION_HOUR || ! localtime_r(&timestamp, &tm))
+	{
+		return timestamp;
+	}
+	if (resolution == ROLLUP_RESOLUTION_WEEK)
+	{
+		tm.tm_mday -= (tm.tm_wday + 6) % 7;
+	}
+	tm.tm_hour = 0;
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+
+/**
+ * signal_rollup(<rollup>, <signal flags>)
+ *
+ * Hands every bucket (including the current one) to the writer on SIGHUP, so that the graphs can be
+ * brought up to date on demand.  Rows are added to, so the rest of the hour is added to them when it
+ * closes.
+ **/
+static void signal_rollup(void *state, sigset_t *signal_flags)
+{
+	if (sigismember(signal_flags, SIGHUP))
+	{
+		flush_rollup(state, 1);
+	}
+}
+
+
+/**
+ * varint_length(<value>)
+ *
+ * Returns the number of bytes that write_varint() writes a value in.
+ **/
+static size_t varint_length(uintmax_t value)
+{
+	size_t length = 1;
+
+	while (value >= 0x80)
+	{
+		length++;
+		value >>= 7;
+	}
+	return length;
+}
+
+
+/**
+ * write_bucket(<rollup>, <bucket>)
+ *
+ * Writes the rows of every statistic of a bucket, under its hour and under the start of its day and of its
+ * week in the rollup tables.  Returns 1 for success or 0 for failure.
+ **/
+static int write_bucket(struct rollup_t *rollup, struct rollup_bucket_t *bucket)
+{
+	struct rollup_counter_t *counter;
+	intmax_t values[3];
+	time_t timestamp;
+	unsigned int i;
+	int j;
+	int r;
+
+	values[0] = bucket->hits;
+	values[1] = bucket->bytes_incoming;
+	values[2] = bucket->bytes_outgoing;
+	for (r = 0; r < ROLLUP_RESOLUTION_COUNT; r++)
+	{
+		timestamp = rollup_timestamp(bucket->timestamp, r);
+		for (j = 0; j < 2 && rollup->statements[r][STATISTIC_HIT][j]; j++)
+		{
+			if (! write_row(rollup->statements[r][STATISTIC_HIT][j], timestamp, NULL, values, 3))
+			{
+				fprintf(stderr, "udploggerrollup.c sqlite3_step(%s%s): %s: %s\n", rollup_tables[STATISTIC_HIT].name, rollup_resolutions[r], rollup->path, sqlite3_errmsg(rollup->database));
+				return 0;
+			}
+		}
+
+		for (i = 0; i < ROLLUP_HASH_SIZE; i++)
+		{
+			for (counter = bucket->counters[i]; counter; counter = counter->next)
+			{
+				if (counter->statistic == STATISTIC_QUANTILE || counter->statistic == STATISTIC_UNIQUE)
+				{
+					if (! write_sketches(rollup, r, timestamp, counter))
+					{
+						return 0;
+					}
+					continue;
+				}
+				if (counter->null)
+				{
+					if (! write_row(rollup->null_statements[r][counter->statistic][0], timestamp, counter, counter->values, 2) ||
+						(! sqlite3_changes(rollup->database) && ! write_row(rollup->null_statements[r][counter->statistic][1], timestamp, counter, counter->values, 2)))
+					{
+						fprintf(stderr, "udploggerrollup.c sqlite3_step(%s%s): %s: %s\n", rollup_tables[counter->statistic].name, rollup_resolutions[r], rollup->path, sqlite3_errmsg(rollup->database));
+						return 0;
+					}
+					continue;
+				}
+				for (j = 0; j < 2 && rollup->statements[r][counter->statistic][j]; j++)
+				{
+					if (! write_row(rollup->statements[r][counter->statistic][j], timestamp, counter, counter->values, 2))
+					{
+						fprintf(stderr, "udploggerrollup.c sqlite3_step(%s%s): %s: %s\n", rollup_tables[counter->statistic].name, rollup_resolutions[r], rollup->path, sqlite3_errmsg(rollup->database));
+						return 0;
+					}
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * write_buckets(<rollup>, <buckets>)
+ *
+ * Writes out a list of buckets in one transaction.  If the database is busy or the write fails, it is
+ * rolled back.  Returns 1 for success or 0 for failure.
+ **/
+static int write_buckets(struct rollup_t *rollup, struct rollup_bucket_t *buckets)
+{
+	struct rollup_bucket_t *bucket;
+	int result = 1;
+
+	if (sqlite3_exec(rollup->database, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "udploggerrollup.c sqlite3_exec(BEGIN): %s: %s\n", rollup->path, sqlite3_errmsg(rollup->database));
+		return 0;
+	}
+	for (bucket = buckets; bucket && result; bucket = bucket->next)
+	{
+		result = write_bucket(rollup, bucket);
+	}
+	if (result && sqlite3_exec(rollup->database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "udploggerrollup.c sqlite3_exec(COMMIT): %s: %s\n", rollup->path, sqlite3_errmsg(rollup->database));
+		result = 0;
+	}
+	if (! result)
+	{
+		sqlite3_exec(rollup->database, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	return result;
+}
+
+
+/**
+ * write_row(<statement>, <timestamp>, <key counter>, <values>, <value count>)
+ *
+ * Binds the timestamp, the key of the counter (if it is not NULL) and the values to the parameters of the
+ * statement (as far as it has them) and runs it.  Returns 1 for success or 0 for failure.
+ **/
+static int write_row(sqlite3_stmt *statement, time_t timestamp, const struct rollup_counter_t *counter, const intmax_t *values, int value_count)
+{
+	int parameters = sqlite3_bind_parameter_count(statement);
+	int result;
+	int i;
+	int n = 1;
+
+	sqlite3_bind_int64(statement, n++, timestamp);
+	if (counter)
+	{
+		if (counter->null)
+		{
+			sqlite3_bind_null(statement, n);
+		}
+		else if (counter->text)
+		{
+			sqlite3_bind_text(statement, n, counter->text, counter->text_length, SQLITE_STATIC);
+		}
+		else
+		{
+			sqlite3_bind_int64(statement, n, counter->number);
+		}
+		n++;
+	}
+	for (i = 0; i < value_count && n <= parameters; i++, n++)
+	{
+		sqlite3_bind_int64(statement, n, values[i]);
+	}
+
+	result = sqlite3_step(statement);
+	sqlite3_reset(statement);
+	return result == SQLITE_DONE;
+}
+
+
+/**
+ * write_sketches(<rollup>, <resolution>, <timestamp>, <counter>)
+ *
+ * Merges the sketches (histograms or HyperLogLog sketches) of a counter with those stored under its key
+ * (if any) in the table of the resolution and writes them in their place.  The counter is left as it is,
+ * in case the transaction fails.  Returns 1 for success or 0 for failure.
+ **/
+static int write_sketches(struct rollup_t *rollup, int resolution, time_t timestamp, const struct rollup_counter_t *counter)
+{
+	struct rollup_histogram_t stored[2];
+	struct rollup_hyperloglog_t stored_hyperloglogs[2];
+	sqlite3_stmt *select = rollup->statements[resolution][counter->statistic][0];
+	sqlite3_stmt *replace = rollup->statements[resolution][counter->statistic][1];
+	unsigned char *data[2] = {NULL, NULL};
+	size_t length[2];
+	int result;
+	int unique = counter->statistic == STATISTIC_UNIQUE;
+	int valid;
+	int i;
+
+	memset(stored, 0, sizeof(stored));
+	memset(stored_hyperloglogs, 0, sizeof(stored_hyperloglogs));
+
+	sqlite3_bind_int64(select, 1, timestamp);
+	sqlite3_bind_text(select, 2, counter->text, counter->text_length, SQLITE_STATIC);
+	result = sqlite3_step(select);
+	if (result == SQLITE_ROW)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if (sqlite3_column_type(select, i) == SQLITE_NULL)
+			{
+				continue;
+			}
+			if (unique)
+			{
+				valid = hyperloglog_decode(sqlite3_column_blob(select, i), sqlite3_column_bytes(select, i), &stored_hyperloglogs[i]);
+			}
+			else
+			{
+				valid = histogram_decode(sqlite3_column_blob(select, i), sqlite3_column_bytes(select, i), &stored[i]);
+			}
+			if (! valid)
+			{
+				fprintf(stderr, "udploggerrollup.c: replacing the invalid %s sketch of '%.*s' at %jd in %s%s of '%s'\n", rollup_tables[counter->statistic].values[i], (int)counter->text_length, counter->text, (intmax_t)timestamp, rollup_tables[counter->statistic].name, rollup_resolutions[resolution], rollup->path);
+				stored[i].bins = 0;
+				hyperloglog_free(&stored_hyperloglogs[i]);
+			}
+		}
+		result = SQLITE_DONE;
+	}
+	sqlite3_reset(select);
+
+	if (result == SQLITE_DONE)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if (unique)
+			{
+				if (hyperloglog_merge(&stored_hyperloglogs[i], &counter->hyperloglogs[i]))
+				{
+					data[i] = hyperloglog_encode(&stored_hyperloglogs[i], &length[i]);
+				}
+			}
+			else
+			{
+				data[i] = histogram_encode(&stored[i], &counter->histograms[i], &length[i]);
+			}
+		}
+		result = SQLITE_ERROR;
+		if (data[0] && data[1])
+		{
+			sqlite3_bind_int64(replace, 1, timestamp);
+			sqlite3_bind_text(replace, 2, counter->text, counter->text_length, SQLITE_STATIC);
+			sqlite3_bind_blob(replace, 3, data[0], length[0], SQLITE_STATIC);
+			sqlite3_bind_blob(replace, 4, data[1], length[1], SQLITE_STATIC);
+			result = sqlite3_step(replace);
+			sqlite3_reset(replace);
+		}
+	}
+	if (result != SQLITE_DONE)
+	{
+		fprintf(stderr, "udploggerrollup.c sqlite3_step(%s%s): %s: %s\n", rollup_tables[counter->statistic].name, rollup_resolutions[resolution], rollup->path, sqlite3_errmsg(rollup->database));
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		free(data[i]);
+		free(stored[i].indexes);
+		free(stored[i].counts);
+		hyperloglog_free(&stored_hyperloglogs[i]);
+	}
+	return result == SQLITE_DONE;
+}
+
+
+/**
+ * write_varint(<buffer>, <value>)
+ *
+ * Writes a value as an unsigned LEB128 varint.  Returns the number of bytes written (at most 10).
+ **/
+static size_t write_varint(unsigned char *data, uintmax_t value)
+{
+	size_t length = 0;
+
+	while (value >= 0x80)
+	{
+		data[length++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	data[length++] = value;
+	return length;
+}
+
+
+/**
+ * writer_main(<rollup>)
+ *
+ * Main function of the writer thread of an instance: writes out the buckets handed to it as they come.
+ * Buckets that fail to be written are kept and retried after ROLLUP_CHECK_INTERVAL, up to
+ * ROLLUP_WRITE_ATTEMPTS times and only until the instance is stopping; the records of the buckets that
+ * are given up on are reported as lost.
+ **/
+static void *writer_main(void *argument)
+{
+	struct rollup_t *rollup = argument;
+	struct rollup_bucket_t *buckets;
+	struct rollup_bucket_t *bucket;
+	struct timespec deadline;
+	int result;
+	struct rollup_bucket_t *retry;
+	int stopping;
+
+	pthread_mutex_lock(&rollup->closed_mutex);
+	while (1)
+	{
+		while (! rollup->closed && ! rollup->closed_stopping)
+		{
+			pthread_cond_wait(&rollup->closed_available, &rollup->closed_mutex);
+		}
+		if (! rollup->closed)
+		{
+			break;
+		}
+		buckets = rollup->closed;
+		rollup->closed = NULL;
+		stopping = rollup->closed_stopping;
+		pthread_mutex_unlock(&rollup->closed_mutex);
+
+		result = write_buckets(rollup, buckets);
+		retry = NULL;
+		while (buckets)
+		{
+			bucket = buckets;
+			buckets = bucket->next;
+			if (! result && ! stopping && ++bucket->attempts < ROLLUP_WRITE_ATTEMPTS)
+			{
+				bucket->next = retry;
+				retry = bucket;
+				continue;
+			}
+			if (! result)
+			{
+				fprintf(stderr, "udploggerrollup.c: statistics of %jd hits at %jd were not saved to '%s'\n", bucket->hits, (intmax_t)bucket->timestamp, rollup->path);
+			}
+			free_bucket(bucket);
+		}
+		pthread_mutex_lock(&rollup->closed_mutex);
+		if (! retry)
+		{
+			continue;
+		}
+
+		for (bucket = retry; bucket->next; bucket = bucket->next);
+		bucket->next = rollup->closed;
+		rollup->closed = retry;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (ROLLUP_CHECK_INTERVAL % 1000) * 1000000;
+		deadline.tv_sec += ROLLUP_CHECK_INTERVAL / 1000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		while (! rollup->closed_stopping && pthread_cond_timedwait(&rollup->closed_available, &rollup->closed_mutex, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&rollup->closed_mutex);
+	return NULL;
+}
@@ -0,0 +1,205 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#ifndef __UDPLOGGERROLLUP_H__
+#define __UDPLOGGERROLLUP_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/*
+ * The statistics that are kept (those of Nexopia.UDPLogger.Statistics.available_statistics()), as indexes
+ * into the table descriptions and prepared statements.  All of them but STATISTIC_HIT are counted per key;
+ * STATISTIC_QUANTILE keeps histograms and STATISTIC_UNIQUE HyperLogLog sketches rather than counts.
+ */
+#define STATISTIC_CONTENT_TYPE 0
+#define STATISTIC_HOST         1
+#define STATISTIC_STATUS       2
+#define STATISTIC_TIME_USED    3
+#define STATISTIC_USERSEX      4
+#define STATISTIC_USERTYPE     5
+#define STATISTIC_QUANTILE     6
+#define STATISTIC_UNIQUE       7
+#define STATISTIC_HIT          8
+#define STATISTIC_COUNT        9
+
+
+/*
+ * The resolutions that the statistics are written at (as Statistics.RESOLUTIONS): the hourly rows of the
+ * buckets, in the tables of the statistics, and rollups of them by day and by week (from Monday, at local
+ * midnight) in the tables of the same name with "_day" and "_week" appended.
+ */
+#define ROLLUP_RESOLUTION_HOUR  0
+#define ROLLUP_RESOLUTION_DAY   1
+#define ROLLUP_RESOLUTION_WEEK  2
+#define ROLLUP_RESOLUTION_COUNT 3
+
+
+/* The number of hash chains of the counters of each bucket. */
+#define ROLLUP_HASH_SIZE 256U
+
+/* The interval (milliseconds) at which buckets are checked for being closed, and a failed write is retried. */
+#define ROLLUP_CHECK_INTERVAL 10000UL
+
+/* How long (seconds) after the end of its hour a bucket is kept open for records that arrive late. */
+#define ROLLUP_GRACE_PERIOD 60
+
+/* How long (milliseconds) a flush waits for another writer of the database before it is retried later. */
+#define ROLLUP_BUSY_TIMEOUT 1000
+
+/* How many times a bucket is written (every ROLLUP_CHECK_INTERVAL) before it is given up on (an hour). */
+#define ROLLUP_WRITE_ATTEMPTS 360U
+
+
+/*
+ * Values below 2 ^ HISTOGRAM_SUB_BUCKET_BITS are counted exactly in histograms, larger ones in bins of
+ * 1.6% of their value (see Nexopia/UDPLogger/Histogram.py, whose bins and serialization these match).
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+
+
+/*
+ * HyperLogLog sketches have 2 ^ HYPERLOGLOG_PRECISION one-byte registers (see
+ * Nexopia/UDPLogger/HyperLogLog.py, whose hashing and serialization these match).  The precision is at
+ * most 16, so that register indexes fit in a uint16_t.
+ */
+#define HYPERLOGLOG_PRECISION 14
+#define HYPERLOGLOG_REGISTERS (1U << HYPERLOGLOG_PRECISION)
+#define HYPERLOGLOG_ENCODING_SPARSE 0
+#define HYPERLOGLOG_ENCODING_DENSE  1
+
+
+/*
+ * Description of the table that a statistic is saved to: its key column (NULL for none) and value
+ * columns (all of value_type), with the same names and types as the Statistics.py class that it mirrors.
+ */
+struct rollup_table_t {
+	const char *name;
+	const char *key;
+	const char *key_type;
+	const char *values[3];
+	const char *value_type;
+};
+
+
+/*
+ * A histogram: the indexes of the bins that are in use, in increasing order, and their counts.
+ */
+struct rollup_histogram_t {
+	size_t bins;
+	size_t size;
+	uint32_t *indexes;
+	uintmax_t *counts;
+};
+
+
+/*
+ * A HyperLogLog sketch.  It is kept sparse, as the indexes of the registers that are in use (in increasing
+ * order) and their values, until its sparse encoding (of which sparse_length is the length of the
+ * registers, without the count) would be longer than the dense one; only then is every register kept
+ * (registers, which is NULL until then).  Since adding a register never shortens the sparse encoding,
+ * hyperloglog_encode() writes whichever form the sketch is in, as HyperLogLog.py does.
+ */
+struct rollup_hyperloglog_t {
+	size_t count;
+	size_t size;
+	size_t sparse_length;
+	uint16_t *indexes;
+	unsigned char *ranks;
+	unsigned char *registers;
+};
+
+
+/*
+ * The count(s) (or, for STATISTIC_QUANTILE, the two histograms and for STATISTIC_UNIQUE, the two
+ * HyperLogLog sketches) of one key of a statistic within a bucket.  Keys are either NULL (null is set),
+ * integers (number) or strings (text, which is not NUL-terminated and is allocated along with the
+ * counter).  Arranged as singly-linked hash chains.
+ */
+struct rollup_counter_t {
+	unsigned char statistic;
+	unsigned char null;
+	intmax_t number;
+	char *text;
+	size_t text_length;
+	intmax_t values[2];
+	struct rollup_histogram_t *histograms;
+	struct rollup_hyperloglog_t *hyperloglogs;
+	struct rollup_counter_t *next;
+};
+
+
+/*
+ * The statistics of one hour: timestamp is the start of the hour (as udploggerstats.py truncates it),
+ * closes is the time at which it ends and attempts counts the failed writes of a closed bucket.
+ * Arranged as a singly-linked list, newest first.
+ */
+struct rollup_bucket_t {
+	time_t timestamp;
+	time_t closes;
+	unsigned int attempts;
+	intmax_t hits;
+	intmax_t bytes_incoming;
+	intmax_t bytes_outgoing;
+	struct rollup_counter_t *counters[ROLLUP_HASH_SIZE];
+	struct rollup_bucket_t *next;
+};
+
+
+/*
+ * The state of one loaded instance of the plugin: the database and the statements that write each
+ * statistic at each resolution (an upsert, or an insert of missing rows and an update of them for SQLite
+ * versions before 3.24; for sketches, a select of the stored row and its replacement) and that write a
+ * row with a NULL key (an update of the stored row, found with IS, and an insert if there is none), the
+ * open buckets
+ * and the hour that the last record fell into (hour_start up to hour_end, which is bucketed as
+ * hour_timestamp).
+ * Buckets that are done with are moved from buckets to closed, from where the writer thread takes them
+ * to write them out; closed, closed_stopping (set to stop the writer) and closed_available (signalled when
+ * either changes) are protected by closed_mutex.  Only the writer uses the database once it is started.
+ * Arranged as a singly-linked list of every instance.
+ */
+struct rollup_t {
+	char *path;
+	sqlite3 *database;
+	sqlite3_stmt *statements[ROLLUP_RESOLUTION_COUNT][STATISTIC_COUNT][2];
+	sqlite3_stmt *null_statements[ROLLUP_RESOLUTION_COUNT][STATISTIC_COUNT][2];
+	struct rollup_bucket_t *buckets;
+	time_t hour_start;
+	time_t hour_end;
+	time_t hour_timestamp;
+	pthread_t writer;
+	int writer_started;
+	pthread_mutex_t closed_mutex;
+	pthread_cond_t closed_available;
+	struct rollup_bucket_t *closed;
+	int closed_stopping;
+	struct rollup_t *next;
+};
+
+#endif
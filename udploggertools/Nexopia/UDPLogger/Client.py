@@ -0,0 +1,64 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import Nexopia.UDPLogger._client
+import Nexopia.UDPLogger.Parse
+
+class Client:
+	"""
+	In-process subscription to one or more udploggerd hosts (through the
+	udplogger client library), as an alternative to reading the output of
+	udploggerc from a pipe.  Each record is returned as a new
+	Nexopia.UDPLogger.Parse.LogLine, parsed straight from the fields of the
+	record (see LogLine.parse_record()) rather than from a udploggerc line.
+	"""
+
+	def __init__(self, hosts=(), interval=30, filter=None, ring=None):
+		self.client = Nexopia.UDPLogger._client.Client(hosts, interval, filter, ring)
+
+	def __iter__(self):
+		while True:
+			for log_data in self.poll():
+				yield log_data
+
+	def fileno(self):
+		return self.client.fileno()
+
+	def poll(self, timeout=-1):
+		"""
+		Waits up to timeout seconds (or indefinitely) for log records and
+		returns a LogLine for each record that was received (or None for a
+		record that could not be parsed).
+		"""
+		results = []
+		for record in self.client.poll(timeout):
+			log_data = Nexopia.UDPLogger.Parse.LogLine()
+			try:
+				log_data.parse_record(record)
+			except (AssertionError, IndexError):
+				log_data = None
+			results.append(log_data)
+		return results
@@ -0,0 +1,280 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+
+import gzip
+import struct
+import time
+
+# See columnar.h for the layout of the files that udploggerc --columnar writes.
+MAGIC = 'UDPC'
+HEADER = struct.Struct('<4sIIHH')
+DIRECTORY_ENTRY = struct.Struct('<BBHI')
+
+INT64 = 1
+DELTA32 = 2
+DICTIONARY = 3
+STRING = 4
+
+NULL = -2 ** 63
+DASH = NULL + 1
+
+GZIP_MAGIC = '\x1f\x8b'
+
+# Column names, by column number (the order of enum log_field_t in record.h,
+# followed by the received and source columns).
+COLUMNS = ['serial', 'tag', 'version', 'method', 'status', 'body_size', 'bytes_incoming', 'bytes_outgoing', 'time_used', 'connection_status', 'request_url', 'query_string', 'remote_address', 'host', 'user_agent', 'forwarded_for', 'referer', 'content_type', 'nexopia_userid', 'nexopia_userage', 'nexopia_usersex', 'nexopia_userlocation', 'nexopia_usertype', 'received', 'source']
+
+# The column that each Nexopia.UDPLogger.Parse.LogLine attribute comes from.
+ATTRIBUTE_COLUMNS = dict([(name, name) for name in COLUMNS if not name in ('received', 'source')])
+ATTRIBUTE_COLUMNS.update({'date_time': 'received', 'unix_timestamp': 'received', 'source_address': 'source', 'source_port': 'source'})
+
+#
+# Conversions from the stored values to the values that Parse.LogLine would
+# have produced from the same text.  Dictionary columns are converted once
+# per distinct value rather than once per row.
+#
+def _integer(value):
+	if value == NULL or value == DASH:
+		return None
+	return value
+
+def _integer_or_zero(value):
+	if value == NULL:
+		return None
+	if value == DASH:
+		return 0
+	return value
+
+def _integer_string(value):
+	try:
+		return int(value)
+	except ValueError:
+		return None
+
+def _string(value):
+	if value == '-':
+		return None
+	return value
+
+def _choice(choices, case):
+	def convert(value):
+		value = case(value)
+		if value in choices:
+			return value
+		return None
+	return convert
+
+def _version(value):
+	try:
+		return int(value[1:])
+	except ValueError:
+		return None
+
+def _source(value):
+	address, colon, port = value.rpartition(':')
+	try:
+		return (address, int(port))
+	except ValueError:
+		return (address, None)
+
+CONVERSIONS = {
+	'body_size': _integer_or_zero,
+	'bytes_incoming': _integer_or_zero,
+	'bytes_outgoing': _integer_or_zero,
+	'connection_status': _choice(('X', '-', '+'), str.upper),
+	'content_type': _string,
+	'forwarded_for': _string,
+	'host': _string,
+	'method': _choice(('CONNECT', 'DELETE', 'GET', 'HEAD', 'OPTIONS', 'POST', 'PUT', 'TRACE'), str.upper),
+	'nexopia_userage': _integer,
+	'nexopia_userid': _integer,
+	'nexopia_userlocation': _integer,
+	'nexopia_usersex': _choice(('female', 'male'), str.lower),
+	'nexopia_usertype': _choice(('anon', 'plus', 'user'), str.lower),
+	'query_string': _string,
+	'received': _integer,
+	'referer': _string,
+	'remote_address': _string,
+	'request_url': _string,
+	'serial': _integer,
+	'source': _source,
+	'status': _integer_string,
+	'tag': lambda value: value,
+	'time_used': _integer,
+	'user_agent': _string,
+	'version': _version,
+}
+
+class RowGroup:
+	"""
+	A row group of a columnar file.  Only the data of the columns that were
+	asked for when the row group was read is available; each column is
+	decoded the first time that it is used.
+	"""
+
+	def __init__(self, rows, columns):
+		self.rows = rows
+		self.columns = columns
+		self.decoded = {}
+
+	def __len__(self):
+		return self.rows
+
+	def column(self, name):
+		"""
+		Returns the values of a column (one per row), converted as
+		Parse.LogLine would convert them.
+		"""
+		if not name in self.decoded:
+			encoding, data = self.columns[name]
+			self.decoded[name] = _decode(self.rows, encoding, data, CONVERSIONS[name])
+		return self.decoded[name]
+
+	def raw_column(self, name):
+		"""
+		Returns the values of a column as they were stored (with NULL and
+		DASH for missing integers and '-' for missing strings).
+		"""
+		encoding, data = self.columns[name]
+		return _decode(self.rows, encoding, data, None)
+
+class Row:
+	pass
+
+def _decode(rows, encoding, data, conversion):
+	if encoding == INT64:
+		values = list(struct.unpack('<%dq' % (rows), data))
+	elif encoding == DELTA32:
+		value = struct.unpack_from('<q', data)[0]
+		values = [value]
+		append = values.append
+		for delta in struct.unpack_from('<%di' % (rows - 1), data, 8):
+			value += delta
+			append(value)
+	elif encoding == DICTIONARY:
+		count = struct.unpack_from('<H', data)[0]
+		entries = []
+		position = 2
+		for i in range(count):
+			length = struct.unpack_from('<I', data, position)[0]
+			entries.append(data[position + 4:position + 4 + length])
+			position += 4 + length
+		if not conversion is None:
+			entries = map(conversion, entries)
+		return [entries[code] for code in struct.unpack_from('<%dH' % (rows), data, position)]
+	elif encoding == STRING:
+		offsets = struct.unpack_from('<%dI' % (rows + 1), data)
+		base = 4 * (rows + 1)
+		values = [data[base + offsets[i]:base + offsets[i + 1]] for i in range(rows)]
+	else:
+		raise ValueError('unknown column encoding %d' % (encoding))
+	if conversion is None:
+		return values
+	return map(conversion, values)
+
+def read_groups(path, columns=None):
+	"""
+	Generates the row groups of a columnar file (which may be gzip-compressed),
+	reading only the named columns (or every column, if columns is None).
+	The other columns are skipped over by seeking in uncompressed files (and
+	are decompressed but never decoded in compressed ones).
+	"""
+	f = open(path, 'rb')
+	try:
+		if f.read(2) == GZIP_MAGIC:
+			f.close()
+			f = gzip.GzipFile(path, 'rb')
+			seekable = False
+		else:
+			f.seek(0)
+			seekable = True
+
+		while True:
+			header = f.read(HEADER.size)
+			if not header:
+				break
+			if len(header) < HEADER.size:
+				raise ValueError('%s: truncated row group' % (path))
+			magic, length, rows, count, version = HEADER.unpack(header)
+			if magic != MAGIC:
+				raise ValueError('%s is not a udploggerc columnar file' % (path))
+			directory = f.read(count * DIRECTORY_ENTRY.size)
+			if seekable:
+				start = f.tell()
+			else:
+				data = f.read(length - HEADER.size - len(directory))
+
+			selected = {}
+			position = 0
+			for i in range(count):
+				column, encoding, reserved, column_length = DIRECTORY_ENTRY.unpack_from(directory, i * DIRECTORY_ENTRY.size)
+				if column < len(COLUMNS) and (columns is None or COLUMNS[column] in columns):
+					if seekable:
+						f.seek(start + position)
+						selected[COLUMNS[column]] = (encoding, f.read(column_length))
+					else:
+						selected[COLUMNS[column]] = (encoding, data[position:position + column_length])
+				position += column_length
+			if seekable:
+				f.seek(start + position)
+			yield RowGroup(rows, selected)
+	finally:
+		f.close()
+
+def read_rows(paths, attributes):
+	"""
+	Generates an object per row of each of the columnar files in turn, with
+	the named Parse.LogLine attributes set (so that it can be handed to code
+	that works on LogLine objects, such as Nexopia.UDPLogger.Statistics).
+	Only the columns that hold those attributes are read.  The same object is
+	returned for every row, just as a LogLine is reused for every line.
+	"""
+	columns = set([ATTRIBUTE_COLUMNS[attribute] for attribute in attributes])
+	row = Row()
+	times = {}
+	for path in paths:
+		for group in read_groups(path, columns):
+			values = [(attribute, group.column(ATTRIBUTE_COLUMNS[attribute])) for attribute in attributes if not ATTRIBUTE_COLUMNS[attribute] in ('received', 'source')]
+			received = None
+			if 'received' in columns:
+				received = group.column('received')
+			source = None
+			if 'source' in columns:
+				source = group.column('source')
+			for i in xrange(group.rows):
+				for attribute, column in values:
+					setattr(row, attribute, column[i])
+				if not received is None:
+					timestamp = received[i]
+					if not timestamp in times:
+						if len(times) > 4096:
+							times.clear()
+						times[timestamp] = (time.localtime(timestamp), float(timestamp))
+					row.date_time, row.unix_timestamp = times[timestamp]
+				if not source is None:
+					row.source_address, row.source_port = source[i]
+				yield row
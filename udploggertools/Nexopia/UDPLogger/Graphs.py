@@ -24,6 +24,10 @@
 # THE SOFTWARE.
 #
 
+import Nexopia.UDPLogger.Histogram
+import Nexopia.UDPLogger.HyperLogLog
+import Nexopia.UDPLogger.Statistics
+
 import BaseHTTPServer
 import inspect
 import locale
@@ -48,6 +52,12 @@ import matplotlib
 matplotlib.use('Agg')
 import matplotlib.pyplot as plt
 
+# Graphs are drawn from the coarsest resolution of the statistics (see
+# Statistics.RESOLUTIONS) that still has at least this many points within the
+# requested range, so that long ranges are drawn from a few day or week rows
+# rather than from every hour.
+MINIMUM_POINTS = 30
+
 def available_graphs():
 	module = sys.modules[__name__]
 	results = []
@@ -62,6 +72,7 @@ def available_graphs():
 class UDPLoggerGraph:
 	def __init__(self):
 		self.plots = {}
+		self.resolution = 'hour'
 		self.timestamps = []
 
 	def add_datapoint(self, plot, timestamp, value):
@@ -93,7 +104,8 @@ class UDPLoggerGraph:
 		s = s.rstrip(',') + '\n'
 		for i in range(len(self.timestamps)):
 			s += '"' + str(self.timestamps[i]) + '",'
-			s += time.strftime('"%d-%b-%Y","%H:00:00","%H:59:59",', time.localtime(self.timestamps[i]))
+			s += time.strftime('"%d-%b-%Y","%H:%M:%S",', time.localtime(self.timestamps[i]))
+			s += time.strftime('"%H:%M:%S",', time.localtime(Nexopia.UDPLogger.Statistics.rollup_next(self.timestamps[i], self.resolution) - 1))
 			for plot in self.plots:
 				s += '"' + str(self.plots[plot][i]) + '",'
 			s = s.rstrip(',') + '\n'
@@ -121,6 +133,26 @@ class UDPLoggerGraph:
 		plt.savefig( output_buffer, format='png' )
 		return output_buffer.getvalue()
 
+	def table(self, table, start_timestamp, end_timestamp):
+		"""
+		Chooses the resolution to read the statistics of a table at over the
+		range (the coarsest with at least MINIMUM_POINTS periods within it, of
+		those that the database has).  Returns the name of the table of that
+		resolution and the start of the period that start_timestamp falls in,
+		from which it is to be read.
+		"""
+		cursor = self.db.cursor()
+		self.resolution = 'hour'
+		for resolution, length in reversed(Nexopia.UDPLogger.Statistics.RESOLUTIONS):
+			if resolution == 'hour' or (end_timestamp - start_timestamp) / length < MINIMUM_POINTS:
+				continue
+			cursor.execute("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = ?", (Nexopia.UDPLogger.Statistics.rollup_table(table, resolution),))
+			if cursor.fetchone()[0]:
+				self.resolution = resolution
+				break
+		cursor.close()
+		return Nexopia.UDPLogger.Statistics.rollup_table(table, self.resolution), Nexopia.UDPLogger.Statistics.rollup_timestamp(start_timestamp, self.resolution)
+
 	def series_fmt(self, series, fmt_idx=[-1]):
 		'''Returns the matplotlib format string that should be used to graph the
 		given series.  For a specification of the matplotlib format string, see.
@@ -158,8 +190,9 @@ class ContentTypeGraph(UDPLoggerGraph):
 
 class ContentTypeHitsGraph(ContentTypeGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('content_type_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT timestamp, content_type, count FROM content_type_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT timestamp, content_type, count FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['content_type'], row['timestamp'], row['count'])
 		cursor.close()
@@ -169,8 +202,9 @@ class ContentTypeHitsGraph(ContentTypeGraph):
 
 class ContentTypeTransferredGraph(ContentTypeGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('content_type_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT timestamp, content_type, transferred FROM content_type_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT timestamp, content_type, transferred FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['content_type'], row['timestamp'], row['transferred'] / float(1024 * 1024))
 		cursor.close()
@@ -180,8 +214,9 @@ class ContentTypeTransferredGraph(ContentTypeGraph):
 
 class HostGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('host_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT * FROM host_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['host'], row['timestamp'], row['count'])
 		cursor.close()
@@ -189,10 +224,88 @@ class HostGraph(UDPLoggerGraph):
 	def description(self):
 		return 'Hits per Virtual Host'
 
+class PercentileGraph(UDPLoggerGraph):
+	"""
+	Percentiles of one of the histograms of quantile_statistics, each period's
+	being merged across virtual hosts (or only that of the given host).
+	"""
+	column = None
+	percentiles = (50, 90, 99, 99.9)
+
+	def __init__(self, host=None):
+		UDPLoggerGraph.__init__(self)
+		self.host = host
+
+	def histograms(self, start_timestamp, end_timestamp):
+		"""
+		Yields (timestamp, Histogram) for each period within the range (each
+		hour, or each day or week of long ranges; see table()).
+		"""
+		table, start_timestamp = self.table('quantile_statistics', start_timestamp, end_timestamp)
+		cursor = self.db.cursor()
+		if self.host is None:
+			cursor.execute('SELECT timestamp, %s FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (self.column, table), (start_timestamp, end_timestamp))
+		else:
+			cursor.execute('SELECT timestamp, %s FROM %s WHERE timestamp >= ? AND timestamp <= ? AND host = ? ORDER BY timestamp' % (self.column, table), (start_timestamp, end_timestamp, self.host))
+		timestamp = None
+		histogram = None
+		for row in cursor:
+			if row['timestamp'] != timestamp:
+				if histogram is not None:
+					yield timestamp, histogram
+				timestamp = row['timestamp']
+				histogram = Nexopia.UDPLogger.Histogram.Histogram()
+			histogram.merge(Nexopia.UDPLogger.Histogram.loads(row[self.column]))
+		if histogram is not None:
+			yield timestamp, histogram
+		cursor.close()
+
+	def histogram(self, start_timestamp, end_timestamp):
+		"""
+		Returns the histogram of the whole range (for example to find the 99th
+		percentile of a host over a day).
+		"""
+		result = Nexopia.UDPLogger.Histogram.Histogram()
+		for timestamp, histogram in self.histograms(start_timestamp, end_timestamp):
+			result.merge(histogram)
+		return result
+
+	def load(self, start_timestamp, end_timestamp):
+		for timestamp, histogram in self.histograms(start_timestamp, end_timestamp):
+			for percentile in self.percentiles:
+				self.add_datapoint(percentile, timestamp, histogram.percentile(percentile))
+
+	def series_fmt(self, series):
+		if series == 50:
+			return 'g-*'
+		elif series == 90:
+			return 'b-*'
+		elif series == 99:
+			return 'm-*'
+		elif series == 99.9:
+			return 'r-*'
+		return UDPLoggerGraph.series_fmt(self, series)
+
+	def series_label(self, series):
+		return '%gth percentile' % (series)
+
+class BytesOutgoingPercentileGraph(PercentileGraph):
+	column = 'bytes_outgoing'
+
+	def description(self):
+		return 'Response Size Percentiles (Byte)'
+
+class TimeUsedPercentileGraph(PercentileGraph):
+	column = 'time_used'
+
+	def description(self):
+		return 'Request Completion Time Percentiles (seconds)'
+
 class StatusGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('status_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT * FROM status_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['status'], row['timestamp'], row['count'])
 		cursor.close()
@@ -234,8 +347,9 @@ class StatusGraph(UDPLoggerGraph):
 
 class TotalHitsGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('hit_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT timestamp, hits FROM hit_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT timestamp, hits FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint('Hits', row['timestamp'], row['hits'])
 		cursor.close()
@@ -250,8 +364,9 @@ class TotalHitsGraph(UDPLoggerGraph):
 
 class TotalTransferredGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('hit_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT timestamp, bytes_incoming, bytes_outgoing FROM hit_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT timestamp, bytes_incoming, bytes_outgoing FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint('Incoming', row['timestamp'], row['bytes_incoming'] / float(1024 * 1024))
 			self.add_datapoint('Outgoing', row['timestamp'], row['bytes_outgoing'] / float(1024 * 1024))
@@ -269,8 +384,9 @@ class TotalTransferredGraph(UDPLoggerGraph):
 
 class TimeUsedGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('time_used_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT * FROM time_used_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['time_used'], row['timestamp'], row['count'])
 		cursor.close()
@@ -312,10 +428,81 @@ class TimeUsedGraph(UDPLoggerGraph):
 			return str(series) + '-' + str(series + 1) + ' seconds'
 		return UDPLoggerGraph.series_label(self, series)
 
+class UniqueGraph(UDPLoggerGraph):
+	"""
+	Estimated distinct remote addresses and logged-in users of each period,
+	from the HyperLogLog sketches of unique_statistics merged across virtual
+	hosts (or only those of the given host).
+	"""
+	columns = ('remote_address', 'userid')
+
+	def __init__(self, host=None):
+		UDPLoggerGraph.__init__(self)
+		self.host = host
+
+	def description(self):
+		return 'Unique Visitors'
+
+	def load(self, start_timestamp, end_timestamp):
+		for timestamp, sketches in self.sketches(start_timestamp, end_timestamp):
+			for column in self.columns:
+				self.add_datapoint(column, timestamp, sketches[column].estimate())
+
+	def series_fmt(self, series):
+		if series == 'remote_address':
+			return 'b-*'
+		elif series == 'userid':
+			return 'g-*'
+		return UDPLoggerGraph.series_fmt(self, series)
+
+	def series_label(self, series):
+		if series == 'remote_address':
+			return 'Remote Addresses'
+		elif series == 'userid':
+			return 'Users'
+		return UDPLoggerGraph.series_label(self, series)
+
+	def sketches(self, start_timestamp, end_timestamp):
+		"""
+		Yields (timestamp, {column: HyperLogLog}) for each period within the
+		range (each hour, or each day or week of long ranges; see table()).
+		"""
+		table, start_timestamp = self.table('unique_statistics', start_timestamp, end_timestamp)
+		cursor = self.db.cursor()
+		if self.host is None:
+			cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
+		else:
+			cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? AND host = ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp, self.host))
+		timestamp = None
+		sketches = None
+		for row in cursor:
+			if row['timestamp'] != timestamp:
+				if sketches is not None:
+					yield timestamp, sketches
+				timestamp = row['timestamp']
+				sketches = dict([(column, Nexopia.UDPLogger.HyperLogLog.HyperLogLog()) for column in self.columns])
+			for column in self.columns:
+				sketches[column].merge(Nexopia.UDPLogger.HyperLogLog.loads(row[column]))
+		if sketches is not None:
+			yield timestamp, sketches
+		cursor.close()
+
+	def uniques(self, start_timestamp, end_timestamp):
+		"""
+		Returns the estimated distinct values of each column over the whole
+		range (for example the unique visitors of a day), as a dict.
+		"""
+		totals = dict([(column, Nexopia.UDPLogger.HyperLogLog.HyperLogLog()) for column in self.columns])
+		for timestamp, sketches in self.sketches(start_timestamp, end_timestamp):
+			for column in self.columns:
+				totals[column].merge(sketches[column])
+		return dict([(column, totals[column].estimate()) for column in self.columns])
+
 class UserSexGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('usersex_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT * FROM usersex_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['sex'], row['timestamp'], row['count'])
 		cursor.close()
@@ -343,8 +530,9 @@ class UserSexGraph(UDPLoggerGraph):
 
 class UserTypeGraph(UDPLoggerGraph):
 	def load(self, start_timestamp, end_timestamp):
+		table, start_timestamp = self.table('usertype_statistics', start_timestamp, end_timestamp)
 		cursor = self.db.cursor()
-		cursor.execute('SELECT * FROM usertype_statistics WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp', (start_timestamp, end_timestamp))
+		cursor.execute('SELECT * FROM %s WHERE timestamp >= ? AND timestamp <= ? ORDER BY timestamp' % (table), (start_timestamp, end_timestamp))
 		for row in cursor:
 			self.add_datapoint(row['type'], row['timestamp'], row['count'])
 		cursor.close()
@@ -0,0 +1,150 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+# Values below 2 ** SUB_BUCKET_BITS are counted exactly; larger ones in bins
+# whose width is at most 1 / 2 ** (SUB_BUCKET_BITS - 1) of their value (1.6%),
+# as in an HDR histogram.  A histogram of any number of values from 0 to
+# 2 ** 64 - 1 has at most 3776 bins.
+SUB_BUCKET_BITS = 7
+SUB_BUCKET_HALF = 1 << (SUB_BUCKET_BITS - 1)
+
+def bin_index(value):
+	"""
+	Returns the index of the bin that a (non-negative integer) value falls
+	into.
+	"""
+	shift = value.bit_length() - SUB_BUCKET_BITS
+	if shift <= 0:
+		return value
+	return (shift << (SUB_BUCKET_BITS - 1)) + (value >> shift)
+
+def bin_range(index):
+	"""
+	Returns the lowest value of a bin and its width.
+	"""
+	if index < (SUB_BUCKET_HALF << 1):
+		return index, 1
+	shift = (index >> (SUB_BUCKET_BITS - 1)) - 1
+	return (index - (shift << (SUB_BUCKET_BITS - 1))) << shift, 1 << shift
+
+def read_varint(data, offset):
+	value = 0
+	shift = 0
+	while True:
+		byte = ord(data[offset])
+		offset += 1
+		value |= (byte & 0x7f) << shift
+		if byte < 0x80:
+			return value, offset
+		shift += 7
+
+def write_varint(output, value):
+	while value >= 0x80:
+		output.append(chr((value & 0x7f) | 0x80))
+		value >>= 7
+	output.append(chr(value))
+
+class Histogram:
+	"""
+	A mergeable histogram of non-negative integers (such as the time used by
+	requests or the bytes sent for them) with bounded memory however many
+	values are added, from which quantiles can be read within the precision
+	of its bins.  Histograms of different hosts or hours are combined with
+	merge(), so they can be stored per hour and host and queried for any
+	combination of them.
+
+	dumps() serializes a histogram to a compact string (for a SQLite BLOB):
+	the number of bins that are in use, then for each of them, in order, the
+	difference between its index and that of the one before (or its index,
+	for the first) and its count, all as unsigned LEB128 varints.  loads()
+	reads it back.  udploggerrollup.c writes the same format.
+	"""
+
+	def __init__(self):
+		self.bins = {}
+		self.count = 0
+
+	def __deepcopy__(self, memo):
+		histogram = Histogram()
+		histogram.bins = dict(self.bins)
+		histogram.count = self.count
+		return histogram
+
+	def __str__(self):
+		return 'Histogram(%d values: %s)' % (self.count, ', '.join(['p%g=%d' % (p, self.percentile(p)) for p in (50, 90, 99)]))
+
+	def add(self, value, count=1):
+		index = bin_index(value)
+		self.bins[index] = self.bins.get(index, 0) + count
+		self.count += count
+
+	def dumps(self):
+		output = []
+		write_varint(output, len(self.bins))
+		previous = 0
+		for index in sorted(self.bins):
+			write_varint(output, index - previous)
+			write_varint(output, self.bins[index])
+			previous = index
+		return ''.join(output)
+
+	def merge(self, other):
+		for index, count in other.bins.iteritems():
+			self.bins[index] = self.bins.get(index, 0) + count
+		self.count += other.count
+
+	def percentile(self, percentile):
+		"""
+		Returns the value below or at which the given percentage (0 to 100) of
+		the values fall (the middle of its bin), or None if the histogram is
+		empty.
+		"""
+		if not self.count:
+			return None
+		rank = max(1, -(-self.count * percentile // 100))
+		seen = 0
+		for index in sorted(self.bins):
+			seen += self.bins[index]
+			if seen >= rank:
+				break
+		lowest, width = bin_range(index)
+		return lowest + (width - 1) // 2
+
+def loads(data):
+	"""
+	Returns the Histogram that dumps() serialized to data.
+	"""
+	histogram = Histogram()
+	data = str(data)
+	bins, offset = read_varint(data, 0)
+	index = 0
+	for i in range(bins):
+		delta, offset = read_varint(data, offset)
+		count, offset = read_varint(data, offset)
+		index += delta
+		histogram.bins[index] = count
+		histogram.count += count
+	return histogram
@@ -0,0 +1,252 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import Nexopia.UDPLogger.Histogram
+
+import bisect
+import math
+
+# Each sketch has 2 ** PRECISION one-byte registers (16 KB once every one of
+# them is kept), which gives a standard error of 1.04 / sqrt(2 ** PRECISION)
+# = 0.81% however many values are added.
+PRECISION = 14
+
+ENCODING_SPARSE = 0
+ENCODING_DENSE = 1
+
+FNV_OFFSET_BASIS = 0xcbf29ce484222325
+FNV_PRIME = 0x100000001b3
+MASK = 0xffffffffffffffff
+
+def hash64(data):
+	"""
+	Returns the 64-bit hash of a string: its FNV-1a hash, mixed with the
+	finalizer of MurmurHash3 so that every bit depends on every byte (the
+	registers are picked by the top bits).  udploggerrollup.c hashes values
+	the same way.
+	"""
+	h = FNV_OFFSET_BASIS
+	for byte in bytearray(data):
+		h = ((h ^ byte) * FNV_PRIME) & MASK
+	h ^= h >> 33
+	h = (h * 0xff51afd7ed558ccd) & MASK
+	h ^= h >> 33
+	h = (h * 0xc4ceb9fe1a85ec53) & MASK
+	h ^= h >> 33
+	return h
+
+def varint_length(value):
+	"""
+	Returns the number of bytes that write_varint() writes a value in.
+	"""
+	return max(1, (value.bit_length() + 6) // 7)
+
+def sigma(x):
+	if x == 1:
+		return float('inf')
+	y = 1.0
+	z = x
+	while True:
+		x *= x
+		previous = z
+		z += x * y
+		y += y
+		if z == previous:
+			return z
+
+def tau(x):
+	if x == 0 or x == 1:
+		return 0.0
+	y = 1.0
+	z = 1 - x
+	while True:
+		x = math.sqrt(x)
+		previous = z
+		y *= 0.5
+		z -= (1 - x) ** 2 * y
+		if z == previous:
+			return z / 3
+
+class HyperLogLog:
+	"""
+	A HyperLogLog sketch, which estimates the number of distinct values (such
+	as remote addresses or user ids) that were added to it in a bounded amount
+	of memory.  Sketches of different hosts or hours are combined with
+	merge(), which gives the sketch of the union of their values, so the
+	uniques over a day are estimated from hourly sketches without counting
+	them again.
+
+	dumps() serializes a sketch to a string (for a SQLite BLOB): a byte for
+	the precision and one for the encoding, then either (ENCODING_SPARSE) the
+	number of registers in use as an unsigned LEB128 varint and, for each of
+	them in order, the difference between its index and that of the one
+	before as a varint and its value as a byte; or (ENCODING_DENSE) every
+	register as a byte.  The shorter of the two is written.  loads() reads it
+	back.  udploggerrollup.c writes the same format.
+
+	In memory, a sketch is kept sparse too (indexes and ranks are the indexes
+	of the registers in use, in order, and their values) until its sparse
+	encoding would be longer than the dense one; only then are all of the
+	registers kept (registers, which is None until then).  Since adding a
+	register never shortens the sparse encoding, dumps() writes whichever
+	form the sketch is in.
+	"""
+
+	def __init__(self, precision=PRECISION):
+		self.precision = precision
+		self.indexes = []
+		self.ranks = []
+		self.sparse_length = 0
+		self.registers = None
+
+	def __deepcopy__(self, memo):
+		hyperloglog = HyperLogLog(self.precision)
+		hyperloglog.indexes = list(self.indexes)
+		hyperloglog.ranks = list(self.ranks)
+		hyperloglog.sparse_length = self.sparse_length
+		if self.registers is not None:
+			hyperloglog.registers = bytearray(self.registers)
+		return hyperloglog
+
+	def __str__(self):
+		return 'HyperLogLog(~%d distinct values)' % (self.estimate())
+
+	def add(self, value):
+		"""
+		Adds a string to the sketch.
+		"""
+		h = hash64(value)
+		bits = 64 - self.precision
+		index = h >> bits
+		rank = bits - (h & ((1 << bits) - 1)).bit_length() + 1
+		self.set(index, rank)
+
+	def densify(self):
+		"""
+		Switches the sketch to keeping every register.
+		"""
+		if self.registers is not None:
+			return
+		self.registers = bytearray(1 << self.precision)
+		for index, rank in zip(self.indexes, self.ranks):
+			self.registers[index] = rank
+		self.indexes = []
+		self.ranks = []
+		self.sparse_length = 0
+
+	def dumps(self):
+		if self.registers is not None:
+			return chr(self.precision) + chr(ENCODING_DENSE) + str(self.registers)
+		output = [chr(self.precision), chr(ENCODING_SPARSE)]
+		Nexopia.UDPLogger.Histogram.write_varint(output, len(self.indexes))
+		previous = 0
+		for index, rank in zip(self.indexes, self.ranks):
+			Nexopia.UDPLogger.Histogram.write_varint(output, index - previous)
+			output.append(chr(rank))
+			previous = index
+		return ''.join(output)
+
+	def estimate(self):
+		"""
+		Returns the estimated number of distinct values in the sketch, by the
+		improved estimator of Ertl ("New cardinality estimation algorithms for
+		HyperLogLog sketches", 2017), which needs neither the small-range
+		correction nor the bias tables of the original estimator.
+		"""
+		m = 1 << self.precision
+		q = 64 - self.precision
+		counts = [0] * (q + 2)
+		if self.registers is not None:
+			for rank in self.registers:
+				counts[rank] += 1
+		else:
+			counts[0] = m - len(self.indexes)
+			for rank in self.ranks:
+				counts[rank] += 1
+		if counts[0] == m:
+			return 0
+		z = m * tau(1 - counts[q + 1] / float(m))
+		for k in range(q, 0, -1):
+			z = 0.5 * (z + counts[k])
+		z += m * sigma(counts[0] / float(m))
+		return int(round(m * m / (2 * math.log(2)) / z))
+
+	def merge(self, other):
+		if other.precision != self.precision:
+			raise ValueError('cannot merge HyperLogLog sketches of precision %d and %d' % (self.precision, other.precision))
+		if other.registers is not None:
+			self.densify()
+			self.registers = bytearray(map(max, self.registers, other.registers))
+			return
+		for index, rank in zip(other.indexes, other.ranks):
+			self.set(index, rank)
+
+	def set(self, index, rank):
+		"""
+		Raises the register at index to rank, if it is lower.  While the sketch
+		is sparse, the length that its sparse encoding would have (less the
+		count) is kept up to date, and the sketch is made dense once that is
+		longer than the dense encoding.
+		"""
+		if self.registers is not None:
+			if rank > self.registers[index]:
+				self.registers[index] = rank
+			return
+		i = bisect.bisect_left(self.indexes, index)
+		if i < len(self.indexes) and self.indexes[i] == index:
+			if rank > self.ranks[i]:
+				self.ranks[i] = rank
+			return
+		previous = self.indexes[i - 1] if i else 0
+		self.sparse_length += varint_length(index - previous) + 1
+		if i < len(self.indexes):
+			self.sparse_length += varint_length(self.indexes[i] - index) - varint_length(self.indexes[i] - previous)
+		self.indexes.insert(i, index)
+		self.ranks.insert(i, rank)
+		if varint_length(len(self.indexes)) + self.sparse_length > 1 << self.precision:
+			self.densify()
+
+def loads(data):
+	"""
+	Returns the HyperLogLog that dumps() serialized to data.
+	"""
+	data = str(data)
+	hyperloglog = HyperLogLog(ord(data[0]))
+	if ord(data[1]) == ENCODING_DENSE:
+		hyperloglog.registers = bytearray(data[2:2 + (1 << hyperloglog.precision)])
+		if len(hyperloglog.registers) != 1 << hyperloglog.precision:
+			raise ValueError('truncated HyperLogLog sketch')
+		return hyperloglog
+	count, offset = Nexopia.UDPLogger.Histogram.read_varint(data, 2)
+	index = 0
+	for i in xrange(count):
+		delta, offset = Nexopia.UDPLogger.Histogram.read_varint(data, offset)
+		index += delta
+		if index >= 1 << hyperloglog.precision:
+			raise ValueError('invalid HyperLogLog sketch')
+		hyperloglog.set(index, ord(data[offset]))
+		offset += 1
+	return hyperloglog
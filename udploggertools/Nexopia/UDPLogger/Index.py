@@ -0,0 +1,244 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+
+import bisect
+import socket
+import struct
+import zlib
+
+# See output.h for the layout of the index files that udploggerc --index writes.
+MAGIC = 'UDPLIDX1'
+ENTRY = struct.Struct('<BBH4sQQQ')
+TYPE_TIME = 1
+TYPE_SERIAL = 2
+
+GZIP_MAGIC = '\x1f\x8b'
+READ_SIZE = 65536
+
+# The size of the parts that split_range() cuts uncompressed files into.
+SPLIT_SIZE = 64 * 1024 * 1024
+
+class Index:
+	"""
+	The sidecar index of a udploggerc log file (<file>.idx), which maps the
+	first line of each second and periodic per-source serial numbers to
+	positions in the file.  A position is an (offset, skip) pair: offset is
+	the start of the buffer that holds the line (a gzip member, in compressed
+	files) and skip is the position of the line within the buffer's data.
+	"""
+
+	def __init__(self, path):
+		self.times = []
+		self.time_positions = []
+		self.serials = {}
+
+		f = open(path + '.idx', 'rb')
+		try:
+			if f.read(len(MAGIC)) != MAGIC:
+				raise ValueError('%s.idx is not a udploggerc index' % (path))
+			data = f.read()
+		finally:
+			f.close()
+
+		for i in range(0, len(data) - ENTRY.size + 1, ENTRY.size):
+			type, reserved, port, address, key, offset, skip = ENTRY.unpack_from(data, i)
+			if type == TYPE_TIME:
+				self.times.append(key)
+				self.time_positions.append((offset, skip))
+			elif type == TYPE_SERIAL:
+				self.serials.setdefault((socket.inet_ntoa(address), port), []).append((key, (offset, skip)))
+
+		# Receive timestamps only go backwards if the clock does; the index cannot be
+		# searched by time if that happened.
+		for i in range(1, len(self.times)):
+			if self.times[i] < self.times[i - 1]:
+				self.times = []
+				self.time_positions = []
+				break
+
+	def serial_position(self, address, port, serial):
+		"""
+		Returns the position of the last checkpoint of the source at or before
+		serial, or None if the index does not have one.
+		"""
+		position = None
+		for key, key_position in self.serials.get((address, port), []):
+			if key <= serial:
+				position = key_position
+		return position
+
+	def time_range(self, start=None, end=None):
+		"""
+		Returns the positions to start and stop reading at in order to see
+		every line received from start to end (inclusive, in seconds since the
+		epoch; None for an open end).  The start position is that of the last
+		indexed second before start, so that seconds missing from the index
+		cannot cause lines to be skipped.  Either position may be None.
+		"""
+		first = None
+		last = None
+		if not start is None:
+			i = bisect.bisect_left(self.times, int(start))
+			if i > 0:
+				first = self.time_positions[i - 1]
+		if not end is None:
+			i = bisect.bisect_right(self.times, int(end))
+			if i < len(self.times):
+				last = self.time_positions[i]
+		return first, last
+
+def open_index(path):
+	"""
+	Returns the index of a log file, or None if it does not have a usable one.
+	"""
+	try:
+		return Index(path)
+	except (IOError, ValueError, struct.error):
+		return None
+
+def read_lines(path, first=None, last=None):
+	"""
+	Generates the lines of a udploggerc log file (which may be gzip-compressed)
+	from position first up to position last (see Index).
+	"""
+	f = open(path, 'rb')
+	try:
+		if f.read(2) == GZIP_MAGIC:
+			lines = _read_compressed(f, first, last)
+		else:
+			lines = _read_plain(f, first, last)
+		for line in lines:
+			yield line
+	finally:
+		f.close()
+
+def read_range(paths, start=None, end=None):
+	"""
+	Generates the lines of each of the udploggerc log files in turn, using
+	their indexes (if they have one) to skip over the lines received before
+	start or after end.  Not every line in the range is in it (and files
+	without an index are read in full), so the lines still need to be
+	checked against the time range.
+	"""
+	for path in paths:
+		first = None
+		last = None
+		if not (start is None and end is None):
+			index = open_index(path)
+			if not index is None:
+				first, last = index.time_range(start, end)
+		for line in read_lines(path, first, last):
+			yield line
+
+def split_range(path, start=None, end=None, size=SPLIT_SIZE):
+	"""
+	Returns (first, last) positions (see read_lines) of consecutive parts of a
+	udploggerc log file, each of about size bytes and beginning at the start
+	of a line, which together hold the lines that read_range() reads from it
+	(so that the parts can be read in parallel).  Compressed files are not
+	split.
+	"""
+	first = None
+	last = None
+	if not (start is None and end is None):
+		index = open_index(path)
+		if not index is None:
+			first, last = index.time_range(start, end)
+	f = open(path, 'rb')
+	try:
+		if f.read(2) == GZIP_MAGIC:
+			return [(first, last)]
+		position = 0
+		if not first is None:
+			position = first[0] + first[1]
+		f.seek(0, 2)
+		stop = f.tell()
+		if not last is None:
+			stop = min(stop, last[0] + last[1])
+		parts = []
+		while position < stop:
+			boundary = stop
+			if position + size < stop:
+				# The part ends at the start of the first line after size bytes.
+				f.seek(position + size - 1)
+				f.readline()
+				boundary = min(stop, f.tell())
+			parts.append(((position, 0), (boundary, 0)))
+			position = boundary
+		return parts
+	finally:
+		f.close()
+
+def _read_compressed(f, first, last):
+	# Every buffer is written as a complete gzip member that holds whole lines,
+	# so the file is decompressed a member at a time and positions are (member
+	# offset, offset within the member's data).
+	offset, skip = first or (0, 0)
+	f.seek(offset)
+	data = ''
+	while last is None or offset <= last[0]:
+		member_offset = offset
+		decompressor = zlib.decompressobj(16 + zlib.MAX_WBITS)
+		member = []
+		while True:
+			if not data:
+				data = f.read(READ_SIZE)
+				if not data:
+					break
+			member.append(decompressor.decompress(data))
+			if decompressor.unused_data:
+				offset += len(data) - len(decompressor.unused_data)
+				data = decompressor.unused_data
+				break
+			offset += len(data)
+			data = ''
+		text = ''.join(member)
+		if not last is None and member_offset == last[0]:
+			text = text[:last[1]]
+		for line in text[skip:].splitlines(True):
+			yield line
+		skip = 0
+		if not data:
+			return
+
+def _read_plain(f, first, last):
+	position = 0
+	if not first is None:
+		position = first[0] + first[1]
+	end = None
+	if not last is None:
+		end = last[0] + last[1]
+	f.seek(position)
+	for line in f:
+		if not end is None and position >= end:
+			return
+		if line[:1] == '\0':
+			# The zero-filled, preallocated tail of a file that is still
+			# being written (see udploggerc --preallocate).
+			return
+		position += len(line)
+		yield line
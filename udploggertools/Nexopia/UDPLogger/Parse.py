@@ -27,6 +27,13 @@
 import time
 
 # On any call to .parse(), each class must fully initialize all the fields that it has authority over.
+#
+# If the native parser (_parse.c) has been built, its LogLine and parse_many()
+# replace the pure-Python ones below (see the end of this file).  It has the
+# same attributes, but only converts each one when it is first read.
+
+# The maximum number of date/times that parse_datetime() keeps converted.
+DATETIME_CACHE_SIZE = 4096
 
 class LogLine_v1:
 	def __str__(self):
@@ -42,9 +49,14 @@ class LogLine_v1:
 		return s
 
 	def parse(self, fields):
-		assert len(fields) == 22, "invalid number of fields in log line"
+		self.parse_data(fields)
 		self.parse_datetime(fields[0])
 		self.parse_source(fields[1])
+
+	def parse_data(self, fields):
+		# Parses the fields of the record itself (everything after the date/time
+		# and source fields that udploggerc adds).
+		assert len(fields) == 22, "invalid number of fields in log line"
 		self.parse_serial(fields[2])
 		self.parse_tag(fields[3])
 		self.parse_method(fields[4])
@@ -215,6 +227,8 @@ class LogLine_v1:
 		if field in cache:
 			self.date_time, self.unix_timestamp = cache[field]
 		else:
+			if len(cache) >= DATETIME_CACHE_SIZE:
+				cache.clear()
 			try:
 				self.date_time = time.strptime(field, '[%Y-%m-%d %H:%M:%S]')
 				self.unix_timestamp = time.mktime(self.date_time)
@@ -230,10 +244,8 @@ class LogLine_v1:
 			self.user_agent = None
 
 class LogLine_v2(LogLine_v1):
-	def parse(self, fields):
+	def parse_data(self, fields):
 		assert len(fields) == 25, "invalid number of fields in log line"
-		self.parse_datetime(fields[0])
-		self.parse_source(fields[1])
 		self.parse_serial(fields[2])
 		self.parse_tag(fields[3])
 		self.parse_version(fields[4])
@@ -282,7 +294,53 @@ class LogLine(LogLine_v2):
 	def parse(self, raw):
 		self.raw = raw
 		fields = self.raw.split('\x1e')
+		self.parse_fields(fields)
+		self.parse_datetime(fields[0])
+		self.parse_source(fields[1])
+
+	def parse_fields(self, fields):
 		if fields[4] == 'v2':
-			LogLine_v2.parse(self, fields)
+			LogLine_v2.parse_data(self, fields)
 		else:
-			LogLine_v1.parse(self, fields)
+			LogLine_v1.parse_data(self, fields)
+			# v1 lines do not have these fields.
+			self.content_type = None
+			self.host = None
+			self.version = None
+
+	def parse_record(self, record, cache={}):
+		# Parses a record as returned by Nexopia.UDPLogger.Client (a tuple of the
+		# source address, source port, receive time and the log packet data)
+		# without formatting it as a udploggerc line first.  raw is set to the
+		# log packet data.  As in parse_datetime(), the date/time of each second
+		# is cached, but only the last one is kept.
+		address, port, received, self.raw = record
+		self.parse_fields(['', ''] + self.raw.split('\x1e'))
+		self.source_address = address
+		self.source_port = port
+		second = int(received)
+		if second not in cache:
+			cache.clear()
+			cache[second] = (time.localtime(second), float(second))
+		self.date_time, self.unix_timestamp = cache[second]
+
+def parse_many(lines):
+	"""
+	Parses each of the lines (after stripping its trailing whitespace) into a
+	new LogLine.  Returns the list of them, with None in place of the lines
+	that could not be parsed.
+	"""
+	results = []
+	for line in lines:
+		log_data = LogLine()
+		try:
+			log_data.parse(line.rstrip())
+		except (AssertionError, IndexError):
+			log_data = None
+		results.append(log_data)
+	return results
+
+try:
+	from Nexopia.UDPLogger._parse import LogLine, parse_many
+except ImportError:
+	pass
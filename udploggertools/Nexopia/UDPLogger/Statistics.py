@@ -24,8 +24,22 @@
 # THE SOFTWARE.
 #
 
+import Nexopia.UDPLogger.Histogram
+import Nexopia.UDPLogger.HyperLogLog
+
+import copy
 import inspect
+import sqlite3
 import sys
+import time
+
+# The resolutions that statistics are kept at, finest first, as (name, length
+# in seconds) pairs: the hourly rows that the statistics count, in their own
+# tables, and rollups of those by day and by week (Monday to Sunday) in tables
+# of their own (see rollup_table()).  Store keeps the rollups up to date as
+# rows are written, so that long ranges can be graphed from a few rows.
+# Periods start at local midnight, as hours are counted in local time.
+RESOLUTIONS = (('hour', 3600), ('day', 86400), ('week', 604800))
 
 def available_statistics():
 	module = sys.modules[__name__]
@@ -37,7 +51,257 @@ def available_statistics():
 				results.append(object())
 	return results
 
+def merge_results(results, other):
+	"""
+	Adds the results of a statistic (nested dicts of counts and sketches) to
+	those of another instance of it: counts are added and sketches merged.
+	"""
+	for key, value in other.iteritems():
+		if not key in results:
+			results[key] = value
+		elif isinstance(value, dict):
+			merge_results(results[key], value)
+		elif hasattr(value, 'merge'):
+			results[key].merge(value)
+		else:
+			results[key] += value
+
+def rollup_next(timestamp, resolution):
+	"""
+	Returns the start of the period (of the named resolution) after the one
+	that starts at timestamp.
+	"""
+	if resolution == 'hour':
+		return timestamp + 3600
+	t = time.localtime(timestamp)
+	return int(time.mktime((t.tm_year, t.tm_mon, t.tm_mday + (7 if resolution == 'week' else 1), 0, 0, 0, 0, 0, -1)))
+
+def rollup_table(table, resolution):
+	"""
+	Returns the name of the table that holds the rows of a statistic's table
+	at the named resolution.
+	"""
+	if resolution == 'hour':
+		return table
+	return '%s_%s' % (table, resolution)
+
+def rollup_timestamp(timestamp, resolution):
+	"""
+	Returns the start of the period (of the named resolution) that timestamp
+	falls in.
+	"""
+	t = time.localtime(timestamp)
+	if resolution == 'hour':
+		return int(time.mktime((t.tm_year, t.tm_mon, t.tm_mday, t.tm_hour, 0, 0, 0, 0, -1)))
+	elif resolution == 'day':
+		return int(time.mktime((t.tm_year, t.tm_mon, t.tm_mday, 0, 0, 0, 0, 0, -1)))
+	return int(time.mktime((t.tm_year, t.tm_mon, t.tm_mday - t.tm_wday, 0, 0, 0, 0, 0, -1)))
+
+class Store:
+	"""
+	Stages the rows of statistics in memory and writes them to a SQLite
+	database in one transaction per flush().  Each table gets a single
+	prepared upsert (INSERT ... ON CONFLICT DO UPDATE, which adds the values
+	of a row to those already stored under its key) that is run over all of
+	its staged rows.  BLOB values are sketches (such as Histograms), which
+	cannot be added in SQL: the rows of tables that have them are merged with
+	the stored ones (and with each other) in Python and replaced.  Tables are
+	created the first time that they are flushed.  The database is switched to
+	write-ahead logging, so that readers (such as the graphs) do not block the
+	writer.
+
+	Every row that is staged is also staged for the rollup tables of the
+	coarser RESOLUTIONS, under the start of its day and of its week, so the
+	rollups are added to (or merged into) as the hourly rows are.
+
+	A NULL key (such as the status of a line without one) never conflicts
+	with the primary key, so the rows with one are added to the stored row
+	of their key (found with IS) one at a time instead; see add().
+	"""
+
+	# ON CONFLICT DO UPDATE needs SQLite 3.24; older versions insert missing
+	# rows and update them with two statements instead.
+	UPSERT = sqlite3.sqlite_version_info >= (3, 24, 0)
+
+	def __init__(self, database_connection):
+		self.database_connection = database_connection
+		self.created = set()
+		self.staged = {}
+		self.timestamps = {}
+		self.database_connection.execute('PRAGMA journal_mode = WAL;')
+		self.database_connection.execute('PRAGMA synchronous = NORMAL;')
+
+	def add(self, cursor, table, key_names, value_names, rows):
+		"""
+		Adds the values of rows (some of whose keys are NULL) to those of the
+		stored row with the same key, or inserts them if there is none.  Only
+		one stored row is added to, so that a database with duplicates of a
+		key (written before NULL keys were matched) keeps the same totals.
+		"""
+		for row in rows:
+			cursor.execute('UPDATE %s SET %s WHERE rowid = (SELECT rowid FROM %s WHERE %s LIMIT 1);' % (table, ', '.join(['%s = %s + ?' % (name, name) for name in value_names]), table, ' AND '.join(['%s IS ?' % (name) for name in key_names])), tuple(row[len(key_names):]) + tuple(row[:len(key_names)]))
+			if cursor.rowcount < 1:
+				cursor.execute('INSERT INTO %s (%s) VALUES (%s);' % (table, ', '.join(key_names + value_names), ', '.join(['?'] * (len(key_names) + len(value_names)))), row)
+
+	def flush(self):
+		"""
+		Writes out the staged rows.
+		"""
+		if not self.staged:
+			return
+		cursor = self.database_connection.cursor()
+		try:
+			# Python's sqlite3 module commits before DDL statements, so the tables
+			# are created before the transaction that writes the rows begins.
+			for table in self.staged:
+				if not table in self.created:
+					keys, values, rows, loads = self.staged[table]
+					cursor.execute('CREATE TABLE IF NOT EXISTS %s (timestamp INTEGER, %s, PRIMARY KEY (%s));' % (table, ', '.join(['%s %s' % column for column in keys + values]), ', '.join(['timestamp'] + [name for name, type in keys])))
+					self.created.add(table)
+			for table in self.staged:
+				keys, values, rows, loads = self.staged[table]
+				key_names = ['timestamp'] + [name for name, type in keys]
+				value_names = [name for name, type in values]
+				if 'BLOB' in [type for name, type in values]:
+					self.merge(cursor, table, key_names, values, rows, loads)
+					continue
+				self.add(cursor, table, key_names, value_names, [row for row in rows if None in row[:len(key_names)]])
+				rows = [row for row in rows if not None in row[:len(key_names)]]
+				if self.UPSERT:
+					cursor.executemany('INSERT INTO %s (%s) VALUES (%s) ON CONFLICT (%s) DO UPDATE SET %s;' % (table, ', '.join(key_names + value_names), ', '.join(['?'] * (len(key_names) + len(value_names))), ', '.join(key_names), ', '.join(['%s = %s + excluded.%s' % (name, name, name) for name in value_names])), rows)
+				else:
+					cursor.executemany('INSERT OR IGNORE INTO %s (%s) VALUES (%s);' % (table, ', '.join(key_names + value_names), ', '.join(['?'] * len(key_names) + ['0'] * len(value_names))), [row[:len(key_names)] for row in rows])
+					cursor.executemany('UPDATE %s SET %s WHERE %s;' % (table, ', '.join(['%s = %s + ?' % (name, name) for name in value_names]), ' AND '.join(['%s = ?' % (name) for name in key_names])), [row[len(key_names):] + row[:len(key_names)] for row in rows])
+			self.database_connection.commit()
+		except:
+			self.database_connection.rollback()
+			raise
+		finally:
+			cursor.close()
+		self.staged = {}
+
+	def merge(self, cursor, table, key_names, values, rows, loads):
+		"""
+		Writes rows whose BLOB values are sketches: the rows with the same key
+		are merged with each other and with the stored row (read back with
+		loads()), sketches being merged and other values added, and written in
+		its place.
+		"""
+		# The sketches of the first row of a key are copied when the second is
+		# merged into them, and the copies merged into in place after that.
+		copied = set()
+		merged = {}
+		for row in rows:
+			key = row[:len(key_names)]
+			if key in merged:
+				merged[key] = self.merge_values(values, merged[key], row[len(key_names):], not key in copied)
+				copied.add(key)
+			else:
+				merged[key] = row[len(key_names):]
+		value_names = [name for name, type in values]
+		for key in merged:
+			cursor.execute('SELECT %s FROM %s WHERE %s;' % (', '.join(value_names), table, ' AND '.join(['%s = ?' % (name) for name in key_names])), key)
+			stored = cursor.fetchone()
+			if stored is None:
+				row = merged[key]
+			else:
+				row = self.merge_values(values, [value if type != 'BLOB' else loads(value) for (name, type), value in zip(values, stored)], merged[key], False)
+			row = [value if type != 'BLOB' else sqlite3.Binary(value.dumps()) for (name, type), value in zip(values, row)]
+			cursor.execute('INSERT OR REPLACE INTO %s (%s) VALUES (%s);' % (table, ', '.join(key_names + value_names), ', '.join(['?'] * (len(key_names) + len(value_names)))), tuple(key) + tuple(row))
+
+	def merge_values(self, values, first, second, copy_first=True):
+		"""
+		Returns the values of two rows combined: sketches (BLOB values) are
+		merged into a copy of those of the first row (or into them, if
+		copy_first is False) and the others added.
+		"""
+		result = []
+		for (name, type), a, b in zip(values, first, second):
+			if type == 'BLOB':
+				if copy_first:
+					a = copy.deepcopy(a)
+				a.merge(b)
+				result.append(a)
+			else:
+				result.append(a + b)
+		return result
+
+	def rebuild(self, statistics):
+		"""
+		Rebuilds the rollup tables of the given statistics from the hourly rows
+		in the database, such as those written before rollups were kept.  The
+		rollup tables are dropped and the hourly rows read back and staged for
+		them a week at a time, each week in a transaction of its own.
+		"""
+		cursor = self.database_connection.cursor()
+		try:
+			for statistic in statistics:
+				cursor.execute("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = ?;", (statistic.table,))
+				if not cursor.fetchone()[0]:
+					continue
+				for resolution, length in RESOLUTIONS[1:]:
+					cursor.execute('DROP TABLE IF EXISTS %s;' % (rollup_table(statistic.table, resolution)))
+					self.created.discard(rollup_table(statistic.table, resolution))
+				self.database_connection.commit()
+				cursor.execute('SELECT MIN(timestamp), MAX(timestamp) FROM %s;' % (statistic.table))
+				first, last = cursor.fetchone()
+				if first is None:
+					continue
+				columns = ['timestamp'] + [name for name, type in statistic.keys + statistic.values]
+				types = [None] + [type for name, type in statistic.keys + statistic.values]
+				week = rollup_timestamp(first, 'week')
+				while week <= last:
+					next_week = rollup_next(week, 'week')
+					cursor.execute('SELECT %s FROM %s WHERE timestamp >= ? AND timestamp < ?;' % (', '.join(columns), statistic.table), (week, next_week))
+					rows = [tuple([value if type != 'BLOB' else statistic.loads(value) for type, value in zip(types, row)]) for row in cursor.fetchall()]
+					self.stage(statistic.table, statistic.keys, statistic.values, rows, statistic.loads, RESOLUTIONS[1:])
+					self.flush()
+					week = next_week
+		finally:
+			cursor.close()
+
+	def stage(self, table, keys, values, rows, loads=None, resolutions=RESOLUTIONS):
+		"""
+		Stages rows for a table whose key columns (besides timestamp) and value
+		columns are given as (name, type) pairs.  Each row is a tuple of the
+		timestamp, the keys and then the values; rows with the same key are
+		added together.  loads() reads back the stored BLOB values, if there
+		are any.  The rows are staged for the table at each of the given
+		resolutions, under the start of their period.
+		"""
+		rows = list(rows)
+		for resolution, length in resolutions:
+			if resolution == 'hour':
+				rollup_rows = rows
+			else:
+				rollup_rows = [(self.timestamp(row[0], resolution),) + tuple(row[1:]) for row in rows]
+			self.staged.setdefault(rollup_table(table, resolution), (keys, values, [], loads))[2].extend(rollup_rows)
+
+	def timestamp(self, timestamp, resolution):
+		"""
+		Returns rollup_timestamp(timestamp, resolution), which is remembered, as
+		the rows of a flush share a few timestamps.
+		"""
+		key = (timestamp, resolution)
+		if not key in self.timestamps:
+			self.timestamps[key] = rollup_timestamp(timestamp, resolution)
+		return self.timestamps[key]
+
 class UDPLoggerStatistic:
+	# The LogLine attributes (besides unix_timestamp) that update() uses, so
+	# that columnar readers only need to decode those.
+	columns = ()
+
+	# The table that the results are saved to and its key columns (besides the
+	# timestamp) and value columns, as (name, type) pairs; rows() generates a
+	# (timestamp, keys..., values...) tuple for each result.
+	table = None
+	keys = ()
+	values = ()
+
+	# The function that reads back the sketches of BLOB values.
+	loads = None
+
 	def __init__(self):
 		self.results = {}
 
@@ -49,37 +313,33 @@ class UDPLoggerStatistic:
 				s += '\t\t%-25s\t%s\n' % (str(i), str(self.results[unix_timestamp][i]))
 		return s
 
-class ContentTypeStatistic(UDPLoggerStatistic):
+	def merge(self, other):
+		"""
+		Adds the results of another instance of the statistic (such as one that
+		counted other lines in another process) to these.  Merging is
+		associative and commutative, so partial results can be merged in any
+		order.
+		"""
+		merge_results(self.results, other.results)
+
 	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS content_type_statistics (
-									timestamp INTEGER,
-									content_type TEXT,
-									count INTEGER,
-									transferred INTEGER,
-									PRIMARY KEY (timestamp, content_type)
-								);''')
+		store = Store(database_connection)
+		self.stage(store)
+		store.flush()
+
+	def stage(self, store):
+		store.stage(self.table, self.keys, self.values, self.rows(), self.loads)
+
+class ContentTypeStatistic(UDPLoggerStatistic):
+	columns = ('bytes_outgoing', 'content_type')
+	table = 'content_type_statistics'
+	keys = (('content_type', 'TEXT'),)
+	values = (('count', 'INTEGER'), ('transferred', 'INTEGER'))
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for content_type in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO content_type_statistics (
-											timestamp,
-											content_type,
-											count,
-											transferred
-										) VALUES (
-											?,
-											?,
-											0,
-											0
-										);''', (unix_timestamp, content_type))
-				cursor.execute('''UPDATE content_type_statistics
-										SET
-											count = count + ?,
-											transferred = transferred + ?
-										WHERE
-											timestamp = ? AND
-											content_type = ?;''', (self.results[unix_timestamp][content_type]['count'], self.results[unix_timestamp][content_type]['transferred'], unix_timestamp, content_type))
-		database_connection.commit()
+				yield (unix_timestamp, content_type, self.results[unix_timestamp][content_type]['count'], self.results[unix_timestamp][content_type]['transferred'])
 
 	def update(self, log):
 		if log.content_type is None:
@@ -100,35 +360,14 @@ class ContentTypeStatistic(UDPLoggerStatistic):
 		self.results[log.unix_timestamp][content_type]['transferred'] += log.bytes_outgoing
 
 class HitStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS hit_statistics (
-									timestamp INTEGER,
-									hits INTEGER,
-									bytes_incoming INTEGER,
-									bytes_outgoing INTEGER,
-									PRIMARY KEY (timestamp)
-								);''')
+	columns = ('bytes_incoming', 'bytes_outgoing')
+	table = 'hit_statistics'
+	keys = ()
+	values = (('hits', 'INTEGER'), ('bytes_incoming', 'INTEGER'), ('bytes_outgoing', 'INTEGER'))
+
+	def rows(self):
 		for unix_timestamp in self.results:
-			cursor.execute('''INSERT OR IGNORE INTO hit_statistics (
-										timestamp,
-										hits,
-										bytes_incoming,
-										bytes_outgoing
-									) VALUES (
-										?,
-										0,
-										0,
-										0
-									);''', (unix_timestamp,))
-			cursor.execute('''UPDATE hit_statistics
-									SET
-										hits = hits + ?,
-										bytes_incoming = bytes_incoming + ?,
-										bytes_outgoing = bytes_outgoing + ?
-									WHERE
-										timestamp = ?;''', (self.results[unix_timestamp]['hits'], self.results[unix_timestamp]['bytes_incoming'], self.results[unix_timestamp]['bytes_outgoing'], unix_timestamp))
-		database_connection.commit()
+			yield (unix_timestamp, self.results[unix_timestamp]['hits'], self.results[unix_timestamp]['bytes_incoming'], self.results[unix_timestamp]['bytes_outgoing'])
 
 	def update(self, log):
 		if not log.unix_timestamp in self.results:
@@ -143,32 +382,15 @@ class HitStatistic(UDPLoggerStatistic):
 		self.results[log.unix_timestamp]['hits'] += 1
 
 class HostStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS host_statistics (
-									timestamp INTEGER,
-									host TEXT,
-									count INTEGER,
-									PRIMARY KEY (timestamp, host)
-								);''')
+	columns = ('host',)
+	table = 'host_statistics'
+	keys = (('host', 'TEXT'),)
+	values = (('count', 'INTEGER'),)
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for host in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO host_statistics (
-											timestamp,
-											host,
-											count
-										) VALUES (
-											?,
-											?,
-											0
-										);''', (unix_timestamp, host))
-				cursor.execute('''UPDATE host_statistics
-										SET
-											count = count + ?
-										WHERE
-											timestamp = ? AND
-											host = ?;''', (self.results[unix_timestamp][host], unix_timestamp, host))
-		database_connection.commit()
+				yield (unix_timestamp, host, self.results[unix_timestamp][host])
 
 	def update(self, log):
 		if log.host is None:
@@ -185,33 +407,53 @@ class HostStatistic(UDPLoggerStatistic):
 			self.results[log.unix_timestamp][host] = 0
 		self.results[log.unix_timestamp][host] += 1
 
+class QuantileStatistic(UDPLoggerStatistic):
+	"""
+	Histograms of the time used by requests and of the bytes sent for them,
+	per virtual host, from which their percentiles can be read (see
+	Histogram.py and Graphs.PercentileGraph).
+	"""
+	columns = ('bytes_outgoing', 'host', 'time_used')
+	table = 'quantile_statistics'
+	keys = (('host', 'TEXT'),)
+	values = (('time_used', 'BLOB'), ('bytes_outgoing', 'BLOB'))
+	loads = staticmethod(Nexopia.UDPLogger.Histogram.loads)
+
+	def rows(self):
+		for unix_timestamp in self.results:
+			for host in self.results[unix_timestamp]:
+				yield (unix_timestamp, host, self.results[unix_timestamp][host]['time_used'], self.results[unix_timestamp][host]['bytes_outgoing'])
+
+	def update(self, log):
+		if log.host is None:
+			host = ""
+		else:
+			i = log.host.find(':')
+			if i > -1:
+				host = log.host[:i]
+			else:
+				host = log.host
+		if not log.unix_timestamp in self.results:
+			self.results[log.unix_timestamp] = {}
+		if not host in self.results[log.unix_timestamp]:
+			self.results[log.unix_timestamp][host] = {}
+			self.results[log.unix_timestamp][host]['bytes_outgoing'] = Nexopia.UDPLogger.Histogram.Histogram()
+			self.results[log.unix_timestamp][host]['time_used'] = Nexopia.UDPLogger.Histogram.Histogram()
+		if log.bytes_outgoing is not None and log.bytes_outgoing >= 0:
+			self.results[log.unix_timestamp][host]['bytes_outgoing'].add(log.bytes_outgoing)
+		if log.time_used is not None and log.time_used >= 0:
+			self.results[log.unix_timestamp][host]['time_used'].add(log.time_used)
+
 class StatusStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS status_statistics (
-									timestamp INTEGER,
-									status INTEGER,
-									count INTEGER,
-									PRIMARY KEY (timestamp, status)
-								);''')
+	columns = ('status',)
+	table = 'status_statistics'
+	keys = (('status', 'INTEGER'),)
+	values = (('count', 'INTEGER'),)
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for status in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO status_statistics (
-											timestamp,
-											status,
-											count
-										) VALUES (
-											?,
-											?,
-											0
-										);''', (unix_timestamp, status))
-				cursor.execute('''UPDATE status_statistics
-										SET
-											count = count + ?
-										WHERE
-											timestamp = ? AND
-											status = ?;''', (self.results[unix_timestamp][status], unix_timestamp, status))
-		database_connection.commit()
+				yield (unix_timestamp, status, self.results[unix_timestamp][status])
 
 	def update(self, log):
 		if not log.unix_timestamp in self.results:
@@ -221,32 +463,15 @@ class StatusStatistic(UDPLoggerStatistic):
 		self.results[log.unix_timestamp][log.status] += 1
 
 class TimeUsedStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS time_used_statistics (
-									timestamp INTEGER,
-									time_used INTEGER,
-									count INTEGER,
-									PRIMARY KEY (timestamp, time_used)
-								);''')
+	columns = ('time_used',)
+	table = 'time_used_statistics'
+	keys = (('time_used', 'INTEGER'),)
+	values = (('count', 'INTEGER'),)
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for time_used in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO time_used_statistics (
-											timestamp,
-											time_used,
-											count
-										) VALUES (
-											?,
-											?,
-											0
-										);''', (unix_timestamp, time_used))
-				cursor.execute('''UPDATE time_used_statistics
-										SET
-											count = count + ?
-										WHERE
-											timestamp = ? AND
-											time_used = ?;''', (self.results[unix_timestamp][time_used], unix_timestamp, time_used))
-		database_connection.commit()
+				yield (unix_timestamp, time_used, self.results[unix_timestamp][time_used])
 
 	def update(self, log):
 		if log.time_used > 10:
@@ -259,33 +484,53 @@ class TimeUsedStatistic(UDPLoggerStatistic):
 			self.results[log.unix_timestamp][time_used] = 0
 		self.results[log.unix_timestamp][time_used] += 1
 
+class UniqueStatistic(UDPLoggerStatistic):
+	"""
+	HyperLogLog sketches of the distinct remote addresses and (logged-in)
+	user ids per virtual host, from which the uniques of any range of hours
+	and hosts are estimated (see HyperLogLog.py and Graphs.UniqueGraph).
+	"""
+	columns = ('host', 'nexopia_userid', 'remote_address')
+	table = 'unique_statistics'
+	keys = (('host', 'TEXT'),)
+	values = (('remote_address', 'BLOB'), ('userid', 'BLOB'))
+	loads = staticmethod(Nexopia.UDPLogger.HyperLogLog.loads)
+
+	def rows(self):
+		for unix_timestamp in self.results:
+			for host in self.results[unix_timestamp]:
+				yield (unix_timestamp, host, self.results[unix_timestamp][host]['remote_address'], self.results[unix_timestamp][host]['userid'])
+
+	def update(self, log):
+		if log.host is None:
+			host = ""
+		else:
+			i = log.host.find(':')
+			if i > -1:
+				host = log.host[:i]
+			else:
+				host = log.host
+		if not log.unix_timestamp in self.results:
+			self.results[log.unix_timestamp] = {}
+		if not host in self.results[log.unix_timestamp]:
+			self.results[log.unix_timestamp][host] = {}
+			self.results[log.unix_timestamp][host]['remote_address'] = Nexopia.UDPLogger.HyperLogLog.HyperLogLog()
+			self.results[log.unix_timestamp][host]['userid'] = Nexopia.UDPLogger.HyperLogLog.HyperLogLog()
+		if log.remote_address is not None:
+			self.results[log.unix_timestamp][host]['remote_address'].add(log.remote_address)
+		if log.nexopia_userid is not None and log.nexopia_userid > 0:
+			self.results[log.unix_timestamp][host]['userid'].add(str(log.nexopia_userid))
+
 class UserSexStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS usersex_statistics (
-									timestamp INTEGER,
-									sex TEXT,
-									count INTEGER,
-									PRIMARY KEY (timestamp, sex)
-								);''')
+	columns = ('nexopia_usersex',)
+	table = 'usersex_statistics'
+	keys = (('sex', 'TEXT'),)
+	values = (('count', 'INTEGER'),)
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for usersex in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO usersex_statistics (
-											timestamp,
-											sex,
-											count
-										) VALUES (
-											?,
-											?,
-											0
-										);''', (unix_timestamp, usersex))
-				cursor.execute('''UPDATE usersex_statistics
-										SET
-											count = count + ?
-										WHERE
-											timestamp = ? AND
-											sex = ?;''', (self.results[unix_timestamp][usersex], unix_timestamp, usersex))
-		database_connection.commit()
+				yield (unix_timestamp, usersex, self.results[unix_timestamp][usersex])
 
 	def update(self, log):
 		if log.nexopia_usersex == None:
@@ -299,32 +544,15 @@ class UserSexStatistic(UDPLoggerStatistic):
 		self.results[log.unix_timestamp][usersex] += 1
 
 class UserTypeStatistic(UDPLoggerStatistic):
-	def save(self, database_connection):
-		cursor = database_connection.cursor()
-		cursor.execute('''CREATE TABLE IF NOT EXISTS usertype_statistics (
-									timestamp INTEGER,
-									type TEXT,
-									count INTEGER,
-									PRIMARY KEY (timestamp, type)
-								);''')
+	columns = ('nexopia_usertype',)
+	table = 'usertype_statistics'
+	keys = (('type', 'TEXT'),)
+	values = (('count', 'INTEGER'),)
+
+	def rows(self):
 		for unix_timestamp in self.results:
 			for usertype in self.results[unix_timestamp]:
-				cursor.execute('''INSERT OR IGNORE INTO usertype_statistics (
-											timestamp,
-											type,
-											count
-										) VALUES (
-											?,
-											?,
-											0
-										);''', (unix_timestamp, usertype))
-				cursor.execute('''UPDATE usertype_statistics
-										SET
-											count = count + ?
-										WHERE
-											timestamp = ? AND
-											type = ?;''', (self.results[unix_timestamp][usertype], unix_timestamp, usertype))
-		database_connection.commit()
+				yield (unix_timestamp, usertype, self.results[unix_timestamp][usertype])
 
 	def update(self, log):
 		if log.nexopia_usertype == None:
@@ -0,0 +1,328 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include "udploggerclient.h"
+
+
+/*
+ * CPython binding for the udplogger client library (libudploggerclient.so), so that Python tools can
+ * subscribe to udploggerd hosts in-process rather than reading the output of udploggerc through a pipe.
+ * Records are returned from Client.poll() as (source address, source port, receive time, record) tuples,
+ * where the record is the raw serial/tag/payload data.  See Client.py for the Python-level wrapper.
+ */
+
+
+typedef struct {
+	PyObject_HEAD
+	struct udplogger_client_t *client;
+	PyObject *records;
+} ClientObject;
+
+
+static void client_batch(struct udplogger_client_t *, struct log_record_t **, size_t, void *);
+static void client_dealloc(ClientObject *);
+static PyObject *client_fileno(ClientObject *);
+static int client_init(ClientObject *, PyObject *, PyObject *);
+static PyObject *client_poll(ClientObject *, PyObject *);
+
+
+static PyMethodDef client_methods[] = {
+	{"fileno", (PyCFunction)client_fileno, METH_NOARGS, "fileno() -> descriptor that is readable whenever poll() has work to do"},
+	{"poll", (PyCFunction)client_poll, METH_VARARGS, "poll([timeout]) -> list of (address, port, received, record) tuples received within timeout seconds (default: block)"},
+	{NULL, NULL, 0, NULL}
+};
+
+
+static PyTypeObject ClientType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                                        /* ob_size */
+	"_client.Client",                         /* tp_name */
+	sizeof(ClientObject),                     /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)client_dealloc,               /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	0,                                        /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+	"Client(hosts=(), interval=30, filter=None, ring=None) -- udplogger client subscription",
+	0,                                        /* tp_traverse */
+	0,                                        /* tp_clear */
+	0,                                        /* tp_richcompare */
+	0,                                        /* tp_weaklistoffset */
+	0,                                        /* tp_iter */
+	0,                                        /* tp_iternext */
+	client_methods,                           /* tp_methods */
+	0,                                        /* tp_members */
+	0,                                        /* tp_getset */
+	0,                                        /* tp_base */
+	0,                                        /* tp_dict */
+	0,                                        /* tp_descr_get */
+	0,                                        /* tp_descr_set */
+	0,                                        /* tp_dictoffset */
+	(initproc)client_init,                    /* tp_init */
+	0,                                        /* tp_alloc */
+	0,                                        /* tp_new */
+};
+
+
+static PyMethodDef module_methods[] = {
+	{NULL, NULL, 0, NULL}
+};
+
+
+/**
+ * init_client()
+ *
+ * Module initialization function.
+ **/
+PyMODINIT_FUNC init_client(void)
+{
+	PyObject *module;
+
+	ClientType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&ClientType) < 0)
+	{
+		return;
+	}
+
+	module = Py_InitModule3("_client", module_methods, "udplogger client library binding");
+	if (! module)
+	{
+		return;
+	}
+	Py_INCREF(&ClientType);
+	PyModule_AddObject(module, "Client", (PyObject *)&ClientType);
+}
+
+
+/**
+ * client_batch(<client>, <records>, <count>, <client object>)
+ *
+ * Batch callback for the client.  Appends a tuple for each record to the list that is being built
+ * by the current call to poll().
+ **/
+static void client_batch(struct udplogger_client_t *client, struct log_record_t **records, size_t count, void *argument)
+{
+	ClientObject *self = argument;
+	size_t i;
+	PyObject *tuple;
+
+	for (i = 0; i < count && self->records; i++)
+	{
+		tuple = Py_BuildValue("(sids#)", inet_ntoa(records[i]->source.sin_addr), (int)ntohs(records[i]->source.sin_port),
+			records[i]->received.tv_sec + (records[i]->received.tv_usec / 1000000.0), records[i]->data, (Py_ssize_t)records[i]->length);
+		if (! tuple || PyList_Append(self->records, tuple))
+		{
+			Py_XDECREF(tuple);
+			Py_CLEAR(self->records);
+			return;
+		}
+		Py_DECREF(tuple);
+	}
+}
+
+
+/**
+ * client_dealloc(<client object>)
+ **/
+static void client_dealloc(ClientObject *self)
+{
+	if (self->client)
+	{
+		udplogger_client_free(self->client);
+	}
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+
+/**
+ * client_fileno(<client object>)
+ **/
+static PyObject *client_fileno(ClientObject *self)
+{
+	if (! self->client)
+	{
+		PyErr_SetString(PyExc_ValueError, "client is not initialized");
+		return NULL;
+	}
+	return PyInt_FromLong(udplogger_client_fd(self->client));
+}
+
+
+/**
+ * client_init(<client object>, <arguments>, <keyword arguments>)
+ *
+ * Creates and starts the underlying client: adds each of the hosts (broadcast if there are none), sets
+ * the beacon interval, filter expression and packet ring interface.
+ **/
+static int client_init(ClientObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *keywords[] = {"hosts", "interval", "filter", "ring", NULL};
+	char *filter = NULL;
+	PyObject *host;
+	PyObject *hosts = NULL;
+	PyObject *iterator;
+	unsigned long interval = UDPLOGGER_CLIENT_DEFAULT_BEACON_INTERVAL;
+	char *ring = NULL;
+
+	if (! PyArg_ParseTupleAndKeywords(args, kwds, "|Okzz", keywords, &hosts, &interval, &filter, &ring))
+	{
+		return -1;
+	}
+
+	if (self->client)
+	{
+		PyErr_SetString(PyExc_ValueError, "client is already initialized");
+		return -1;
+	}
+	self->client = udplogger_client_new();
+	if (! self->client)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "could not create client");
+		return -1;
+	}
+
+	if (hosts && hosts != Py_None)
+	{
+		iterator = PyObject_GetIter(hosts);
+		if (! iterator)
+		{
+			return -1;
+		}
+		while ((host = PyIter_Next(iterator)))
+		{
+			if (! PyString_Check(host) || ! udplogger_client_add_host(self->client, PyString_AsString(host)))
+			{
+				PyErr_Format(PyExc_ValueError, "invalid host specification");
+				Py_DECREF(host);
+				Py_DECREF(iterator);
+				return -1;
+			}
+			Py_DECREF(host);
+		}
+		Py_DECREF(iterator);
+		if (PyErr_Occurred())
+		{
+			return -1;
+		}
+	}
+
+	if (! udplogger_client_set_beacon_interval(self->client, interval))
+	{
+		PyErr_SetString(PyExc_ValueError, "invalid beacon interval");
+		return -1;
+	}
+	if (! udplogger_client_set_filter(self->client, filter))
+	{
+		PyErr_SetString(PyExc_ValueError, "invalid filter expression");
+		return -1;
+	}
+	if (! udplogger_client_set_ring(self->client, ring))
+	{
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	udplogger_client_set_batch_callback(self->client, client_batch, self);
+	if (! udplogger_client_start(self->client))
+	{
+		PyErr_SetString(PyExc_RuntimeError, "could not start client");
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * client_poll(<client object>, <arguments>)
+ *
+ * Waits (with the GIL released) for up to <timeout> seconds for the client to have work to do, then runs
+ * one step of its event loop and returns the records that were received.  Signals that arrive while
+ * waiting are handled by the interpreter as usual.
+ **/
+static PyObject *client_poll(ClientObject *self, PyObject *args)
+{
+	struct pollfd pfd;
+	PyObject *records;
+	int result;
+	double timeout = -1.0;
+
+	if (! PyArg_ParseTuple(args, "|d", &timeout))
+	{
+		return NULL;
+	}
+	if (! self->client)
+	{
+		PyErr_SetString(PyExc_ValueError, "client is not initialized");
+		return NULL;
+	}
+
+	pfd.fd = udplogger_client_fd(self->client);
+	pfd.events = POLLIN;
+	Py_BEGIN_ALLOW_THREADS
+	result = poll(&pfd, 1, timeout < 0 ? -1 : (int)(timeout * 1000));
+	Py_END_ALLOW_THREADS
+	if (result < 0 && errno != EINTR)
+	{
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	if (PyErr_CheckSignals())
+	{
+		return NULL;
+	}
+
+	self->records = PyList_New(0);
+	if (! self->records)
+	{
+		return NULL;
+	}
+	if (result > 0 && udplogger_client_poll(self->client, 0) < 0)
+	{
+		Py_CLEAR(self->records);
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	records = self->records;
+	self->records = NULL;
+	if (! records && ! PyErr_Occurred())
+	{
+		PyErr_NoMemory();
+	}
+	return records;
+}
@@ -0,0 +1,1015 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#include <Python.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+
+/*
+ * Native implementation of Nexopia.UDPLogger.Parse.LogLine.  parse() only splits the line into fields;
+ * each attribute is converted from its field the first time that it is read (and kept until the next
+ * parse()), so tools only pay for the attributes that they use.  The attributes have the same names and
+ * values as those of the pure-Python class, may be assigned to, and the object has a __dict__ for any
+ * others.  parse_many() parses a list of lines into new LogLine objects in one call, and parse_record()
+ * parses a record from Nexopia.UDPLogger.Client without a udploggerc line being formatted for it.
+ *
+ * Timestamps are converted with time.strptime() and time.mktime(), exactly as Parse.py does, but the
+ * results are kept in a small direct-mapped cache (indexed by a hash of the time field; a colliding time
+ * simply replaces the entry) instead of a dictionary that grows without bound.
+ */
+
+
+/*
+ * Field positions (see Parse.py).  v1 lines have FIELD_V1_COUNT fields, v2 lines (whose fifth field
+ * is "v2") have FIELD_V2_COUNT.
+ */
+#define FIELD_DATETIME        0
+#define FIELD_SOURCE          1
+#define FIELD_SERIAL          2
+#define FIELD_TAG             3
+#define FIELD_VERSION         4
+#define FIELD_V1_COUNT        22
+#define FIELD_V2_COUNT        25
+#define FIELD_MISSING         -1
+
+
+/*
+ * TIME_CACHE_SIZE    The number of entries in the timestamp cache (a power of two).
+ * TIME_FIELD_LENGTH  The length of the time fields that are cached ("[%Y-%m-%d %H:%M:%S]").
+ * TIME_FORMAT        The format of the time field.
+ */
+#define TIME_CACHE_SIZE       1024U
+#define TIME_FIELD_LENGTH     21
+#define TIME_FORMAT           "[%Y-%m-%d %H:%M:%S]"
+
+
+/*
+ * How each attribute is converted from its field.
+ */
+enum conversion_t {
+	CONVERT_DATE_TIME,
+	CONVERT_INTEGER,
+	CONVERT_INTEGER_OR_ZERO,
+	CONVERT_LOWER_CHOICE,
+	CONVERT_RAW,
+	CONVERT_SOURCE_ADDRESS,
+	CONVERT_SOURCE_PORT,
+	CONVERT_STRING,
+	CONVERT_STRING_OR_NONE,
+	CONVERT_UNIX_TIMESTAMP,
+	CONVERT_UPPER_CHOICE,
+	CONVERT_VERSION
+};
+
+
+/*
+ * The values that a choice attribute may take; objects holds the interned string of each name (set up
+ * when the module is initialized), so converted values are shared rather than allocated.
+ */
+struct choice_t {
+	const char *names[9];
+	PyObject *objects[9];
+};
+
+
+/*
+ * An attribute: its name, its field in v1 and v2 lines and its conversion.
+ */
+struct attribute_t {
+	const char *name;
+	int v1_field;
+	int v2_field;
+	enum conversion_t conversion;
+	struct choice_t *choice;
+};
+
+
+/*
+ * A timestamp cache entry; date_time is NULL for an empty entry.
+ */
+struct time_cache_entry_t {
+	char key[TIME_FIELD_LENGTH];
+	PyObject *date_time;
+	PyObject *unix_timestamp;
+};
+
+
+static struct choice_t connection_statuses = {{"X", "-", "+", NULL}};
+static struct choice_t methods = {{"CONNECT", "DELETE", "GET", "HEAD", "OPTIONS", "POST", "PUT", "TRACE", NULL}};
+static struct choice_t user_sexes = {{"female", "male", NULL}};
+static struct choice_t user_types = {{"anon", "plus", "user", NULL}};
+
+
+/*
+ * The attributes, in alphabetical order (the order in which str() lists them).  ATTRIBUTE_RAW,
+ * ATTRIBUTE_DATE_TIME, ATTRIBUTE_UNIX_TIMESTAMP, ATTRIBUTE_SOURCE_ADDRESS and ATTRIBUTE_SOURCE_PORT
+ * are the indexes of the attributes that are not converted on their own.
+ */
+static struct attribute_t attributes[] = {
+	{"body_size", 6, 7, CONVERT_INTEGER_OR_ZERO, NULL},
+	{"bytes_incoming", 7, 8, CONVERT_INTEGER_OR_ZERO, NULL},
+	{"bytes_outgoing", 8, 9, CONVERT_INTEGER_OR_ZERO, NULL},
+	{"connection_status", 10, 11, CONVERT_UPPER_CHOICE, &connection_statuses},
+	{"content_type", FIELD_MISSING, 19, CONVERT_STRING_OR_NONE, NULL},
+	{"date_time", FIELD_DATETIME, FIELD_DATETIME, CONVERT_DATE_TIME, NULL},
+	{"forwarded_for", 15, 17, CONVERT_STRING_OR_NONE, NULL},
+	{"host", FIELD_MISSING, 15, CONVERT_STRING_OR_NONE, NULL},
+	{"method", 4, 5, CONVERT_UPPER_CHOICE, &methods},
+	{"nexopia_userage", 18, 21, CONVERT_INTEGER, NULL},
+	{"nexopia_userid", 17, 20, CONVERT_INTEGER, NULL},
+	{"nexopia_userlocation", 20, 23, CONVERT_INTEGER, NULL},
+	{"nexopia_usersex", 19, 22, CONVERT_LOWER_CHOICE, &user_sexes},
+	{"nexopia_usertype", 21, 24, CONVERT_LOWER_CHOICE, &user_types},
+	{"query_string", 12, 13, CONVERT_STRING_OR_NONE, NULL},
+	{"raw", FIELD_MISSING, FIELD_MISSING, CONVERT_RAW, NULL},
+	{"referer", 16, 18, CONVERT_STRING_OR_NONE, NULL},
+	{"remote_address", 13, 14, CONVERT_STRING_OR_NONE, NULL},
+	{"request_url", 11, 12, CONVERT_STRING_OR_NONE, NULL},
+	{"serial", FIELD_SERIAL, FIELD_SERIAL, CONVERT_INTEGER, NULL},
+	{"source_address", FIELD_SOURCE, FIELD_SOURCE, CONVERT_SOURCE_ADDRESS, NULL},
+	{"source_port", FIELD_SOURCE, FIELD_SOURCE, CONVERT_SOURCE_PORT, NULL},
+	{"status", 5, 6, CONVERT_INTEGER, NULL},
+	{"tag", FIELD_TAG, FIELD_TAG, CONVERT_STRING, NULL},
+	{"time_used", 9, 10, CONVERT_INTEGER, NULL},
+	{"unix_timestamp", FIELD_DATETIME, FIELD_DATETIME, CONVERT_UNIX_TIMESTAMP, NULL},
+	{"user_agent", 14, 16, CONVERT_STRING_OR_NONE, NULL},
+	{"version", FIELD_MISSING, FIELD_VERSION, CONVERT_VERSION, NULL}
+};
+#define ATTRIBUTE_COUNT          (sizeof(attributes) / sizeof(attributes[0]))
+#define ATTRIBUTE_DATE_TIME      5
+#define ATTRIBUTE_RAW            15
+#define ATTRIBUTE_SOURCE_ADDRESS 20
+#define ATTRIBUTE_SOURCE_PORT    21
+#define ATTRIBUTE_UNIX_TIMESTAMP 25
+
+
+/*
+ * A parsed log line.  line is the string that the fields (offsets and lengths, count of them) were
+ * split from and version is 1 or 2 (0 before the first successful parse()).  values holds each
+ * attribute once it has been converted or assigned.
+ */
+typedef struct {
+	PyObject_HEAD
+	PyObject *dict;
+	PyObject *line;
+	int version;
+	Py_ssize_t offsets[FIELD_V2_COUNT];
+	Py_ssize_t lengths[FIELD_V2_COUNT];
+	PyObject *values[sizeof(attributes) / sizeof(attributes[0])];
+} LogLineObject;
+
+
+static PyObject *convert_field(LogLineObject *, struct attribute_t *, const char *, Py_ssize_t);
+static PyObject *convert_integer(const char *, Py_ssize_t);
+static PyObject *convert_time(LogLineObject *, const char *, Py_ssize_t);
+static int logline_clear(LogLineObject *);
+static void logline_dealloc(LogLineObject *);
+static PyObject *logline_get(LogLineObject *, void *);
+static PyObject *logline_parse(LogLineObject *, PyObject *);
+static PyObject *logline_parse_record(LogLineObject *, PyObject *);
+static int logline_set(LogLineObject *, PyObject *, void *);
+static int logline_split(LogLineObject *, PyObject *, unsigned int, int);
+static PyObject *logline_str(LogLineObject *);
+static int logline_traverse(LogLineObject *, visitproc, void *);
+static PyObject *parse_many(PyObject *, PyObject *);
+
+
+/*
+ * Global Variable Declarations
+ *
+ * record_date_time       is the date_time of the last second that a record was received in.
+ * record_second          is that second.
+ * record_unix_timestamp  is the unix_timestamp of that second.
+ * time_cache             is the timestamp cache.
+ * time_localtime         is time.localtime.
+ * time_mktime            is time.mktime.
+ * time_strptime          is time.strptime.
+ */
+static PyObject *record_date_time = NULL;
+static long record_second = 0;
+static PyObject *record_unix_timestamp = NULL;
+static struct time_cache_entry_t time_cache[TIME_CACHE_SIZE];
+static PyObject *time_localtime = NULL;
+static PyObject *time_mktime = NULL;
+static PyObject *time_strptime = NULL;
+
+
+static PyGetSetDef logline_getset[sizeof(attributes) / sizeof(attributes[0]) + 1];
+
+
+static PyMethodDef logline_methods[] = {
+	{"parse", (PyCFunction)logline_parse, METH_O, "parse(line) -- splits a udploggerc log line (without its trailing newline) into fields"},
+	{"parse_record", (PyCFunction)logline_parse_record, METH_O, "parse_record(record) -- splits the data of a Nexopia.UDPLogger.Client record (address, port, received, data) into fields"},
+	{NULL, NULL, 0, NULL}
+};
+
+
+static PyTypeObject LogLineType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                                        /* ob_size */
+	"_parse.LogLine",                         /* tp_name */
+	sizeof(LogLineObject),                    /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)logline_dealloc,              /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	(reprfunc)logline_str,                    /* tp_str */
+	PyObject_GenericGetAttr,                  /* tp_getattro */
+	PyObject_GenericSetAttr,                  /* tp_setattro */
+	0,                                        /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+	"LogLine() -- a udploggerc log line, see parse()",
+	(traverseproc)logline_traverse,           /* tp_traverse */
+	(inquiry)logline_clear,                   /* tp_clear */
+	0,                                        /* tp_richcompare */
+	0,                                        /* tp_weaklistoffset */
+	0,                                        /* tp_iter */
+	0,                                        /* tp_iternext */
+	logline_methods,                          /* tp_methods */
+	0,                                        /* tp_members */
+	logline_getset,                           /* tp_getset */
+	0,                                        /* tp_base */
+	0,                                        /* tp_dict */
+	0,                                        /* tp_descr_get */
+	0,                                        /* tp_descr_set */
+	offsetof(LogLineObject, dict),            /* tp_dictoffset */
+	0,                                        /* tp_init */
+	0,                                        /* tp_alloc */
+	0,                                        /* tp_new */
+	PyObject_GC_Del,                          /* tp_free */
+};
+
+
+static PyMethodDef module_methods[] = {
+	{"parse_many", (PyCFunction)parse_many, METH_O, "parse_many(lines) -> list of a new LogLine for each line (with its trailing whitespace stripped), or None for a line that could not be parsed"},
+	{NULL, NULL, 0, NULL}
+};
+
+
+/**
+ * init_parse()
+ *
+ * Module initialization function.  Sets up the attribute descriptors and the interned choice values,
+ * and looks up the time functions.
+ **/
+PyMODINIT_FUNC init_parse(void)
+{
+	struct choice_t *choices[] = {&connection_statuses, &methods, &user_sexes, &user_types, NULL};
+	unsigned int i;
+	unsigned int j;
+	PyObject *module;
+	PyObject *time_module;
+
+	for (i = 0; i < ATTRIBUTE_COUNT; i++)
+	{
+		logline_getset[i].name = (char *)attributes[i].name;
+		logline_getset[i].get = (getter)logline_get;
+		logline_getset[i].set = (setter)logline_set;
+		logline_getset[i].closure = &attributes[i];
+	}
+	for (i = 0; choices[i]; i++)
+	{
+		for (j = 0; choices[i]->names[j]; j++)
+		{
+			choices[i]->objects[j] = PyString_InternFromString(choices[i]->names[j]);
+			if (! choices[i]->objects[j])
+			{
+				return;
+			}
+		}
+	}
+
+	time_module = PyImport_ImportModule("time");
+	if (! time_module)
+	{
+		return;
+	}
+	time_localtime = PyObject_GetAttrString(time_module, "localtime");
+	time_mktime = PyObject_GetAttrString(time_module, "mktime");
+	time_strptime = PyObject_GetAttrString(time_module, "strptime");
+	Py_DECREF(time_module);
+	if (! time_localtime || ! time_mktime || ! time_strptime)
+	{
+		return;
+	}
+
+	LogLineType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&LogLineType) < 0)
+	{
+		return;
+	}
+
+	module = Py_InitModule3("_parse", module_methods, "native udploggerc log line parser");
+	if (! module)
+	{
+		return;
+	}
+	Py_INCREF(&LogLineType);
+	PyModule_AddObject(module, "LogLine", (PyObject *)&LogLineType);
+}
+
+
+/**
+ * convert_field(<log line>, <attribute>, <field>, <length>)
+ *
+ * Converts the field of an attribute into its value, as Parse.py does.  Returns a new reference, or
+ * NULL on error.  Attributes that share a field (the time and source ones) are all set at once, except
+ * for those that have been assigned to.
+ **/
+static PyObject *convert_field(LogLineObject *self, struct attribute_t *attribute, const char *field, Py_ssize_t length)
+{
+	char buffer[16];
+	unsigned int choice;
+	const char *colon;
+	Py_ssize_t i;
+	PyObject *value;
+
+	switch (attribute->conversion)
+	{
+		case CONVERT_DATE_TIME:
+		case CONVERT_UNIX_TIMESTAMP:
+			value = convert_time(self, field, length);
+			if (value && attribute->conversion == CONVERT_UNIX_TIMESTAMP)
+			{
+				Py_DECREF(value);
+				value = self->values[ATTRIBUTE_UNIX_TIMESTAMP];
+				Py_INCREF(value);
+			}
+			return value;
+		case CONVERT_INTEGER:
+			return convert_integer(field, length);
+		case CONVERT_INTEGER_OR_ZERO:
+			if (length == 1 && field[0] == '-')
+			{
+				return PyInt_FromLong(0);
+			}
+			return convert_integer(field, length);
+		case CONVERT_LOWER_CHOICE:
+		case CONVERT_UPPER_CHOICE:
+			value = Py_None;
+			if (length < sizeof(buffer))
+			{
+				for (i = 0; i < length; i++)
+				{
+					buffer[i] = (attribute->conversion == CONVERT_UPPER_CHOICE) ? toupper((unsigned char)field[i]) : tolower((unsigned char)field[i]);
+				}
+				buffer[length] = '\0';
+				for (choice = 0; attribute->choice->names[choice]; choice++)
+				{
+					if (! strcmp(buffer, attribute->choice->names[choice]))
+					{
+						value = attribute->choice->objects[choice];
+						break;
+					}
+				}
+			}
+			Py_INCREF(value);
+			return value;
+		case CONVERT_SOURCE_ADDRESS:
+		case CONVERT_SOURCE_PORT:
+			/* "[<address>:<port>]"; the port is None if it is not a number. */
+			field++;
+			length = (length >= 2) ? length - 2 : 0;
+			colon = memchr(field, ':', length);
+			value = PyString_FromStringAndSize(field, colon ? colon - field : length);
+			if (! value)
+			{
+				return NULL;
+			}
+			if (! self->values[ATTRIBUTE_SOURCE_ADDRESS])
+			{
+				self->values[ATTRIBUTE_SOURCE_ADDRESS] = value;
+			}
+			else
+			{
+				Py_DECREF(value);
+			}
+			value = colon ? convert_integer(colon + 1, field + length - colon - 1) : convert_integer("", 0);
+			if (! value)
+			{
+				return NULL;
+			}
+			if (! self->values[ATTRIBUTE_SOURCE_PORT])
+			{
+				self->values[ATTRIBUTE_SOURCE_PORT] = value;
+			}
+			else
+			{
+				Py_DECREF(value);
+			}
+			value = self->values[(attribute->conversion == CONVERT_SOURCE_ADDRESS) ? ATTRIBUTE_SOURCE_ADDRESS : ATTRIBUTE_SOURCE_PORT];
+			Py_INCREF(value);
+			return value;
+		case CONVERT_STRING:
+			return PyString_FromStringAndSize(field, length);
+		case CONVERT_STRING_OR_NONE:
+			if (length == 1 && field[0] == '-')
+			{
+				Py_INCREF(Py_None);
+				return Py_None;
+			}
+			return PyString_FromStringAndSize(field, length);
+		case CONVERT_VERSION:
+			return convert_integer(field + (length > 0), length - (length > 0));
+		default:
+			PyErr_SetString(PyExc_AttributeError, attribute->name);
+			return NULL;
+	}
+}
+
+
+/**
+ * convert_integer(<field>, <length>)
+ *
+ * Returns the value of int(<field>), or None if the field is not an integer.  Plain decimal numbers
+ * are converted directly; anything else is handed to int() itself.
+ **/
+static PyObject *convert_integer(const char *field, Py_ssize_t length)
+{
+	Py_ssize_t i = 0;
+	int negative = 0;
+	PyObject *result;
+	PyObject *string;
+	long value = 0;
+
+	if (length && field[0] == '-')
+	{
+		negative = 1;
+		i = 1;
+	}
+	if (length > i && length - i <= 18)
+	{
+		for (; i < length && field[i] >= '0' && field[i] <= '9'; i++)
+		{
+			value = value * 10 + (field[i] - '0');
+		}
+		if (i == length)
+		{
+			return PyInt_FromLong(negative ? -value : value);
+		}
+	}
+
+	string = PyString_FromStringAndSize(field, length);
+	if (! string)
+	{
+		return NULL;
+	}
+	result = PyNumber_Int(string);
+	Py_DECREF(string);
+	if (! result && PyErr_ExceptionMatches(PyExc_ValueError))
+	{
+		PyErr_Clear();
+		Py_INCREF(Py_None);
+		result = Py_None;
+	}
+	return result;
+}
+
+
+/**
+ * convert_time(<log line>, <field>, <length>)
+ *
+ * Sets the date_time and unix_timestamp attributes of a log line from its time field (both are None if
+ * the field is not a valid time), using the timestamp cache.  An attribute that has been assigned to is
+ * left as it is.  Returns a new reference to the date_time of the field, or NULL on error.
+ **/
+static PyObject *convert_time(LogLineObject *self, const char *field, Py_ssize_t length)
+{
+	PyObject *date_time = NULL;
+	struct time_cache_entry_t *entry = NULL;
+	uint32_t hash = 2166136261U;
+	Py_ssize_t i;
+	PyObject *string;
+	PyObject *unix_timestamp = NULL;
+
+	if (length == TIME_FIELD_LENGTH)
+	{
+		for (i = 0; i < length; i++)
+		{
+			hash = (hash ^ (unsigned char)field[i]) * 16777619U;
+		}
+		entry = &time_cache[hash & (TIME_CACHE_SIZE - 1)];
+		if (entry->date_time && ! memcmp(entry->key, field, TIME_FIELD_LENGTH))
+		{
+			date_time = entry->date_time;
+			unix_timestamp = entry->unix_timestamp;
+			Py_INCREF(date_time);
+			Py_INCREF(unix_timestamp);
+		}
+	}
+
+	if (! date_time)
+	{
+		string = PyString_FromStringAndSize(field, length);
+		if (! string)
+		{
+			return NULL;
+		}
+		date_time = PyObject_CallFunction(time_strptime, "Os", string, TIME_FORMAT);
+		Py_DECREF(string);
+		if (date_time)
+		{
+			unix_timestamp = PyObject_CallFunctionObjArgs(time_mktime, date_time, NULL);
+		}
+		if (! unix_timestamp)
+		{
+			Py_CLEAR(date_time);
+			if (! PyErr_ExceptionMatches(PyExc_ValueError) && ! PyErr_ExceptionMatches(PyExc_OverflowError))
+			{
+				return NULL;
+			}
+			PyErr_Clear();
+			Py_INCREF(Py_None);
+			Py_INCREF(Py_None);
+			date_time = Py_None;
+			unix_timestamp = Py_None;
+		}
+
+		if (entry)
+		{
+			Py_XDECREF(entry->date_time);
+			Py_XDECREF(entry->unix_timestamp);
+			memcpy(entry->key, field, TIME_FIELD_LENGTH);
+			Py_INCREF(date_time);
+			Py_INCREF(unix_timestamp);
+			entry->date_time = date_time;
+			entry->unix_timestamp = unix_timestamp;
+		}
+	}
+
+	/* Either attribute may have been assigned to already, which is kept. */
+	if (! self->values[ATTRIBUTE_UNIX_TIMESTAMP])
+	{
+		self->values[ATTRIBUTE_UNIX_TIMESTAMP] = unix_timestamp;
+	}
+	else
+	{
+		Py_DECREF(unix_timestamp);
+	}
+	if (! self->values[ATTRIBUTE_DATE_TIME])
+	{
+		Py_INCREF(date_time);
+		self->values[ATTRIBUTE_DATE_TIME] = date_time;
+	}
+	return date_time;
+}
+
+
+/**
+ * logline_clear(<log line>)
+ *
+ * Garbage collector support: drops every reference that the log line holds (its attribute values, line
+ * and __dict__ may all lead back to it).
+ **/
+static int logline_clear(LogLineObject *self)
+{
+	unsigned int i;
+
+	for (i = 0; i < ATTRIBUTE_COUNT; i++)
+	{
+		Py_CLEAR(self->values[i]);
+	}
+	Py_CLEAR(self->line);
+	Py_CLEAR(self->dict);
+	return 0;
+}
+
+
+/**
+ * logline_dealloc(<log line>)
+ **/
+static void logline_dealloc(LogLineObject *self)
+{
+	PyObject_GC_UnTrack(self);
+	logline_clear(self);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+
+/**
+ * logline_get(<log line>, <attribute>)
+ *
+ * Attribute getter: returns the value of an attribute, converting it from its field if it has not been
+ * read (or assigned) since the line was parsed.
+ **/
+static PyObject *logline_get(LogLineObject *self, void *closure)
+{
+	struct attribute_t *attribute = closure;
+	int index = attribute - attributes;
+	int number;
+	PyObject *value;
+
+	if (self->values[index])
+	{
+		Py_INCREF(self->values[index]);
+		return self->values[index];
+	}
+	if (! self->version || attribute->conversion == CONVERT_RAW)
+	{
+		PyErr_SetString(PyExc_AttributeError, attribute->name);
+		return NULL;
+	}
+
+	number = (self->version == 2) ? attribute->v2_field : attribute->v1_field;
+	if (number == FIELD_MISSING)
+	{
+		/* The attributes of fields that v1 lines do not have are None. */
+		value = Py_None;
+		Py_INCREF(value);
+	}
+	else
+	{
+		value = convert_field(self, attribute, PyString_AS_STRING(self->line) + self->offsets[number], self->lengths[number]);
+		if (! value)
+		{
+			return NULL;
+		}
+	}
+
+	if (! self->values[index])
+	{
+		Py_INCREF(value);
+		self->values[index] = value;
+	}
+	return value;
+}
+
+
+/**
+ * logline_parse(<log line>, <line>)
+ *
+ * Splits a line into fields, raising the same exceptions as Parse.py for lines that do not have the
+ * number of fields of a v1 or v2 log line.
+ **/
+static PyObject *logline_parse(LogLineObject *self, PyObject *line)
+{
+	if (! PyString_Check(line))
+	{
+		PyErr_SetString(PyExc_TypeError, "parse() argument must be a string");
+		return NULL;
+	}
+	if (! logline_split(self, line, FIELD_DATETIME, 1))
+	{
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+
+/**
+ * logline_parse_record(<log line>, <record>)
+ *
+ * Splits the data of a record (an (address, port, received, data) tuple, as returned by the poll() of
+ * Nexopia.UDPLogger._client.Client) into fields.  The source and time attributes are taken from the
+ * record itself rather than converted from fields, so no udploggerc line is formatted for the record;
+ * the raw attribute is the record data.  The date_time and unix_timestamp of the last second that a
+ * record was received in are kept, since records arrive in that order.
+ **/
+static PyObject *logline_parse_record(LogLineObject *self, PyObject *record)
+{
+	PyObject *address;
+	PyObject *data;
+	PyObject *date_time;
+	PyObject *port;
+	double received;
+	long second;
+	PyObject *unix_timestamp;
+
+	if (! PyTuple_Check(record))
+	{
+		PyErr_SetString(PyExc_TypeError, "parse_record() argument must be a tuple");
+		return NULL;
+	}
+	if (! PyArg_ParseTuple(record, "SOdS", &address, &port, &received, &data))
+	{
+		return NULL;
+	}
+
+	second = (long)received;
+	if (! record_date_time || second != record_second)
+	{
+		date_time = PyObject_CallFunction(time_localtime, "l", second);
+		if (! date_time)
+		{
+			return NULL;
+		}
+		unix_timestamp = PyFloat_FromDouble(second);
+		if (! unix_timestamp)
+		{
+			Py_DECREF(date_time);
+			return NULL;
+		}
+		Py_XDECREF(record_date_time);
+		Py_XDECREF(record_unix_timestamp);
+		record_date_time = date_time;
+		record_unix_timestamp = unix_timestamp;
+		record_second = second;
+	}
+
+	if (! logline_split(self, data, FIELD_SERIAL, 1))
+	{
+		return NULL;
+	}
+	Py_INCREF(address);
+	self->values[ATTRIBUTE_SOURCE_ADDRESS] = address;
+	Py_INCREF(port);
+	self->values[ATTRIBUTE_SOURCE_PORT] = port;
+	Py_INCREF(record_date_time);
+	self->values[ATTRIBUTE_DATE_TIME] = record_date_time;
+	Py_INCREF(record_unix_timestamp);
+	self->values[ATTRIBUTE_UNIX_TIMESTAMP] = record_unix_timestamp;
+	Py_RETURN_NONE;
+}
+
+
+/**
+ * logline_set(<log line>, <value>, <attribute>)
+ *
+ * Attribute setter: the value replaces the converted one until the next parse().
+ **/
+static int logline_set(LogLineObject *self, PyObject *value, void *closure)
+{
+	int index = (struct attribute_t *)closure - attributes;
+
+	Py_XINCREF(value);
+	Py_XDECREF(self->values[index]);
+	self->values[index] = value;
+	return 0;
+}
+
+
+/**
+ * logline_split(<log line>, <line>, <first field>, <raise>)
+ *
+ * Sets the raw attribute of a log line and splits the line into fields, forgetting the values of the
+ * previous line.  The line starts with the field numbered <first field> (FIELD_SERIAL for the data of a
+ * record, which has no time or source fields; the fields before it are left empty).  A line with the
+ * wrong number of fields leaves the fields of the previous line in place (as Parse.py does); an
+ * exception is only set for it if <raise> is non-zero.  Returns 1 for success or 0 if the line could
+ * not be parsed.
+ **/
+static int logline_split(LogLineObject *self, PyObject *line, unsigned int first, int raise)
+{
+	unsigned int count = first;
+	const char *data = PyString_AS_STRING(line);
+	const char *delimiter;
+	const char *end = data + PyString_GET_SIZE(line);
+	const char *field = data;
+	unsigned int i;
+	Py_ssize_t lengths[FIELD_V2_COUNT];
+	Py_ssize_t offsets[FIELD_V2_COUNT];
+	int version;
+
+	Py_INCREF(line);
+	Py_XDECREF(self->values[ATTRIBUTE_RAW]);
+	self->values[ATTRIBUTE_RAW] = line;
+
+	for (i = 0; i < first; i++)
+	{
+		offsets[i] = 0;
+		lengths[i] = 0;
+	}
+	while (1)
+	{
+		delimiter = memchr(field, '\x1e', end - field);
+		if (count < FIELD_V2_COUNT)
+		{
+			offsets[count] = field - data;
+			lengths[count] = (delimiter ? delimiter : end) - field;
+		}
+		count++;
+		if (! delimiter || count > FIELD_V2_COUNT)
+		{
+			break;
+		}
+		field = delimiter + 1;
+	}
+
+	if (count <= FIELD_VERSION)
+	{
+		if (raise)
+		{
+			PyErr_SetString(PyExc_IndexError, "list index out of range");
+		}
+		return 0;
+	}
+	version = (lengths[FIELD_VERSION] == 2 && ! memcmp(data + offsets[FIELD_VERSION], "v2", 2)) ? 2 : 1;
+	if (count != ((version == 2) ? FIELD_V2_COUNT : FIELD_V1_COUNT))
+	{
+		if (raise)
+		{
+			PyErr_SetString(PyExc_AssertionError, "invalid number of fields in log line");
+		}
+		return 0;
+	}
+
+	for (i = 0; i < ATTRIBUTE_COUNT; i++)
+	{
+		if (i != ATTRIBUTE_RAW)
+		{
+			Py_CLEAR(self->values[i]);
+		}
+	}
+	Py_INCREF(line);
+	Py_XDECREF(self->line);
+	self->line = line;
+	self->version = version;
+	memcpy(self->offsets, offsets, count * sizeof(Py_ssize_t));
+	memcpy(self->lengths, lengths, count * sizeof(Py_ssize_t));
+	return 1;
+}
+
+
+/**
+ * logline_str(<log line>)
+ *
+ * Lists the fields of the raw line and the value of each attribute, in the format of Parse.py.
+ **/
+static PyObject *logline_str(LogLineObject *self)
+{
+	unsigned int i;
+	PyObject *fields;
+	PyObject *result;
+	PyObject *value;
+
+	if (! self->values[ATTRIBUTE_RAW])
+	{
+		PyErr_SetString(PyExc_AttributeError, "raw");
+		return NULL;
+	}
+	value = PyObject_CallMethod(self->values[ATTRIBUTE_RAW], "split", "s", "\x1e");
+	if (! value)
+	{
+		return NULL;
+	}
+	fields = PyObject_Str(value);
+	Py_DECREF(value);
+	if (! fields)
+	{
+		return NULL;
+	}
+	/* Values are concatenated rather than formatted with %s, which would cut them short at a NUL byte. */
+	result = PyString_FromString("raw => ");
+	PyString_ConcatAndDel(&result, fields);
+	PyString_ConcatAndDel(&result, PyString_FromString("\n"));
+
+	for (i = 0; i < ATTRIBUTE_COUNT && result; i++)
+	{
+		if (i == ATTRIBUTE_RAW)
+		{
+			continue;
+		}
+		value = logline_get(self, &attributes[i]);
+		if (! value)
+		{
+			Py_CLEAR(result);
+			break;
+		}
+		if (PyString_Check(value))
+		{
+			PyString_ConcatAndDel(&result, PyString_FromFormat("%s => \"", attributes[i].name));
+			PyString_Concat(&result, value);
+			PyString_ConcatAndDel(&result, PyString_FromString("\"\n"));
+		}
+		else
+		{
+			PyString_ConcatAndDel(&result, PyString_FromFormat("%s => ", attributes[i].name));
+			PyString_ConcatAndDel(&result, PyObject_Str(value));
+			PyString_ConcatAndDel(&result, PyString_FromString("\n"));
+		}
+		Py_DECREF(value);
+	}
+	return result;
+}
+
+
+/**
+ * logline_traverse(<log line>, <visit>, <argument>)
+ *
+ * Garbage collector support: visits every object that the log line holds a reference to.
+ **/
+static int logline_traverse(LogLineObject *self, visitproc visit, void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < ATTRIBUTE_COUNT; i++)
+	{
+		Py_VISIT(self->values[i]);
+	}
+	Py_VISIT(self->line);
+	Py_VISIT(self->dict);
+	return 0;
+}
+
+
+/**
+ * parse_many(<module>, <lines>)
+ *
+ * Parses each line of an iterable (after stripping its trailing whitespace, as the tools do before
+ * calling parse()) into a new LogLine.  Returns the list of them, with None in place of the lines that
+ * could not be parsed.
+ **/
+static PyObject *parse_many(PyObject *module, PyObject *lines)
+{
+	PyObject *item;
+	PyObject *iterator;
+	Py_ssize_t length;
+	PyObject *line;
+	LogLineObject *log_line;
+	PyObject *result;
+	int status;
+
+	iterator = PyObject_GetIter(lines);
+	if (! iterator)
+	{
+		return NULL;
+	}
+	result = PyList_New(0);
+
+	while (result && (item = PyIter_Next(iterator)))
+	{
+		if (! PyString_Check(item))
+		{
+			PyErr_SetString(PyExc_TypeError, "parse_many() lines must be strings");
+			Py_DECREF(item);
+			Py_CLEAR(result);
+			break;
+		}
+
+		length = PyString_GET_SIZE(item);
+		while (length && isspace((unsigned char)PyString_AS_STRING(item)[length - 1]))
+		{
+			length--;
+		}
+		if (length == PyString_GET_SIZE(item))
+		{
+			line = item;
+		}
+		else
+		{
+			line = PyString_FromStringAndSize(PyString_AS_STRING(item), length);
+			Py_DECREF(item);
+		}
+
+		log_line = line ? (LogLineObject *)PyType_GenericNew(&LogLineType, NULL, NULL) : NULL;
+		if (! log_line)
+		{
+			Py_XDECREF(line);
+			Py_CLEAR(result);
+			break;
+		}
+		if (logline_split(log_line, line, FIELD_DATETIME, 0))
+		{
+			status = PyList_Append(result, (PyObject *)log_line);
+		}
+		else
+		{
+			status = PyList_Append(result, Py_None);
+		}
+		Py_DECREF(log_line);
+		Py_DECREF(line);
+		if (status)
+		{
+			Py_CLEAR(result);
+		}
+	}
+
+	Py_DECREF(iterator);
+	if (PyErr_Occurred())
+	{
+		Py_XDECREF(result);
+		return NULL;
+	}
+	return result;
+}
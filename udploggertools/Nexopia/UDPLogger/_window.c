@@ -0,0 +1,399 @@
+/**
+ * The MIT License (http://www.opensource.org/licenses/mit-license.php)
+ * 
+ * Copyright (c) 2010 Nexopia.com, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ **/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Native sliding-window counter for udploggerratewatcher.py.  SlidingWindow.add() counts a hit for a key
+ * (a remote address or user id) at a time and returns how many hits the key has had within the window --
+ * the newest second seen and the window_size seconds before it, as for the pure-Python SlidingWindow --
+ * so that a rate limit is checked as each hit is counted rather than by scanning every key.
+ *
+ * The keys are kept (as 64-bit hashes) in a table of a fixed number of entries, each with a ring of
+ * per-second counts and their sum.  Nothing is expired in bulk: an entry's ring is brought up to date
+ * (the seconds that have left the window since it was last touched are subtracted) whenever it is
+ * looked at, and an entry that has not been touched for a whole window is free to be reused.  A key is
+ * looked for in a group of WINDOW_PROBE_COUNT neighbouring entries; while there is room the counts are
+ * exact.  Once every entry of the group is in use, the key takes over the entry with the smallest count
+ * (as in the space-saving algorithm), so that memory stays bounded and the keys that are hit often keep
+ * their entries.  Unlike space-saving the key starts from nothing rather than from the count that it
+ * took over: a count is never higher than the true one, so that a flood of distinct keys cannot make
+ * innocent keys exceed a rate limit (though the keys that are taken over lose their counts).  The number
+ * of takeovers is kept in the evictions attribute.
+ */
+
+
+/*
+ * WINDOW_DEFAULT_KEYS   The default number of entries (rounded up to a power of two).
+ * WINDOW_MAXIMUM_SIZE   The longest window (seconds).
+ * WINDOW_PROBE_COUNT    The number of entries that a key may be kept in.
+ */
+#define WINDOW_DEFAULT_KEYS   131072UL
+#define WINDOW_MAXIMUM_SIZE   3600L
+#define WINDOW_PROBE_COUNT    16U
+
+
+/*
+ * A key (hash is 0 for an entry that has never been used) and the sum of its per-second counts up to
+ * and including the second last.
+ */
+struct window_entry_t {
+	uint64_t hash;
+	PY_LONG_LONG last;
+	uint32_t count;
+};
+
+
+typedef struct {
+	PyObject_HEAD
+	long window_size;
+	unsigned long max_keys;
+	unsigned long evictions;
+	struct window_entry_t *entries;
+	uint16_t *seconds;
+	PY_LONG_LONG newest;
+	int started;
+} SlidingWindowObject;
+
+
+static uint64_t hash_key(const char *, Py_ssize_t);
+static PyObject *slidingwindow_add(SlidingWindowObject *, PyObject *);
+static void slidingwindow_dealloc(SlidingWindowObject *);
+static void slidingwindow_expire(SlidingWindowObject *, size_t);
+static int slidingwindow_init(SlidingWindowObject *, PyObject *, PyObject *);
+
+
+static PyMemberDef slidingwindow_members[] = {
+	{"window_size", T_LONG, offsetof(SlidingWindowObject, window_size), READONLY, "length of the window (seconds)"},
+	{"max_keys", T_ULONG, offsetof(SlidingWindowObject, max_keys), READONLY, "number of keys that can be counted at once"},
+	{"evictions", T_ULONG, offsetof(SlidingWindowObject, evictions), READONLY, "number of times that a key took over the entry of another"},
+	{NULL, 0, 0, 0, NULL}
+};
+
+
+static PyMethodDef slidingwindow_methods[] = {
+	{"add", (PyCFunction)slidingwindow_add, METH_VARARGS, "add(timestamp, key[, value]) -> count of key within the window, once value (default 1) has been added to it at timestamp"},
+	{NULL, NULL, 0, NULL}
+};
+
+
+static PyTypeObject SlidingWindowType = {
+	PyObject_HEAD_INIT(NULL)
+	0,                                        /* ob_size */
+	"_window.SlidingWindow",                  /* tp_name */
+	sizeof(SlidingWindowObject),              /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)slidingwindow_dealloc,        /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	0,                                        /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+	"SlidingWindow(window_size, max_keys=131072) -- per-key hit counts over the last window_size seconds",
+	0,                                        /* tp_traverse */
+	0,                                        /* tp_clear */
+	0,                                        /* tp_richcompare */
+	0,                                        /* tp_weaklistoffset */
+	0,                                        /* tp_iter */
+	0,                                        /* tp_iternext */
+	slidingwindow_methods,                    /* tp_methods */
+	slidingwindow_members,                    /* tp_members */
+	0,                                        /* tp_getset */
+	0,                                        /* tp_base */
+	0,                                        /* tp_dict */
+	0,                                        /* tp_descr_get */
+	0,                                        /* tp_descr_set */
+	0,                                        /* tp_dictoffset */
+	(initproc)slidingwindow_init,             /* tp_init */
+	0,                                        /* tp_alloc */
+	0,                                        /* tp_new */
+};
+
+
+static PyMethodDef module_methods[] = {
+	{NULL, NULL, 0, NULL}
+};
+
+
+/**
+ * init_window()
+ *
+ * Module initialization function.
+ **/
+PyMODINIT_FUNC init_window(void)
+{
+	PyObject *module;
+
+	SlidingWindowType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&SlidingWindowType) < 0)
+	{
+		return;
+	}
+
+	module = Py_InitModule3("_window", module_methods, "native sliding-window hit counter");
+	if (! module)
+	{
+		return;
+	}
+	Py_INCREF(&SlidingWindowType);
+	PyModule_AddObject(module, "SlidingWindow", (PyObject *)&SlidingWindowType);
+}
+
+
+/**
+ * hash_key(<key>, <length>)
+ *
+ * Returns a 64-bit hash of the key (FNV-1a with its bits mixed, so that the high bits can be used to
+ * find the entries of the key).  Never returns 0, which marks unused entries.
+ **/
+static uint64_t hash_key(const char *key, Py_ssize_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	Py_ssize_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash ? hash : 1;
+}
+
+
+/**
+ * slidingwindow_add(<sliding window>, <arguments>)
+ *
+ * Advances the window to the second of the timestamp (if it is newer than any seen before), finds (or
+ * takes) the entry of the key, adds the value to its count for that second and returns its count within
+ * the window.  Hits older than the window are not counted; the current count of the key is returned for
+ * them.  Per-second counts saturate at 65535.
+ **/
+static PyObject *slidingwindow_add(SlidingWindowObject *self, PyObject *args)
+{
+	const char *key;
+	Py_ssize_t key_length;
+	double timestamp;
+	long value = 1;
+	PY_LONG_LONG second;
+	PY_LONG_LONG slots = self->window_size + 1;
+	struct window_entry_t *entry;
+	uint16_t *count;
+	uint64_t hash;
+	size_t candidate = 0;
+	size_t index;
+	size_t mask = self->max_keys - 1;
+	unsigned int i;
+	int found = 0;
+
+	if (! self->entries)
+	{
+		PyErr_SetString(PyExc_ValueError, "sliding window is not initialized");
+		return NULL;
+	}
+	if (! PyArg_ParseTuple(args, "ds#|l", &timestamp, &key, &key_length, &value))
+	{
+		return NULL;
+	}
+	if (value < 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "value must not be negative");
+		return NULL;
+	}
+
+	second = (PY_LONG_LONG)floor(timestamp);
+	if (! self->started || second > self->newest)
+	{
+		self->newest = second;
+		self->started = 1;
+	}
+
+	/* The key's own entry, else an unused or expired one, else the one with the smallest count (which is cleared). */
+	hash = hash_key(key, key_length);
+	index = (size_t)(hash >> 32) & mask;
+	for (i = 0; i < WINDOW_PROBE_COUNT && found != 1; i++)
+	{
+		entry = &self->entries[(index + i) & mask];
+		if (entry->hash == hash)
+		{
+			candidate = (index + i) & mask;
+			found = 1;
+		}
+		else if (! found && (! entry->hash || self->newest - entry->last >= slots))
+		{
+			candidate = (index + i) & mask;
+			found = -1;
+		}
+	}
+	if (! found)
+	{
+		for (i = 0; i < WINDOW_PROBE_COUNT; i++)
+		{
+			slidingwindow_expire(self, (index + i) & mask);
+			if (i == 0 || self->entries[(index + i) & mask].count < self->entries[candidate].count)
+			{
+				candidate = (index + i) & mask;
+			}
+		}
+		self->evictions++;
+	}
+	entry = &self->entries[candidate];
+	if (found != 1)
+	{
+		memset(self->seconds + candidate * slots, 0, slots * sizeof(uint16_t));
+		entry->count = 0;
+		entry->last = self->newest;
+	}
+	entry->hash = hash;
+	slidingwindow_expire(self, candidate);
+
+	if (second >= self->newest - self->window_size)
+	{
+		count = self->seconds + candidate * slots + (size_t)(((second % slots) + slots) % slots);
+		if ((unsigned long)value > (unsigned long)(UINT16_MAX - *count))
+		{
+			value = UINT16_MAX - *count;
+		}
+		*count += value;
+		entry->count += value;
+	}
+	return PyLong_FromUnsignedLong(entry->count);
+}
+
+
+/**
+ * slidingwindow_dealloc(<sliding window>)
+ **/
+static void slidingwindow_dealloc(SlidingWindowObject *self)
+{
+	free(self->entries);
+	free(self->seconds);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+
+/**
+ * slidingwindow_expire(<sliding window>, <entry index>)
+ *
+ * Brings the counts of an entry up to the newest second: the seconds that have left the window since
+ * the entry was last brought up to date are subtracted from its count and cleared.
+ **/
+static void slidingwindow_expire(SlidingWindowObject *self, size_t index)
+{
+	struct window_entry_t *entry = &self->entries[index];
+	PY_LONG_LONG slots = self->window_size + 1;
+	PY_LONG_LONG second;
+	uint16_t *seconds = self->seconds + index * slots;
+	size_t slot;
+
+	if (entry->last >= self->newest)
+	{
+		return;
+	}
+	if (self->newest - entry->last >= slots)
+	{
+		memset(seconds, 0, slots * sizeof(uint16_t));
+		entry->count = 0;
+	}
+	else
+	{
+		for (second = entry->last + 1; second <= self->newest; second++)
+		{
+			slot = (size_t)(((second % slots) + slots) % slots);
+			entry->count -= seconds[slot];
+			seconds[slot] = 0;
+		}
+	}
+	entry->last = self->newest;
+}
+
+
+/**
+ * slidingwindow_init(<sliding window>, <arguments>, <keyword arguments>)
+ *
+ * Allocates the entries and their per-second counts.  max_keys is rounded up to a power of two.
+ **/
+static int slidingwindow_init(SlidingWindowObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *keywords[] = {"window_size", "max_keys", NULL};
+	unsigned long max_keys = WINDOW_DEFAULT_KEYS;
+	long window_size;
+
+	if (self->entries)
+	{
+		PyErr_SetString(PyExc_ValueError, "sliding window is already initialized");
+		return -1;
+	}
+	if (! PyArg_ParseTupleAndKeywords(args, kwds, "l|k", keywords, &window_size, &max_keys))
+	{
+		return -1;
+	}
+	if (window_size <= 0 || window_size > WINDOW_MAXIMUM_SIZE)
+	{
+		PyErr_SetString(PyExc_ValueError, "window_size must be between 1 and 3600 seconds");
+		return -1;
+	}
+	if (max_keys == 0 || max_keys > (1UL << 28))
+	{
+		PyErr_SetString(PyExc_ValueError, "max_keys must be between 1 and 268435456");
+		return -1;
+	}
+
+	self->window_size = window_size;
+	for (self->max_keys = WINDOW_PROBE_COUNT; self->max_keys < max_keys; self->max_keys <<= 1);
+	self->entries = calloc(self->max_keys, sizeof(struct window_entry_t));
+	self->seconds = calloc(self->max_keys * (window_size + 1), sizeof(uint16_t));
+	if (! self->entries || ! self->seconds)
+	{
+		free(self->entries);
+		free(self->seconds);
+		self->entries = NULL;
+		self->seconds = NULL;
+		PyErr_NoMemory();
+		return -1;
+	}
+	self->evictions = 0;
+	self->started = 0;
+	return 0;
+}
@@ -0,0 +1,179 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+# Compares the rate at which udploggerratewatcher.py can count hits with the
+# native sliding window (Nexopia.UDPLogger._window.SlidingWindow), with the
+# pure-Python one and with the original scan of every key after every hit.
+# The hits are a synthetic stream of remote addresses: a long tail of
+# ordinary clients plus a few that exceed the rate limit.  The keys that each
+# window reports as exceeding the limit are compared; they are the same as
+# long as the native window has room for every key (with a smaller
+# --max-keys it reports how many keys it took over and how many reports
+# differ).
+#
+# Run from the udploggertools directory (after make):
+#   python benchmarks/ratewatch.py [--hits N] [--keys N] [--max-keys N] [--seconds N]
+#
+
+import os
+import sys
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+import Nexopia.UDPLogger._window
+
+import getopt
+import imp
+import random
+import time
+
+RATE = 20
+WINDOW_SIZE = 60
+
+def load_exact_window():
+	"""
+	Returns the pure-Python SlidingWindow of udploggerratewatcher.py (which
+	the native one replaces when it can be imported).
+	"""
+	native = sys.modules.pop('Nexopia.UDPLogger._window')
+	sys.modules['Nexopia.UDPLogger._window'] = None
+	try:
+		ratewatcher = imp.load_source('ratewatcher', os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'udploggerratewatcher.py'))
+	finally:
+		sys.modules['Nexopia.UDPLogger._window'] = native
+	return ratewatcher.SlidingWindow
+
+def generate(keys, seconds, hits):
+	"""
+	Returns a list of (timestamp, address) hits: hits per second spread over
+	keys addresses (a few of which take far more than their share).
+	"""
+	random.seed(keys * 1000003 + seconds)
+	addresses = ['10.%d.%d.%d' % (i >> 16, (i >> 8) & 255, i & 255) for i in range(keys)]
+	abusers = addresses[:10]
+	stream = []
+	start = 1262304000
+	for second in range(seconds):
+		for i in range(hits):
+			if i % 50 == 0:
+				address = random.choice(abusers)
+			else:
+				address = addresses[random.randint(0, keys - 1)]
+			stream.append((start + second + i / float(hits), address))
+	return stream
+
+def run(name, window, stream):
+	"""
+	Counts the stream, returning the set of keys that exceeded the rate limit
+	and the time taken.
+	"""
+	reported = set()
+	start = time.time()
+	for timestamp, key in stream:
+		if window.add(timestamp, key, 1) > RATE:
+			reported.add(key)
+	elapsed = time.time() - start
+	print '%-10s %9d hits in %8.3f s, %10.0f hits/s, %d keys over the limit' % (name, len(stream), elapsed, len(stream) / elapsed, len(reported))
+	return reported
+
+def run_scan(window, stream):
+	"""
+	The original approach: after each hit, every key of the window is checked
+	against the limit.
+	"""
+	reported = set()
+	start = time.time()
+	for timestamp, key in stream:
+		window.add(timestamp, key, 1)
+		for key, value in window.aggregate.iteritems():
+			if value > RATE:
+				reported.add(key)
+	elapsed = time.time() - start
+	print '%-10s %9d hits in %8.3f s, %10.0f hits/s, %d keys over the limit' % ('scan', len(stream), elapsed, len(stream) / elapsed, len(reported))
+	return reported
+
+def main(options):
+	ExactWindow = load_exact_window()
+	stream = generate(options['keys'], options['seconds'], options['hits'])
+	print '%d keys, %d seconds of %d hits, limit of %d hits per %d seconds' % (options['keys'], options['seconds'], options['hits'], RATE, WINDOW_SIZE)
+
+	# The scan is far too slow to run over the whole stream.
+	scan = run_scan(ExactWindow(WINDOW_SIZE), stream[:options['hits'] * 2])
+	exact = run('exact', ExactWindow(WINDOW_SIZE), stream)
+	window = Nexopia.UDPLogger._window.SlidingWindow(WINDOW_SIZE, options['max-keys'])
+	native = run('native', window, stream)
+	if scan != run('exact', ExactWindow(WINDOW_SIZE), stream[:options['hits'] * 2]):
+		print 'the scan and the exact window report different keys'
+		sys.exit(1)
+	if window.evictions:
+		print 'the native window took over %d entries; %d keys were not reported, %d were reported wrongly' % (window.evictions, len(exact - native), len(native - exact))
+	elif exact != native:
+		print 'the exact and native windows report different keys'
+		sys.exit(1)
+	else:
+		print 'the exact and native windows report the same keys'
+
+def parse_arguments(argv):
+	options = {}
+	options['hits'] = 10000
+	options['keys'] = 100000
+	options['max-keys'] = 131072
+	options['seconds'] = 120
+
+	try:
+		opts, args = getopt.getopt(argv, 'h', ['help', 'hits=', 'keys=', 'max-keys=', 'seconds='])
+	except getopt.GetoptError, e:
+		print str(e)
+		usage()
+		sys.exit(3)
+	for o, a in opts:
+		if o in ['-h', '--help']:
+			usage()
+			sys.exit(0)
+		elif o in ['--hits', '--keys', '--max-keys', '--seconds']:
+			try:
+				options[o[2:]] = int(a)
+				if options[o[2:]] < 1:
+					raise ValueError
+			except ValueError:
+				sys.stderr.write('invalid argument for option %s (must be integer x, where x >= 1): "%s"\n' % (o[2:], a))
+				usage()
+				sys.exit(2)
+		else:
+			assert False, 'unhandled option: ' + o
+	return options
+
+def usage():
+	print '''
+Usage %s [OPTIONS]
+
+  -h, --help                                     display this help and exit
+      --hits <count>                             the number of hits per second (default 10000)
+      --keys <count>                             the number of distinct remote addresses (default 100000)
+      --max-keys <count>                         the number of keys that the native window has room for (default 131072)
+      --seconds <count>                          the number of seconds of hits (default 120)
+''' % (sys.argv[0])
+
+if __name__ == '__main__':
+	main(parse_arguments(sys.argv[1:]))
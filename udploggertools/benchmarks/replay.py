@@ -0,0 +1,237 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+# Replays a synthetic log with udploggerreplay against a stub HTTP/1.1
+# server on localhost and checks that every request is accounted for: the
+# status codes, timeouts and connection errors that udploggerreplay reports
+# are compared with what the log asks the server for.  The server answers
+# with Content-Length and chunked bodies, closes some connections after the
+# response (and drops some idle keep-alive connections) and is slow to
+# answer a few requests, so that the keep-alive, retry and timeout paths of
+# udploggerreplay are all exercised.  The rate and lag percentiles printed
+# by udploggerreplay show how closely it kept to the logged schedule.
+#
+# Run from the udploggertools directory (after make in the top directory):
+#   python benchmarks/replay.py [--rate N] [--seconds N] [--speed N] [--flood]
+#
+
+import BaseHTTPServer
+import SocketServer
+import getopt
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+DELIMITER = '\x1e'
+REPLAY = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'udploggerreplay')
+TIMEOUT = 0.5
+
+class StubHandler(BaseHTTPServer.BaseHTTPRequestHandler):
+	"""
+	Answers /status/<code>, /slow/<milliseconds>, /chunked and /close (and
+	anything else with a 200), on keep-alive connections.
+	"""
+	disable_nagle_algorithm = True
+	protocol_version = 'HTTP/1.1'
+	wbufsize = 65536
+
+	def do_GET(self):
+		path = self.path.split('?')[0]
+		body = 'x' * random.randint(0, 4096)
+		code = 200
+		close = False
+		chunked = False
+		if path.startswith('/status/'):
+			code = int(path[8:])
+		elif path.startswith('/slow/'):
+			time.sleep(int(path[6:]) / 1000.0)
+		elif path == '/chunked':
+			chunked = True
+		elif path == '/close':
+			close = True
+		self.send_response(code)
+		if chunked:
+			self.send_header('Transfer-Encoding', 'chunked')
+		else:
+			self.send_header('Content-Length', str(len(body)))
+		if close:
+			self.send_header('Connection', 'close')
+			self.close_connection = 1
+		self.end_headers()
+		if chunked:
+			for start in range(0, len(body), 1000):
+				self.wfile.write('%x\r\n%s\r\n' % (len(body[start:start + 1000]), body[start:start + 1000]))
+			self.wfile.write('0\r\n\r\n')
+		else:
+			self.wfile.write(body)
+
+	def handle(self):
+		# Idle keep-alive connections are dropped after a while, as servers do.
+		self.request.settimeout(1.0)
+		try:
+			BaseHTTPServer.BaseHTTPRequestHandler.handle(self)
+		except Exception:
+			pass
+
+	def log_message(self, format, *args):
+		pass
+
+class StubServer(SocketServer.ThreadingMixIn, BaseHTTPServer.HTTPServer):
+	daemon_threads = True
+	request_queue_size = 1024
+
+	def handle_error(self, request, client_address):
+		# udploggerreplay closes the connections of requests that time out.
+		pass
+
+def generate(path, rate, seconds):
+	"""
+	Writes seconds of rate requests per second in udploggerc format and
+	returns the results that they are expected to get.
+	"""
+	random.seed(rate * 1000003 + seconds)
+	expected = {}
+	start = 1262304000
+	output = open(path, 'w')
+	for second in range(seconds):
+		stamp = time.strftime('[%Y-%m-%d %H:%M:%S]', time.localtime(start + second))
+		for i in range(rate):
+			choice = random.random()
+			if choice < 0.05:
+				url, result = '/status/404', '404'
+			elif choice < 0.07:
+				url, result = '/status/500', '500'
+			elif choice < 0.08:
+				url, result = '/slow/%d' % (TIMEOUT * 3000), 'Timeout'
+			elif choice < 0.18:
+				url, result = '/chunked', '200'
+			elif choice < 0.20:
+				url, result = '/close', '200'
+			else:
+				url, result = '/page/%d' % random.randint(0, 100000), '200'
+			expected[result] = expected.get(result, 0) + 1
+			fields = [stamp, '[127.0.0.1:43824]', str(second * rate + i), 'apache', 'v2', 'GET', '200', '100', '200', '300', '1000', 'X', url, random.choice(['-', 'a=1&b=2']), '10.0.0.1', 'www.example.com']
+			fields += ['-'] * (25 - len(fields))
+			output.write(DELIMITER.join(fields) + '\n')
+	output.close()
+	return expected
+
+def main(options):
+	server = StubServer(('127.0.0.1', 0), StubHandler)
+	thread = threading.Thread(target=server.serve_forever)
+	thread.daemon = True
+	thread.start()
+
+	descriptor, path = tempfile.mkstemp(suffix='.log')
+	os.close(descriptor)
+	try:
+		expected = generate(path, options['rate'], options['seconds'])
+		command = [REPLAY, '--target-host', '127.0.0.1:%d' % server.server_address[1], '--target-vhost', 'www.example.com', '--timeout', str(TIMEOUT), '--max-concurrent-requests', str(options['max-concurrent-requests']), '--speed', str(options['speed']), '--checkpoint', '5']
+		if options['flood']:
+			command.append('--flood')
+		print ' '.join(command + [path])
+		replay = subprocess.Popen(command + [path], stdout=subprocess.PIPE)
+		output = replay.communicate()[0]
+	finally:
+		os.unlink(path)
+		server.shutdown()
+		# Lets the handlers of the slow requests finish before the interpreter exits.
+		time.sleep(TIMEOUT * 3)
+	sys.stdout.write(output)
+	if replay.returncode:
+		print 'udploggerreplay exited with %d' % replay.returncode
+		sys.exit(1)
+
+	results = {}
+	for line in output.splitlines():
+		if line.startswith('Run Complete: '):
+			results = dict(re.findall(r' (\w+)\[(\d+)\]', line))
+	results = dict((code, int(count)) for code, count in results.iteritems())
+	if results != expected:
+		print 'expected %s' % ' '.join('%s[%d]' % (code, count) for code, count in sorted(expected.iteritems()))
+		sys.exit(1)
+	print 'every request was accounted for'
+
+def parse_arguments(argv):
+	options = {}
+	options['flood'] = False
+	options['max-concurrent-requests'] = 64
+	options['rate'] = 500
+	options['seconds'] = 10
+	options['speed'] = 1.0
+
+	try:
+		opts, args = getopt.getopt(argv, 'h', ['flood', 'help', 'max-concurrent-requests=', 'rate=', 'seconds=', 'speed='])
+	except getopt.GetoptError, e:
+		print str(e)
+		usage()
+		sys.exit(3)
+	for o, a in opts:
+		if o in ['-h', '--help']:
+			usage()
+			sys.exit(0)
+		elif o == '--flood':
+			options['flood'] = True
+		elif o in ['--max-concurrent-requests', '--rate', '--seconds']:
+			try:
+				options[o[2:]] = int(a)
+				if options[o[2:]] < 1:
+					raise ValueError
+			except ValueError:
+				sys.stderr.write('invalid argument for option %s (must be integer x, where x >= 1): "%s"\n' % (o[2:], a))
+				usage()
+				sys.exit(2)
+		elif o == '--speed':
+			try:
+				options['speed'] = float(a)
+				if options['speed'] <= 0:
+					raise ValueError
+			except ValueError:
+				sys.stderr.write('invalid argument for option speed (must be a number x, where x > 0): "%s"\n' % (a))
+				usage()
+				sys.exit(2)
+		else:
+			assert False, 'unhandled option: ' + o
+	return options
+
+def usage():
+	print '''
+Usage %s [OPTIONS]
+
+      --flood                                    replay as fast as possible rather than at the logged rate
+  -h, --help                                     display this help and exit
+      --max-concurrent-requests <count>          the number of connections that udploggerreplay may use (default 64)
+      --rate <count>                             the number of requests per second of the log (default 500)
+      --seconds <count>                          the number of seconds of the log (default 10)
+      --speed <factor>                           replay the log <factor> times as fast as it was logged (default 1)
+''' % (sys.argv[0])
+
+if __name__ == '__main__':
+	main(parse_arguments(sys.argv[1:]))
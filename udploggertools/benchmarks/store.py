@@ -0,0 +1,195 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+#
+# Compares the time that it takes to save an hour (or more) of statistics to a
+# SQLite database through Nexopia.UDPLogger.Statistics.Store with the time that
+# the original per-row path (an INSERT OR IGNORE and an UPDATE for every row,
+# the table created on every call and one commit per statistic) takes for the
+# same data.  Only the hourly tables are measured: the per-row path has no day
+# and week rollups, so Store is limited to the hourly resolution here.  Each
+# path saves the data twice into a fresh database, the second time on top of
+# the rows written by the first, and the resulting tables are checked to be
+# identical.
+#
+# Run from the udploggertools directory:
+#   python benchmarks/store.py [--hours N] [--hosts N]
+#
+
+import os
+import sys
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+import Nexopia.UDPLogger.Statistics
+
+import getopt
+import random
+import shutil
+import sqlite3
+import tempfile
+import time
+
+CONTENT_TYPES = ['', 'application/javascript', 'application/json', 'application/x-shockwave-flash', 'image/gif', 'image/jpeg', 'image/png', 'text/css', 'text/html', 'text/javascript', 'text/plain', 'text/xml']
+STATUSES = [None, 200, 206, 301, 302, 304, 400, 401, 403, 404, 411, 417, 500, 501, 502, 503]
+
+def generate(hours, hosts):
+	"""
+	Returns a set of statistics with hourly results like those of a busy
+	site: every status, content type, time used and user type, and requests
+	to a long tail of virtual hosts.
+	"""
+	random.seed(hours * 1000003 + hosts)
+	statistics = Nexopia.UDPLogger.Statistics.available_statistics()
+	start = int(time.mktime(time.strptime('2010-01-01 00:00:00', '%Y-%m-%d %H:%M:%S')))
+	for hour in range(hours):
+		timestamp = start + hour * 3600
+		for statistic in statistics:
+			results = statistic.results.setdefault(timestamp, {})
+			if isinstance(statistic, Nexopia.UDPLogger.Statistics.ContentTypeStatistic):
+				for content_type in CONTENT_TYPES:
+					count = random.randint(1, 100000)
+					results[content_type] = {'count': count, 'transferred': count * random.randint(100, 50000)}
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.HitStatistic):
+				results.update({'hits': random.randint(1000000, 2000000), 'bytes_incoming': random.randint(10 ** 8, 10 ** 9), 'bytes_outgoing': random.randint(10 ** 10, 10 ** 11)})
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.HostStatistic):
+				for i in range(hosts):
+					results['host%d.example.com' % (i)] = int(100000 / (i + 1)) + 1
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.StatusStatistic):
+				for status in STATUSES:
+					results[status] = random.randint(1, 100000)
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.TimeUsedStatistic):
+				for time_used in range(-1, 11):
+					results[time_used] = random.randint(1, 100000)
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.UserSexStatistic):
+				for usersex in ('female', 'male', 'unknown'):
+					results[usersex] = random.randint(1, 100000)
+			elif isinstance(statistic, Nexopia.UDPLogger.Statistics.UserTypeStatistic):
+				for usertype in ('anon', 'plus', 'user', 'unknown'):
+					results[usertype] = random.randint(1, 100000)
+	return statistics
+
+def save_per_row(statistics, database_connection):
+	"""
+	The original save() of each statistic.
+	"""
+	for statistic in statistics:
+		cursor = database_connection.cursor()
+		key_names = ['timestamp'] + [name for name, type in statistic.keys]
+		value_names = [name for name, type in statistic.values]
+		cursor.execute('CREATE TABLE IF NOT EXISTS %s (timestamp INTEGER, %s, PRIMARY KEY (%s));' % (statistic.table, ', '.join(['%s %s' % column for column in statistic.keys + statistic.values]), ', '.join(key_names)))
+		for row in statistic.rows():
+			key = row[:len(key_names)]
+			cursor.execute('INSERT OR IGNORE INTO %s (%s) VALUES (%s);' % (statistic.table, ', '.join(key_names + value_names), ', '.join(['?'] * len(key_names) + ['0'] * len(value_names))), key)
+			cursor.execute('UPDATE %s SET %s WHERE %s;' % (statistic.table, ', '.join(['%s = %s + ?' % (name, name) for name in value_names]), ' AND '.join(['%s = ?' % (name) for name in key_names])), row[len(key_names):] + key)
+		database_connection.commit()
+
+def save_store(statistics, database_connection):
+	"""
+	Statistics.Store, writing the hourly tables only (as save_per_row does).
+	"""
+	store = Nexopia.UDPLogger.Statistics.Store(database_connection)
+	for statistic in statistics:
+		store.stage(statistic.table, statistic.keys, statistic.values, statistic.rows(), statistic.loads, Nexopia.UDPLogger.Statistics.RESOLUTIONS[:1])
+	store.flush()
+
+def dump(path, statistics):
+	database_connection = sqlite3.connect(path)
+	tables = {}
+	for statistic in statistics:
+		# Rows with a NULL key never conflict in the per-row path (which leaves
+		# them at zero), so only the others are compared.
+		key_names = ['timestamp'] + [name for name, type in statistic.keys]
+		tables[statistic.table] = database_connection.execute('SELECT * FROM %s WHERE %s ORDER BY %s;' % (statistic.table, ' AND '.join(['%s IS NOT NULL' % (name) for name in key_names]), ', '.join(key_names))).fetchall()
+	database_connection.close()
+	return tables
+
+def run(name, save, statistics, directory):
+	path = os.path.join(directory, name + '.db')
+	timings = []
+	for i in range(2):
+		database_connection = sqlite3.connect(path)
+		start = time.time()
+		save(statistics, database_connection)
+		timings.append(time.time() - start)
+		database_connection.close()
+	print '%-10s first save %8.3f s, second save %8.3f s' % (name, timings[0], timings[1])
+	return dump(path, statistics)
+
+def main(options):
+	statistics = generate(options['hours'], options['hosts'])
+	rows = sum([len(list(statistic.rows())) for statistic in statistics])
+	print '%d hour(s), %d rows per save (SQLite %s)' % (options['hours'], rows, sqlite3.sqlite_version)
+
+	directory = tempfile.mkdtemp()
+	try:
+		per_row = run('per-row', save_per_row, statistics, directory)
+		store = run('store', save_store, statistics, directory)
+	finally:
+		shutil.rmtree(directory)
+	if per_row != store:
+		print 'the databases differ'
+		sys.exit(1)
+	print 'the databases are identical'
+
+def parse_arguments(argv):
+	options = {}
+	options['hosts'] = 20000
+	options['hours'] = 1
+
+	try:
+		opts, args = getopt.getopt(argv, 'h', ['help', 'hosts=', 'hours='])
+	except getopt.GetoptError, e:
+		print str(e)
+		usage()
+		sys.exit(3)
+	for o, a in opts:
+		if o in ['-h', '--help']:
+			usage()
+			sys.exit(0)
+		elif o in ['--hosts', '--hours']:
+			try:
+				options[o[2:]] = int(a)
+				if options[o[2:]] < 1:
+					raise ValueError
+			except ValueError:
+				sys.stderr.write('invalid argument for option %s (must be integer x, where x >= 1): "%s"\n' % (o[2:], a))
+				usage()
+				sys.exit(2)
+		else:
+			assert False, 'unhandled option: ' + o
+	return options
+
+def usage():
+	print '''
+Usage %s [OPTIONS]
+
+  -h, --help                                     display this help and exit
+      --hosts <count>                            the number of virtual hosts per hour (default 20000)
+      --hours <count>                            the number of hours of statistics (default 1)
+''' % (sys.argv[0])
+
+if __name__ == '__main__':
+	main(parse_arguments(sys.argv[1:]))
@@ -0,0 +1,84 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+# Checks that the native LogLine (Nexopia.UDPLogger._parse) behaves as the
+# pure-Python one of Parse.py: the same values after parse(), and assigned
+# attributes that are kept when an attribute sharing their field (date_time
+# and unix_timestamp, source_address and source_port) is first read after
+# the assignment.
+#
+# Run from the udploggertools directory (after make):
+#   python tests/parse.py
+#
+
+import os
+import sys
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+import Nexopia.UDPLogger.Parse
+import Nexopia.UDPLogger._parse
+
+import unittest
+
+FIELDS = ['[2010-01-01 00:00:00]', '[127.0.0.1:43824]', '1', 'apache', 'v2', 'GET', '200', '100', '200', '300', '1000', 'X', '/a\x00b', '-', '10.0.0.1', 'www.example.com', '-', '-', '-', 'text/html', '42', '-', '-', '-', '-']
+LINE = '\x1e'.join(FIELDS)
+
+class LogLineTest(unittest.TestCase):
+	def parse(self, cls):
+		log_line = cls()
+		log_line.parse(LINE)
+		return log_line
+
+	def test_values(self):
+		python = self.parse(Nexopia.UDPLogger.Parse.LogLine)
+		native = self.parse(Nexopia.UDPLogger._parse.LogLine)
+		self.assertEqual(str(native), str(python))
+
+	def test_assigned_time_is_kept(self):
+		for cls in (Nexopia.UDPLogger.Parse.LogLine, Nexopia.UDPLogger._parse.LogLine):
+			log_line = self.parse(cls)
+			log_line.unix_timestamp = 12345.0
+			self.assertEqual(log_line.date_time.tm_year, 2010)
+			self.assertEqual(log_line.unix_timestamp, 12345.0)
+
+			log_line = self.parse(cls)
+			log_line.date_time = None
+			self.assertNotEqual(log_line.unix_timestamp, None)
+			self.assertEqual(log_line.date_time, None)
+
+	def test_assigned_source_is_kept(self):
+		for cls in (Nexopia.UDPLogger.Parse.LogLine, Nexopia.UDPLogger._parse.LogLine):
+			log_line = self.parse(cls)
+			log_line.source_port = 1
+			self.assertEqual(log_line.source_address, '127.0.0.1')
+			self.assertEqual(log_line.source_port, 1)
+
+			log_line = self.parse(cls)
+			log_line.source_address = 'example'
+			self.assertEqual(log_line.source_port, 43824)
+			self.assertEqual(log_line.source_address, 'example')
+
+if __name__ == '__main__':
+	unittest.main()
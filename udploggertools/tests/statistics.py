@@ -0,0 +1,74 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# The MIT License (http://www.opensource.org/licenses/mit-license.php)
+# 
+# Copyright (c) 2010 Nexopia.com, Inc.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+#
+# Checks that Nexopia.UDPLogger.Statistics.Store adds rows to the stored ones
+# with the same key, including keys that are NULL (such as the status of
+# lines without one), at every resolution.
+#
+# Run from the udploggertools directory:
+#   python tests/statistics.py
+#
+
+import os
+import sys
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+import Nexopia.UDPLogger.Statistics
+
+import sqlite3
+import unittest
+
+TIMESTAMP = 1262304000
+
+class StoreTest(unittest.TestCase):
+	def setUp(self):
+		self.database_connection = sqlite3.connect(':memory:')
+
+	def tearDown(self):
+		self.database_connection.close()
+
+	def save(self, results):
+		statistic = Nexopia.UDPLogger.Statistics.StatusStatistic()
+		statistic.results[TIMESTAMP] = results
+		statistic.save(self.database_connection)
+
+	def rows(self, table):
+		return self.database_connection.execute('SELECT status, count FROM %s ORDER BY status;' % (table)).fetchall()
+
+	def test_keys_are_added_to(self):
+		for i in range(3):
+			self.save({None: 1, 200: 2})
+		for resolution, length in Nexopia.UDPLogger.Statistics.RESOLUTIONS:
+			self.assertEqual(self.rows(Nexopia.UDPLogger.Statistics.rollup_table('status_statistics', resolution)), [(None, 3), (200, 6)])
+
+	def test_duplicate_null_keys_keep_their_total(self):
+		self.save({200: 1})
+		self.database_connection.execute('INSERT INTO status_statistics VALUES (?, NULL, 1);', (TIMESTAMP,))
+		self.database_connection.execute('INSERT INTO status_statistics VALUES (?, NULL, 1);', (TIMESTAMP,))
+		self.database_connection.commit()
+		self.save({None: 5})
+		self.assertEqual(sum([count for status, count in self.rows('status_statistics') if status is None]), 7)
+
+if __name__ == '__main__':
+	unittest.main()
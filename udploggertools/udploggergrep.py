@@ -24,6 +24,7 @@
 # THE SOFTWARE.
 #
 
+import Nexopia.UDPLogger.Index
 import Nexopia.UDPLogger.Parse
 
 import getopt
@@ -34,8 +35,14 @@ import time
 def main(options):
 	log_data = Nexopia.UDPLogger.Parse.LogLine()
 
+	if options['files']:
+		# Log files written by udploggerc --index can be seeked to the time range.
+		source = Nexopia.UDPLogger.Index.read_range(options['files'], options['time-after'], options['time-before'])
+	else:
+		source = sys.stdin
+
 	lineno = 0
-	for line in sys.stdin:
+	for line in source:
 		lineno += 1
 		line = line.rstrip()
 		try:
@@ -97,6 +104,7 @@ def main(options):
 def parse_arguments(argv):
 	options = {}
 	options['content-type'] = None
+	options['files'] = []
 	options['host'] = None
 	options['method'] = None
 	options['query'] = None
@@ -199,11 +207,16 @@ def parse_arguments(argv):
 			sys.exit(0)
 		else:
 			assert False, 'unhandled option: ' + o
+	options['files'] = args
 	return options
 
 def usage():
 	print '''
-Usage %s [OPTIONS]
+Usage %s [OPTIONS] [FILE]...
+
+Reads udploggerc output from each FILE (which may be gzip-compressed) or from
+standard input.  Files that have a udploggerc index (FILE.idx) are only read
+within the --time-after/--time-before range.
 
       --content-type <regexp>                    show log entries whose content-type matches <regexp>
   -h, --help                                     display this help and exit
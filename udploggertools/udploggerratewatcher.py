@@ -37,16 +37,26 @@ import subprocess
 import sys
 
 class SlidingWindow:
-	aggregate = {}
-	window = {}
-	window_timestamps = []
-	window_size = 0
-	
-	def __init__(self, window_size):
+	"""
+	Counts hits per key over the last window_size seconds (the newest second
+	seen and the window_size seconds before it).  add() returns the count of
+	the key that it added to, so that the rate limit is checked as each hit
+	is counted.  The native Nexopia.UDPLogger._window.SlidingWindow (used when
+	it is built) keeps the counts of up to max_keys keys in a fixed amount of
+	memory; this one keeps every key, in a dict per second.
+	"""
+
+	def __init__(self, window_size, max_keys=None):
+		self.aggregate = {}
+		self.window = {}
+		self.window_timestamps = []
 		self.window_size = window_size
 
-	def add(self, timestamp, key, value):
+	def add(self, timestamp, key, value=1):
+		timestamp = int(timestamp)
 		if timestamp not in self.window:
+			if self.window_timestamps and timestamp < self.window_timestamps[-1] - self.window_size:
+				return self.aggregate.get(key, 0)
 			self.window[timestamp] = {}
 			bisect.insort(self.window_timestamps, timestamp)
 			self.expire()
@@ -55,7 +65,8 @@ class SlidingWindow:
 		self.window[timestamp][key] = self.window[timestamp][key] + value
 		if key not in self.aggregate:
 			self.aggregate[key] = 0
-		self.aggregate[key] = self.aggregate[key] + value 
+		self.aggregate[key] = self.aggregate[key] + value
+		return self.aggregate[key]
 
 	def expire(self):
 		while (len(self.window_timestamps) > 0) and (self.window_timestamps[0] < (self.window_timestamps[len(self.window_timestamps)-1] - self.window_size)):
@@ -69,12 +80,10 @@ class SlidingWindow:
 		assert len(self.window_timestamps) == len(self.window)
 		assert len(self.window_timestamps) <= (self.window_size + 1)
 
-	def fetch_keys_above(self, limit):
-		keys_above = []
-		for key, value in self.aggregate.iteritems():
-			if value > limit:
-				keys_above.append(key)
-		return keys_above
+try:
+	from Nexopia.UDPLogger._window import SlidingWindow
+except ImportError:
+	pass
 
 def execute_command(command, log_data):
 	command = command.replace("$UID$", str(log_data.nexopia_userid))
@@ -84,55 +93,33 @@ def execute_command(command, log_data):
 	return subprocess.call(args)
 
 def main(options):
-	log_data = Nexopia.UDPLogger.Parse.LogLine()
-	ip_sw = SlidingWindow(options.window_size)
-	uid_sw = SlidingWindow(options.window_size)
+	ip_sw = SlidingWindow(options.window_size, options.max_keys)
+	uid_sw = SlidingWindow(options.window_size, options.max_keys)
 
-	lineno = 0
 	if options.repeat_command:
 		reported = None
 	else:
 		reported = set([])
-	for line in sys.stdin:
-		lineno += 1
-		line = line.rstrip()
-		try:
-			log_data.parse(line)
-		except Exception, e:
-			logging.error('skipping line #%d, could not parse data "%s": %s\n' % (lineno, line.replace('\x1e', '\\x1e'), str(e)))
+	if options.subscribe:
+		# Imported here so that the client library binding is only required when it is used.
+		from Nexopia.UDPLogger.Client import Client
+		source = Client(options.host, filter=options.filter)
+	else:
+		source = parse_lines(sys.stdin)
+	for log_data in source:
+		if log_data is None:
+			logging.error('skipping record, could not parse data\n')
 			continue
 
 		if options.remote_ip and log_data.remote_address is not None:
-			ip_sw.add(log_data.unix_timestamp, log_data.remote_address, 1)
-			for ip in ip_sw.fetch_keys_above(options.rate):
-				if reported is not None:
-					if ip in reported:
-						continue
-					else:
-						reported = reported | set([ip])				
-				if ip in options.whitelist:
-					logging.debug('bypassing rate-limit for whitelisted remote ip address %s' % (ip))
-					continue
-				else:
-					logging.info('remote ip address rate-limit triggered for %s' % (ip))
-					if options.command:
-						execute_command(options.command, log_data)
+			ip = log_data.remote_address
+			if ip_sw.add(log_data.unix_timestamp, ip, 1) > options.rate:
+				trigger(options, reported, ip, 'remote ip address', log_data)
 
 		if options.nexopia_userid and log_data.nexopia_userid is not None:
-			uid_sw.add(log_data.unix_timestamp, str(log_data.nexopia_userid), 1)
-			for uid in uid_sw.fetch_keys_above(options.rate):
-				if reported is not None:
-					if uid in reported:
-						continue
-					else:
-						reported = reported | set([uid])
-				if uid in options.whitelist:
-					logging.debug('bypassing rate-limit for whitelisted nexopia user id %s' % (uid))
-					continue
-				else:
-					logging.info('nexopia user id rate-limit triggered for %s' % (uid))
-					if options.command:
-						execute_command(options.command, log_data)
+			uid = str(log_data.nexopia_userid)
+			if uid_sw.add(log_data.unix_timestamp, uid, 1) > options.rate:
+				trigger(options, reported, uid, 'nexopia user id', log_data)
 
 def parse_arguments():
 	"""
@@ -153,6 +140,22 @@ def parse_arguments():
 		default=False,
 		help="enable display of verbose debugging information"
 	)
+	parser.add_option(
+		"--filter",
+		help="with --subscribe, only receive log lines that match this filter expression (see udploggerc --help)"
+	)
+	parser.add_option(
+		"--host",
+		action="append",
+		help="with --subscribe, send beacons to this udploggerd HOST[:PORT] (may be given more than once; default broadcast)"
+	)
+	parser.add_option(
+		"--max-keys",
+		default=131072,
+		dest="max_keys",
+		help="count the hits of up to this many keys at once in a fixed amount of memory (about (26 + 2 * WINDOW_SIZE) bytes each); beyond that the keys with the fewest hits make way for new ones (and lose their counts)",
+		type="int"
+	)
 	parser.add_option(
 		"--nexopia-userid",
 		action="store_true",
@@ -180,6 +183,12 @@ def parse_arguments():
 		dest="repeat_command",
 		help="trigger the command for EACH request that exceeds the rate-limit, rather than only once per data aggregation key"
 	)
+	parser.add_option(
+		"--subscribe",
+		action="store_true",
+		default=False,
+		help="receive log lines directly from udploggerd hosts (through the udplogger client library) rather than from stdin"
+	)
 	parser.add_option(
 		"--whitelist",
 		action="append",
@@ -199,14 +208,57 @@ def parse_arguments():
 		parser.error("option --rate: must be larger than zero")
 	if options.window_size <= 0:
 		parser.error("option --window-size: must be larger than zero")
+	if options.max_keys <= 0:
+		parser.error("option --max-keys: must be larger than zero")
 	if not options.nexopia_userid and not options.remote_ip:
 		parser.error("must aggregate over at least one identifier, use either --nexopia-userid or --remote-ip (or both)")
+	if (options.host or options.filter) and not options.subscribe:
+		parser.error("options --host and --filter require --subscribe")
+	if not options.host:
+		options.host = []
 	if not options.whitelist:
 		options.whitelist = []
 	options.whitelist = set(options.whitelist)
 
 	return options
 
+def parse_lines(source):
+	"""
+	Parses each udploggerc line read from source, logging and skipping the
+	lines that cannot be parsed.  The same LogLine is returned for each line.
+	"""
+	log_data = Nexopia.UDPLogger.Parse.LogLine()
+	lineno = 0
+	for line in source:
+		lineno += 1
+		line = line.rstrip()
+		try:
+			log_data.parse(line)
+		except Exception, e:
+			logging.error('skipping line #%d, could not parse data "%s": %s\n' % (lineno, line.replace('\x1e', '\\x1e'), str(e)))
+			continue
+		if log_data.unix_timestamp is None:
+			logging.error('skipping line #%d, could not parse time "%s"\n' % (lineno, line.replace('\x1e', '\\x1e')))
+			continue
+		yield log_data
+
+def trigger(options, reported, key, description, log_data):
+	"""
+	Runs the command for a key (of the given description) that has exceeded
+	the rate limit, unless it is whitelisted or (without --repeat-command)
+	has already been reported.
+	"""
+	if reported is not None:
+		if key in reported:
+			return
+		reported.add(key)
+	if key in options.whitelist:
+		logging.debug('bypassing rate-limit for whitelisted %s %s' % (description, key))
+	else:
+		logging.info('%s rate-limit triggered for %s' % (description, key))
+		if options.command:
+			execute_command(options.command, log_data)
+
 if __name__ == "__main__":
 	options = parse_arguments()
 	
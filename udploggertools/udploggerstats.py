@@ -24,29 +24,36 @@
 # THE SOFTWARE.
 #
 
+import Nexopia.UDPLogger.Columnar
+import Nexopia.UDPLogger.Index
 import Nexopia.UDPLogger.Parse
 import Nexopia.UDPLogger.Statistics
 
 import getopt
+import glob
+import multiprocessing
 import re
 import sqlite3
 import sys
 import time
 
-def main(options):
-	log_data = Nexopia.UDPLogger.Parse.LogLine()
+def columnar_attributes(statistics_gatherers):
+	# Columnar files are already split into fields; only the columns that the
+	# statistics use are read.
+	attributes = set(['date_time', 'unix_timestamp'])
+	for i in range (0, len(statistics_gatherers)):
+		attributes.update(statistics_gatherers[i].columns)
+	return attributes
 
-	statistics_gatherers = Nexopia.UDPLogger.Statistics.available_statistics()
+def gather(records, statistics_gatherers, options):
+	for log_data in records:
+		if not options['time-after'] is None:
+			if options['time-after'] > log_data.unix_timestamp:
+				continue
 
-	lineno = 0
-	for line in sys.stdin:
-		lineno += 1
-		line = line.rstrip()
-		try:
-			log_data.parse(line)
-		except Exception, e:
-			sys.stderr.write('skipping line #%d, could not parse data "%s": %s\n' % (lineno, line.replace('\x1e', '\\x1e'), str(e)))
-			continue
+		if not options['time-before'] is None:
+			if options['time-before'] < log_data.unix_timestamp:
+				continue
 
 		#
 		# Reach into our log_data and reset the time to have zero minutes/seconds.
@@ -59,29 +66,134 @@ def main(options):
 		for i in range (0, len(statistics_gatherers)):
 			statistics_gatherers[i].update(log_data)
 
+def gather_part(arguments):
+	"""
+	Counts the lines of one part of a file (see parts()) in a worker process
+	and returns its statistics, by class name.
+	"""
+	options, path, first, last = arguments
+	statistics_gatherers = Nexopia.UDPLogger.Statistics.available_statistics()
+	if options['columnar']:
+		records = Nexopia.UDPLogger.Columnar.read_rows([path], columnar_attributes(statistics_gatherers))
+	else:
+		records = parse_lines(Nexopia.UDPLogger.Index.read_lines(path, first, last), path)
+	gather(records, statistics_gatherers, options)
+	return dict([(statistic.__class__.__name__, statistic) for statistic in statistics_gatherers])
+
+def main(options):
+	statistics_gatherers = Nexopia.UDPLogger.Statistics.available_statistics()
+
+	if options['rebuild-rollups']:
+		Nexopia.UDPLogger.Statistics.Store(options['database']).rebuild(statistics_gatherers)
+		return
+
+	if options['jobs'] > 1 and options['files']:
+		# The parts of the files are counted in parallel, by separate processes,
+		# and their statistics merged as they come in.
+		pool = multiprocessing.Pool(options['jobs'])
+		try:
+			for statistics in pool.imap_unordered(gather_part, parts(options)):
+				for i in range (0, len(statistics_gatherers)):
+					statistics_gatherers[i].merge(statistics[statistics_gatherers[i].__class__.__name__])
+			pool.close()
+		except:
+			pool.terminate()
+			raise
+		finally:
+			pool.join()
+	else:
+		if options['columnar']:
+			records = Nexopia.UDPLogger.Columnar.read_rows(options['files'], columnar_attributes(statistics_gatherers))
+		elif options['files']:
+			# Log files written by udploggerc --index can be seeked to the time range.
+			records = parse_lines(Nexopia.UDPLogger.Index.read_range(options['files'], options['time-after'], options['time-before']))
+		else:
+			records = parse_lines(sys.stdin)
+		gather(records, statistics_gatherers, options)
+
+	# Every statistic is written out in a single transaction.
+	store = None
+	if not options['database'] is None:
+		store = Nexopia.UDPLogger.Statistics.Store(options['database'])
 	for i in range (0, len(statistics_gatherers)):
 		if options['verbosity'] > 0:
 			print statistics_gatherers[i]
-		if not options['database'] is None:
-			statistics_gatherers[i].save(options['database'])
+		if not store is None:
+			statistics_gatherers[i].stage(store)
+	if not store is None:
+		store.flush()
+
+def parse_lines(lines, name=None):
+	log_data = Nexopia.UDPLogger.Parse.LogLine()
+
+	lineno = 0
+	for line in lines:
+		lineno += 1
+		line = line.rstrip()
+		try:
+			log_data.parse(line)
+		except Exception, e:
+			if name is None:
+				sys.stderr.write('skipping line #%d, could not parse data "%s": %s\n' % (lineno, line.replace('\x1e', '\\x1e'), str(e)))
+			else:
+				sys.stderr.write('%s: skipping line, could not parse data "%s": %s\n' % (name, line.replace('\x1e', '\\x1e'), str(e)))
+			continue
+		yield log_data
 
 def parse_arguments(argv):
 	options = {}
+	options['columnar'] = False
 	options['database'] = None
+	options['files'] = []
+	options['jobs'] = 1
+	options['rebuild-rollups'] = False
+	options['time-after'] = None
+	options['time-before'] = None
 	options['verbosity'] = 0
 
 	try:
-		opts, args = getopt.getopt(argv, 'd:hv', ['database=', 'help', 'verbose', 'version'])
+		opts, args = getopt.getopt(argv, 'cd:hj:v', ['columnar', 'database=', 'help', 'jobs=', 'rebuild-rollups', 'time-after=', 'time-before=', 'verbose', 'version'])
 	except getopt.GetoptError, e:
 		print str(e)
 		usage()
 		sys.exit(3)
 	for o, a in opts:
-		if o in ['-d', '--database']:
+		if o in ['-c', '--columnar']:
+			options['columnar'] = True
+		elif o in ['-d', '--database']:
 			options['database'] = sqlite3.connect(a)
 		elif o in ['-h', '--help']:
 			usage()
 			sys.exit(0)
+		elif o in ['-j', '--jobs']:
+			try:
+				options['jobs'] = int(a)
+			except ValueError:
+				options['jobs'] = -1
+			if options['jobs'] == 0:
+				options['jobs'] = multiprocessing.cpu_count()
+			if options['jobs'] < 0:
+				sys.stderr.write('invalid argument for option jobs: "%s"\n' % (a))
+				usage()
+				sys.exit(2)
+		elif o in ['--time-after']:
+			try:
+				options['time-after'] = time.mktime(time.strptime(a, '%Y-%m-%d %H:%M:%S'))
+			except (TypeError, ValueError), e:
+				sys.stderr.write('invalid argument for option time-after: "%s"\n' % (a))
+				sys.stderr.write('date and times must be in the format "%Y-%m-%d %H:%M:%S" (i.e. "2009-10-20 15:18:17")\n')
+				usage()
+				sys.exit(2)
+		elif o in ['--time-before']:
+			try:
+				options['time-before'] = time.mktime(time.strptime(a, '%Y-%m-%d %H:%M:%S'))
+			except (TypeError, ValueError), e:
+				sys.stderr.write('invalid argument for option time-before: "%s"\n' % (a))
+				sys.stderr.write('date and times must be in the format "%Y-%m-%d %H:%M:%S" (i.e. "2009-10-20 15:18:17")\n')
+				usage()
+				sys.exit(2)
+		elif o in ['--rebuild-rollups']:
+			options['rebuild-rollups'] = True
 		elif o in ['-v', '--verbose']:
 			options['verbosity'] += 1
 		elif o in ['--version']:
@@ -89,14 +201,56 @@ def parse_arguments(argv):
 			sys.exit(0)
 		else:
 			assert False, 'unhandled option: ' + o
+	# Quoted patterns (such as "/var/log/udplogger/access.log.*") are expanded
+	# here, so that more files can be given than fit on a command line.
+	for arg in args:
+		if glob.has_magic(arg):
+			options['files'].extend(sorted(glob.glob(arg)))
+		else:
+			options['files'].append(arg)
+	if options['rebuild-rollups'] and options['database'] is None:
+		sys.stderr.write('--rebuild-rollups requires --database\n')
+		usage()
+		sys.exit(2)
+	if options['columnar'] and not options['files']:
+		sys.stderr.write('--columnar requires at least one FILE\n')
+		usage()
+		sys.exit(2)
 	return options
 
+def parts(options):
+	"""
+	Generates the work of the worker processes: the arguments of gather_part()
+	for each part of each file.  Uncompressed log files are split into parts
+	(within their indexed time range); other files are counted whole.
+	"""
+	# The database connection stays in this process.
+	worker_options = dict([(key, options[key]) for key in ('columnar', 'time-after', 'time-before')])
+	for path in options['files']:
+		if options['columnar']:
+			yield (worker_options, path, None, None)
+			continue
+		for first, last in Nexopia.UDPLogger.Index.split_range(path, options['time-after'], options['time-before']):
+			yield (worker_options, path, first, last)
+
 def usage():
 	print '''
-Usage %s [OPTIONS]
+Usage %s [OPTIONS] [FILE]...
+
+Reads udploggerc output from each FILE (which may be gzip-compressed, or a
+quoted glob pattern) or from standard input.  Files that have a udploggerc index
+(FILE.idx) are only read within the --time-after/--time-before range.  With
+--jobs, files (and parts of large uncompressed files) are read in parallel.
+Statistics are saved by hour, and rolled up by day and by week as they are
+saved; --rebuild-rollups derives the rollups of hours saved without them.
 
+  -c, --columnar                                 each FILE was written by udploggerc --columnar
   -d, --database <db path>                       use <db path> as the sqlite data store for statistic storage
   -h, --help                                     display this help and exit
+  -j, --jobs <n>                                 read files with <n> worker processes (0: one per CPU; default 1)
+      --rebuild-rollups                          rebuild the day and week rollups of the database from its hourly statistics (instead of reading any FILE)
+      --time-after <date/time>                   only count log entries that occurred at-or-after <date/time> (e.g. 2009-10-20 15:18:17)
+      --time-before <date/time>                  only count log entries that occurred before-or-at <date/time> (e.g. 2009-10-20 17:18:17)
   -v, --verbose                                  display calculated statistics after run
   --version                                      display udploggerstats.py version and exit
 ''' % (sys.argv[0])